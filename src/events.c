@@ -74,6 +74,8 @@ static void wolfsentry_event_free(struct wolfsentry_context *wolfsentry, struct
     (void)wolfsentry_action_list_delete_all(wolfsentry, &event->action_list);
     if (event->config)
         WOLFSENTRY_FREE(event->config);
+    if (event->admission_sketch)
+        WOLFSENTRY_FREE(event->admission_sketch);
     WOLFSENTRY_FREE(event);
 }
 
@@ -136,6 +138,8 @@ wolfsentry_errcode_t wolfsentry_event_clone_bare(
     (*new_event)->insert_event = NULL;
     (*new_event)->match_event = NULL;
     (*new_event)->delete_event = NULL;
+    (*new_event)->release_event = NULL;
+    (*new_event)->admission_sketch = NULL;
     WOLFSENTRY_LIST_HEADER_RESET((*new_event)->action_list.header);
 
     if (src_event->config) {
@@ -195,6 +199,15 @@ wolfsentry_errcode_t wolfsentry_event_clone_resolve(
         WOLFSENTRY_REFCOUNT_INCREMENT(new_event->delete_event->header.refcount);
     }
 
+    if (src_event->release_event) {
+        new_event->release_event = src_event->release_event;
+        if ((ret = wolfsentry_table_ent_get(&dest_context->events.header, (struct wolfsentry_table_ent_header **)&new_event->release_event)) < 0) {
+            new_event->release_event = NULL;
+            WOLFSENTRY_ERROR_RERETURN(ret);
+        }
+        WOLFSENTRY_REFCOUNT_INCREMENT(new_event->release_event->header.refcount);
+    }
+
     WOLFSENTRY_RETURN_OK;
 }
 
@@ -315,6 +328,8 @@ wolfsentry_errcode_t wolfsentry_event_drop_reference(struct wolfsentry_context *
         wolfsentry_event_drop_reference(wolfsentry, event->match_event, NULL);
     if (event->delete_event)
         wolfsentry_event_drop_reference(wolfsentry, event->delete_event, NULL);
+    if (event->release_event)
+        wolfsentry_event_drop_reference(wolfsentry, event->release_event, NULL);
     wolfsentry_event_free(wolfsentry, event);
     if (action_results)
         WOLFSENTRY_SET_BITS(*action_results, WOLFSENTRY_ACTION_RES_DEALLOCATED);
@@ -333,6 +348,10 @@ wolfsentry_errcode_t wolfsentry_event_delete(
     if ((ret = wolfsentry_event_get_1(wolfsentry, label, label_len, &old)) < 0)
         return ret;
 
+    /* routes may still hold the event, but it can't be found from here on. */
+    if ((ret = wolfsentry_table_ent_delete_1(wolfsentry, &old->header)) < 0)
+        return ret;
+
     if ((ret = wolfsentry_action_list_delete_all(wolfsentry, &old->action_list)) < 0)
         return ret;
 
@@ -351,6 +370,11 @@ wolfsentry_errcode_t wolfsentry_event_delete(
             return ret;
         old->delete_event = NULL;
     }
+    if (old->release_event) {
+        if ((ret = wolfsentry_event_drop_reference(wolfsentry, old->release_event, NULL /* action_results */)) < 0)
+            return ret;
+        old->release_event = NULL;
+    }
 
     return wolfsentry_event_drop_reference(wolfsentry, old, action_results);
 }
@@ -359,6 +383,274 @@ wolfsentry_errcode_t wolfsentry_event_flush_all(struct wolfsentry_context *wolfs
     return wolfsentry_table_free_ents(wolfsentry, &wolfsentry->events.header);
 }
 
+static int wolfsentry_event_subevent_eq(const struct wolfsentry_event *left, const struct wolfsentry_event *right) {
+    if ((left == NULL) || (right == NULL))
+        return left == right;
+    return wolfsentry_event_key_cmp_1(left->label, left->label_len, right->label, right->label_len) == 0;
+}
+
+/* left and right are in different contexts, so their actions and subevents are compared by label. */
+static int wolfsentry_event_eq(const struct wolfsentry_event *left, const struct wolfsentry_event *right) {
+    const struct wolfsentry_action_list_ent *i, *j;
+
+    if (left->priority != right->priority)
+        return 0;
+    if ((left->config == NULL) != (right->config == NULL))
+        return 0;
+    if (left->config && memcmp(left->config, right->config, sizeof *left->config))
+        return 0;
+
+    for (i = (const struct wolfsentry_action_list_ent *)left->action_list.header.head,
+             j = (const struct wolfsentry_action_list_ent *)right->action_list.header.head;
+         i && j;
+         i = (const struct wolfsentry_action_list_ent *)i->header.next,
+             j = (const struct wolfsentry_action_list_ent *)j->header.next) {
+        if ((i->action->label_len != j->action->label_len) ||
+            memcmp(i->action->label, j->action->label, i->action->label_len))
+            return 0;
+    }
+    if (i || j)
+        return 0;
+
+    return wolfsentry_event_subevent_eq(left->insert_event, right->insert_event) &&
+        wolfsentry_event_subevent_eq(left->match_event, right->match_event) &&
+        wolfsentry_event_subevent_eq(left->delete_event, right->delete_event) &&
+        wolfsentry_event_subevent_eq(left->release_event, right->release_event);
+}
+
+/* routes already laid out for the event have to stay readable. */
+static wolfsentry_errcode_t wolfsentry_event_merge_check(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_event *event,
+    struct wolfsentry_context *staged,
+    const struct wolfsentry_event *staged_event)
+{
+    const struct wolfsentry_eventconfig_internal *config = event->config ? event->config : &wolfsentry->config;
+    const struct wolfsentry_eventconfig_internal *staged_config = staged_event->config ? staged_event->config : &staged->config;
+
+    if ((event->header.refcount > 1) &&
+        ((config->config.route_private_data_size != staged_config->config.route_private_data_size) ||
+         (config->config.route_private_data_alignment != staged_config->config.route_private_data_alignment)))
+        WOLFSENTRY_ERROR_RETURN(INCOMPATIBLE_STATE);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* a shadow is a bare event, never in a table, that holds an event's new
+ * contents until they're swapped in, and its old contents after that.
+ */
+static void wolfsentry_event_merge_shadow_free(struct wolfsentry_context *wolfsentry, struct wolfsentry_event *shadow) {
+    struct wolfsentry_event **subevents[] = { &shadow->insert_event, &shadow->match_event, &shadow->delete_event, &shadow->release_event };
+    size_t i;
+
+    for (i = 0; i < sizeof subevents / sizeof subevents[0]; ++i) {
+        if (*subevents[i])
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(wolfsentry, *subevents[i], NULL /* action_results */));
+    }
+    wolfsentry_event_free(wolfsentry, shadow);
+}
+
+#define WOLFSENTRY_EVENT_MERGE_SWAP(type, a, b) do { type _swap = (a); (a) = (b); (b) = _swap; } while (0)
+
+/* the priority, config, actions and subevents are the contents.  the
+ * admission sketch is the event's own state, and stays put.
+ */
+static void wolfsentry_event_merge_swap(struct wolfsentry_event *event, struct wolfsentry_event *shadow) {
+    WOLFSENTRY_EVENT_MERGE_SWAP(wolfsentry_priority_t, event->priority, shadow->priority);
+    WOLFSENTRY_EVENT_MERGE_SWAP(struct wolfsentry_eventconfig_internal *, event->config, shadow->config);
+    WOLFSENTRY_EVENT_MERGE_SWAP(struct wolfsentry_action_list, event->action_list, shadow->action_list);
+    WOLFSENTRY_EVENT_MERGE_SWAP(struct wolfsentry_event *, event->insert_event, shadow->insert_event);
+    WOLFSENTRY_EVENT_MERGE_SWAP(struct wolfsentry_event *, event->match_event, shadow->match_event);
+    WOLFSENTRY_EVENT_MERGE_SWAP(struct wolfsentry_event *, event->delete_event, shadow->delete_event);
+    WOLFSENTRY_EVENT_MERGE_SWAP(struct wolfsentry_event *, event->release_event, shadow->release_event);
+}
+
+struct wolfsentry_event_merge_ent {
+    struct wolfsentry_event *event;
+    struct wolfsentry_event *shadow; /* null if the contents are unchanged. */
+    wolfsentry_event_flags_t flags; /* swapped along with the contents. */
+};
+
+struct wolfsentry_event_merge {
+    struct wolfsentry_event_merge_ent *ents;
+    size_t n_ents;
+    struct wolfsentry_event **inserted;
+    size_t n_inserted;
+    int swapped_p;
+};
+
+/* the role flags follow staged, where the new config made them, except that
+ * an event still holding dynamic routes stays a parent.
+ */
+static void wolfsentry_event_merge_swap_all(struct wolfsentry_context *wolfsentry, struct wolfsentry_event_merge *merge) {
+    struct wolfsentry_table_ent_header *i;
+    size_t n;
+
+    for (n = 0; n < merge->n_ents; ++n) {
+        struct wolfsentry_event_merge_ent *ent = &merge->ents[n];
+        if (ent->shadow)
+            wolfsentry_event_merge_swap(ent->event, ent->shadow);
+        WOLFSENTRY_EVENT_MERGE_SWAP(wolfsentry_event_flags_t, ent->event->flags, ent->flags);
+    }
+    merge->swapped_p = ! merge->swapped_p;
+
+    if (merge->swapped_p) {
+        for (i = wolfsentry->routes_dynamic.header.head; i; i = i->next) {
+            struct wolfsentry_event *parent_event = ((struct wolfsentry_route *)i)->parent_event;
+            if (parent_event)
+                WOLFSENTRY_SET_BITS(parent_event->flags, WOLFSENTRY_EVENT_FLAG_IS_PARENT_EVENT);
+        }
+    }
+}
+
+static void wolfsentry_event_merge_free(struct wolfsentry_context *wolfsentry, struct wolfsentry_event_merge *merge) {
+    size_t n;
+
+    for (n = 0; n < merge->n_ents; ++n) {
+        if (merge->ents[n].shadow)
+            wolfsentry_event_merge_shadow_free(wolfsentry, merge->ents[n].shadow);
+    }
+    WOLFSENTRY_FREE(merge);
+}
+
+/* events new in staged are inserted bare, and each event that differs from
+ * its counterpart in staged gets a shadow with the new contents.  only once
+ * every check has passed and every shadow is built are the contents swapped
+ * into the events, in place, so that the routes and events that hold them
+ * stay good.  *reordered_p is set if a priority changed, as routes are sorted
+ * by the priority of their parent.  on failure, wolfsentry is left as it was.
+ */
+wolfsentry_errcode_t wolfsentry_event_table_merge(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_context *staged,
+    int *reordered_p,
+    struct wolfsentry_event_merge **merge)
+{
+    struct wolfsentry_table_ent_header *i, *new;
+    struct wolfsentry_event *event;
+    size_t n_staged = (size_t)staged->events.header.n_ents;
+    wolfsentry_errcode_t ret;
+
+    *reordered_p = 0;
+
+    for (i = staged->events.header.head; i; i = i->next) {
+        struct wolfsentry_event *staged_event = (struct wolfsentry_event *)i;
+        if ((wolfsentry_event_get_1(wolfsentry, staged_event->label, staged_event->label_len, &event) >= 0) &&
+            ((ret = wolfsentry_event_merge_check(wolfsentry, event, staged, staged_event)) < 0))
+            return ret;
+    }
+
+    if ((*merge = (struct wolfsentry_event_merge *)WOLFSENTRY_MALLOC(sizeof **merge + n_staged * (sizeof *(*merge)->ents + sizeof *(*merge)->inserted))) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(*merge, 0, sizeof **merge);
+    (*merge)->ents = (struct wolfsentry_event_merge_ent *)(*merge + 1);
+    (*merge)->inserted = (struct wolfsentry_event **)((*merge)->ents + n_staged);
+
+    /* new events go in bare first, as the subevents of others may be among them. */
+    for (i = staged->events.header.head; i; i = i->next) {
+        struct wolfsentry_event *staged_event = (struct wolfsentry_event *)i;
+        if (wolfsentry_event_get_1(wolfsentry, staged_event->label, staged_event->label_len, &event) >= 0)
+            continue;
+        if ((ret = wolfsentry_event_clone_bare(staged, i, wolfsentry, &new, WOLFSENTRY_CLONE_FLAG_NONE)) < 0)
+            goto out;
+        if (((ret = wolfsentry_id_generate(wolfsentry, WOLFSENTRY_OBJECT_TYPE_EVENT, &new->id)) < 0) ||
+            ((ret = wolfsentry_table_ent_insert(wolfsentry, new, &wolfsentry->events.header, 1 /* unique_p */)) < 0)) {
+            wolfsentry_event_free(wolfsentry, (struct wolfsentry_event *)new);
+            goto out;
+        }
+        (*merge)->inserted[(*merge)->n_inserted++] = (struct wolfsentry_event *)new;
+    }
+
+    for (i = staged->events.header.head; i; i = i->next) {
+        struct wolfsentry_event *staged_event = (struct wolfsentry_event *)i;
+        struct wolfsentry_event_merge_ent *ent = &(*merge)->ents[(*merge)->n_ents];
+        if ((ret = wolfsentry_event_get_1(wolfsentry, staged_event->label, staged_event->label_len, &event)) < 0)
+            goto out;
+        ent->event = event;
+        ent->shadow = NULL;
+        ent->flags = staged_event->flags;
+        if (! wolfsentry_event_eq(event, staged_event)) {
+            if ((ret = wolfsentry_event_clone_bare(staged, i, wolfsentry, &new, WOLFSENTRY_CLONE_FLAG_NONE)) < 0)
+                goto out;
+            if ((ret = wolfsentry_event_clone_resolve(staged, i, wolfsentry, new, WOLFSENTRY_CLONE_FLAG_NONE)) < 0) {
+                wolfsentry_event_merge_shadow_free(wolfsentry, (struct wolfsentry_event *)new);
+                goto out;
+            }
+            ent->shadow = (struct wolfsentry_event *)new;
+            if (event->priority != staged_event->priority)
+                *reordered_p = 1;
+        }
+        ++(*merge)->n_ents;
+    }
+
+    wolfsentry_event_merge_swap_all(wolfsentry, *merge);
+
+    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+  out:
+
+    if (ret < 0) {
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_table_merge_rollback(wolfsentry, merge));
+        *reordered_p = 0;
+    }
+
+    return ret;
+}
+
+/* swaps the old contents back in, and takes the new events back out. */
+wolfsentry_errcode_t wolfsentry_event_table_merge_rollback(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_event_merge **merge)
+{
+    wolfsentry_errcode_t ret = WOLFSENTRY_ERROR_ENCODE(OK);
+    size_t n;
+
+    if ((*merge)->swapped_p)
+        wolfsentry_event_merge_swap_all(wolfsentry, *merge);
+    for (n = 0; n < (*merge)->n_ents; ++n) {
+        if ((*merge)->ents[n].shadow) {
+            wolfsentry_event_merge_shadow_free(wolfsentry, (*merge)->ents[n].shadow);
+            (*merge)->ents[n].shadow = NULL;
+        }
+    }
+    for (n = 0; n < (*merge)->n_inserted; ++n) {
+        struct wolfsentry_event *event = (*merge)->inserted[n];
+        wolfsentry_errcode_t delete_ret = wolfsentry_event_delete(wolfsentry, event->label, event->label_len, NULL /* action_results */);
+        if ((delete_ret < 0) && (ret >= 0))
+            ret = delete_ret;
+    }
+    wolfsentry_event_merge_free(wolfsentry, *merge);
+    *merge = NULL;
+    return ret;
+}
+
+/* events that are gone from staged are deleted, now that the routes using
+ * them are gone, and the old contents are freed.
+ */
+wolfsentry_errcode_t wolfsentry_event_table_merge_commit(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_context *staged,
+    struct wolfsentry_event_merge **merge)
+{
+    struct wolfsentry_table_ent_header *i, *next;
+    struct wolfsentry_event *staged_event;
+    wolfsentry_errcode_t ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+    wolfsentry_event_merge_free(wolfsentry, *merge);
+    *merge = NULL;
+
+    for (i = wolfsentry->events.header.head; i; i = next) {
+        struct wolfsentry_event *event = (struct wolfsentry_event *)i;
+        next = i->next;
+        if (wolfsentry_event_get_1(staged, event->label, event->label_len, &staged_event) >= 0)
+            continue;
+        if ((ret = wolfsentry_event_delete(wolfsentry, event->label, event->label_len, NULL /* action_results */)) < 0)
+            break;
+    }
+
+    return ret;
+}
+
 typedef enum { W_E_A_A_PREPEND, W_E_A_A_APPEND, W_E_A_A_INSERT, W_E_A_A_DELETE } w_e_a_a_what_t;
 
 static inline wolfsentry_errcode_t wolfsentry_event_action_change_1(
@@ -521,6 +813,12 @@ wolfsentry_errcode_t wolfsentry_event_set_subevent(
         event->delete_event = subevent;
         ret = WOLFSENTRY_ERROR_ENCODE(OK);
         break;
+    case WOLFSENTRY_ACTION_TYPE_RELEASE:
+        if (event->release_event)
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(wolfsentry, event->release_event, NULL /* action_results */));
+        event->release_event = subevent;
+        ret = WOLFSENTRY_ERROR_ENCODE(OK);
+        break;
     case WOLFSENTRY_ACTION_TYPE_POST:
     case WOLFSENTRY_ACTION_TYPE_NONE:
         break;
@@ -0,0 +1,910 @@
+/*
+ * image.c
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfSentry.
+ *
+ * wolfSentry is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSentry is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#define _DEFAULT_SOURCE /* for MAP_POPULATE */
+
+#include "wolfsentry_internal.h"
+
+#define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_IMAGE_C
+
+/* an image is a header, then the action records, the event records, the route
+ * index, and the routes, each region 8-byte aligned.  all references within
+ * the image are offsets or indexes, so it can be mapped anywhere.
+ */
+
+#define WOLFSENTRY_IMAGE_MAGIC 0x57534931U /* "WSI1" */
+#define WOLFSENTRY_IMAGE_MAGIC_SWAPPED 0x31495357U
+
+#define WOLFSENTRY_IMAGE_ALIGN(x, align) (((x) + ((align) - 1U)) & ~((size_t)(align) - 1U))
+
+enum {
+    WOLFSENTRY_IMAGE_FLAG_NONE = 0U,
+    WOLFSENTRY_IMAGE_FLAG_HAS_DEFAULTCONFIG = 1U << 0U,
+    WOLFSENTRY_IMAGE_FLAG_HAS_DEFAULT_POLICY = 1U << 1U
+};
+
+struct wolfsentry_image_eventconfig {
+    uint64_t route_private_data_size; /* as supplied, i.e. without the slop added by wolfsentry_eventconfig_load(). */
+    uint64_t route_private_data_alignment;
+    uint64_t penaltybox_duration; /* intervals are in nanoseconds, so that images don't depend on the time callbacks. */
+    uint64_t rate_limit_period;
+    uint64_t derogatory_window;
+    uint32_t max_connection_count;
+    uint32_t max_subnet_connection_count;
+    uint32_t rate_limit_tokens;
+    uint32_t rate_limit_burst;
+    uint32_t derogatory_threshold_for_penaltybox;
+    uint32_t route_admission_threshold;
+    uint32_t flags;
+    uint32_t padding1;
+};
+
+struct wolfsentry_image_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t layout; /* wolfsentry_image_layout() of the build that compiled the image. */
+    uint32_t flags;
+    uint64_t image_size;
+    uint64_t checksum; /* of everything after the header. */
+    uint64_t actions_offset;
+    uint64_t events_offset;
+    uint64_t route_index_offset;
+    uint64_t routes_offset;
+    uint64_t n_routes;
+    uint64_t route_alignment;
+    uint32_t n_actions;
+    uint32_t n_events;
+    uint32_t default_policy_static;
+    uint32_t padding1;
+    struct wolfsentry_image_eventconfig config;
+};
+
+/* followed by the label. */
+struct wolfsentry_image_action {
+    uint32_t size; /* of the whole record, padded to 8 bytes. */
+    uint32_t label_len;
+};
+
+/* followed by n_actions uint32_t action indexes, then the label. */
+struct wolfsentry_image_event {
+    uint32_t size; /* of the whole record, padded to 8 bytes. */
+    uint32_t label_len;
+    uint32_t priority;
+    uint32_t has_config;
+    int32_t subevents[4]; /* indexes of the insert, match, delete and release events, or -1. */
+    uint32_t n_actions;
+    uint32_t padding1;
+    struct wolfsentry_image_eventconfig config;
+};
+
+/* the index has the routes in table order, so that they can be appended. */
+struct wolfsentry_image_route_ent {
+    uint64_t offset; /* from the start of the image. */
+    uint32_t size;
+    int32_t parent_event; /* event index, or -1. */
+};
+
+static const wolfsentry_action_type_t wolfsentry_image_subevent_types[4] = {
+    WOLFSENTRY_ACTION_TYPE_INSERT,
+    WOLFSENTRY_ACTION_TYPE_MATCH,
+    WOLFSENTRY_ACTION_TYPE_DELETE,
+    WOLFSENTRY_ACTION_TYPE_RELEASE
+};
+
+/* routes are used as laid out, so the image has to come from a build that
+ * lays them out identically.
+ */
+static uint32_t wolfsentry_image_layout(void) {
+    const uint32_t params[] = {
+        (uint32_t)sizeof(struct wolfsentry_route),
+        (uint32_t)offsetof(struct wolfsentry_route, data),
+        (uint32_t)offsetof(struct wolfsentry_route, meta),
+        (uint32_t)offsetof(struct wolfsentry_route, remote),
+        (uint32_t)sizeof(void *),
+        (uint32_t)sizeof(wolfsentry_time_t),
+        (uint32_t)sizeof(wolfsentry_ent_id_t),
+        (uint32_t)sizeof(wolfsentry_hitcount_t),
+        (uint32_t)sizeof(wolfsentry_route_flags_t),
+        (uint32_t)sizeof(wolfsentry_addr_bits_t),
+        (uint32_t)WOLFSENTRY_MAX_ADDR_BYTES,
+        (uint32_t)WOLFSENTRY_IMAGE_VERSION
+    };
+    const byte *p = (const byte *)params;
+    uint32_t h = 2166136261U;
+    size_t i;
+    for (i = 0; i < sizeof params; ++i)
+        h = (h ^ p[i]) * 16777619U;
+    return h;
+}
+
+#define WOLFSENTRY_IMAGE_CHECKSUM_PRIME 0x9e3779b97f4a7c15ULL
+#define WOLFSENTRY_IMAGE_ROTL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+/* four independent lanes, so that the multiplies pipeline and checking the
+ * image stays a small part of loading it.  len is a multiple of 8.
+ */
+uint64_t wolfsentry_image_checksum(const byte *buf, size_t len) {
+    uint64_t lanes[4] = { 1, 2, 3, 4 };
+    uint64_t w, h;
+    size_t i, lane;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        for (lane = 0; lane < 4; ++lane) {
+            memcpy(&w, buf + i + (lane * 8), sizeof w);
+            lanes[lane] = WOLFSENTRY_IMAGE_ROTL64((lanes[lane] ^ w) * WOLFSENTRY_IMAGE_CHECKSUM_PRIME, 29);
+        }
+    }
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, buf + i, sizeof w);
+        lanes[0] = WOLFSENTRY_IMAGE_ROTL64((lanes[0] ^ w) * WOLFSENTRY_IMAGE_CHECKSUM_PRIME, 29);
+    }
+
+    h = (uint64_t)len;
+    for (lane = 0; lane < 4; ++lane)
+        h = WOLFSENTRY_IMAGE_ROTL64((h ^ lanes[lane]) * WOLFSENTRY_IMAGE_CHECKSUM_PRIME, 29);
+    return h ^ (h >> 32);
+}
+
+static inline size_t wolfsentry_image_private_data_slop(size_t alignment) {
+    return alignment ? offsetof(struct wolfsentry_route, data) % alignment : 0;
+}
+
+static wolfsentry_errcode_t wolfsentry_image_interval_export(struct wolfsentry_context *wolfsentry, wolfsentry_time_t howlong, uint64_t *nsecs_out) {
+    long secs, nsecs;
+    wolfsentry_errcode_t ret;
+    if (howlong <= 0) {
+        *nsecs_out = 0;
+        WOLFSENTRY_RETURN_OK;
+    }
+    if ((ret = WOLFSENTRY_INTERVAL_TO_SECONDS(howlong, &secs, &nsecs)) < 0)
+        return ret;
+    *nsecs_out = ((uint64_t)secs * 1000000000ULL) + (uint64_t)nsecs;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_image_interval_import(struct wolfsentry_context *wolfsentry, uint64_t nsecs, wolfsentry_time_t *howlong) {
+    if (nsecs == 0) {
+        *howlong = 0;
+        WOLFSENTRY_RETURN_OK;
+    }
+    return WOLFSENTRY_INTERVAL_FROM_SECONDS((long)(nsecs / 1000000000ULL), (long)(nsecs % 1000000000ULL), howlong);
+}
+
+static wolfsentry_errcode_t wolfsentry_image_eventconfig_export(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_eventconfig_internal *internal,
+    struct wolfsentry_image_eventconfig *out)
+{
+    const struct wolfsentry_eventconfig *config = &internal->config;
+    wolfsentry_errcode_t ret;
+
+    memset(out, 0, sizeof *out);
+    out->route_private_data_size = config->route_private_data_size - wolfsentry_image_private_data_slop(config->route_private_data_alignment);
+    out->route_private_data_alignment = config->route_private_data_alignment;
+    if ((ret = wolfsentry_image_interval_export(wolfsentry, config->penaltybox_duration, &out->penaltybox_duration)) < 0)
+        return ret;
+    if ((ret = wolfsentry_image_interval_export(wolfsentry, config->rate_limit_period, &out->rate_limit_period)) < 0)
+        return ret;
+    if ((ret = wolfsentry_image_interval_export(wolfsentry, config->derogatory_window, &out->derogatory_window)) < 0)
+        return ret;
+    out->max_connection_count = config->max_connection_count;
+    out->max_subnet_connection_count = config->max_subnet_connection_count;
+    out->rate_limit_tokens = config->rate_limit_tokens;
+    out->rate_limit_burst = config->rate_limit_burst;
+    out->derogatory_threshold_for_penaltybox = config->derogatory_threshold_for_penaltybox;
+    out->route_admission_threshold = config->route_admission_threshold;
+    out->flags = (uint32_t)config->flags;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_image_eventconfig_import(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_image_eventconfig *in,
+    struct wolfsentry_eventconfig *config)
+{
+    wolfsentry_errcode_t ret;
+
+    memset(config, 0, sizeof *config);
+    config->route_private_data_size = (size_t)in->route_private_data_size;
+    config->route_private_data_alignment = (size_t)in->route_private_data_alignment;
+    if ((ret = wolfsentry_image_interval_import(wolfsentry, in->penaltybox_duration, &config->penaltybox_duration)) < 0)
+        return ret;
+    if ((ret = wolfsentry_image_interval_import(wolfsentry, in->rate_limit_period, &config->rate_limit_period)) < 0)
+        return ret;
+    if ((ret = wolfsentry_image_interval_import(wolfsentry, in->derogatory_window, &config->derogatory_window)) < 0)
+        return ret;
+    config->max_connection_count = in->max_connection_count;
+    config->max_subnet_connection_count = in->max_subnet_connection_count;
+    config->rate_limit_tokens = in->rate_limit_tokens;
+    config->rate_limit_burst = in->rate_limit_burst;
+    config->derogatory_threshold_for_penaltybox = in->derogatory_threshold_for_penaltybox;
+    config->route_admission_threshold = in->route_admission_threshold;
+    config->flags = (wolfsentry_eventconfig_flags_t)in->flags;
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* route_private_data_size of the eventconfig_internal that would be loaded from in. */
+static inline uint64_t wolfsentry_image_eventconfig_private_data_size(const struct wolfsentry_image_eventconfig *in) {
+    return in->route_private_data_size + wolfsentry_image_private_data_slop((size_t)in->route_private_data_alignment);
+}
+
+static int wolfsentry_image_event_index(struct wolfsentry_context *wolfsentry, const struct wolfsentry_event *event) {
+    struct wolfsentry_table_ent_header *i;
+    int n;
+    if (event == NULL)
+        return -1;
+    for (i = wolfsentry->events.header.head, n = 0; i; i = i->next, ++n) {
+        if (i == &event->header)
+            return n;
+    }
+    return -1;
+}
+
+static int wolfsentry_image_action_referenced(struct wolfsentry_context *wolfsentry, const struct wolfsentry_action *action) {
+    struct wolfsentry_table_ent_header *i;
+    for (i = wolfsentry->events.header.head; i; i = i->next) {
+        struct wolfsentry_event *event = (struct wolfsentry_event *)i;
+        struct wolfsentry_list_ent_header *j;
+        for (wolfsentry_list_ent_get_first(&event->action_list.header, &j); j; wolfsentry_list_ent_get_next(&event->action_list.header, &j)) {
+            if (((struct wolfsentry_action_list_ent *)j)->action == action)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* index among the referenced actions, which are the only ones in the image. */
+static uint32_t wolfsentry_image_action_index(struct wolfsentry_context *wolfsentry, const struct wolfsentry_action *action) {
+    struct wolfsentry_table_ent_header *i;
+    uint32_t n = 0;
+    for (i = wolfsentry->actions.header.head; i; i = i->next) {
+        if (i == &action->header)
+            break;
+        if (wolfsentry_image_action_referenced(wolfsentry, (struct wolfsentry_action *)i))
+            ++n;
+    }
+    return n;
+}
+
+static uint32_t wolfsentry_image_event_n_actions(const struct wolfsentry_event *event) {
+    struct wolfsentry_list_ent_header *j;
+    uint32_t n = 0;
+    for (wolfsentry_list_ent_get_first((struct wolfsentry_list_header *)&event->action_list.header, &j); j; wolfsentry_list_ent_get_next((struct wolfsentry_list_header *)&event->action_list.header, &j))
+        ++n;
+    return n;
+}
+
+static inline size_t wolfsentry_image_route_size(const struct wolfsentry_route *route) {
+    return offsetof(struct wolfsentry_route, data) + route->data_addr_size;
+}
+
+wolfsentry_errcode_t wolfsentry_image_compile(
+    struct wolfsentry_context *wolfsentry,
+    void *image,
+    size_t *image_size)
+{
+    struct wolfsentry_image_header *header;
+    struct wolfsentry_image_route_ent *route_index;
+    struct wolfsentry_table_ent_header *i;
+    byte *base = (byte *)image;
+    size_t size, route_alignment = sizeof(uint64_t);
+    size_t actions_offset, events_offset, route_index_offset, routes_offset;
+    uint32_t n_actions = 0, n_events = 0;
+    uint64_t n_routes = 0;
+    const struct wolfsentry_event *last_parent = NULL;
+    int last_parent_index = -1;
+    wolfsentry_errcode_t ret;
+
+    if (image_size == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if ((uintptr_t)image & (sizeof(uint64_t) - 1U))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    /* first pass: the size of each region. */
+    size = sizeof *header;
+    actions_offset = size;
+    for (i = wolfsentry->actions.header.head; i; i = i->next) {
+        struct wolfsentry_action *action = (struct wolfsentry_action *)i;
+        if (! wolfsentry_image_action_referenced(wolfsentry, action))
+            continue;
+        size += WOLFSENTRY_IMAGE_ALIGN(sizeof(struct wolfsentry_image_action) + action->label_len, 8U);
+        ++n_actions;
+    }
+    events_offset = size;
+    if (wolfsentry->config.config.route_private_data_alignment > route_alignment)
+        route_alignment = wolfsentry->config.config.route_private_data_alignment;
+    for (i = wolfsentry->events.header.head; i; i = i->next) {
+        struct wolfsentry_event *event = (struct wolfsentry_event *)i;
+        size += WOLFSENTRY_IMAGE_ALIGN(sizeof(struct wolfsentry_image_event) + (wolfsentry_image_event_n_actions(event) * sizeof(uint32_t)) + event->label_len, 8U);
+        if (event->config && (event->config->config.route_private_data_alignment > route_alignment))
+            route_alignment = event->config->config.route_private_data_alignment;
+        ++n_events;
+    }
+    route_index_offset = size;
+    for (i = wolfsentry->routes_static.header.head; i; i = i->next)
+        ++n_routes;
+    size += (size_t)n_routes * sizeof *route_index;
+    size = WOLFSENTRY_IMAGE_ALIGN(size, route_alignment);
+    routes_offset = size;
+    for (i = wolfsentry->routes_static.header.head; i; i = i->next)
+        size += WOLFSENTRY_IMAGE_ALIGN(wolfsentry_image_route_size((struct wolfsentry_route *)i), route_alignment);
+
+    if ((image == NULL) || (*image_size < size)) {
+        *image_size = size;
+        WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
+    }
+    *image_size = size;
+
+    memset(base, 0, size);
+
+    header = (struct wolfsentry_image_header *)base;
+    header->magic = WOLFSENTRY_IMAGE_MAGIC;
+    header->version = WOLFSENTRY_IMAGE_VERSION;
+    header->layout = wolfsentry_image_layout();
+    header->image_size = size;
+    header->actions_offset = actions_offset;
+    header->events_offset = events_offset;
+    header->route_index_offset = route_index_offset;
+    header->routes_offset = routes_offset;
+    header->n_routes = n_routes;
+    header->route_alignment = route_alignment;
+    header->n_actions = n_actions;
+    header->n_events = n_events;
+    if ((ret = wolfsentry_image_eventconfig_export(wolfsentry, &wolfsentry->config, &header->config)) < 0)
+        return ret;
+    /* a config loaded over the one the context was created with is carried over. */
+    if (memcmp(&wolfsentry->config.config, &wolfsentry->config_at_creation.config, sizeof wolfsentry->config.config))
+        header->flags |= (uint32_t)WOLFSENTRY_IMAGE_FLAG_HAS_DEFAULTCONFIG;
+    if (wolfsentry->routes_static.default_policy) {
+        header->flags |= (uint32_t)WOLFSENTRY_IMAGE_FLAG_HAS_DEFAULT_POLICY;
+        header->default_policy_static = (uint32_t)wolfsentry->routes_static.default_policy;
+    }
+
+    size = actions_offset;
+    for (i = wolfsentry->actions.header.head; i; i = i->next) {
+        struct wolfsentry_action *action = (struct wolfsentry_action *)i;
+        struct wolfsentry_image_action *rec = (struct wolfsentry_image_action *)(base + size);
+        if (! wolfsentry_image_action_referenced(wolfsentry, action))
+            continue;
+        rec->size = (uint32_t)WOLFSENTRY_IMAGE_ALIGN(sizeof *rec + action->label_len, 8U);
+        rec->label_len = action->label_len;
+        memcpy(rec + 1, action->label, action->label_len);
+        size += rec->size;
+    }
+
+    for (i = wolfsentry->events.header.head; i; i = i->next) {
+        struct wolfsentry_event *event = (struct wolfsentry_event *)i;
+        struct wolfsentry_image_event *rec = (struct wolfsentry_image_event *)(base + size);
+        uint32_t *action_indexes = (uint32_t *)(rec + 1);
+        struct wolfsentry_list_ent_header *j;
+        rec->n_actions = wolfsentry_image_event_n_actions(event);
+        rec->size = (uint32_t)WOLFSENTRY_IMAGE_ALIGN(sizeof *rec + (rec->n_actions * sizeof(uint32_t)) + event->label_len, 8U);
+        rec->label_len = event->label_len;
+        rec->priority = event->priority;
+        rec->subevents[0] = wolfsentry_image_event_index(wolfsentry, event->insert_event);
+        rec->subevents[1] = wolfsentry_image_event_index(wolfsentry, event->match_event);
+        rec->subevents[2] = wolfsentry_image_event_index(wolfsentry, event->delete_event);
+        rec->subevents[3] = wolfsentry_image_event_index(wolfsentry, event->release_event);
+        if (event->config) {
+            rec->has_config = 1;
+            if ((ret = wolfsentry_image_eventconfig_export(wolfsentry, event->config, &rec->config)) < 0)
+                return ret;
+        }
+        for (wolfsentry_list_ent_get_first(&event->action_list.header, &j); j; wolfsentry_list_ent_get_next(&event->action_list.header, &j))
+            *action_indexes++ = wolfsentry_image_action_index(wolfsentry, ((struct wolfsentry_action_list_ent *)j)->action);
+        memcpy(action_indexes, event->label, event->label_len);
+        size += rec->size;
+    }
+
+    route_index = (struct wolfsentry_image_route_ent *)(base + route_index_offset);
+    size = routes_offset;
+    for (i = wolfsentry->routes_static.header.head; i; i = i->next, ++route_index) {
+        struct wolfsentry_route *src = (struct wolfsentry_route *)i;
+        struct wolfsentry_route *dst = (struct wolfsentry_route *)(base + size);
+        size_t route_size = wolfsentry_image_route_size(src);
+
+        if (src->parent_event != last_parent) {
+            last_parent = src->parent_event;
+            last_parent_index = wolfsentry_image_event_index(wolfsentry, last_parent);
+        }
+
+        route_index->offset = size;
+        route_index->size = (uint32_t)route_size;
+        route_index->parent_event = last_parent_index;
+
+        /* only the key and the addresses are kept -- the loader starts the rest fresh. */
+        memcpy(dst, src, route_size);
+        memset(&dst->header, 0, sizeof dst->header);
+        memset(&dst->purge_link, 0, sizeof dst->purge_link);
+        memset(&dst->penaltybox_link, 0, sizeof dst->penaltybox_link);
+        dst->penaltybox_release_time = 0;
+        dst->parent_event = NULL;
+        dst->purge_slot = 0;
+        memset(&dst->meta, 0, sizeof dst->meta);
+        WOLFSENTRY_CLEAR_BITS(dst->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE | WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE | WOLFSENTRY_ROUTE_FLAG_INSERT_ACTIONS_CALLED | WOLFSENTRY_ROUTE_FLAG_DELETE_ACTIONS_CALLED);
+        if (dst->data_addr_offset > 0)
+            memset(dst->data, 0, dst->data_addr_offset);
+
+        size += WOLFSENTRY_IMAGE_ALIGN(route_size, route_alignment);
+    }
+
+    header->checksum = wolfsentry_image_checksum(base + sizeof *header, header->image_size - sizeof *header);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static inline int wolfsentry_image_label_ok(uint32_t label_len) {
+    return (label_len > 0) && (label_len <= WOLFSENTRY_MAX_LABEL_BYTES);
+}
+
+static wolfsentry_errcode_t wolfsentry_image_check_header(const byte *base, size_t image_size) {
+    const struct wolfsentry_image_header *header = (const struct wolfsentry_image_header *)base;
+
+    if ((uintptr_t)base & (sizeof(uint64_t) - 1U))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (image_size < sizeof *header)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    if (header->magic == WOLFSENTRY_IMAGE_MAGIC_SWAPPED)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INCOMPATIBLE);
+    if (header->magic != WOLFSENTRY_IMAGE_MAGIC)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    if ((header->version != WOLFSENTRY_IMAGE_VERSION) || (header->layout != wolfsentry_image_layout()))
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INCOMPATIBLE);
+    if ((header->image_size > image_size) || (header->image_size < sizeof *header) || (header->image_size & 7U))
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    if (wolfsentry_image_checksum(base + sizeof *header, (size_t)header->image_size - sizeof *header) != header->checksum)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_CHECKSUM);
+
+    if ((header->actions_offset != sizeof *header) ||
+        (header->events_offset < header->actions_offset) ||
+        (header->route_index_offset < header->events_offset) ||
+        (header->routes_offset < header->route_index_offset) ||
+        (header->routes_offset > header->image_size) ||
+        ((header->events_offset | header->route_index_offset) & 7U))
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    if ((header->route_alignment < sizeof(uint64_t)) || (header->route_alignment & (header->route_alignment - 1U)) || (header->routes_offset & (header->route_alignment - 1U)))
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    if ((uintptr_t)base & (header->route_alignment - 1U))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (header->n_routes > (header->routes_offset - header->route_index_offset) / sizeof(struct wolfsentry_image_route_ent))
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* everything else that can be checked without changing the context, so that
+ * a bad image is turned away before anything is loaded from it.
+ */
+static wolfsentry_errcode_t wolfsentry_image_check(
+    struct wolfsentry_context *wolfsentry,
+    const byte *base,
+    const struct wolfsentry_image_action **actions,
+    const struct wolfsentry_image_event **events)
+{
+    const struct wolfsentry_image_header *header = (const struct wolfsentry_image_header *)base;
+    const struct wolfsentry_image_route_ent *route_index;
+    uint64_t offset, end, i;
+    uint64_t private_data_size;
+    uint32_t n;
+    wolfsentry_errcode_t ret;
+
+    /* the image's routes have private data areas sized for its configs, which
+     * have to agree with those they will be loaded under.
+     */
+    if ((header->config.route_private_data_alignment != wolfsentry->config.config.route_private_data_alignment) ||
+        (wolfsentry_image_eventconfig_private_data_size(&header->config) != wolfsentry->config.config.route_private_data_size))
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INCOMPATIBLE);
+
+    for (offset = header->actions_offset, n = 0; offset < header->events_offset; ++n) {
+        const struct wolfsentry_image_action *rec = (const struct wolfsentry_image_action *)(base + offset);
+        struct wolfsentry_action *action;
+        if ((offset + sizeof *rec > header->events_offset) ||
+            (! wolfsentry_image_label_ok(rec->label_len)) ||
+            (rec->size < sizeof *rec + rec->label_len) ||
+            (rec->size & 7U) ||
+            (offset + rec->size > header->events_offset) ||
+            (n >= header->n_actions))
+            WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+        /* actions are bound by label, so they have to be there already. */
+        if ((ret = wolfsentry_action_get_reference(wolfsentry, (const char *)(rec + 1), (int)rec->label_len, &action)) < 0)
+            return ret;
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_action_drop_reference(wolfsentry, action, NULL /* action_results */));
+        actions[n] = rec;
+        offset += rec->size;
+    }
+    if (n != header->n_actions)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+
+    for (offset = header->events_offset, n = 0; offset < header->route_index_offset; ++n) {
+        const struct wolfsentry_image_event *rec = (const struct wolfsentry_image_event *)(base + offset);
+        const uint32_t *action_indexes = (const uint32_t *)(rec + 1);
+        struct wolfsentry_event *event;
+        int j;
+        if ((offset + sizeof *rec > header->route_index_offset) ||
+            (! wolfsentry_image_label_ok(rec->label_len)) ||
+            (rec->n_actions > header->n_actions) ||
+            (rec->size < sizeof *rec + (rec->n_actions * sizeof(uint32_t)) + rec->label_len) ||
+            (rec->size & 7U) ||
+            (offset + rec->size > header->route_index_offset) ||
+            (n >= header->n_events) ||
+            (rec->priority > MAX_UINT_OF(wolfsentry_priority_t)))
+            WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+        for (j = 0; j < 4; ++j) {
+            if ((rec->subevents[j] < -1) || (rec->subevents[j] >= (int32_t)header->n_events))
+                WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+        }
+        for (i = 0; i < rec->n_actions; ++i) {
+            if (action_indexes[i] >= header->n_actions)
+                WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+        }
+        if (wolfsentry_event_get_reference(wolfsentry, (const char *)(action_indexes + rec->n_actions), (int)rec->label_len, &event) >= 0) {
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(wolfsentry, event, NULL /* action_results */));
+            WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
+        }
+        events[n] = rec;
+        offset += rec->size;
+    }
+    if (n != header->n_events)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+
+    route_index = (const struct wolfsentry_image_route_ent *)(base + header->route_index_offset);
+    end = header->routes_offset;
+    for (i = 0; i < header->n_routes; ++i) {
+        const struct wolfsentry_route *route;
+        /* routes are laid out in index order, and mustn't overlap. */
+        if ((route_index[i].offset < end) ||
+            (route_index[i].offset & (header->route_alignment - 1U)) ||
+            (route_index[i].size < offsetof(struct wolfsentry_route, data)) ||
+            (route_index[i].offset + route_index[i].size > header->image_size) ||
+            (route_index[i].parent_event < -1) ||
+            (route_index[i].parent_event >= (int32_t)header->n_events))
+            WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+        route = (const struct wolfsentry_route *)(base + route_index[i].offset);
+        if ((wolfsentry_image_route_size(route) != route_index[i].size) ||
+            (route->remote.addr_len > WOLFSENTRY_MAX_ADDR_BYTES * BITS_PER_BYTE) ||
+            (route->local.addr_len > WOLFSENTRY_MAX_ADDR_BYTES * BITS_PER_BYTE) ||
+            (route->remote.extra_port_count != 0) ||
+            (route->local.extra_port_count != 0) ||
+            ((size_t)route->data_addr_offset + WOLFSENTRY_BITS_TO_BYTES((size_t)route->remote.addr_len) + WOLFSENTRY_BITS_TO_BYTES((size_t)route->local.addr_len) > route->data_addr_size))
+            WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+        if ((route_index[i].parent_event >= 0) && events[route_index[i].parent_event]->has_config)
+            private_data_size = wolfsentry_image_eventconfig_private_data_size(&events[route_index[i].parent_event]->config);
+        else
+            private_data_size = wolfsentry_image_eventconfig_private_data_size(&header->config);
+        if (route->data_addr_offset != private_data_size)
+            WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+        end = route_index[i].offset + route_index[i].size;
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+int wolfsentry_image_owns(struct wolfsentry_context *wolfsentry, const void *ptr) {
+    struct wolfsentry_list_ent_header *i;
+    for (wolfsentry_list_ent_get_first(&wolfsentry->images, &i); i; wolfsentry_list_ent_get_next(&wolfsentry->images, &i)) {
+        struct wolfsentry_image_ent *ent = (struct wolfsentry_image_ent *)i;
+        if (((uintptr_t)ptr >= (uintptr_t)ent->image) && ((uintptr_t)ptr < (uintptr_t)ent->image + ent->image_size))
+            return 1;
+    }
+    return 0;
+}
+
+void wolfsentry_image_release_all(struct wolfsentry_context *wolfsentry) {
+    struct wolfsentry_list_ent_header *i;
+    for (;;) {
+        struct wolfsentry_image_ent *ent;
+        wolfsentry_list_ent_get_first(&wolfsentry->images, &i);
+        if (i == NULL)
+            break;
+        ent = (struct wolfsentry_image_ent *)i;
+        wolfsentry_list_ent_delete(&wolfsentry->images, i);
+        if (ent->release)
+            ent->release(ent->release_arg, ent->image, ent->image_size);
+        WOLFSENTRY_FREE(ent);
+    }
+}
+
+wolfsentry_errcode_t wolfsentry_image_load(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    void *image,
+    size_t image_size,
+    wolfsentry_image_release_cb_t release,
+    void *release_arg,
+    wolfsentry_action_res_t *action_results)
+{
+    byte *base = (byte *)image;
+    const struct wolfsentry_image_header *header = (const struct wolfsentry_image_header *)base;
+    const struct wolfsentry_image_route_ent *route_index = NULL;
+    struct wolfsentry_image_ent *ent = NULL;
+    void **scratch = NULL;
+    const struct wolfsentry_image_action **actions;
+    const struct wolfsentry_image_event **event_recs = NULL;
+    struct wolfsentry_event **events;
+    struct wolfsentry_eventconfig config, saved_config;
+    wolfsentry_action_res_t saved_policy;
+    uint64_t i, n_routes_inserted = 0;
+    uint32_t j, n_events_inserted = 0;
+    int registered = 0, config_saved = 0, policy_saved = 0, pinned = 0;
+    wolfsentry_errcode_t ret;
+
+    if ((image == NULL) || (action_results == NULL)) {
+        ret = WOLFSENTRY_ERROR_ENCODE(INVALID_ARG);
+        goto out;
+    }
+    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+
+    if ((ret = wolfsentry_image_check_header(base, image_size)) < 0)
+        goto out;
+
+    /* one allocation for the record and event pointers, however many routes there are. */
+    if ((scratch = (void **)WOLFSENTRY_MALLOC((sizeof *scratch * ((size_t)header->n_actions + (2U * (size_t)header->n_events))) + 1U)) == NULL) {
+        ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
+        goto out;
+    }
+    actions = (const struct wolfsentry_image_action **)scratch;
+    event_recs = (const struct wolfsentry_image_event **)(scratch + header->n_actions);
+    events = (struct wolfsentry_event **)(scratch + header->n_actions + header->n_events);
+
+    if ((ret = wolfsentry_image_check(wolfsentry, base, actions, event_recs)) < 0)
+        goto out;
+
+    if ((ent = (struct wolfsentry_image_ent *)WOLFSENTRY_MALLOC(sizeof *ent)) == NULL) {
+        ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
+        goto out;
+    }
+    memset(ent, 0, sizeof *ent);
+    ent->image = base;
+    ent->image_size = image_size;
+    ent->release = release;
+    ent->release_arg = release_arg;
+
+    /* whatever is changed from here on is put back if the load fails. */
+    if (header->flags & WOLFSENTRY_IMAGE_FLAG_HAS_DEFAULTCONFIG) {
+        if ((ret = wolfsentry_image_eventconfig_import(wolfsentry, &header->config, &config)) < 0)
+            goto out;
+        if ((ret = wolfsentry_defaultconfig_get(wolfsentry, &saved_config)) < 0)
+            goto out;
+        if ((ret = wolfsentry_defaultconfig_update(wolfsentry, &config)) < 0)
+            goto out;
+        config_saved = 1;
+    }
+    if (header->flags & WOLFSENTRY_IMAGE_FLAG_HAS_DEFAULT_POLICY) {
+        if ((ret = wolfsentry_route_table_default_policy_get(wolfsentry, &wolfsentry->routes_static, &saved_policy)) < 0)
+            goto out;
+        if ((ret = wolfsentry_route_table_default_policy_set(wolfsentry, &wolfsentry->routes_static, (wolfsentry_action_res_t)header->default_policy_static)) < 0)
+            goto out;
+        policy_saved = 1;
+    }
+
+    for (j = 0; j < header->n_events; ++j) {
+        const struct wolfsentry_image_event *rec = event_recs[j];
+        const char *label = (const char *)((const uint32_t *)(rec + 1) + rec->n_actions);
+        if (rec->has_config) {
+            if ((ret = wolfsentry_image_eventconfig_import(wolfsentry, &rec->config, &config)) < 0)
+                goto out;
+        }
+        if ((ret = wolfsentry_event_insert(wolfsentry, label, (int)rec->label_len, (wolfsentry_priority_t)rec->priority, rec->has_config ? &config : NULL, WOLFSENTRY_EVENT_FLAG_NONE, NULL /* id */)) < 0)
+            goto out;
+        ++n_events_inserted;
+        /* the table holds the event, so the pointer stays good without the reference. */
+        if ((ret = wolfsentry_event_get_reference(wolfsentry, label, (int)rec->label_len, &events[j])) < 0)
+            goto out;
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(wolfsentry, events[j], NULL /* action_results */));
+    }
+
+    /* subevents and actions refer to other events by label, so they come once all are in. */
+    for (j = 0; j < header->n_events; ++j) {
+        const struct wolfsentry_image_event *rec = event_recs[j];
+        const uint32_t *action_indexes = (const uint32_t *)(rec + 1);
+        int k;
+        for (k = 0; k < 4; ++k) {
+            if (rec->subevents[k] < 0)
+                continue;
+            if ((ret = wolfsentry_event_set_subevent(wolfsentry, events[j]->label, events[j]->label_len, wolfsentry_image_subevent_types[k], events[rec->subevents[k]]->label, events[rec->subevents[k]]->label_len)) < 0)
+                goto out;
+        }
+        for (i = 0; i < rec->n_actions; ++i) {
+            const struct wolfsentry_image_action *action = actions[action_indexes[i]];
+            if ((ret = wolfsentry_event_action_append(wolfsentry, events[j]->label, events[j]->label_len, (const char *)(action + 1), (int)action->label_len)) < 0)
+                goto out;
+        }
+    }
+
+    /* from here on, routes in the table can live in the image. */
+    wolfsentry_list_ent_append(&wolfsentry->images, &ent->header);
+    registered = 1;
+
+    route_index = (const struct wolfsentry_image_route_ent *)(base + header->route_index_offset);
+    for (i = 0; i < header->n_routes; ++i) {
+        struct wolfsentry_route *route = (struct wolfsentry_route *)(base + route_index[i].offset);
+        if ((ret = wolfsentry_route_insert_in_place(
+                 wolfsentry,
+                 caller_arg,
+                 &wolfsentry->routes_static,
+                 route,
+                 (route_index[i].parent_event >= 0) ? events[route_index[i].parent_event] : NULL,
+                 action_results)) < 0)
+            goto out;
+        ++n_routes_inserted;
+    }
+
+    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+  out:
+
+    if (ret < 0) {
+        wolfsentry_action_res_t rollback_results;
+        while (n_routes_inserted > 0) {
+            struct wolfsentry_route *route = (struct wolfsentry_route *)(base + route_index[--n_routes_inserted].offset);
+            /* a route still referenced from outside the table needs the image
+             * until the context goes, as after any delete of an image route.
+             */
+            if (route->header.refcount > 1)
+                pinned = 1;
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_delete_by_id(wolfsentry, caller_arg, route->header.id, NULL /* event_label */, 0 /* event_label_len */, &rollback_results));
+        }
+        while (n_events_inserted > 0) {
+            const struct wolfsentry_image_event *rec = event_recs[--n_events_inserted];
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_delete(wolfsentry, (const char *)((const uint32_t *)(rec + 1) + rec->n_actions), (int)rec->label_len, &rollback_results));
+        }
+        if (policy_saved)
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_table_default_policy_set(wolfsentry, &wolfsentry->routes_static, saved_policy));
+        if (config_saved)
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_defaultconfig_update(wolfsentry, &saved_config));
+        if (registered && (! pinned)) {
+            wolfsentry_list_ent_delete(&wolfsentry->images, &ent->header);
+            registered = 0;
+        }
+    }
+
+    if (scratch)
+        WOLFSENTRY_FREE(scratch);
+    if ((ret < 0) && (! registered)) {
+        if (ent)
+            WOLFSENTRY_FREE(ent);
+        if (release && image)
+            release(release_arg, image, image_size);
+    }
+
+    return ret;
+}
+
+#ifndef WOLFSENTRY_NO_STDIO
+
+#ifndef WOLFSENTRY_NO_MMAP
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static void wolfsentry_image_munmap(void *release_arg, void *image, size_t image_size) {
+    (void)release_arg;
+    (void)munmap(image, image_size);
+}
+
+wolfsentry_errcode_t wolfsentry_image_load_file(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    const char *path,
+    wolfsentry_action_res_t *action_results)
+{
+    struct stat st;
+    void *image;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+    if (fstat(fd, &st) < 0) {
+        (void)close(fd);
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+    }
+    if (st.st_size < (off_t)sizeof(struct wolfsentry_image_header)) {
+        (void)close(fd);
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    }
+    /* private and writable -- linking the routes in place never writes the
+     * file.  every route is written to, so where the system allows, the
+     * mapping is populated up front rather than faulted in a page at a time.
+     */
+#ifdef MAP_POPULATE
+    image = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+#else
+    image = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+#endif
+    (void)close(fd);
+    if (image == MAP_FAILED)
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+#ifndef MAP_POPULATE
+    (void)posix_madvise(image, (size_t)st.st_size, POSIX_MADV_WILLNEED);
+#endif
+
+    return wolfsentry_image_load(wolfsentry, caller_arg, image, (size_t)st.st_size, wolfsentry_image_munmap, NULL /* release_arg */, action_results);
+}
+
+#else /* WOLFSENTRY_NO_MMAP */
+
+static void wolfsentry_image_free(void *release_arg, void *image, size_t image_size) {
+    struct wolfsentry_context *wolfsentry = (struct wolfsentry_context *)release_arg;
+    (void)image_size;
+    if (wolfsentry->allocator.memalign)
+        WOLFSENTRY_FREE_ALIGNED(image);
+    else
+        WOLFSENTRY_FREE(image);
+}
+
+wolfsentry_errcode_t wolfsentry_image_load_file(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    const char *path,
+    wolfsentry_action_res_t *action_results)
+{
+    FILE *f;
+    long image_size;
+    struct wolfsentry_image_header header;
+    size_t alignment;
+    void *image;
+
+    if ((f = fopen(path, "rb")) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+    if ((fseek(f, 0, SEEK_END) < 0) || ((image_size = ftell(f)) < 0) || (fseek(f, 0, SEEK_SET) < 0)) {
+        (void)fclose(f);
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+    }
+    if ((size_t)image_size < sizeof header) {
+        (void)fclose(f);
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    }
+    /* the routes are linked in place, so the buffer needs the alignment they
+     * were compiled for, which can be more than the allocator's default.  a
+     * bogus alignment is left for the load to turn away.
+     */
+    if ((fread(&header, 1, sizeof header, f) != sizeof header) || (fseek(f, 0, SEEK_SET) < 0)) {
+        (void)fclose(f);
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+    }
+    if ((header.route_alignment >= sizeof(uint64_t)) && (header.route_alignment <= (uint64_t)image_size) && ((header.route_alignment & (header.route_alignment - 1U)) == 0))
+        alignment = (size_t)header.route_alignment;
+    else
+        alignment = sizeof(uint64_t);
+    if (wolfsentry->allocator.memalign)
+        image = WOLFSENTRY_MEMALIGN(alignment, (size_t)image_size);
+    else
+        image = WOLFSENTRY_MALLOC((size_t)image_size);
+    if (image == NULL) {
+        (void)fclose(f);
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    }
+    if (fread(image, 1, (size_t)image_size, f) != (size_t)image_size) {
+        (void)fclose(f);
+        wolfsentry_image_free(wolfsentry, image, (size_t)image_size);
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+    }
+    (void)fclose(f);
+
+    return wolfsentry_image_load(wolfsentry, caller_arg, image, (size_t)image_size, wolfsentry_image_free, wolfsentry, action_results);
+}
+
+#endif /* WOLFSENTRY_NO_MMAP */
+
+#endif /* !WOLFSENTRY_NO_STDIO */
@@ -34,10 +34,18 @@ wolfsentry_errcode_t wolfsentry_table_ent_insert(struct wolfsentry_context *wolf
             return ret;
     }
 
-    while (i) {
-        if ((cmpret = table->cmp_fn(i, ent)) >= 0)
-            break;
-        i = i->next;
+    /* bulk loads (JSON configs, ruleset images) arrive mostly in order. */
+    if (table->tail && (table->cmp_fn(table->tail, ent) < 0))
+        i = NULL;
+    else {
+        /* merges insert in order among existing ents. */
+        if (table->last_insert && (table->cmp_fn(table->last_insert, ent) < 0))
+            i = table->last_insert->next;
+        while (i) {
+            if ((cmpret = table->cmp_fn(i, ent)) >= 0)
+                break;
+            i = i->next;
+        }
     }
     if (i) {
         if ((cmpret == 0) && unique_p) {
@@ -65,6 +73,7 @@ wolfsentry_errcode_t wolfsentry_table_ent_insert(struct wolfsentry_context *wolf
     ++table->n_ents;
     ++table->n_inserts;
     ent->parent_table = table;
+    table->last_insert = ent;
 
     WOLFSENTRY_RETURN_OK;
 }
@@ -156,6 +165,12 @@ wolfsentry_errcode_t wolfsentry_table_ent_insert_by_id(struct wolfsentry_context
     if (ent->id == WOLFSENTRY_ENT_ID_NONE)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
 
+    /* fresh IDs are allocated in ascending order, so they nearly always
+     * belong at the tail.
+     */
+    if (wolfsentry->ents_by_id.tail && (wolfsentry_ent_id_cmp(wolfsentry->ents_by_id.tail, ent->id) < 0))
+        i = NULL;
+
     while (i) {
         if ((cmpret = wolfsentry_ent_id_cmp(i, ent->id)) >= 0)
             break;
@@ -192,7 +207,7 @@ wolfsentry_errcode_t wolfsentry_table_ent_get_by_id(struct wolfsentry_context *w
     if (id == WOLFSENTRY_ENT_ID_NONE)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
 
-    for (i = wolfsentry->ents_by_id.head; i; i = i->next) {
+    for (i = wolfsentry->ents_by_id.head; i; i = i->next_by_id) {
         int c = wolfsentry_ent_id_cmp(i, id);
         if (c >= 0) {
             if (c == 0) {
@@ -254,6 +269,8 @@ wolfsentry_errcode_t wolfsentry_table_ent_delete_1(struct wolfsentry_context *wo
     if (ent->parent_table == NULL)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
 
+    if (ent->parent_table->last_insert == ent)
+        ent->parent_table->last_insert = ent->prev;
     if (ent->prev)
         ent->prev->next = ent->next;
     else
@@ -310,6 +327,59 @@ wolfsentry_errcode_t wolfsentry_table_ent_drop_reference(struct wolfsentry_conte
     WOLFSENTRY_RETURN_OK;
 }
 
+/* stable merge sort of the ents by cmp_fn, for when something they are sorted
+ * by has changed under them.
+ */
+void wolfsentry_table_sort(struct wolfsentry_table_header *table) {
+    struct wolfsentry_table_ent_header *list = table->head, *p, *q, *e, *tail = NULL;
+    size_t run = 1, n_merges, p_size, q_size, i;
+
+    if (list == NULL)
+        return;
+
+    for (;;) {
+        p = list;
+        list = tail = NULL;
+        n_merges = 0;
+        while (p) {
+            ++n_merges;
+            q = p;
+            p_size = 0;
+            for (i = 0; (i < run) && q; ++i) {
+                ++p_size;
+                q = q->next;
+            }
+            q_size = run;
+            while ((p_size > 0) || ((q_size > 0) && q)) {
+                if ((p_size == 0) || ((q_size > 0) && q && (table->cmp_fn(p, q) > 0))) {
+                    e = q;
+                    q = q->next;
+                    --q_size;
+                } else {
+                    e = p;
+                    p = p->next;
+                    --p_size;
+                }
+                if (tail)
+                    tail->next = e;
+                else
+                    list = e;
+                e->prev = tail;
+                tail = e;
+            }
+            p = q;
+        }
+        tail->next = NULL;
+        if (n_merges <= 1)
+            break;
+        run *= 2;
+    }
+
+    table->head = list;
+    table->tail = tail;
+    table->last_insert = NULL;
+}
+
 wolfsentry_errcode_t wolfsentry_table_free_ents(struct wolfsentry_context *wolfsentry, struct wolfsentry_table_header *table) {
     struct wolfsentry_table_ent_header *i = table->head, *next;
     wolfsentry_errcode_t ret;
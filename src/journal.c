@@ -0,0 +1,972 @@
+/*
+ * journal.c
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfSentry.
+ *
+ * wolfSentry is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSentry is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#include "wolfsentry_internal.h"
+
+#define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_JOURNAL_C
+
+/* a journal is a run of records, each this header followed by the remote
+ * address, the local address, the parent event label, and zeros up to a
+ * multiple of 8 bytes.  the route is identified by its key and parent, as
+ * for an exact lookup, and flags is the whole of its flags after the change.
+ */
+struct wolfsentry_journal_record {
+    uint64_t checksum; /* of the rest of the record. */
+    uint16_t size; /* of the whole record. */
+    byte type;
+    byte version;
+    uint32_t flags;
+    int64_t when; /* of the change, in nanoseconds since the epoch. */
+    int64_t penaltybox_when; /* the route's last_penaltybox_time, the same way, or zero. */
+    uint16_t sa_family, sa_proto, remote_port, local_port, remote_addr_len, local_addr_len;
+    byte remote_interface, local_interface, label_len, reserved;
+};
+
+#define WOLFSENTRY_JOURNAL_RECORD_MAX_SIZE \
+    ((sizeof(struct wolfsentry_journal_record) + (WOLFSENTRY_MAX_ADDR_BYTES * 2) + WOLFSENTRY_MAX_LABEL_BYTES + 7U) & ~(size_t)7U)
+
+/* a gap record is the header alone, with no route. */
+#define WOLFSENTRY_JOURNAL_GAP_SIZE \
+    ((sizeof(struct wolfsentry_journal_record) + 7U) & ~(size_t)7U)
+
+/* in the ring, each record is preceded by 8 bytes, the first 4 of which are
+ * the size of the two together once the record is complete, and zero until
+ * then.  sizes are multiples of 8, so these never wrap.
+ */
+#define WOLFSENTRY_JOURNAL_SLOT_HEADER_SIZE 8U
+
+struct wolfsentry_journal {
+    struct wolfsentry_journal_config config;
+    byte *ring;
+    uint64_t head; /* bytes ever reserved by producers. */
+    uint64_t tail; /* bytes ever drained by the writer. */
+    byte *staging; /* records drained but not yet written, config.ring_size bytes. */
+    size_t staged;
+    int unsynced_p;
+    int gap_pending; /* records were dropped since the last one appended. */
+    struct wolfsentry_journal_stats stats;
+#ifdef WOLFSENTRY_THREADSAFE
+    struct wolfsentry_rwlock drain_lock;
+#endif
+#ifdef WOLFSENTRY_JOURNAL_THREAD
+    pthread_t thread;
+    sem_t wakeup;
+    volatile int stop;
+#endif
+};
+
+/* the latest deletes seen, so that a change older than the delete of its
+ * route, arriving after it, doesn't put the route back.  the oldest is
+ * overwritten by the next.  each is found by a hash of its key, checked
+ * before the key itself.
+ */
+struct wolfsentry_journal_tombstone {
+    uint64_t key_hash;
+    int64_t when; /* of the delete, as in its record. */
+    uint64_t key[WOLFSENTRY_JOURNAL_RECORD_MAX_SIZE / sizeof(uint64_t)]; /* the record, less everything but the route key. */
+};
+
+struct wolfsentry_journal_tombstones {
+    size_t next, n_ents;
+    struct wolfsentry_journal_tombstone ents[WOLFSENTRY_FLEXIBLE_ARRAY_SIZE];
+};
+
+static wolfsentry_errcode_t wolfsentry_journal_time_to_nsecs(struct wolfsentry_context *wolfsentry, wolfsentry_time_t t, int64_t *nsecs) {
+    long epoch_secs, epoch_nsecs;
+    wolfsentry_errcode_t ret;
+    if ((ret = WOLFSENTRY_TO_EPOCH_TIME(t, &epoch_secs, &epoch_nsecs)) < 0)
+        return ret;
+    *nsecs = ((int64_t)epoch_secs * 1000000000LL) + (int64_t)epoch_nsecs;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_journal_nsecs_to_time(struct wolfsentry_context *wolfsentry, int64_t nsecs, wolfsentry_time_t *t) {
+    return WOLFSENTRY_FROM_EPOCH_TIME((long)(nsecs / 1000000000LL), (long)(nsecs % 1000000000LL), t);
+}
+
+static wolfsentry_errcode_t wolfsentry_journal_record_encode(
+    struct wolfsentry_context *wolfsentry,
+    wolfsentry_journal_record_type_t type,
+    const struct wolfsentry_route *route,
+    byte *buf,
+    size_t *size)
+{
+    struct wolfsentry_journal_record rec;
+    size_t remote_addr_bytes = WOLFSENTRY_BITS_TO_BYTES((size_t)route->remote.addr_len);
+    size_t local_addr_bytes = WOLFSENTRY_BITS_TO_BYTES((size_t)route->local.addr_len);
+    size_t offset = sizeof rec;
+    wolfsentry_time_t now;
+    wolfsentry_errcode_t ret;
+
+    memset(&rec, 0, sizeof rec);
+    rec.type = (byte)type;
+    rec.version = WOLFSENTRY_JOURNAL_VERSION;
+    rec.flags = (uint32_t)(route->flags & ~WOLFSENTRY_ROUTE_INTERNAL_FLAGS);
+    /* stamped with the change itself, so that a peer can order it against its own. */
+    if ((type != WOLFSENTRY_JOURNAL_RECORD_DELETE) && (route->meta.last_change_time != 0))
+        now = route->meta.last_change_time;
+    else if ((ret = WOLFSENTRY_GET_TIME(&now)) < 0)
+        return ret;
+    if ((ret = wolfsentry_journal_time_to_nsecs(wolfsentry, now, &rec.when)) < 0)
+        return ret;
+    if ((route->meta.last_penaltybox_time != 0) &&
+        ((ret = wolfsentry_journal_time_to_nsecs(wolfsentry, route->meta.last_penaltybox_time, &rec.penaltybox_when)) < 0))
+        return ret;
+    rec.sa_family = route->sa_family;
+    rec.sa_proto = route->sa_proto;
+    rec.remote_port = route->remote.sa_port;
+    rec.local_port = route->local.sa_port;
+    rec.remote_addr_len = route->remote.addr_len;
+    rec.local_addr_len = route->local.addr_len;
+    rec.remote_interface = route->remote.interface;
+    rec.local_interface = route->local.interface;
+    if (route->parent_event)
+        rec.label_len = (byte)route->parent_event->label_len;
+
+    memcpy(buf + offset, WOLFSENTRY_ROUTE_REMOTE_ADDR(route), remote_addr_bytes);
+    offset += remote_addr_bytes;
+    memcpy(buf + offset, WOLFSENTRY_ROUTE_LOCAL_ADDR(route), local_addr_bytes);
+    offset += local_addr_bytes;
+    if (rec.label_len) {
+        memcpy(buf + offset, route->parent_event->label, rec.label_len);
+        offset += rec.label_len;
+    }
+    *size = (offset + 7U) & ~(size_t)7U;
+    memset(buf + offset, 0, *size - offset);
+
+    rec.size = (uint16_t)*size;
+    memcpy(buf, &rec, sizeof rec);
+    rec.checksum = wolfsentry_image_checksum(buf + sizeof rec.checksum, *size - sizeof rec.checksum);
+    memcpy(buf, &rec.checksum, sizeof rec.checksum);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* marks the place of records that were dropped -- a reader can't trust the
+ * table it built from the records before it, and needs a fresh snapshot.
+ */
+static wolfsentry_errcode_t wolfsentry_journal_gap_encode(
+    struct wolfsentry_context *wolfsentry,
+    byte *buf,
+    size_t *size)
+{
+    struct wolfsentry_journal_record rec;
+    wolfsentry_time_t now;
+    wolfsentry_errcode_t ret;
+
+    memset(buf, 0, WOLFSENTRY_JOURNAL_GAP_SIZE);
+    memset(&rec, 0, sizeof rec);
+    rec.type = (byte)WOLFSENTRY_JOURNAL_RECORD_GAP;
+    rec.version = WOLFSENTRY_JOURNAL_VERSION;
+    if (((ret = WOLFSENTRY_GET_TIME(&now)) < 0) ||
+        ((ret = wolfsentry_journal_time_to_nsecs(wolfsentry, now, &rec.when)) < 0))
+        return ret;
+    *size = rec.size = (uint16_t)WOLFSENTRY_JOURNAL_GAP_SIZE;
+    memcpy(buf, &rec, sizeof rec);
+    rec.checksum = wolfsentry_image_checksum(buf + sizeof rec.checksum, *size - sizeof rec.checksum);
+    memcpy(buf, &rec.checksum, sizeof rec.checksum);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* the ring is accessed modulo its size, so records can straddle the end. */
+static void wolfsentry_journal_ring_put(struct wolfsentry_journal *journal, uint64_t pos, const byte *src, size_t len) {
+    size_t offset = (size_t)(pos & (journal->config.ring_size - 1));
+    size_t first = journal->config.ring_size - offset;
+    if (first > len)
+        first = len;
+    memcpy(journal->ring + offset, src, first);
+    memcpy(journal->ring, src + first, len - first);
+}
+
+static void wolfsentry_journal_ring_get(struct wolfsentry_journal *journal, uint64_t pos, byte *dst, size_t len) {
+    size_t offset = (size_t)(pos & (journal->config.ring_size - 1));
+    size_t first = journal->config.ring_size - offset;
+    if (first > len)
+        first = len;
+    memcpy(dst, journal->ring + offset, first);
+    memcpy(dst + first, journal->ring, len - first);
+}
+
+static void wolfsentry_journal_ring_zero(struct wolfsentry_journal *journal, uint64_t pos, size_t len) {
+    size_t offset = (size_t)(pos & (journal->config.ring_size - 1));
+    size_t first = journal->config.ring_size - offset;
+    if (first > len)
+        first = len;
+    memset(journal->ring + offset, 0, first);
+    memset(journal->ring, 0, len - first);
+}
+
+static inline uint32_t *wolfsentry_journal_slot_ready(struct wolfsentry_journal *journal, uint64_t pos) {
+    return (uint32_t *)(void *)(journal->ring + (size_t)(pos & (journal->config.ring_size - 1)));
+}
+
+/* moves complete records from the ring to the staging buffer, and the staging
+ * buffer to the sink, until the ring runs dry.  a failed write leaves the
+ * records staged for the next try.  the caller holds the drain lock.
+ */
+static wolfsentry_errcode_t wolfsentry_journal_drain(struct wolfsentry_journal *journal) {
+    uint64_t tail = journal->tail;
+    wolfsentry_errcode_t ret;
+
+    for (;;) {
+        uint32_t slot_size;
+        while ((slot_size = WOLFSENTRY_ATOMIC_LOAD(*wolfsentry_journal_slot_ready(journal, tail))) != 0) {
+            size_t size = slot_size - WOLFSENTRY_JOURNAL_SLOT_HEADER_SIZE;
+            if (journal->staged + size > journal->config.ring_size)
+                break;
+            wolfsentry_journal_ring_get(journal, tail + WOLFSENTRY_JOURNAL_SLOT_HEADER_SIZE, journal->staging + journal->staged, size);
+            journal->staged += size;
+            /* a later slot header can land anywhere in this one. */
+            wolfsentry_journal_ring_zero(journal, tail, slot_size);
+            tail += slot_size;
+            WOLFSENTRY_ATOMIC_STORE(journal->tail, tail);
+        }
+        if (journal->staged == 0)
+            break;
+        /* group commit -- everything drained goes in one write. */
+        if ((ret = journal->config.write(journal->config.sink_context, journal->staging, journal->staged)) < 0)
+            return ret;
+        WOLFSENTRY_ATOMIC_INCREMENT(journal->stats.n_writes, 1);
+        WOLFSENTRY_ATOMIC_INCREMENT(journal->stats.n_bytes_written, journal->staged);
+        journal->staged = 0;
+        journal->unsynced_p = 1;
+    }
+
+    if (journal->unsynced_p && journal->config.sync) {
+        if ((ret = journal->config.sync(journal->config.sink_context)) < 0)
+            return ret;
+        WOLFSENTRY_ATOMIC_INCREMENT(journal->stats.n_syncs, 1);
+    }
+    journal->unsynced_p = 0;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_journal_flush_1(struct wolfsentry_journal *journal) {
+    wolfsentry_errcode_t ret;
+    if ((ret = wolfsentry_lock_mutex(&journal->drain_lock)) < 0)
+        return ret;
+    ret = wolfsentry_journal_drain(journal);
+    WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_lock_unlock(&journal->drain_lock));
+    return ret;
+}
+
+/* n_ents is zero for WOLFSENTRY_JOURNAL_DEFAULT_TOMBSTONES, or the number a
+ * journal was started with.  a change in number keeps the latest deletes.
+ */
+static wolfsentry_errcode_t wolfsentry_journal_tombstones_init(struct wolfsentry_context *wolfsentry, size_t n_ents) {
+    struct wolfsentry_journal_tombstones *old = wolfsentry->journal_tombstones, *new;
+    size_t i, n_kept;
+
+    if (old && ((n_ents == 0) || (n_ents == old->n_ents)))
+        WOLFSENTRY_RETURN_OK;
+    if (n_ents == 0)
+        n_ents = WOLFSENTRY_JOURNAL_DEFAULT_TOMBSTONES;
+    if ((new = (struct wolfsentry_journal_tombstones *)WOLFSENTRY_MALLOC(sizeof *new + (sizeof new->ents[0] * n_ents))) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(new, 0, sizeof *new + (sizeof new->ents[0] * n_ents));
+    new->n_ents = n_ents;
+    if (old) {
+        n_kept = (old->n_ents < n_ents) ? old->n_ents : n_ents;
+        for (i = 0; i < n_kept; ++i)
+            new->ents[n_kept - 1 - i] = old->ents[(old->next + old->n_ents - 1 - i) % old->n_ents];
+        new->next = n_kept % n_ents;
+        WOLFSENTRY_FREE(old);
+    }
+    wolfsentry->journal_tombstones = new;
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* two records name the same route if their keys are the same. */
+static void wolfsentry_journal_tombstone_key(const struct wolfsentry_journal_record *rec, const byte *p, uint64_t *key) {
+    struct wolfsentry_journal_record key_rec;
+    size_t key_bytes = WOLFSENTRY_BITS_TO_BYTES((size_t)rec->remote_addr_len) + WOLFSENTRY_BITS_TO_BYTES((size_t)rec->local_addr_len) + rec->label_len;
+
+    memset(key, 0, WOLFSENTRY_JOURNAL_RECORD_MAX_SIZE);
+    memset(&key_rec, 0, sizeof key_rec);
+    key_rec.flags = rec->flags & (uint32_t)WOLFSENTRY_ROUTE_IMMUTABLE_FLAGS;
+    key_rec.sa_family = rec->sa_family;
+    key_rec.sa_proto = rec->sa_proto;
+    key_rec.remote_port = rec->remote_port;
+    key_rec.local_port = rec->local_port;
+    key_rec.remote_addr_len = rec->remote_addr_len;
+    key_rec.local_addr_len = rec->local_addr_len;
+    key_rec.remote_interface = rec->remote_interface;
+    key_rec.local_interface = rec->local_interface;
+    key_rec.label_len = rec->label_len;
+    memcpy(key, &key_rec, sizeof key_rec);
+    memcpy((byte *)key + sizeof key_rec, p + sizeof key_rec, key_bytes);
+}
+
+static struct wolfsentry_journal_tombstone *wolfsentry_journal_tombstone_find(struct wolfsentry_journal_tombstones *tombstones, const uint64_t *key, uint64_t key_hash) {
+    size_t i;
+    for (i = 0; i < tombstones->n_ents; ++i) {
+        if ((tombstones->ents[i].key_hash == key_hash) &&
+            (memcmp(tombstones->ents[i].key, key, sizeof tombstones->ents[i].key) == 0))
+            return &tombstones->ents[i];
+    }
+    return NULL;
+}
+
+static void wolfsentry_journal_tombstone_add(struct wolfsentry_context *wolfsentry, const struct wolfsentry_journal_record *rec, const byte *p) {
+    struct wolfsentry_journal_tombstones *tombstones = wolfsentry->journal_tombstones;
+    struct wolfsentry_journal_tombstone *tombstone;
+    uint64_t key[WOLFSENTRY_JOURNAL_RECORD_MAX_SIZE / sizeof(uint64_t)];
+    uint64_t key_hash;
+
+    if (tombstones == NULL)
+        return;
+    wolfsentry_journal_tombstone_key(rec, p, key);
+    key_hash = wolfsentry_image_checksum((const byte *)key, sizeof key);
+    if ((tombstone = wolfsentry_journal_tombstone_find(tombstones, key, key_hash)) == NULL) {
+        tombstone = &tombstones->ents[tombstones->next];
+        tombstones->next = (tombstones->next + 1) % tombstones->n_ents;
+        tombstone->key_hash = key_hash;
+        memcpy(tombstone->key, key, sizeof key);
+    } else if (tombstone->when >= rec->when)
+        return;
+    tombstone->when = rec->when;
+}
+
+/* nonzero if the route the record names was deleted here, no earlier than the record. */
+static int wolfsentry_journal_tombstone_covers(struct wolfsentry_context *wolfsentry, const struct wolfsentry_journal_record *rec, const byte *p) {
+    struct wolfsentry_journal_tombstone *tombstone;
+    uint64_t key[WOLFSENTRY_JOURNAL_RECORD_MAX_SIZE / sizeof(uint64_t)];
+
+    if (wolfsentry->journal_tombstones == NULL)
+        return 0;
+    wolfsentry_journal_tombstone_key(rec, p, key);
+    tombstone = wolfsentry_journal_tombstone_find(wolfsentry->journal_tombstones, key, wolfsentry_image_checksum((const byte *)key, sizeof key));
+    return (tombstone != NULL) && (tombstone->when >= rec->when);
+}
+
+/* puts one or more encoded records in the ring as a single slot, or returns
+ * nonzero if there's no room for them.
+ */
+static int wolfsentry_journal_append(struct wolfsentry_journal *journal, const byte *buf, size_t size) {
+    size_t slot_size = WOLFSENTRY_JOURNAL_SLOT_HEADER_SIZE + size;
+    uint64_t head, tail;
+
+    head = WOLFSENTRY_ATOMIC_LOAD(journal->head);
+    for (;;) {
+        tail = WOLFSENTRY_ATOMIC_LOAD(journal->tail);
+        /* the change is never held up by the sink, even with no writer
+         * thread -- then it's up to the caller to flush in time.
+         */
+        if (head + slot_size - tail > journal->config.ring_size)
+            return -1;
+        if (WOLFSENTRY_ATOMIC_CMPXCHG(journal->head, &head, head + slot_size))
+            break;
+    }
+
+    wolfsentry_journal_ring_put(journal, head + WOLFSENTRY_JOURNAL_SLOT_HEADER_SIZE, buf, size);
+    WOLFSENTRY_ATOMIC_STORE(*wolfsentry_journal_slot_ready(journal, head), (uint32_t)slot_size);
+
+#ifdef WOLFSENTRY_JOURNAL_THREAD
+    /* wake the writer only on crossing the threshold, not for every record past it. */
+    if ((head - tail < journal->config.group_commit_bytes) &&
+        (head + slot_size - tail >= journal->config.group_commit_bytes))
+        (void)sem_post(&journal->wakeup);
+#endif
+
+    return 0;
+}
+
+void wolfsentry_journal_note(struct wolfsentry_context *wolfsentry, wolfsentry_journal_record_type_t type, const struct wolfsentry_route *route) {
+    struct wolfsentry_journal *journal = wolfsentry->journal;
+    uint64_t buf[(WOLFSENTRY_JOURNAL_GAP_SIZE + WOLFSENTRY_JOURNAL_RECORD_MAX_SIZE) / sizeof(uint64_t)];
+    size_t gap_size = 0, size;
+    int gap_pending = 1;
+
+    /* drops are marked ahead of the first record to get in after them, in the same slot. */
+    if (WOLFSENTRY_ATOMIC_CMPXCHG(journal->gap_pending, &gap_pending, 0) &&
+        (wolfsentry_journal_gap_encode(wolfsentry, (byte *)buf, &gap_size) < 0))
+        goto drop;
+    if (wolfsentry_journal_record_encode(wolfsentry, type, route, (byte *)buf + gap_size, &size) < 0)
+        goto drop;
+    /* a local delete is remembered like one applied from a peer. */
+    if (type == WOLFSENTRY_JOURNAL_RECORD_DELETE) {
+        struct wolfsentry_journal_record rec;
+        memcpy(&rec, (byte *)buf + gap_size, sizeof rec);
+        wolfsentry_journal_tombstone_add(wolfsentry, &rec, (byte *)buf + gap_size);
+    }
+    if (wolfsentry_journal_append(journal, (const byte *)buf, gap_size + size) != 0)
+        goto drop;
+    WOLFSENTRY_ATOMIC_INCREMENT(journal->stats.n_records, 1);
+    return;
+
+  drop:
+    WOLFSENTRY_ATOMIC_INCREMENT(journal->stats.n_dropped, 1);
+    WOLFSENTRY_ATOMIC_STORE(journal->gap_pending, 1);
+}
+
+#ifdef WOLFSENTRY_JOURNAL_THREAD
+
+#include <errno.h>
+
+static void *wolfsentry_journal_thread(void *arg) {
+    struct wolfsentry_context *wolfsentry = (struct wolfsentry_context *)arg;
+    struct wolfsentry_journal *journal = wolfsentry->journal;
+    wolfsentry_errcode_t ret;
+
+    while (! journal->stop) {
+        struct timespec abs_timeout;
+#ifdef WOLFSENTRY_CLOCK_BUILTINS
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_builtin_time_cache_refresh());
+#endif
+        if ((ret = wolfsentry_time_now_plus_delta_timespec(wolfsentry, journal->config.group_commit_interval, &abs_timeout)) < 0) {
+            WOLFSENTRY_WARN("wolfsentry_time_now_plus_delta_timespec returned " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+            break;
+        }
+        while ((sem_timedwait(&journal->wakeup, &abs_timeout) < 0) && (errno == EINTR))
+            ;
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_journal_flush_1(journal));
+    }
+
+    return NULL;
+}
+
+#endif /* WOLFSENTRY_JOURNAL_THREAD */
+
+static void wolfsentry_journal_free(struct wolfsentry_context *wolfsentry, struct wolfsentry_journal *journal) {
+    WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_lock_destroy(&journal->drain_lock));
+    if (journal->ring)
+        WOLFSENTRY_FREE(journal->ring);
+    if (journal->staging)
+        WOLFSENTRY_FREE(journal->staging);
+    WOLFSENTRY_FREE(journal);
+}
+
+wolfsentry_errcode_t wolfsentry_journal_start(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_journal_config *config)
+{
+    struct wolfsentry_journal *journal;
+    wolfsentry_errcode_t ret;
+
+    if (wolfsentry->journal)
+        WOLFSENTRY_ERROR_RETURN(ALREADY);
+    if ((config == NULL) || (config->write == NULL) || (config->group_commit_interval < 0))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (config->ring_size && ((config->ring_size & (config->ring_size - 1)) || (config->ring_size < WOLFSENTRY_JOURNAL_SLOT_HEADER_SIZE + WOLFSENTRY_JOURNAL_GAP_SIZE + WOLFSENTRY_JOURNAL_RECORD_MAX_SIZE)))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if ((ret = wolfsentry_journal_tombstones_init(wolfsentry, config->n_tombstones)) < 0)
+        return ret;
+    if ((journal = (struct wolfsentry_journal *)WOLFSENTRY_MALLOC(sizeof *journal)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(journal, 0, sizeof *journal);
+
+    journal->config = *config;
+    if (journal->config.ring_size == 0)
+        journal->config.ring_size = WOLFSENTRY_JOURNAL_DEFAULT_RING_SIZE;
+    if (journal->config.group_commit_bytes == 0)
+        journal->config.group_commit_bytes = journal->config.ring_size / 4;
+    if (journal->config.group_commit_interval == 0)
+        journal->config.group_commit_interval = WOLFSENTRY_JOURNAL_DEFAULT_GROUP_COMMIT_INTERVAL;
+
+    if ((ret = wolfsentry_lock_init(&journal->drain_lock, 0 /* pshared */)) < 0) {
+        WOLFSENTRY_FREE(journal);
+        return ret;
+    }
+
+    if (((journal->ring = (byte *)WOLFSENTRY_MALLOC(journal->config.ring_size)) == NULL) ||
+        ((journal->staging = (byte *)WOLFSENTRY_MALLOC(journal->config.ring_size)) == NULL))
+    {
+        wolfsentry_journal_free(wolfsentry, journal);
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    }
+    memset(journal->ring, 0, journal->config.ring_size);
+
+#ifdef WOLFSENTRY_JOURNAL_THREAD
+    if (sem_init(&journal->wakeup, 0 /* pshared */, 0 /* value */) < 0) {
+        wolfsentry_journal_free(wolfsentry, journal);
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+    }
+    wolfsentry->journal = journal;
+    if (pthread_create(&journal->thread, NULL /* attr */, wolfsentry_journal_thread, wolfsentry) != 0) {
+        wolfsentry->journal = NULL;
+        (void)sem_destroy(&journal->wakeup);
+        wolfsentry_journal_free(wolfsentry, journal);
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+    }
+#else
+    wolfsentry->journal = journal;
+#endif
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+wolfsentry_errcode_t wolfsentry_journal_flush(struct wolfsentry_context *wolfsentry) {
+    if (wolfsentry->journal == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    return wolfsentry_journal_flush_1(wolfsentry->journal);
+}
+
+wolfsentry_errcode_t wolfsentry_journal_stop(struct wolfsentry_context *wolfsentry) {
+    struct wolfsentry_journal *journal = wolfsentry->journal;
+    wolfsentry_errcode_t ret;
+
+    if (journal == NULL)
+        WOLFSENTRY_ERROR_RETURN(ALREADY);
+
+#ifdef WOLFSENTRY_JOURNAL_THREAD
+    journal->stop = 1;
+    if (sem_post(&journal->wakeup) < 0)
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
+    if (pthread_join(journal->thread, NULL /* retval */) != 0)
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
+    (void)sem_destroy(&journal->wakeup);
+#endif
+
+    /* whatever the outcome, the journal is gone -- the records were already counted. */
+    ret = wolfsentry_journal_flush_1(journal);
+    /* drops since the last record are marked at the end. */
+    if ((ret >= 0) && journal->gap_pending) {
+        uint64_t buf[WOLFSENTRY_JOURNAL_GAP_SIZE / sizeof(uint64_t)];
+        size_t size;
+        if ((ret = wolfsentry_journal_gap_encode(wolfsentry, (byte *)buf, &size)) >= 0) {
+            if (wolfsentry_journal_append(journal, (const byte *)buf, size) != 0)
+                ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
+            else
+                ret = wolfsentry_journal_flush_1(journal);
+        }
+    }
+    wolfsentry->journal = NULL;
+    wolfsentry_journal_free(wolfsentry, journal);
+
+    return ret;
+}
+
+wolfsentry_errcode_t wolfsentry_journal_get_stats(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_journal_stats *stats)
+{
+    struct wolfsentry_journal *journal = wolfsentry->journal;
+    if (journal == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    stats->n_records = WOLFSENTRY_ATOMIC_LOAD(journal->stats.n_records);
+    stats->n_dropped = WOLFSENTRY_ATOMIC_LOAD(journal->stats.n_dropped);
+    stats->n_writes = WOLFSENTRY_ATOMIC_LOAD(journal->stats.n_writes);
+    stats->n_bytes_written = WOLFSENTRY_ATOMIC_LOAD(journal->stats.n_bytes_written);
+    stats->n_syncs = WOLFSENTRY_ATOMIC_LOAD(journal->stats.n_syncs);
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* a record that fails here ends the journal. */
+static int wolfsentry_journal_record_check(const byte *p, size_t len, struct wolfsentry_journal_record *rec) {
+    if (len < sizeof *rec)
+        return -1;
+    memcpy(rec, p, sizeof *rec);
+    if ((rec->size < sizeof *rec) ||
+        (rec->size > len) ||
+        (rec->size & 7U) ||
+        (rec->version != WOLFSENTRY_JOURNAL_VERSION) ||
+        (rec->type < WOLFSENTRY_JOURNAL_RECORD_INSERT) ||
+        (rec->type > WOLFSENTRY_JOURNAL_RECORD_GAP) ||
+        (rec->flags & (uint32_t)WOLFSENTRY_ROUTE_INTERNAL_FLAGS) ||
+        (rec->remote_addr_len > WOLFSENTRY_MAX_ADDR_BYTES * BITS_PER_BYTE) ||
+        (rec->local_addr_len > WOLFSENTRY_MAX_ADDR_BYTES * BITS_PER_BYTE) ||
+        (rec->label_len > WOLFSENTRY_MAX_LABEL_BYTES) ||
+        (sizeof *rec + WOLFSENTRY_BITS_TO_BYTES((size_t)rec->remote_addr_len) + WOLFSENTRY_BITS_TO_BYTES((size_t)rec->local_addr_len) + rec->label_len > rec->size))
+        return -1;
+    if (wolfsentry_image_checksum(p + sizeof rec->checksum, (size_t)rec->size - sizeof rec->checksum) != rec->checksum)
+        return -1;
+    return 0;
+}
+
+/* the route a record names. */
+struct wolfsentry_journal_key {
+    WOLFSENTRY_SOCKADDR(WOLFSENTRY_MAX_ADDR_BYTES * BITS_PER_BYTE) remote, local;
+    const char *label;
+    int label_len;
+};
+
+static wolfsentry_errcode_t wolfsentry_journal_record_key(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_journal_record *rec,
+    const byte *p,
+    struct wolfsentry_journal_key *key)
+{
+    size_t remote_addr_bytes = WOLFSENTRY_BITS_TO_BYTES((size_t)rec->remote_addr_len);
+    size_t local_addr_bytes = WOLFSENTRY_BITS_TO_BYTES((size_t)rec->local_addr_len);
+    struct wolfsentry_event *event = NULL;
+    wolfsentry_errcode_t ret;
+
+    key->remote.sa_family = key->local.sa_family = rec->sa_family;
+    key->remote.sa_proto = key->local.sa_proto = rec->sa_proto;
+    key->remote.sa_port = rec->remote_port;
+    key->local.sa_port = rec->local_port;
+    key->remote.addr_len = rec->remote_addr_len;
+    key->local.addr_len = rec->local_addr_len;
+    key->remote.interface = rec->remote_interface;
+    key->local.interface = rec->local_interface;
+    memcpy(key->remote.addr, p + sizeof *rec, remote_addr_bytes);
+    memcpy(key->local.addr, p + sizeof *rec + remote_addr_bytes, local_addr_bytes);
+    key->label = rec->label_len ? (const char *)(p + sizeof *rec + remote_addr_bytes + local_addr_bytes) : NULL;
+    key->label_len = (int)rec->label_len;
+
+    /* a missing parent is an error, so that it isn't taken for a missing route. */
+    if (key->label) {
+        if ((ret = wolfsentry_event_get_reference(wolfsentry, key->label, key->label_len, &event)) < 0)
+            return ret;
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(wolfsentry, event, NULL /* action_results */));
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* an exact lookup in the dynamic table, with *route left null if it isn't there. */
+static wolfsentry_errcode_t wolfsentry_journal_record_lookup(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_journal_record *rec,
+    const struct wolfsentry_journal_key *key,
+    struct wolfsentry_route **route)
+{
+    wolfsentry_errcode_t ret = wolfsentry_route_get_reference(
+        wolfsentry,
+        &wolfsentry->routes_dynamic,
+        (const struct wolfsentry_sockaddr *)&key->remote,
+        (const struct wolfsentry_sockaddr *)&key->local,
+        (wolfsentry_route_flags_t)((rec->flags & WOLFSENTRY_ROUTE_IMMUTABLE_FLAGS) | WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS),
+        key->label,
+        key->label_len,
+        1 /* exact_p */,
+        NULL /* inexact_matches */,
+        route);
+    if (ret < 0) {
+        *route = NULL;
+        if (WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_NOT_FOUND))
+            WOLFSENTRY_RETURN_OK;
+    }
+    return ret;
+}
+
+/* the route goes in the batch with its times in place, so that it's inserted as of the change. */
+static wolfsentry_errcode_t wolfsentry_journal_batch_add(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_batch *batch,
+    const struct wolfsentry_journal_record *rec,
+    const struct wolfsentry_journal_key *key,
+    wolfsentry_time_t when,
+    wolfsentry_time_t penaltybox_when,
+    struct wolfsentry_route **new)
+{
+    wolfsentry_errcode_t ret;
+    if ((ret = wolfsentry_route_batch_add_static(
+             wolfsentry,
+             batch,
+             (const struct wolfsentry_sockaddr *)&key->remote,
+             (const struct wolfsentry_sockaddr *)&key->local,
+             (wolfsentry_route_flags_t)rec->flags,
+             key->label,
+             key->label_len)) < 0)
+        return ret;
+    *new = (struct wolfsentry_route *)batch->routes.tail;
+    (*new)->meta.insert_time = (*new)->meta.last_change_time = when;
+    (*new)->meta.last_penaltybox_time = penaltybox_when;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static void wolfsentry_journal_batch_unlink(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_batch *batch,
+    struct wolfsentry_route *route)
+{
+    if (route->header.prev)
+        route->header.prev->next = route->header.next;
+    else
+        batch->routes.head = route->header.next;
+    if (route->header.next)
+        route->header.next->prev = route->header.prev;
+    else
+        batch->routes.tail = route->header.prev;
+    --batch->routes.n_ents;
+    route->header.prev = route->header.next = NULL;
+    (void)wolfsentry_route_drop_reference(wolfsentry, route, NULL /* action_results */);
+}
+
+/* brings the mutable flags of a route in the table to those of the record. */
+static wolfsentry_errcode_t wolfsentry_journal_route_update(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route *route,
+    const struct wolfsentry_journal_record *rec,
+    wolfsentry_time_t when,
+    wolfsentry_time_t penaltybox_when,
+    int from_peer_p)
+{
+    wolfsentry_route_flags_t flags_before, flags_after;
+    wolfsentry_route_flags_t flags_to_set = (wolfsentry_route_flags_t)(rec->flags & WOLFSENTRY_ROUTE_MUTABLE_FLAGS & ~route->flags);
+    wolfsentry_route_flags_t flags_to_clear = (wolfsentry_route_flags_t)(route->flags & WOLFSENTRY_ROUTE_MUTABLE_FLAGS & ~rec->flags);
+    wolfsentry_errcode_t ret;
+
+    if ((ret = wolfsentry_route_update_flags_2(wolfsentry, route, flags_to_set, flags_to_clear, &flags_before, &flags_after, from_peer_p)) < 0)
+        return ret;
+    route->meta.last_change_time = when;
+    /* the box dates from the original change, not this one. */
+    if ((route->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED) && (penaltybox_when != 0)) {
+        route->meta.last_penaltybox_time = penaltybox_when;
+        wolfsentry_route_penaltybox_schedule(wolfsentry, route);
+    }
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_journal_replay_record(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    const struct wolfsentry_journal_record *rec,
+    const byte *p,
+    wolfsentry_time_t when,
+    wolfsentry_time_t penaltybox_when,
+    wolfsentry_action_res_t *action_results)
+{
+    struct wolfsentry_journal_key key;
+    struct wolfsentry_route *route;
+    wolfsentry_errcode_t ret;
+
+    if (((ret = wolfsentry_journal_record_key(wolfsentry, rec, p, &key)) < 0) ||
+        ((ret = wolfsentry_journal_record_lookup(wolfsentry, rec, &key, &route)) < 0))
+        return ret;
+
+    if (route == NULL) {
+        struct wolfsentry_route_batch *batch = NULL;
+        struct wolfsentry_route *new;
+
+        if (rec->type != WOLFSENTRY_JOURNAL_RECORD_INSERT)
+            WOLFSENTRY_RETURN_OK;
+
+        if ((ret = wolfsentry_route_batch_new(wolfsentry, &batch)) < 0)
+            return ret;
+        if ((ret = wolfsentry_journal_batch_add(wolfsentry, batch, rec, &key, when, penaltybox_when, &new)) >= 0)
+            ret = wolfsentry_route_batch_insert(wolfsentry, caller_arg, &wolfsentry->routes_dynamic, &batch, 1, 0 /* all_or_none_p */, action_results);
+        if (batch)
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_batch_free(wolfsentry, &batch));
+        return ret;
+    }
+
+    if (rec->type == WOLFSENTRY_JOURNAL_RECORD_DELETE)
+        ret = wolfsentry_route_delete_by_id(wolfsentry, caller_arg, route->header.id, NULL /* event_label */, 0 /* event_label_len */, action_results);
+    else
+        ret = wolfsentry_journal_route_update(wolfsentry, route, rec, when, penaltybox_when, 0 /* from_peer_p */);
+
+    WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_drop_reference(wolfsentry, route, NULL /* action_results */));
+
+    return ret;
+}
+
+wolfsentry_errcode_t wolfsentry_journal_replay(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    const void *journal,
+    size_t journal_size,
+    size_t *replayed_size,
+    wolfsentry_action_res_t *action_results)
+{
+    const byte *base = (const byte *)journal;
+    struct wolfsentry_journal_record rec;
+    size_t offset, good_size;
+    int64_t last_when = 0;
+    wolfsentry_time_t now;
+    wolfsentry_errcode_t ret;
+
+    if ((journal == NULL) || (replayed_size == NULL) || (action_results == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+
+    /* times are re-based on the last record, as a snapshot's are on its save. */
+    for (offset = 0; wolfsentry_journal_record_check(base + offset, journal_size - offset, &rec) == 0; offset += rec.size) {
+        if (rec.when > last_when)
+            last_when = rec.when;
+    }
+    good_size = offset;
+
+    if ((ret = WOLFSENTRY_GET_TIME(&now)) < 0)
+        return ret;
+
+    for (offset = 0; offset < good_size; offset += rec.size) {
+        wolfsentry_time_t when, penaltybox_when = 0;
+        wolfsentry_action_res_t record_action_results = WOLFSENTRY_ACTION_RES_NONE;
+
+        memcpy(&rec, base + offset, sizeof rec);
+        if (rec.type == WOLFSENTRY_JOURNAL_RECORD_GAP) {
+            offset += rec.size;
+            ret = WOLFSENTRY_ERROR_ENCODE(DATA_MISSING);
+            goto out;
+        }
+        if ((ret = wolfsentry_snapshot_time_rebase(wolfsentry, now, last_when - rec.when, &when)) < 0)
+            goto out;
+        if ((rec.penaltybox_when != 0) &&
+            ((ret = wolfsentry_snapshot_time_rebase(wolfsentry, now, last_when - rec.penaltybox_when, &penaltybox_when)) < 0))
+            goto out;
+        if ((ret = wolfsentry_journal_replay_record(wolfsentry, caller_arg, &rec, base + offset, when, penaltybox_when, &record_action_results)) < 0)
+            goto out;
+        *action_results |= record_action_results;
+    }
+
+    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+  out:
+
+    *replayed_size = offset;
+
+    return ret;
+}
+
+/* whether a change at when beats what's known of the route.  the last writer
+ * wins, and a tie goes the same way on every peer: to a delete, and otherwise
+ * to the greater mutable flags.  an insert or flag change with the same flags
+ * changes nothing either way.
+ */
+static int wolfsentry_journal_record_wins(struct wolfsentry_context *wolfsentry, const struct wolfsentry_journal_record *rec, wolfsentry_time_t when, const struct wolfsentry_route *route) {
+    wolfsentry_time_t diff = WOLFSENTRY_DIFF_TIME(when, route->meta.last_change_time);
+    if (diff != 0)
+        return diff > 0;
+    if (rec->type == WOLFSENTRY_JOURNAL_RECORD_DELETE)
+        return 1;
+    return (rec->flags & (uint32_t)WOLFSENTRY_ROUTE_MUTABLE_FLAGS) > ((uint32_t)route->flags & (uint32_t)WOLFSENTRY_ROUTE_MUTABLE_FLAGS);
+}
+
+/* records that miss the table are gathered into batches of this many routes. */
+#define WOLFSENTRY_JOURNAL_APPLY_BATCH_SIZE 64
+
+wolfsentry_errcode_t wolfsentry_journal_apply(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    const void *records,
+    size_t records_size,
+    size_t *applied_size,
+    wolfsentry_action_res_t *action_results)
+{
+    const byte *base = (const byte *)records;
+    struct wolfsentry_route_batch *batch = NULL;
+    struct wolfsentry_journal_record rec;
+    size_t offset, batch_offset = 0;
+    int gap_p = 0;
+    wolfsentry_errcode_t ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+    if ((records == NULL) || (applied_size == NULL) || (action_results == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+    if ((ret = wolfsentry_journal_tombstones_init(wolfsentry, 0 /* n_ents */)) < 0)
+        return ret;
+
+    for (offset = 0; wolfsentry_journal_record_check(base + offset, records_size - offset, &rec) == 0; offset += rec.size) {
+        wolfsentry_action_res_t record_action_results = WOLFSENTRY_ACTION_RES_NONE;
+        struct wolfsentry_journal_key key;
+        struct wolfsentry_route *route, *new;
+        struct wolfsentry_table_ent_header *i;
+        wolfsentry_time_t when, penaltybox_when = 0;
+
+        /* what came before the gap is still applied, and the caller resumes after it. */
+        if (rec.type == WOLFSENTRY_JOURNAL_RECORD_GAP) {
+            gap_p = 1;
+            break;
+        }
+
+        /* peers share a clock, so times are taken as they are. */
+        if (((ret = wolfsentry_journal_nsecs_to_time(wolfsentry, rec.when, &when)) < 0) ||
+            ((rec.penaltybox_when != 0) && ((ret = wolfsentry_journal_nsecs_to_time(wolfsentry, rec.penaltybox_when, &penaltybox_when)) < 0)) ||
+            ((ret = wolfsentry_journal_record_key(wolfsentry, &rec, base + offset, &key)) < 0) ||
+            ((ret = wolfsentry_journal_record_lookup(wolfsentry, &rec, &key, &route)) < 0))
+            break;
+
+        if (route) {
+            if (wolfsentry_journal_record_wins(wolfsentry, &rec, when, route)) {
+                if (rec.type == WOLFSENTRY_JOURNAL_RECORD_DELETE) {
+                    if ((ret = wolfsentry_route_delete_by_id_1(wolfsentry, caller_arg, route->header.id, NULL /* event_label */, 0 /* event_label_len */, 1 /* from_peer_p */, &record_action_results)) >= 0)
+                        wolfsentry_journal_tombstone_add(wolfsentry, &rec, base + offset);
+                } else
+                    ret = wolfsentry_journal_route_update(wolfsentry, route, &rec, when, penaltybox_when, 1 /* from_peer_p */);
+                *action_results |= record_action_results;
+            }
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_drop_reference(wolfsentry, route, NULL /* action_results */));
+            if (ret < 0)
+                break;
+            continue;
+        }
+
+        /* a route that isn't in the table yet may still be waiting in the
+         * batch, so the two are settled by the same rule before the new one
+         * is kept.  a flag change counts as an insert, so that a peer that
+         * missed the insert still gets the box -- unless the route was
+         * deleted here since.
+         */
+        if ((rec.type != WOLFSENTRY_JOURNAL_RECORD_DELETE) && wolfsentry_journal_tombstone_covers(wolfsentry, &rec, base + offset))
+            continue;
+        if (batch == NULL) {
+            if ((ret = wolfsentry_route_batch_new(wolfsentry, &batch)) < 0)
+                break;
+            batch_offset = offset;
+        }
+        if ((ret = wolfsentry_journal_batch_add(wolfsentry, batch, &rec, &key, when, penaltybox_when, &new)) < 0)
+            break;
+        for (i = batch->routes.head; i != &new->header; i = i->next) {
+            if (wolfsentry_route_key_cmp((struct wolfsentry_route *)i, new) == 0)
+                break;
+        }
+        if (i != &new->header) {
+            if (wolfsentry_journal_record_wins(wolfsentry, &rec, when, (const struct wolfsentry_route *)i)) {
+                wolfsentry_journal_batch_unlink(wolfsentry, batch, (struct wolfsentry_route *)i);
+                if (rec.type == WOLFSENTRY_JOURNAL_RECORD_DELETE) {
+                    wolfsentry_journal_batch_unlink(wolfsentry, batch, new);
+                    wolfsentry_journal_tombstone_add(wolfsentry, &rec, base + offset);
+                }
+            } else
+                wolfsentry_journal_batch_unlink(wolfsentry, batch, new);
+        } else if (rec.type == WOLFSENTRY_JOURNAL_RECORD_DELETE) {
+            wolfsentry_journal_batch_unlink(wolfsentry, batch, new);
+            wolfsentry_journal_tombstone_add(wolfsentry, &rec, base + offset);
+        }
+
+        if (batch->routes.n_ents >= WOLFSENTRY_JOURNAL_APPLY_BATCH_SIZE) {
+            ret = wolfsentry_route_batch_insert_1(wolfsentry, caller_arg, &wolfsentry->routes_dynamic, &batch, 1, 0 /* all_or_none_p */, 1 /* from_peer_p */, &record_action_results);
+            *action_results |= record_action_results;
+            batch = NULL;
+            /* what was applied before the batch failed is settled again on a retry. */
+            if (ret < 0) {
+                offset = batch_offset;
+                break;
+            }
+        }
+    }
+
+    if (batch) {
+        if (ret >= 0) {
+            wolfsentry_action_res_t batch_action_results = WOLFSENTRY_ACTION_RES_NONE;
+            ret = wolfsentry_route_batch_insert_1(wolfsentry, caller_arg, &wolfsentry->routes_dynamic, &batch, 1, 0 /* all_or_none_p */, 1 /* from_peer_p */, &batch_action_results);
+            *action_results |= batch_action_results;
+        } else
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_batch_free(wolfsentry, &batch));
+        if (ret < 0)
+            offset = batch_offset;
+    }
+
+    if (gap_p && (ret >= 0)) {
+        offset += rec.size;
+        ret = WOLFSENTRY_ERROR_ENCODE(DATA_MISSING);
+    }
+
+    *applied_size = offset;
+
+    return ret;
+}
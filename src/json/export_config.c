@@ -0,0 +1,617 @@
+/*
+ * export_config.c
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfSentry.
+ *
+ * wolfSentry is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSentry is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#include "../wolfsentry_internal.h"
+#include "wolfsentry/wolfsentry_json.h"
+
+#define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_JSON_EXPORT_CONFIG_C
+
+#include <stdarg.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* entries are rendered whole into a buffer of chunk_size bytes, with the
+ * context locked shared only while the buffer fills, and the buffer is passed
+ * to the sink with the lock released.  between chunks, a reference is held on
+ * the entry to resume from.  if it was deleted in the meantime, the walk
+ * resumes where its key would fall.
+ */
+
+struct json_export_state {
+    struct wolfsentry_context *wolfsentry;
+    wolfsentry_config_export_flags_t export_flags;
+    wolfsentry_config_export_sink_t sink;
+    void *sink_arg;
+    char *buf;
+    size_t buf_size; /* including room for the terminating null from vsnprintf(). */
+    size_t buf_len;
+    unsigned int event_pass; /* the depth of the events json_export_want_event() picks. */
+};
+
+typedef int (*json_export_want_fn_t)(const struct json_export_state *jes, const struct wolfsentry_table_ent_header *ent);
+typedef wolfsentry_errcode_t (*json_export_ent_fn_t)(struct json_export_state *jes, const struct wolfsentry_table_ent_header *ent, int first_p);
+
+static wolfsentry_errcode_t json_export_printf(struct json_export_state *jes, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static wolfsentry_errcode_t json_export_printf(struct json_export_state *jes, const char *fmt, ...) {
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(jes->buf + jes->buf_len, jes->buf_size - jes->buf_len, fmt, args);
+    va_end(args);
+    if (n < 0)
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+    if ((size_t)n >= jes->buf_size - jes->buf_len)
+        WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
+    jes->buf_len += (size_t)n;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t json_export_string(struct json_export_state *jes, const char *s, size_t s_len) {
+    static const char hex_digits[] = "0123456789abcdef";
+    size_t i;
+
+    if (jes->buf_size - jes->buf_len < s_len + 3)
+        WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
+    jes->buf[jes->buf_len++] = '"';
+    for (i = 0; i < s_len; ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if ((c == '"') || (c == '\\') || (c < 0x20)) {
+            if (jes->buf_size - jes->buf_len < (s_len - i) + 8)
+                WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
+            jes->buf[jes->buf_len++] = '\\';
+            if (c >= 0x20)
+                jes->buf[jes->buf_len++] = (char)c;
+            else {
+                memcpy(jes->buf + jes->buf_len, "u00", 3);
+                jes->buf_len += 3;
+                jes->buf[jes->buf_len++] = hex_digits[c >> 4];
+                jes->buf[jes->buf_len++] = hex_digits[c & 0xf];
+            }
+        } else
+            jes->buf[jes->buf_len++] = (char)c;
+    }
+    jes->buf[jes->buf_len++] = '"';
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t json_export_flush(struct json_export_state *jes) {
+    wolfsentry_errcode_t ret;
+    if (jes->buf_len == 0)
+        WOLFSENTRY_RETURN_OK;
+    ret = jes->sink(jes->sink_arg, jes->buf, jes->buf_len);
+    jes->buf_len = 0;
+    if (ret < 0)
+        return ret;
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* for the fixed text between sections, rendered with the lock released. */
+static wolfsentry_errcode_t json_export_text(struct json_export_state *jes, const char *text) {
+    wolfsentry_errcode_t ret = json_export_printf(jes, "%s", text);
+    if (ret < 0) {
+        if ((! WOLFSENTRY_ERROR_CODE_IS(ret, BUFFER_TOO_SMALL)) || (jes->buf_len == 0))
+            return ret;
+        if ((ret = json_export_flush(jes)) < 0)
+            return ret;
+        return json_export_printf(jes, "%s", text);
+    }
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t json_export_eventconfig(struct json_export_state *jes, const struct wolfsentry_eventconfig *config, const char *indent) {
+    long penaltybox_duration, rate_limit_period, derogatory_window, nsecs;
+    wolfsentry_errcode_t ret;
+
+    if (((ret = wolfsentry_interval_to_seconds(jes->wolfsentry, config->penaltybox_duration, &penaltybox_duration, &nsecs)) < 0) ||
+        ((ret = wolfsentry_interval_to_seconds(jes->wolfsentry, config->rate_limit_period, &rate_limit_period, &nsecs)) < 0) ||
+        ((ret = wolfsentry_interval_to_seconds(jes->wolfsentry, config->derogatory_window, &derogatory_window, &nsecs)) < 0))
+        return ret;
+
+    return json_export_printf(
+        jes,
+        "\n%s\"max-connection-count\" : %u,"
+        "\n%s\"max-subnet-connection-count\" : %u,"
+        "\n%s\"penalty-box-duration\" : %ld,"
+        "\n%s\"rate-limit-tokens\" : %u,"
+        "\n%s\"rate-limit-period\" : %ld,"
+        "\n%s\"rate-limit-burst\" : %u,"
+        "\n%s\"route-admission-threshold\" : %u,"
+        "\n%s\"derogatory-threshold-for-penaltybox\" : %u,"
+        "\n%s\"derogatory-window\" : %ld",
+        indent, (unsigned int)config->max_connection_count,
+        indent, (unsigned int)config->max_subnet_connection_count,
+        indent, penaltybox_duration,
+        indent, (unsigned int)config->rate_limit_tokens,
+        indent, rate_limit_period,
+        indent, (unsigned int)config->rate_limit_burst,
+        indent, (unsigned int)config->route_admission_threshold,
+        indent, (unsigned int)config->derogatory_threshold_for_penaltybox,
+        indent, derogatory_window);
+}
+
+static const char *json_export_policy(wolfsentry_action_res_t policy) {
+    if (policy == (WOLFSENTRY_ACTION_RES_ACCEPT|WOLFSENTRY_ACTION_RES_STOP))
+        return "accept";
+    else if (policy == (WOLFSENTRY_ACTION_RES_REJECT|WOLFSENTRY_ACTION_RES_STOP))
+        return "reject";
+    else
+        return NULL;
+}
+
+static wolfsentry_errcode_t json_export_defaultconfig(struct json_export_state *jes) {
+    const char *policy;
+    wolfsentry_errcode_t ret;
+
+    if ((ret = json_export_eventconfig(jes, &jes->wolfsentry->config.config, "        ")) < 0)
+        return ret;
+    if ((policy = json_export_policy(jes->wolfsentry->routes_static.default_policy)) != NULL) {
+        if ((ret = json_export_printf(jes, ",\n        \"default-policy-static\" : \"%s\"", policy)) < 0)
+            return ret;
+    }
+    if ((policy = json_export_policy(jes->wolfsentry->routes_dynamic.default_policy)) != NULL) {
+        if ((ret = json_export_printf(jes, ",\n        \"default-policy-dynamic\" : \"%s\"", policy)) < 0)
+            return ret;
+    }
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* events are inserted by the loader in the order given, and can only name
+ * subevents that are already in, so they go out in passes by depth: pass 0
+ * has the events with no subevents, and pass n the events whose deepest
+ * subevent went out in pass n - 1.  depths are counted no higher than limit,
+ * which also stops the walk on a subevent cycle.
+ */
+static unsigned int json_export_event_depth(const struct wolfsentry_event *event, unsigned int limit) {
+    const struct wolfsentry_event *subevents[4];
+    unsigned int depth = 0, sub_depth, i;
+
+    if (limit == 0)
+        return 0;
+    subevents[0] = event->insert_event;
+    subevents[1] = event->match_event;
+    subevents[2] = event->delete_event;
+    subevents[3] = event->release_event;
+    for (i = 0; i < sizeof subevents / sizeof subevents[0]; ++i) {
+        if (subevents[i] == NULL)
+            continue;
+        sub_depth = 1 + json_export_event_depth(subevents[i], limit - 1);
+        if (sub_depth > depth)
+            depth = sub_depth;
+    }
+    return depth;
+}
+
+static int json_export_want_event(const struct json_export_state *jes, const struct wolfsentry_table_ent_header *ent) {
+    return json_export_event_depth((const struct wolfsentry_event *)ent, jes->event_pass + 1) == jes->event_pass;
+}
+
+static wolfsentry_errcode_t json_export_subevent(struct json_export_state *jes, const char *key, const struct wolfsentry_event *subevent) {
+    wolfsentry_errcode_t ret;
+    if (subevent == NULL)
+        WOLFSENTRY_RETURN_OK;
+    if ((ret = json_export_printf(jes, ",\n            \"%s\" : ", key)) < 0)
+        return ret;
+    return json_export_string(jes, subevent->label, subevent->label_len);
+}
+
+static wolfsentry_errcode_t json_export_event(struct json_export_state *jes, const struct wolfsentry_table_ent_header *ent, int first_p) {
+    const struct wolfsentry_event *event = (const struct wolfsentry_event *)ent;
+    const struct wolfsentry_list_ent_header *i;
+    wolfsentry_errcode_t ret;
+
+    if (((ret = json_export_printf(jes, "%s\n        {\n            \"label\" : ", first_p ? "" : ",")) < 0) ||
+        ((ret = json_export_string(jes, event->label, event->label_len)) < 0))
+        return ret;
+    if (event->priority != 0) {
+        if ((ret = json_export_printf(jes, ",\n            \"priority\" : %u", (unsigned int)event->priority)) < 0)
+            return ret;
+    }
+    if (event->config) {
+        if (((ret = json_export_printf(jes, ",\n            \"config\" : {")) < 0) ||
+            ((ret = json_export_eventconfig(jes, &event->config->config, "                ")) < 0) ||
+            ((ret = json_export_printf(jes, "\n            }")) < 0))
+            return ret;
+    }
+    if (event->action_list.header.head) {
+        if ((ret = json_export_printf(jes, ",\n            \"actions\" : [ ")) < 0)
+            return ret;
+        for (i = event->action_list.header.head; i; i = i->next) {
+            const struct wolfsentry_action *action = ((const struct wolfsentry_action_list_ent *)i)->action;
+            if (((ret = json_export_string(jes, action->label, action->label_len)) < 0) ||
+                ((ret = json_export_printf(jes, i->next ? ", " : " ]")) < 0))
+                return ret;
+        }
+    }
+    if (((ret = json_export_subevent(jes, "insert-event", event->insert_event)) < 0) ||
+        ((ret = json_export_subevent(jes, "match-event", event->match_event)) < 0) ||
+        ((ret = json_export_subevent(jes, "delete-event", event->delete_event)) < 0) ||
+        ((ret = json_export_subevent(jes, "release-event", event->release_event)) < 0))
+        return ret;
+    return json_export_printf(jes, "\n        }");
+}
+
+static wolfsentry_errcode_t json_export_address(struct json_export_state *jes, wolfsentry_family_t sa_family, const byte *addr, wolfsentry_addr_bits_t addr_bits) {
+    byte addr_buf[16];
+    char fmt_buf[64];
+    unsigned int full_bits;
+    size_t addr_bytes = WOLFSENTRY_BITS_TO_BYTES((size_t)addr_bits);
+
+    if (sa_family == WOLFSENTRY_AF_INET)
+        full_bits = 32;
+    else if (sa_family == WOLFSENTRY_AF_INET6)
+        full_bits = 128;
+    else if (sa_family == WOLFSENTRY_AF_LINK)
+        full_bits = (addr_bits > 48) ? 64 : 48;
+    else
+        WOLFSENTRY_ERROR_RETURN(OP_NOT_SUPP_FOR_PROTO);
+
+    if (addr_bits > full_bits)
+        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+
+    /* routes keep only the prefix bytes, but the loader wants the whole address. */
+    memset(addr_buf, 0, sizeof addr_buf);
+    memcpy(addr_buf, addr, addr_bytes);
+
+    if (sa_family == WOLFSENTRY_AF_LINK) {
+        unsigned int i;
+        char *cp = fmt_buf;
+        for (i = 0; i < (full_bits >> 3); ++i) {
+            (void)snprintf(cp, sizeof fmt_buf - (size_t)(cp - fmt_buf), "%s%02x", i ? ":" : "", (unsigned int)addr_buf[i]);
+            cp += i ? 3 : 2;
+        }
+    } else if (inet_ntop(sa_family == WOLFSENTRY_AF_INET ? AF_INET : AF_INET6, addr_buf, fmt_buf, sizeof fmt_buf) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+
+    if (addr_bits == full_bits)
+        return json_export_printf(jes, "\n                \"address\" : \"%s\"", fmt_buf);
+    else
+        return json_export_printf(jes, "\n                \"address\" : \"%s\",\n                \"prefix-bits\" : %u", fmt_buf, (unsigned int)addr_bits);
+}
+
+static wolfsentry_errcode_t json_export_endpoint(struct json_export_state *jes, const struct wolfsentry_route *route, int local_p) {
+    const struct wolfsentry_route_endpoint *e = local_p ? &route->local : &route->remote;
+    int interface_p = ! WOLFSENTRY_CHECK_BITS(route->flags, local_p ? WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD : WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD);
+    int addr_p = ! WOLFSENTRY_CHECK_BITS(route->flags, local_p ? WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD : WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD);
+    int port_p = ! WOLFSENTRY_CHECK_BITS(route->flags, local_p ? WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD : WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD);
+    wolfsentry_errcode_t ret;
+
+    if ((! interface_p) && (! addr_p) && (! port_p))
+        WOLFSENTRY_RETURN_OK;
+
+    if ((ret = json_export_printf(jes, ",\n            \"%s\" : {", local_p ? "local" : "remote")) < 0)
+        return ret;
+    if (interface_p) {
+        if ((ret = json_export_printf(jes, "\n                \"interface\" : %u%s", (unsigned int)e->interface, (addr_p || port_p) ? "," : "")) < 0)
+            return ret;
+    }
+    if (addr_p) {
+        if ((ret = json_export_address(jes, route->sa_family, local_p ? WOLFSENTRY_ROUTE_LOCAL_ADDR(route) : WOLFSENTRY_ROUTE_REMOTE_ADDR(route), e->addr_len)) < 0)
+            return ret;
+        if (port_p && ((ret = json_export_printf(jes, ",")) < 0))
+            return ret;
+    }
+    if (port_p) {
+        if ((ret = json_export_printf(jes, "\n                \"port\" : %u", (unsigned int)e->sa_port)) < 0)
+            return ret;
+    }
+    return json_export_printf(jes, "\n            }");
+}
+
+static wolfsentry_errcode_t json_export_route_metadata(struct json_export_state *jes, const struct wolfsentry_route *route) {
+    return json_export_printf(
+        jes,
+        ",\n            \"metadata\" : {"
+        "\n                \"insert-time\" : %lld,"
+        "\n                \"last-hit-time\" : %lld,"
+        "\n                \"last-penaltybox-time\" : %lld,"
+        "\n                \"hit-count\" : %lu,"
+        "\n                \"connection-count\" : %u,"
+        "\n                \"derogatory-count\" : %u,"
+        "\n                \"commendable-count\" : %u"
+        "\n            }",
+        (long long)route->meta.insert_time,
+        (long long)route->meta.last_hit_time,
+        (long long)route->meta.last_penaltybox_time,
+        (unsigned long)route->header.hitcount,
+        (unsigned int)route->meta.connection_count,
+        (unsigned int)route->meta.derogatory_count,
+        (unsigned int)route->meta.commendable_count);
+}
+
+#define JSON_EXPORT_BOOL(flags, bit) (WOLFSENTRY_CHECK_BITS(flags, bit) ? "true" : "false")
+
+static wolfsentry_errcode_t json_export_route(struct json_export_state *jes, const struct wolfsentry_table_ent_header *ent, int first_p) {
+    const struct wolfsentry_route *route = (const struct wolfsentry_route *)ent;
+    wolfsentry_errcode_t ret;
+
+    if ((ret = json_export_printf(jes, "%s\n        {", first_p ? "" : ",")) < 0)
+        return ret;
+    if (route->parent_event && (! WOLFSENTRY_CHECK_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD))) {
+        if (((ret = json_export_printf(jes, "\n            \"parent-event\" : ")) < 0) ||
+            ((ret = json_export_string(jes, route->parent_event->label, route->parent_event->label_len)) < 0) ||
+            ((ret = json_export_printf(jes, ",")) < 0))
+            return ret;
+    }
+    if ((ret = json_export_printf(
+             jes,
+             "\n            \"tcplike-port-numbers\" : %s,"
+             "\n            \"direction-in\" : %s,"
+             "\n            \"direction-out\" : %s,"
+             "\n            \"penalty-boxed\" : %s,"
+             "\n            \"green-listed\" : %s,"
+             "\n            \"dont-count-hits\" : %s,"
+             "\n            \"dont-count-current-connections\" : %s",
+             JSON_EXPORT_BOOL(route->flags, WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS),
+             JSON_EXPORT_BOOL(route->flags, WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN),
+             JSON_EXPORT_BOOL(route->flags, WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT),
+             JSON_EXPORT_BOOL(route->flags, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED),
+             JSON_EXPORT_BOOL(route->flags, WOLFSENTRY_ROUTE_FLAG_GREENLISTED),
+             JSON_EXPORT_BOOL(route->flags, WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS),
+             JSON_EXPORT_BOOL(route->flags, WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_CURRENT_CONNECTIONS))) < 0)
+        return ret;
+    if (! WOLFSENTRY_CHECK_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD)) {
+#ifdef WOLFSENTRY_PROTOCOL_NAMES
+        const char *family_name = wolfsentry_family_ntop(route->sa_family);
+        if (family_name)
+            ret = json_export_printf(jes, ",\n            \"family\" : \"%s\"", family_name);
+        else
+#endif
+            ret = json_export_printf(jes, ",\n            \"family\" : %u", (unsigned int)route->sa_family);
+        if (ret < 0)
+            return ret;
+    }
+    if (! WOLFSENTRY_CHECK_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD)) {
+        if ((ret = json_export_printf(jes, ",\n            \"protocol\" : %u", (unsigned int)route->sa_proto)) < 0)
+            return ret;
+    }
+    if (((ret = json_export_endpoint(jes, route, 0 /* local_p */)) < 0) ||
+        ((ret = json_export_endpoint(jes, route, 1 /* local_p */)) < 0))
+        return ret;
+    if ((ent->parent_table == &jes->wolfsentry->routes_dynamic.header) ||
+        WOLFSENTRY_CHECK_BITS(jes->export_flags, WOLFSENTRY_CONFIG_EXPORT_FLAG_ROUTE_METADATA)) {
+        if ((ret = json_export_route_metadata(jes, route)) < 0)
+            return ret;
+    }
+    return json_export_printf(jes, "\n        }");
+}
+
+static wolfsentry_errcode_t json_export_action(struct json_export_state *jes, const struct wolfsentry_table_ent_header *ent, int first_p) {
+    const struct wolfsentry_action *action = (const struct wolfsentry_action *)ent;
+    wolfsentry_errcode_t ret;
+
+    if (((ret = json_export_printf(jes, "%s\n        {\n            \"label\" : ", first_p ? "" : ",")) < 0) ||
+        ((ret = json_export_string(jes, action->label, action->label_len)) < 0))
+        return ret;
+    return json_export_printf(jes, ",\n            \"flags\" : {\n                \"disabled\" : %s\n            }\n        }",
+                              JSON_EXPORT_BOOL(action->flags, WOLFSENTRY_ACTION_FLAG_DISABLED));
+}
+
+/* picks up the walk after (or, if inclusive_p, at) resume, then drops the
+ * reference held on it.  called with the lock held.
+ */
+static struct wolfsentry_table_ent_header *json_export_resume(
+    struct json_export_state *jes,
+    struct wolfsentry_table_header *table,
+    struct wolfsentry_table_ent_header *resume,
+    int inclusive_p)
+{
+    struct wolfsentry_table_ent_header *i;
+
+    if (resume->parent_table == table)
+        i = inclusive_p ? resume : resume->next;
+    else {
+        struct wolfsentry_cursor cursor;
+        int cursor_position;
+        (void)wolfsentry_table_cursor_seek(table, resume, &cursor, &cursor_position);
+        if (cursor_position < 0)
+            i = NULL;
+        else if ((cursor_position == 0) && (! inclusive_p))
+            i = cursor.point->next; /* a new entry with the same key as one already exported. */
+        else
+            i = cursor.point;
+    }
+    WOLFSENTRY_WARN_ON_FAILURE(table->free_fn(jes->wolfsentry, resume, NULL /* action_results */));
+    return i;
+}
+
+static wolfsentry_errcode_t json_export_table(
+    struct json_export_state *jes,
+    struct wolfsentry_table_header *table,
+    json_export_want_fn_t want_ent,
+    json_export_ent_fn_t export_ent,
+    int *n_exported)
+{
+    struct wolfsentry_context *wolfsentry = jes->wolfsentry;
+    struct wolfsentry_table_ent_header *resume = NULL, *i;
+    int resume_inclusive_p = 0;
+    wolfsentry_errcode_t ret;
+
+    for (;;) {
+        if ((ret = wolfsentry_context_lock_shared(wolfsentry)) < 0) {
+            if (resume)
+                WOLFSENTRY_WARN_ON_FAILURE(table->free_fn(wolfsentry, resume, NULL /* action_results */));
+            return ret;
+        }
+
+        if (resume) {
+            i = json_export_resume(jes, table, resume, resume_inclusive_p);
+            resume = NULL;
+        } else
+            i = table->head;
+
+        for (; i; i = i->next) {
+            size_t ent_start = jes->buf_len;
+            if (want_ent && (! want_ent(jes, i)))
+                continue;
+            if ((ret = export_ent(jes, i, *n_exported == 0)) < 0) {
+                jes->buf_len = ent_start;
+                /* a full buffer ends the chunk, unless the entry wouldn't fit even alone. */
+                if ((! WOLFSENTRY_ERROR_CODE_IS(ret, BUFFER_TOO_SMALL)) || (ent_start == 0)) {
+                    WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_unlock(wolfsentry));
+                    return ret;
+                }
+                WOLFSENTRY_REFCOUNT_INCREMENT(i->refcount);
+                resume = i;
+                resume_inclusive_p = 1;
+                break;
+            }
+            ++*n_exported;
+        }
+
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_unlock(wolfsentry));
+
+        if (resume == NULL)
+            WOLFSENTRY_RETURN_OK;
+
+        if ((ret = json_export_flush(jes)) < 0) {
+            if ((wolfsentry_context_lock_shared(wolfsentry)) >= 0) {
+                WOLFSENTRY_WARN_ON_FAILURE(table->free_fn(wolfsentry, resume, NULL /* action_results */));
+                WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_unlock(wolfsentry));
+            }
+            return ret;
+        }
+    }
+}
+
+static wolfsentry_errcode_t json_export_section(
+    struct json_export_state *jes,
+    const char *key,
+    struct wolfsentry_table_header *table,
+    json_export_ent_fn_t export_ent)
+{
+    char open[64];
+    int n_exported = 0;
+    wolfsentry_errcode_t ret;
+
+    (void)snprintf(open, sizeof open, ",\n    \"%s\" : [", key);
+    if ((ret = json_export_text(jes, open)) < 0)
+        return ret;
+    if ((ret = json_export_table(jes, table, NULL, export_ent, &n_exported)) < 0)
+        return ret;
+    return json_export_text(jes, "\n    ]");
+}
+
+/* the lock is dropped between chunks, so whether another pass is needed is
+ * checked afresh after each one.
+ */
+static wolfsentry_errcode_t json_export_events_section(struct json_export_state *jes) {
+    struct wolfsentry_context *wolfsentry = jes->wolfsentry;
+    struct wolfsentry_table_ent_header *i;
+    int n_exported = 0, deeper_p;
+    wolfsentry_errcode_t ret;
+
+    if ((ret = json_export_text(jes, ",\n    \"events-insert\" : [")) < 0)
+        return ret;
+    for (jes->event_pass = 0; ; ++jes->event_pass) {
+        if ((ret = json_export_table(jes, &wolfsentry->events.header, json_export_want_event, json_export_event, &n_exported)) < 0)
+            return ret;
+        if ((ret = wolfsentry_context_lock_shared(wolfsentry)) < 0)
+            return ret;
+        deeper_p = 0;
+        for (i = wolfsentry->events.header.head; i; i = i->next) {
+            if (json_export_event_depth((const struct wolfsentry_event *)i, jes->event_pass + 1) > jes->event_pass) {
+                deeper_p = 1;
+                break;
+            }
+        }
+        /* a cycle never bottoms out, but can't be deeper than the table is long. */
+        if (jes->event_pass >= (unsigned int)wolfsentry->events.header.n_ents)
+            deeper_p = 0;
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_unlock(wolfsentry));
+        if (! deeper_p)
+            break;
+    }
+    return json_export_text(jes, "\n    ]");
+}
+
+wolfsentry_errcode_t wolfsentry_config_json_export(
+    struct wolfsentry_context *wolfsentry,
+    wolfsentry_config_export_flags_t export_flags,
+    size_t chunk_size,
+    wolfsentry_config_export_sink_t sink,
+    void *sink_arg)
+{
+    struct json_export_state jes;
+    wolfsentry_errcode_t ret;
+
+    if (sink == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (chunk_size == 0)
+        chunk_size = WOLFSENTRY_CONFIG_EXPORT_CHUNK_SIZE_DEFAULT;
+
+    memset(&jes, 0, sizeof jes);
+    jes.wolfsentry = wolfsentry;
+    jes.export_flags = export_flags;
+    jes.sink = sink;
+    jes.sink_arg = sink_arg;
+    jes.buf_size = chunk_size + 1;
+    if ((jes.buf = (char *)WOLFSENTRY_MALLOC(jes.buf_size)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+
+    if ((ret = json_export_text(&jes, "{\n    \"wolfsentry-config-version\" : 1,\n    \"config-update\" : {")) < 0)
+        goto out;
+
+    /* the top config is small, but is rendered as a unit, so may need a fresh buffer. */
+    for (;;) {
+        size_t start = jes.buf_len;
+        if ((ret = wolfsentry_context_lock_shared(wolfsentry)) < 0)
+            goto out;
+        ret = json_export_defaultconfig(&jes);
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_unlock(wolfsentry));
+        if (ret >= 0)
+            break;
+        jes.buf_len = start;
+        if ((! WOLFSENTRY_ERROR_CODE_IS(ret, BUFFER_TOO_SMALL)) || (start == 0))
+            goto out;
+        if ((ret = json_export_flush(&jes)) < 0)
+            goto out;
+    }
+    if ((ret = json_export_text(&jes, "\n    }")) < 0)
+        goto out;
+
+    if ((ret = json_export_events_section(&jes)) < 0)
+        goto out;
+    if ((ret = json_export_section(&jes, "static-routes-insert", &wolfsentry->routes_static.header, json_export_route)) < 0)
+        goto out;
+    if (WOLFSENTRY_CHECK_BITS(export_flags, WOLFSENTRY_CONFIG_EXPORT_FLAG_DYNAMIC_ROUTES)) {
+        if ((ret = json_export_section(&jes, "dynamic-routes", &wolfsentry->routes_dynamic.header, json_export_route)) < 0)
+            goto out;
+    }
+    if (WOLFSENTRY_CHECK_BITS(export_flags, WOLFSENTRY_CONFIG_EXPORT_FLAG_ACTIONS)) {
+        if ((ret = json_export_section(&jes, "actions-update", &wolfsentry->actions.header, json_export_action)) < 0)
+            goto out;
+    }
+
+    if ((ret = json_export_text(&jes, "\n}\n")) < 0)
+        goto out;
+    ret = json_export_flush(&jes);
+
+  out:
+
+    WOLFSENTRY_FREE(jes.buf);
+    if (ret < 0)
+        return ret;
+    WOLFSENTRY_RETURN_OK;
+}
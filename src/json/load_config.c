@@ -37,10 +37,31 @@
                        ((MAX_MAC_ADDR_BITS > MAX_IPV4_ADDR_BITS) ? \
                         MAX_MAC_ADDR_BITS : MAX_IPV4_ADDR_BITS))
 
+/* keys run to 35 bytes ("derogatory-threshold-for-penaltybox"), and an IPv6
+ * address to 45, so neither is bounded by WOLFSENTRY_MAX_LABEL_BYTES.  labels
+ * are checked against it where they're used.
+ */
+#define MAX_KEY_BYTES 48
+#define MAX_STRING_BYTES (WOLFSENTRY_MAX_LABEL_BYTES > 48 ? WOLFSENTRY_MAX_LABEL_BYTES : 48)
+
 #ifdef WOLFSENTRY_PROTOCOL_NAMES
 #include <netdb.h>
 #endif
 
+#include <errno.h>
+
+#ifndef WOLFSENTRY_NO_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(WOLFSENTRY_THREADSAFE) && !defined(FREERTOS) && !defined(_WIN32)
+#define WOLFSENTRY_JSON_PARALLEL_THREADS
+#include <pthread.h>
+#endif
+
 #ifndef __unused
 #define __unused __attribute__((unused))
 #endif
@@ -58,7 +79,14 @@
 
 "config-update" : {
     "max-connection-count" : number,
+    "max-subnet-connection-count" : number,
     "penaltybox-duration" : number|string, // allow suffixes s,m,h,d
+    "rate-limit-tokens" : number,
+    "rate-limit-period" : number|string, // allow suffixes s,m,h,d
+    "rate-limit-burst" : number,
+    "route-admission-threshold" : number,
+    "derogatory-threshold-for-penaltybox" : number,
+    "derogatory-window" : number|string, // allow suffixes s,m,h,d
     "default-policy" : "accept" | "reject"
 },
 
@@ -68,12 +96,20 @@
     "label" : string,
     "config" : {
         "max-connection-count" : number
+        "max-subnet-connection-count" : number
         "penalty-box-duration" : number|string // allow suffixes s,m,h,d
+        "rate-limit-tokens" : number
+        "rate-limit-period" : number|string // allow suffixes s,m,h,d
+        "rate-limit-burst" : number
+        "route-admission-threshold" : number
+        "derogatory-threshold-for-penaltybox" : number
+        "derogatory-window" : number|string // allow suffixes s,m,h,d
     }
     "actions" : [ string ... ],
     "insert-event" : string,
     "match-event" : string,
-    "delete-event" : string
+    "delete-event" : string,
+    "release-event" : string
 
 }
 ],
@@ -119,6 +155,183 @@
 */
 
 
+enum json_key {
+    K_UNKNOWN = 0,
+    K_WOLFSENTRY_CONFIG_VERSION,
+    K_CONFIG_UPDATE,
+    K_EVENTS_INSERT,
+    K_STATIC_ROUTES_INSERT,
+    K_ACTIONS_UPDATE,
+    K_MAX_CONNECTION_COUNT,
+    K_MAX_SUBNET_CONNECTION_COUNT,
+    K_PENALTY_BOX_DURATION,
+    K_RATE_LIMIT_TOKENS,
+    K_RATE_LIMIT_PERIOD,
+    K_RATE_LIMIT_BURST,
+    K_ROUTE_ADMISSION_THRESHOLD,
+    K_DEROGATORY_THRESHOLD_FOR_PENALTYBOX,
+    K_DEROGATORY_WINDOW,
+    K_DEFAULT_POLICY_STATIC,
+    K_DEFAULT_POLICY_DYNAMIC,
+    K_PORT,
+    K_ADDRESS,
+    K_PREFIX_BITS,
+    K_INTERFACE,
+    K_REMOTE,
+    K_LOCAL,
+    K_PARENT_EVENT,
+    K_FAMILY,
+    K_PROTOCOL,
+    K_TCPLIKE_PORT_NUMBERS,
+    K_DIRECTION_IN,
+    K_DIRECTION_OUT,
+    K_PENALTY_BOXED,
+    K_GREEN_LISTED,
+    K_DONT_COUNT_HITS,
+    K_DONT_COUNT_CURRENT_CONNECTIONS,
+    K_LABEL,
+    K_PRIORITY,
+    K_CONFIG,
+    K_INSERT_EVENT,
+    K_MATCH_EVENT,
+    K_DELETE_EVENT,
+    K_RELEASE_EVENT,
+    K_ACTIONS,
+};
+
+/* keys are classified once, as they're parsed, rather than strcmp()ed at each
+ * value.  switching on the length leaves at most a few candidates to compare.
+ */
+static enum json_key json_key_lookup(const char *key, size_t key_len) {
+#define KEY_IS(k) (! memcmp(key, k, sizeof k - 1))
+    switch (key_len) {
+    case 4:
+        if (KEY_IS("port"))
+            return K_PORT;
+        break;
+    case 5:
+        if (KEY_IS("label"))
+            return K_LABEL;
+        if (KEY_IS("local"))
+            return K_LOCAL;
+        break;
+    case 6:
+        if (KEY_IS("config"))
+            return K_CONFIG;
+        if (KEY_IS("family"))
+            return K_FAMILY;
+        if (KEY_IS("remote"))
+            return K_REMOTE;
+        break;
+    case 7:
+        if (KEY_IS("actions"))
+            return K_ACTIONS;
+        if (KEY_IS("address"))
+            return K_ADDRESS;
+        break;
+    case 8:
+        if (KEY_IS("priority"))
+            return K_PRIORITY;
+        if (KEY_IS("protocol"))
+            return K_PROTOCOL;
+        break;
+    case 9:
+        if (KEY_IS("interface"))
+            return K_INTERFACE;
+        break;
+    case 11:
+        if (KEY_IS("match-event"))
+            return K_MATCH_EVENT;
+        if (KEY_IS("prefix-bits"))
+            return K_PREFIX_BITS;
+        break;
+    case 12:
+        if (KEY_IS("delete-event"))
+            return K_DELETE_EVENT;
+        if (KEY_IS("direction-in"))
+            return K_DIRECTION_IN;
+        if (KEY_IS("green-listed"))
+            return K_GREEN_LISTED;
+        if (KEY_IS("insert-event"))
+            return K_INSERT_EVENT;
+        if (KEY_IS("parent-event"))
+            return K_PARENT_EVENT;
+        break;
+    case 13:
+        if (KEY_IS("config-update"))
+            return K_CONFIG_UPDATE;
+        if (KEY_IS("direction-out"))
+            return K_DIRECTION_OUT;
+        if (KEY_IS("events-insert"))
+            return K_EVENTS_INSERT;
+        if (KEY_IS("penalty-boxed"))
+            return K_PENALTY_BOXED;
+        if (KEY_IS("release-event"))
+            return K_RELEASE_EVENT;
+        break;
+    case 14:
+        if (KEY_IS("actions-update"))
+            return K_ACTIONS_UPDATE;
+        break;
+    case 15:
+        if (KEY_IS("dont-count-hits"))
+            return K_DONT_COUNT_HITS;
+        break;
+    case 16:
+        if (KEY_IS("rate-limit-burst"))
+            return K_RATE_LIMIT_BURST;
+        break;
+    case 17:
+        if (KEY_IS("derogatory-window"))
+            return K_DEROGATORY_WINDOW;
+        if (KEY_IS("rate-limit-period"))
+            return K_RATE_LIMIT_PERIOD;
+        if (KEY_IS("rate-limit-tokens"))
+            return K_RATE_LIMIT_TOKENS;
+        break;
+    case 20:
+        if (KEY_IS("max-connection-count"))
+            return K_MAX_CONNECTION_COUNT;
+        if (KEY_IS("penalty-box-duration"))
+            return K_PENALTY_BOX_DURATION;
+        if (KEY_IS("static-routes-insert"))
+            return K_STATIC_ROUTES_INSERT;
+        if (KEY_IS("tcplike-port-numbers"))
+            return K_TCPLIKE_PORT_NUMBERS;
+        break;
+    case 21:
+        if (KEY_IS("default-policy-static"))
+            return K_DEFAULT_POLICY_STATIC;
+        break;
+    case 22:
+        if (KEY_IS("default-policy-dynamic"))
+            return K_DEFAULT_POLICY_DYNAMIC;
+        break;
+    case 25:
+        if (KEY_IS("route-admission-threshold"))
+            return K_ROUTE_ADMISSION_THRESHOLD;
+        if (KEY_IS("wolfsentry-config-version"))
+            return K_WOLFSENTRY_CONFIG_VERSION;
+        break;
+    case 27:
+        if (KEY_IS("max-subnet-connection-count"))
+            return K_MAX_SUBNET_CONNECTION_COUNT;
+        break;
+    case 30:
+        if (KEY_IS("dont-count-current-connections"))
+            return K_DONT_COUNT_CURRENT_CONNECTIONS;
+        break;
+    case 35:
+        if (KEY_IS("derogatory-threshold-for-penaltybox"))
+            return K_DEROGATORY_THRESHOLD_FOR_PENALTYBOX;
+        break;
+    }
+#undef KEY_IS
+    return K_UNKNOWN;
+}
+
+struct json_validate_state;
+
 struct wolfsentry_json_process_state {
     uint32_t config_version;
 
@@ -131,7 +344,7 @@ struct wolfsentry_json_process_state {
     enum { S_U_C_NONE = 0, S_U_C_EVENTCONFIG, S_U_C_FLAGS, S_U_C_ACTION_LIST, S_U_C_REMOTE_ENDPOINT, S_U_C_LOCAL_ENDPOINT, S_U_C_ROUTE_METADATA } section_under_construction;
 
     int cur_depth;
-    char cur_keyname[WOLFSENTRY_MAX_LABEL_BYTES];
+    enum json_key cur_key;
     int cur_keydepth;
     JSON_INPUT_POS key_pos;
 
@@ -146,11 +359,14 @@ struct wolfsentry_json_process_state {
     JSON_PARSER parser;
     struct wolfsentry_context *wolfsentry_actual, *wolfsentry;
 
+    struct wolfsentry_route_batch *route_batch; /* if set, routes are collected here rather than inserted. */
+
+    struct json_validate_state *validate; /* if set (LOAD_FLAG_VALIDATE_ONLY), nothing is inserted, only checked. */
+
     union {
         struct {
             char event_label[WOLFSENTRY_MAX_LABEL_BYTES];
             int event_label_len;
-            void *caller_arg; /* xxx */
             WOLFSENTRY_SOCKADDR(MAX_ADDR_BITS) remote;
             WOLFSENTRY_SOCKADDR(MAX_ADDR_BITS) local;
             wolfsentry_route_flags_t flags;
@@ -306,10 +522,382 @@ static wolfsentry_errcode_t convert_default_policy(JSON_TYPE type, const char *d
     return 0;
 }
 
+/* validate-only loads (WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY) run the
+ * usual parse, but in place of each insert, check what the insert would, against
+ * compact indexes of the events and route keys seen so far.  no context is
+ * cloned, and no events or routes are allocated.  with NO_FLUSH, references
+ * and duplicates are also looked up in the live context, read-only.
+ */
+
+enum {
+    JSON_VALIDATE_EVENT_CONFIGED = 1U << 0U,
+    JSON_VALIDATE_EVENT_PARENT   = 1U << 1U,
+    JSON_VALIDATE_EVENT_SUBEVENT = 1U << 2U
+};
+
+struct json_validate_event {
+    byte label_len;
+    byte flags;
+    char label[WOLFSENTRY_MAX_LABEL_BYTES];
+};
+
+/* a route key as wolfsentry_route_key_cmp() sees it, with the parent event by
+ * index.  only the address bytes in use are stored.
+ */
+struct json_validate_route_key {
+    wolfsentry_route_flags_t flags;
+    uint32_t parent_event; /* index + 1, or 0 for none. */
+    wolfsentry_family_t sa_family;
+    wolfsentry_proto_t sa_proto;
+    wolfsentry_port_t remote_port;
+    wolfsentry_port_t local_port;
+    wolfsentry_addr_bits_t remote_addr_len;
+    wolfsentry_addr_bits_t local_addr_len;
+    byte remote_interface;
+    byte local_interface;
+    byte addrs[2 * (MAX_ADDR_BITS / BITS_PER_BYTE)];
+};
+
+/* open addressing, with the hash kept in the slot so that growing doesn't
+ * touch the entries.  ref is an index or an offset, plus one.
+ */
+struct json_validate_slot {
+    uint32_t hash;
+    uint32_t ref;
+};
+
+struct json_validate_state {
+    struct json_validate_event *events;
+    uint32_t n_events, events_size;
+    struct json_validate_slot *event_slots;
+    uint32_t event_slots_size;
+
+    byte *route_keys;
+    size_t route_keys_len, route_keys_size;
+    struct json_validate_slot *route_slots;
+    uint32_t n_route_keys, route_slots_size;
+
+    uint32_t cur_event; /* index + 1 of the event under construction. */
+};
+
+static uint32_t json_validate_hash(const void *buf, size_t len) {
+    const byte *p = (const byte *)buf;
+    uint32_t hash = 2166136261U;
+    while (len-- > 0)
+        hash = (hash ^ *p++) * 16777619U;
+    return hash;
+}
+
+static wolfsentry_errcode_t json_validate_init(struct wolfsentry_json_process_state *jps) {
+    if ((jps->validate = (struct json_validate_state *)wolfsentry_malloc(jps->wolfsentry_actual, sizeof *jps->validate)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(jps->validate, 0, sizeof *jps->validate);
+    WOLFSENTRY_RETURN_OK;
+}
+
+static void json_validate_free(struct wolfsentry_json_process_state *jps) {
+    struct json_validate_state *vs = jps->validate;
+    if (vs == NULL)
+        return;
+    if (vs->events)
+        wolfsentry_free(jps->wolfsentry_actual, vs->events);
+    if (vs->event_slots)
+        wolfsentry_free(jps->wolfsentry_actual, vs->event_slots);
+    if (vs->route_keys)
+        wolfsentry_free(jps->wolfsentry_actual, vs->route_keys);
+    if (vs->route_slots)
+        wolfsentry_free(jps->wolfsentry_actual, vs->route_slots);
+    wolfsentry_free(jps->wolfsentry_actual, vs);
+    jps->validate = NULL;
+}
+
+/* keeps the slots at most half full. */
+static wolfsentry_errcode_t json_validate_slots_reserve(struct wolfsentry_json_process_state *jps, struct json_validate_slot **slots, uint32_t *slots_size, uint32_t n_ents) {
+    struct json_validate_slot *new_slots;
+    uint32_t new_size, i;
+
+    if ((size_t)(n_ents + 1U) * 2U <= *slots_size)
+        WOLFSENTRY_RETURN_OK;
+    new_size = *slots_size ? *slots_size * 2U : 64U;
+    if (new_size <= *slots_size)
+        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+    if ((new_slots = (struct json_validate_slot *)wolfsentry_malloc(jps->wolfsentry_actual, sizeof *new_slots * new_size)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(new_slots, 0, sizeof *new_slots * new_size);
+    for (i = 0; i < *slots_size; ++i) {
+        uint32_t j;
+        if ((*slots)[i].ref == 0)
+            continue;
+        for (j = (*slots)[i].hash & (new_size - 1U); new_slots[j].ref != 0; j = (j + 1U) & (new_size - 1U))
+            ;
+        new_slots[j] = (*slots)[i];
+    }
+    if (*slots)
+        wolfsentry_free(jps->wolfsentry_actual, *slots);
+    *slots = new_slots;
+    *slots_size = new_size;
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* returns the event, or null with *slot set to the free slot for it. */
+static struct json_validate_event *json_validate_event_find(struct json_validate_state *vs, const char *label, int label_len, uint32_t hash, uint32_t *slot) {
+    uint32_t i;
+
+    for (i = hash & (vs->event_slots_size - 1U); vs->event_slots[i].ref != 0; i = (i + 1U) & (vs->event_slots_size - 1U)) {
+        struct json_validate_event *event = &vs->events[vs->event_slots[i].ref - 1U];
+        if ((vs->event_slots[i].hash == hash) && (event->label_len == label_len) && (memcmp(event->label, label, (size_t)label_len) == 0))
+            return event;
+    }
+    *slot = i;
+    return NULL;
+}
+
+static wolfsentry_errcode_t json_validate_event_add(struct wolfsentry_json_process_state *jps, const char *label, int label_len, byte flags, uint32_t *index) {
+    struct json_validate_state *vs = jps->validate;
+    uint32_t hash = json_validate_hash(label, (size_t)label_len), slot = 0;
+    wolfsentry_errcode_t ret;
+
+    if ((ret = json_validate_slots_reserve(jps, &vs->event_slots, &vs->event_slots_size, vs->n_events)) < 0)
+        return ret;
+    if (vs->n_events == vs->events_size) {
+        uint32_t new_size = vs->events_size ? vs->events_size * 2U : 16U;
+        struct json_validate_event *new_events = (struct json_validate_event *)wolfsentry_realloc(jps->wolfsentry_actual, vs->events, sizeof *new_events * new_size);
+        if (new_events == NULL)
+            WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+        vs->events = new_events;
+        vs->events_size = new_size;
+    }
+    (void)json_validate_event_find(vs, label, label_len, hash, &slot);
+    vs->events[vs->n_events].label_len = (byte)label_len;
+    vs->events[vs->n_events].flags = flags;
+    memcpy(vs->events[vs->n_events].label, label, (size_t)label_len);
+    *index = vs->n_events++;
+    vs->event_slots[slot].hash = hash;
+    vs->event_slots[slot].ref = vs->n_events;
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* finds an event from this config, or with NO_FLUSH, from the live context,
+ * which is then indexed too.
+ */
+static wolfsentry_errcode_t json_validate_event_get(struct wolfsentry_json_process_state *jps, const char *label, int label_len, uint32_t *index) {
+    struct json_validate_state *vs = jps->validate;
+    struct json_validate_event *event;
+    struct wolfsentry_event *live_event;
+    wolfsentry_event_flags_t live_flags;
+    uint32_t slot;
+    byte flags = 0;
+    wolfsentry_errcode_t ret;
+
+    if (label_len == 0)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (label_len > WOLFSENTRY_MAX_LABEL_BYTES)
+        WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
+
+    if ((vs->n_events > 0) &&
+        ((event = json_validate_event_find(vs, label, label_len, json_validate_hash(label, (size_t)label_len), &slot)) != NULL)) {
+        *index = (uint32_t)(event - vs->events);
+        WOLFSENTRY_RETURN_OK;
+    }
+
+    if (! WOLFSENTRY_CHECK_BITS(jps->load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_NO_FLUSH))
+        WOLFSENTRY_ERROR_RETURN(ITEM_NOT_FOUND);
+    if ((ret = wolfsentry_event_get_reference(jps->wolfsentry_actual, label, label_len, &live_event)) < 0)
+        return ret;
+    live_flags = wolfsentry_event_get_flags(live_event);
+    (void)wolfsentry_event_drop_reference(jps->wolfsentry_actual, live_event, NULL /* action_results */);
+    if (WOLFSENTRY_CHECK_BITS(live_flags, WOLFSENTRY_EVENT_FLAG_IS_PARENT_EVENT))
+        flags |= JSON_VALIDATE_EVENT_PARENT;
+    if (WOLFSENTRY_CHECK_BITS(live_flags, WOLFSENTRY_EVENT_FLAG_IS_SUBEVENT))
+        flags |= JSON_VALIDATE_EVENT_SUBEVENT;
+    return json_validate_event_add(jps, label, label_len, flags, index);
+}
+
+static wolfsentry_errcode_t json_validate_event_insert(struct wolfsentry_json_process_state *jps) {
+    struct json_validate_state *vs = jps->validate;
+    uint32_t index;
+    wolfsentry_errcode_t ret;
+
+    ret = json_validate_event_get(jps, jps->o_u_c.event.label, jps->o_u_c.event.label_len, &index);
+    if (ret >= 0)
+        WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_NOT_FOUND))
+        return ret;
+    if ((ret = json_validate_event_add(jps, jps->o_u_c.event.label, jps->o_u_c.event.label_len,
+                                       jps->o_u_c.event.configed ? JSON_VALIDATE_EVENT_CONFIGED : 0, &index)) < 0)
+        return ret;
+    vs->cur_event = index + 1U;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t json_validate_event_update_config(struct wolfsentry_json_process_state *jps) {
+    struct json_validate_event *event = &jps->validate->events[jps->validate->cur_event - 1U];
+
+    if (event->flags & JSON_VALIDATE_EVENT_SUBEVENT)
+        WOLFSENTRY_ERROR_RETURN(INCOMPATIBLE_STATE);
+    event->flags |= JSON_VALIDATE_EVENT_CONFIGED;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t json_validate_event_set_subevent(struct wolfsentry_json_process_state *jps, const char *label, int label_len) {
+    struct json_validate_state *vs = jps->validate;
+    uint32_t index;
+    wolfsentry_errcode_t ret;
+
+    if (vs->events[vs->cur_event - 1U].flags & JSON_VALIDATE_EVENT_SUBEVENT)
+        WOLFSENTRY_ERROR_RETURN(INCOMPATIBLE_STATE);
+    if ((ret = json_validate_event_get(jps, label, label_len, &index)) < 0)
+        return ret;
+    if (vs->events[index].flags & (JSON_VALIDATE_EVENT_PARENT | JSON_VALIDATE_EVENT_CONFIGED))
+        WOLFSENTRY_ERROR_RETURN(INCOMPATIBLE_STATE);
+    vs->events[index].flags |= JSON_VALIDATE_EVENT_SUBEVENT;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t json_validate_event_action_append(struct wolfsentry_json_process_state *jps, const char *label, int label_len) {
+    struct wolfsentry_action *action;
+    wolfsentry_errcode_t ret;
+
+    if ((ret = wolfsentry_action_get_reference(jps->wolfsentry_actual, label, label_len, &action)) < 0)
+        return ret;
+    (void)wolfsentry_action_drop_reference(jps->wolfsentry_actual, action, NULL /* action_results */);
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* the address bytes in use, with the pad bits cleared as wolfsentry_route_init()
+ * clears them.
+ */
+static size_t json_validate_route_key_addr(byte *out, const struct wolfsentry_sockaddr *sa) {
+    size_t addr_bytes = WOLFSENTRY_BITS_TO_BYTES((size_t)sa->addr_len);
+    int left_over_bits = sa->addr_len % BITS_PER_BYTE;
+    memcpy(out, sa->addr, addr_bytes);
+    if (left_over_bits)
+        out[addr_bytes - 1] = (byte)(out[addr_bytes - 1] & (0xffu << (BITS_PER_BYTE - left_over_bits)));
+    return addr_bytes;
+}
+
+/* the checks of wolfsentry_route_insert_static(), in the same order. */
+static wolfsentry_errcode_t json_validate_route_insert(struct wolfsentry_json_process_state *jps) {
+    struct json_validate_state *vs = jps->validate;
+    const struct wolfsentry_sockaddr *remote = (const struct wolfsentry_sockaddr *)&jps->o_u_c.route.remote;
+    const struct wolfsentry_sockaddr *local = (const struct wolfsentry_sockaddr *)&jps->o_u_c.route.local;
+    wolfsentry_route_flags_t flags = jps->o_u_c.route.flags;
+    struct json_validate_route_key key;
+    size_t key_len;
+    uint32_t parent_index = 0, hash, i;
+    wolfsentry_errcode_t ret;
+
+    if ((remote->sa_family != local->sa_family) ||
+        (remote->sa_proto != local->sa_proto))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if (jps->o_u_c.route.event_label_len > 0) {
+        if ((ret = json_validate_event_get(jps, jps->o_u_c.route.event_label, jps->o_u_c.route.event_label_len, &parent_index)) < 0)
+            return ret;
+    }
+
+    if (! (flags & (WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT)))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if (((flags & WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD) && (remote->interface != 0)) ||
+        ((flags & WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD) && (local->interface != 0)) ||
+        ((flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD) && (remote->sa_family != 0)) ||
+        ((flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD) && (remote->addr_len != 0)) ||
+        ((flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD) && (local->addr_len != 0)) ||
+        ((flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD) && (remote->sa_proto != 0)) ||
+        ((flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD) && (remote->sa_port != 0)) ||
+        ((flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD) && (local->sa_port != 0)))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if (((flags & WOLFSENTRY_ROUTE_FLAG_SA_FAMILY_WILDCARD) &&
+         ((! (flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD)) ||
+          (! (flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD)) ||
+          (! (flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD)))) ||
+        ((flags & WOLFSENTRY_ROUTE_FLAG_SA_PROTO_WILDCARD) &&
+         ((! (flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD)) ||
+          (! (flags & WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_PORT_WILDCARD)))))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if (jps->o_u_c.route.event_label_len > 0) {
+        if (vs->events[parent_index].flags & JSON_VALIDATE_EVENT_SUBEVENT)
+            WOLFSENTRY_ERROR_RETURN(INCOMPATIBLE_STATE);
+        ++parent_index;
+    }
+
+    memset(&key, 0, sizeof key);
+    key.flags = flags & WOLFSENTRY_ROUTE_IMMUTABLE_FLAGS;
+    key.parent_event = parent_index;
+    key.sa_family = remote->sa_family;
+    key.sa_proto = remote->sa_proto;
+    key.remote_port = remote->sa_port;
+    key.local_port = local->sa_port;
+    key.remote_addr_len = remote->addr_len;
+    key.local_addr_len = local->addr_len;
+    key.remote_interface = remote->interface;
+    key.local_interface = local->interface;
+    key_len = json_validate_route_key_addr(key.addrs, remote);
+    key_len += json_validate_route_key_addr(key.addrs + key_len, local);
+    key_len = (offsetof(struct json_validate_route_key, addrs) + key_len + 3U) & ~(size_t)3U;
+    hash = json_validate_hash(&key, key_len);
+
+    if ((ret = json_validate_slots_reserve(jps, &vs->route_slots, &vs->route_slots_size, vs->n_route_keys)) < 0)
+        return ret;
+    for (i = hash & (vs->route_slots_size - 1U); vs->route_slots[i].ref != 0; i = (i + 1U) & (vs->route_slots_size - 1U)) {
+        if ((vs->route_slots[i].hash == hash) && (memcmp(vs->route_keys + vs->route_slots[i].ref - 1U, &key, key_len) == 0))
+            WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
+    }
+
+    if (WOLFSENTRY_CHECK_BITS(jps->load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_NO_FLUSH)) {
+        struct wolfsentry_route_table *static_routes;
+        struct wolfsentry_route *route;
+        wolfsentry_route_flags_t inexact_matches;
+        if ((ret = wolfsentry_route_get_table_static(jps->wolfsentry_actual, &static_routes)) < 0)
+            return ret;
+        if (wolfsentry_route_get_reference(
+                jps->wolfsentry_actual,
+                static_routes,
+                remote,
+                local,
+                flags,
+                (jps->o_u_c.route.event_label_len > 0) ? jps->o_u_c.route.event_label : NULL,
+                jps->o_u_c.route.event_label_len,
+                1 /* exact_p */,
+                &inexact_matches,
+                &route) >= 0) {
+            (void)wolfsentry_route_drop_reference(jps->wolfsentry_actual, route, NULL /* action_results */);
+            WOLFSENTRY_ERROR_RETURN(ITEM_ALREADY_PRESENT);
+        }
+    }
+
+    if (vs->route_keys_len + key_len > vs->route_keys_size) {
+        size_t new_size = vs->route_keys_size ? vs->route_keys_size * 2U : 65536U;
+        byte *new_keys;
+        if (new_size > MAX_UINT_OF(uint32_t))
+            WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+        if ((new_keys = (byte *)wolfsentry_realloc(jps->wolfsentry_actual, vs->route_keys, new_size)) == NULL)
+            WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+        vs->route_keys = new_keys;
+        vs->route_keys_size = new_size;
+    }
+    memcpy(vs->route_keys + vs->route_keys_len, &key, key_len);
+    vs->route_slots[i].hash = hash;
+    vs->route_slots[i].ref = (uint32_t)vs->route_keys_len + 1U;
+    vs->route_keys_len += key_len;
+    ++vs->n_route_keys;
+
+    if (parent_index)
+        vs->events[parent_index - 1U].flags |= JSON_VALIDATE_EVENT_PARENT;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
 static wolfsentry_errcode_t handle_eventconfig_clause(struct wolfsentry_json_process_state *jps, JSON_TYPE type, const char *data, size_t data_size, struct wolfsentry_eventconfig *eventconfig) {
     if (type == JSON_OBJECT_END) {
-        wolfsentry_errcode_t ret = wolfsentry_defaultconfig_update(jps->wolfsentry, &jps->default_config);
+        wolfsentry_errcode_t ret;
         jps->table_under_construction = T_U_C_NONE;
+        if (jps->validate)
+            return wolfsentry_eventconfig_check(&jps->default_config);
+        ret = wolfsentry_defaultconfig_update(jps->wolfsentry, &jps->default_config);
         if (ret < 0)
             return ret;
         if (jps->default_policy_static) {
@@ -332,109 +920,52 @@ static wolfsentry_errcode_t handle_eventconfig_clause(struct wolfsentry_json_pro
         }
         WOLFSENTRY_RETURN_OK;
     }
-    if (! strcmp(jps->cur_keyname, "max-connection-count"))
+    switch (jps->cur_key) {
+    case K_MAX_CONNECTION_COUNT:
         return convert_uint32(type, data, data_size, &eventconfig->max_connection_count);
-    if (! strcmp(jps->cur_keyname, "penalty-box-duration"))
+    case K_MAX_SUBNET_CONNECTION_COUNT:
+        return convert_uint32(type, data, data_size, &eventconfig->max_subnet_connection_count);
+    case K_PENALTY_BOX_DURATION:
         return convert_wolfsentry_duration(jps->wolfsentry, type, data, data_size, &eventconfig->penaltybox_duration);
-    if (jps->table_under_construction != T_U_C_TOPCONFIG)
-        WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_KEY);
-    if (! strcmp(jps->cur_keyname, "default-policy-static"))
+    case K_RATE_LIMIT_TOKENS:
+        return convert_uint32(type, data, data_size, &eventconfig->rate_limit_tokens);
+    case K_RATE_LIMIT_PERIOD:
+        return convert_wolfsentry_duration(jps->wolfsentry, type, data, data_size, &eventconfig->rate_limit_period);
+    case K_RATE_LIMIT_BURST:
+        return convert_uint32(type, data, data_size, &eventconfig->rate_limit_burst);
+    case K_ROUTE_ADMISSION_THRESHOLD:
+        return convert_uint32(type, data, data_size, &eventconfig->route_admission_threshold);
+    case K_DEROGATORY_THRESHOLD_FOR_PENALTYBOX:
+        return convert_uint32(type, data, data_size, &eventconfig->derogatory_threshold_for_penaltybox);
+    case K_DEROGATORY_WINDOW:
+        return convert_wolfsentry_duration(jps->wolfsentry, type, data, data_size, &eventconfig->derogatory_window);
+    case K_DEFAULT_POLICY_STATIC:
+        if (jps->table_under_construction != T_U_C_TOPCONFIG)
+            break;
         return convert_default_policy(type, data, data_size, &jps->default_policy_static);
-    if (! strcmp(jps->cur_keyname, "default-policy-dynamic"))
+    case K_DEFAULT_POLICY_DYNAMIC:
+        if (jps->table_under_construction != T_U_C_TOPCONFIG)
+            break;
         return convert_default_policy(type, data, data_size, &jps->default_policy_dynamic);
+    default:
+        break;
+    }
     WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_KEY);
 }
 
-static inline int convert_hex_digit(char digit) {
-    if ((digit >= '0') && (digit <= '9'))
-        return digit - '0';
-    else if ((digit >= 'A') && (digit <= 'F'))
-        return digit - 'A' + 10;
-    else if ((digit >= 'a') && (digit <= 'f'))
-        return digit - 'a' + 10;
-    else
-        return -1;
-}
-
-static inline int convert_hex_byte(const char **in, size_t *in_len, byte *out) {
-    int d1, d2;
-    if (*in_len < 2)
-        return -1;
-    d1 = convert_hex_digit(*(*in)++);
-    if (d1 < 0)
-        return d1;
-    d2 = convert_hex_digit(*(*in)++);
-    if (d2 < 0)
-        return d2;
-    *out = (byte)((d1 << 4) | d2);
-    *in_len -= 2;
-    return 0;
-}
-
 static wolfsentry_errcode_t convert_sockaddr_address(JSON_TYPE type, const char *data, size_t data_size, struct wolfsentry_sockaddr *sa) {
+    wolfsentry_addr_bits_t addr_bits;
+    wolfsentry_errcode_t ret;
+
     if (type != JSON_STRING)
         WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_VALUE);
 
-    if (sa->sa_family == WOLFSENTRY_AF_LINK) {
-        int n;
-        for (n=0; ;) {
-            if (n == 8)
-                WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_VALUE);
-            if (convert_hex_byte(&data, &data_size, sa->addr + n) < 0)
-                WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_VALUE);
-            ++n;
-            if (data_size == 0) {
-                if ((n != 6) && (n != 8))
-                    WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_VALUE);
-                if (sa->addr_len == 0)
-                    sa->addr_len = (wolfsentry_addr_bits_t)(n * 8);
-                return 0;
-            }
-            if (*data++ != ':')
-                WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_VALUE);
-            --data_size;
-        }
-
-        WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_VALUE);
-    }
-    else if (sa->sa_family == WOLFSENTRY_AF_INET) {
-        char d_buf[16];
-        if (data_size >= sizeof d_buf)
-            WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
-        memcpy(d_buf, data, data_size);
-        d_buf[data_size] = 0;
-        switch (inet_pton(AF_INET, d_buf, sa->addr)) {
-        case 1:
-            if (sa->addr_len == 0)
-                sa->addr_len = 32;
-            return 0;
-        case 0:
-            WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_VALUE);
-        case -1:
-        default:
-            WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
-        }
-    }
-    else if (sa->sa_family == WOLFSENTRY_AF_INET6) {
-        char d_buf[64];
-        if (data_size >= sizeof d_buf)
-            WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
-        memcpy(d_buf, data, data_size);
-        d_buf[data_size] = 0;
-        switch (inet_pton(AF_INET6, d_buf, sa->addr)) {
-        case 1:
-            if (sa->addr_len == 0)
-                sa->addr_len = 128;
-            return 0;
-        case 0:
-            WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_VALUE);
-        case -1:
-        default:
-            WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
-        }
-    }
-    else
+    ret = wolfsentry_addr_pton(sa->sa_family, data, data_size, sa->addr, &addr_bits);
+    if (ret < 0)
         WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_VALUE);
+    if (sa->addr_len == 0)
+        sa->addr_len = addr_bits;
+    WOLFSENTRY_RETURN_OK;
 }
 
 #ifdef WOLFSENTRY_PROTOCOL_NAMES
@@ -470,7 +1001,7 @@ static wolfsentry_errcode_t convert_sockaddr_port_name(struct wolfsentry_json_pr
 #endif
 
 static wolfsentry_errcode_t handle_route_endpoint_clause(struct wolfsentry_json_process_state *jps, JSON_TYPE type, const char *data, size_t data_size, struct wolfsentry_sockaddr *sa) {
-    if (! strcmp(jps->cur_keyname, "port")) {
+    if (jps->cur_key == K_PORT) {
         WOLFSENTRY_CLEAR_BITS(jps->o_u_c.route.flags,
                               sa == (struct wolfsentry_sockaddr *)&jps->o_u_c.route.remote ?
                               WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD :
@@ -483,15 +1014,20 @@ static wolfsentry_errcode_t handle_route_endpoint_clause(struct wolfsentry_json_
 #endif
         else
             WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_VALUE);
-    } else if (! strcmp(jps->cur_keyname, "address")) {
+    } else if (jps->cur_key == K_ADDRESS) {
         WOLFSENTRY_CLEAR_BITS(jps->o_u_c.route.flags,
                               sa == (struct wolfsentry_sockaddr *)&jps->o_u_c.route.remote ?
                               WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD :
                               WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD);
         return convert_sockaddr_address(type, data, data_size, sa);
-    } else if (! strcmp(jps->cur_keyname, "prefix-bits"))
-        return convert_uint16(type, data, data_size, &sa->addr_len);
-    else if (! strcmp(jps->cur_keyname, "interface")) {
+    } else if (jps->cur_key == K_PREFIX_BITS) {
+        wolfsentry_errcode_t ret = convert_uint16(type, data, data_size, &sa->addr_len);
+        if (ret < 0)
+            return ret;
+        if (sa->addr_len > MAX_ADDR_BITS)
+            WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_VALUE);
+        return 0;
+    } else if (jps->cur_key == K_INTERFACE) {
         WOLFSENTRY_CLEAR_BITS(jps->o_u_c.route.flags,
                               sa == (struct wolfsentry_sockaddr *)&jps->o_u_c.route.remote ?
                               WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD :
@@ -583,9 +1119,26 @@ static wolfsentry_errcode_t handle_route_clause(struct wolfsentry_json_process_s
     if ((jps->cur_depth == 2) && (type == JSON_OBJECT_END)) {
         wolfsentry_ent_id_t id;
         wolfsentry_action_res_t action_results;
+        if (jps->validate) {
+            ret = json_validate_route_insert(jps);
+            reset_o_u_c(jps);
+            return ret < 0 ? ret : 0;
+        }
+        if (jps->route_batch) {
+            ret = wolfsentry_route_batch_add_static(
+                jps->wolfsentry,
+                jps->route_batch,
+                (const struct wolfsentry_sockaddr *)&jps->o_u_c.route.remote,
+                (const struct wolfsentry_sockaddr *)&jps->o_u_c.route.local,
+                jps->o_u_c.route.flags,
+                (jps->o_u_c.route.event_label_len > 0) ? jps->o_u_c.route.event_label : NULL,
+                jps->o_u_c.route.event_label_len);
+            reset_o_u_c(jps);
+            return ret < 0 ? ret : 0;
+        }
         ret = wolfsentry_route_insert_static(
             jps->wolfsentry,
-            jps->o_u_c.route.caller_arg,
+            NULL /* caller_arg */,
             (const struct wolfsentry_sockaddr *)&jps->o_u_c.route.remote,
             (const struct wolfsentry_sockaddr *)&jps->o_u_c.route.local,
             jps->o_u_c.route.flags,
@@ -616,10 +1169,10 @@ static wolfsentry_errcode_t handle_route_clause(struct wolfsentry_json_process_s
     }
     if (jps->cur_depth == 4) {
         if (type == JSON_OBJECT_BEG) {
-            if (! strcmp(jps->cur_keyname, "remote")) {
+            if (jps->cur_key == K_REMOTE) {
                 jps->section_under_construction = S_U_C_REMOTE_ENDPOINT;
                 return 0;
-            } else if (! strcmp(jps->cur_keyname, "local")) {
+            } else if (jps->cur_key == K_LOCAL) {
                 jps->section_under_construction = S_U_C_LOCAL_ENDPOINT;
                 return 0;
             } else
@@ -639,35 +1192,35 @@ static wolfsentry_errcode_t handle_route_clause(struct wolfsentry_json_process_s
     if (jps->cur_depth != 3)
         WOLFSENTRY_ERROR_RETURN(CONFIG_UNEXPECTED);
 
-    if (! strcmp(jps->cur_keyname, "parent-event")) {
+    switch (jps->cur_key) {
+    case K_PARENT_EVENT:
         if (data_size > sizeof jps->o_u_c.route.event_label)
             WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_VALUE);
         jps->o_u_c.route.event_label_len = (int)data_size;
         memcpy(jps->o_u_c.route.event_label, data, data_size);
         WOLFSENTRY_CLEAR_BITS(jps->o_u_c.route.flags, WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD);
-    }
-    else if (! strcmp(jps->cur_keyname, "family"))
+        return 0;
+    case K_FAMILY:
         return handle_route_family_clause(jps, type, data, data_size);
-    else if (! strcmp(jps->cur_keyname, "protocol"))
+    case K_PROTOCOL:
         return handle_route_protocol_clause(jps, type, data, data_size);
-    else if (! strcmp(jps->cur_keyname, "tcplike-port-numbers"))
+    case K_TCPLIKE_PORT_NUMBERS:
         return handle_route_boolean_clause(type, &jps->o_u_c.route.flags, WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS);
-    else if (! strcmp(jps->cur_keyname, "direction-in"))
+    case K_DIRECTION_IN:
         return handle_route_boolean_clause(type, &jps->o_u_c.route.flags, WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN);
-    else if (! strcmp(jps->cur_keyname, "direction-out"))
+    case K_DIRECTION_OUT:
         return handle_route_boolean_clause(type, &jps->o_u_c.route.flags, WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT);
-    else if (! strcmp(jps->cur_keyname, "penalty-boxed"))
+    case K_PENALTY_BOXED:
         return handle_route_boolean_clause(type, &jps->o_u_c.route.flags, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED);
-    else if (! strcmp(jps->cur_keyname, "green-listed"))
+    case K_GREEN_LISTED:
         return handle_route_boolean_clause(type, &jps->o_u_c.route.flags, WOLFSENTRY_ROUTE_FLAG_GREENLISTED);
-    else if (! strcmp(jps->cur_keyname, "dont-count-hits"))
+    case K_DONT_COUNT_HITS:
         return handle_route_boolean_clause(type, &jps->o_u_c.route.flags, WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS);
-    else if (! strcmp(jps->cur_keyname, "dont-count-current-connections"))
+    case K_DONT_COUNT_CURRENT_CONNECTIONS:
         return handle_route_boolean_clause(type, &jps->o_u_c.route.flags, WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_CURRENT_CONNECTIONS);
-    else
+    default:
         WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_KEY);
-
-    return 0;
+    }
 }
 
 static wolfsentry_errcode_t handle_event_clause(struct wolfsentry_json_process_state *jps, JSON_TYPE type, const char *data, size_t data_size) {
@@ -687,7 +1240,7 @@ static wolfsentry_errcode_t handle_event_clause(struct wolfsentry_json_process_s
             WOLFSENTRY_ERROR_RETURN(CONFIG_UNEXPECTED);
     }
 
-    if ((jps->cur_depth == 3) && (type == JSON_STRING) && (! strcmp(jps->cur_keyname, "label"))) {
+    if ((jps->cur_depth == 3) && (type == JSON_STRING) && (jps->cur_key == K_LABEL)) {
         if (data_size >= sizeof jps->o_u_c.event.label)
             WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
         memcpy(jps->o_u_c.event.label, data, data_size);
@@ -696,7 +1249,7 @@ static wolfsentry_errcode_t handle_event_clause(struct wolfsentry_json_process_s
     }
 
     if ((jps->cur_depth == 3) && (type == JSON_NUMBER)) {
-        if (! strcmp(jps->cur_keyname, "priority")) {
+        if (jps->cur_key == K_PRIORITY) {
             if (jps->o_u_c.event.inserted)
                 WOLFSENTRY_ERROR_RETURN(CONFIG_OUT_OF_SEQUENCE);
             return convert_uint16(type, data, data_size, &jps->o_u_c.event.priority);
@@ -704,7 +1257,7 @@ static wolfsentry_errcode_t handle_event_clause(struct wolfsentry_json_process_s
         WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_KEY);
     }
 
-    if ((jps->cur_depth == 4) && (type == JSON_OBJECT_BEG) && (! strcmp(jps->cur_keyname, "config")) && (jps->section_under_construction == S_U_C_NONE)) {
+    if ((jps->cur_depth == 4) && (type == JSON_OBJECT_BEG) && (jps->cur_key == K_CONFIG) && (jps->section_under_construction == S_U_C_NONE)) {
         if (jps->o_u_c.event.inserted)
             WOLFSENTRY_ERROR_RETURN(CONFIG_OUT_OF_SEQUENCE);
         jps->section_under_construction = S_U_C_EVENTCONFIG;
@@ -718,13 +1271,20 @@ static wolfsentry_errcode_t handle_event_clause(struct wolfsentry_json_process_s
 
     if ((jps->cur_depth == 3) && (type == JSON_OBJECT_END) && (jps->section_under_construction == S_U_C_EVENTCONFIG)) {
         jps->section_under_construction = S_U_C_NONE;
-        if (jps->o_u_c.event.inserted)
-            return wolfsentry_event_update_config(jps->wolfsentry, jps->o_u_c.event.label, jps->o_u_c.event.label_len, &jps->o_u_c.event.config);
-        else
+        if (! jps->o_u_c.event.inserted)
             WOLFSENTRY_RETURN_OK;
+        else if (jps->validate)
+            return json_validate_event_update_config(jps);
+        else
+            return wolfsentry_event_update_config(jps->wolfsentry, jps->o_u_c.event.label, jps->o_u_c.event.label_len, &jps->o_u_c.event.config);
     }
 
-    if (! jps->o_u_c.event.inserted) {
+    if (! jps->o_u_c.event.inserted && jps->validate) {
+        wolfsentry_errcode_t ret = json_validate_event_insert(jps);
+        if (ret < 0)
+            return ret;
+        jps->o_u_c.event.inserted = 1;
+    } else if (! jps->o_u_c.event.inserted) {
         wolfsentry_ent_id_t id;
         wolfsentry_errcode_t ret = wolfsentry_event_insert(
             jps->wolfsentry,
@@ -745,16 +1305,20 @@ static wolfsentry_errcode_t handle_event_clause(struct wolfsentry_json_process_s
     if ((jps->cur_depth == 3) && (type == JSON_STRING)) {
         wolfsentry_action_type_t subevent_type = WOLFSENTRY_ACTION_TYPE_NONE;
 
-        if (! strcmp(jps->cur_keyname, "insert-event"))
+        if (jps->cur_key == K_INSERT_EVENT)
             subevent_type = WOLFSENTRY_ACTION_TYPE_INSERT;
-        else if (! strcmp(jps->cur_keyname, "match-event"))
+        else if (jps->cur_key == K_MATCH_EVENT)
             subevent_type = WOLFSENTRY_ACTION_TYPE_MATCH;
-        else if (! strcmp(jps->cur_keyname, "delete-event"))
+        else if (jps->cur_key == K_DELETE_EVENT)
             subevent_type = WOLFSENTRY_ACTION_TYPE_DELETE;
+        else if (jps->cur_key == K_RELEASE_EVENT)
+            subevent_type = WOLFSENTRY_ACTION_TYPE_RELEASE;
 
         if (subevent_type != WOLFSENTRY_ACTION_TYPE_NONE) {
             if (data_size > WOLFSENTRY_MAX_LABEL_BYTES)
                 WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
+            if (jps->validate)
+                return json_validate_event_set_subevent(jps, data, (int)data_size);
             return wolfsentry_event_set_subevent(
                 jps->wolfsentry,
                 jps->o_u_c.event.label,
@@ -767,7 +1331,7 @@ static wolfsentry_errcode_t handle_event_clause(struct wolfsentry_json_process_s
         WOLFSENTRY_ERROR_RETURN(CONFIG_INVALID_KEY);
     }
 
-    if ((jps->cur_depth == 4) && (type == JSON_ARRAY_BEG) && (jps->section_under_construction == S_U_C_NONE) && (! strcmp(jps->cur_keyname, "actions"))) {
+    if ((jps->cur_depth == 4) && (type == JSON_ARRAY_BEG) && (jps->section_under_construction == S_U_C_NONE) && (jps->cur_key == K_ACTIONS)) {
         jps->section_under_construction = S_U_C_ACTION_LIST;
         return 0;
     }
@@ -775,6 +1339,8 @@ static wolfsentry_errcode_t handle_event_clause(struct wolfsentry_json_process_s
     if ((jps->cur_depth == 4) && (jps->section_under_construction == S_U_C_ACTION_LIST) && (type == JSON_STRING)) {
         if (data_size > WOLFSENTRY_MAX_LABEL_BYTES)
             WOLFSENTRY_ERROR_RETURN(STRING_ARG_TOO_LONG);
+        if (jps->validate)
+            return json_validate_event_action_append(jps, data, (int)data_size);
         return wolfsentry_event_action_append(
                     jps->wolfsentry,
                     jps->o_u_c.event.label,
@@ -812,10 +1378,9 @@ static wolfsentry_errcode_t json_process(
     if (type == JSON_KEY) {
         memcpy(&jps->key_pos, &jps->parser.pos, sizeof jps->key_pos);
         jps->key_pos.column_number -= (unsigned)(data_size + 2U); /* kludge to move the pointer back to the start of the key */
-        if (data_size >= sizeof jps->cur_keyname)
+        if (data_size >= MAX_KEY_BYTES)
             WOLFSENTRY_ERROR_OUT(CONFIG_INVALID_KEY);
-        memcpy(jps->cur_keyname, data, data_size);
-        jps->cur_keyname[data_size] = 0;
+        jps->cur_key = json_key_lookup(data, data_size);
         jps->cur_keydepth = jps->cur_depth;
         return 0;
     }
@@ -842,7 +1407,7 @@ static wolfsentry_errcode_t json_process(
             case JSON_STRING:
                 if (jps->cur_depth != 1)
                     WOLFSENTRY_ERROR_OUT(CONFIG_UNEXPECTED);
-                if (! strcmp(jps->cur_keyname, "wolfsentry-config-version")) {
+                if (jps->cur_key == K_WOLFSENTRY_CONFIG_VERSION) {
                     ret = convert_uint32(type, data, data_size, &jps->config_version);
                     if (ret < 0)
                         goto out;
@@ -856,7 +1421,7 @@ static wolfsentry_errcode_t json_process(
                     WOLFSENTRY_ERROR_OUT(CONFIG_UNEXPECTED);
                 if (jps->cur_depth != 2)
                     WOLFSENTRY_ERROR_OUT(CONFIG_UNEXPECTED);
-                if (! strcmp(jps->cur_keyname, "config-update")) {
+                if (jps->cur_key == K_CONFIG_UPDATE) {
                     jps->table_under_construction = T_U_C_TOPCONFIG;
                     return 0;
                 }
@@ -866,15 +1431,15 @@ static wolfsentry_errcode_t json_process(
                     WOLFSENTRY_ERROR_OUT(CONFIG_UNEXPECTED);
                 if (jps->cur_depth != 2)
                     WOLFSENTRY_ERROR_OUT(CONFIG_UNEXPECTED);
-                if (! strcmp(jps->cur_keyname, "events-insert")) {
+                if (jps->cur_key == K_EVENTS_INSERT) {
                     jps->table_under_construction = T_U_C_EVENTS;
                     return 0;
                 }
-                if (! strcmp(jps->cur_keyname, "static-routes-insert")) {
+                if (jps->cur_key == K_STATIC_ROUTES_INSERT) {
                     jps->table_under_construction = T_U_C_STATIC_ROUTES;
                     return 0;
                 }
-                if (! strcmp(jps->cur_keyname, "actions-update")) {
+                if (jps->cur_key == K_ACTIONS_UPDATE) {
                     jps->table_under_construction = T_U_C_ACTIONS;
                     return 0;
                 }
@@ -940,12 +1505,8 @@ static wolfsentry_errcode_t json_process(
         return 0;
 }
 
-wolfsentry_errcode_t wolfsentry_config_json_init(
-    struct wolfsentry_context *wolfsentry,
-    wolfsentry_config_load_flags_t load_flags,
-    struct wolfsentry_json_process_state **jps)
-{
-    wolfsentry_errcode_t ret;
+static wolfsentry_errcode_t json_parser_init(struct wolfsentry_json_process_state *jps) {
+    int ret;
     static const JSON_CALLBACKS json_callbacks = {
         .process = (int (*)(JSON_TYPE,  const char *, size_t,  void *))json_process
     };
@@ -954,24 +1515,52 @@ wolfsentry_errcode_t wolfsentry_config_json_init(
         .max_total_len = 0,
         .max_total_values = 0,
         .max_number_len = 20,
-        .max_string_len = WOLFSENTRY_MAX_LABEL_BYTES,
-        .max_key_len = WOLFSENTRY_MAX_LABEL_BYTES,
+        .max_string_len = MAX_STRING_BYTES,
+        .max_key_len = MAX_KEY_BYTES,
         .max_nesting_level = 10,
         .flags = JSON_NOSCALARROOT,
-        .wolfsentry_context = wolfsentry
+        .wolfsentry_context = jps->wolfsentry_actual
     };
 
+    ret = json_init(&jps->parser,
+                    &json_callbacks,
+                    &json_config,
+                    jps);
+    if (ret == JSON_ERR_SUCCESS)
+        WOLFSENTRY_RETURN_OK;
+    else if (ret == JSON_ERR_OUTOFMEMORY)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    else
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
+}
+
+wolfsentry_errcode_t wolfsentry_config_json_init(
+    struct wolfsentry_context *wolfsentry,
+    wolfsentry_config_load_flags_t load_flags,
+    struct wolfsentry_json_process_state **jps)
+{
+    wolfsentry_errcode_t ret;
+
     if (wolfsentry == NULL)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
 
     if (WOLFSENTRY_MASKIN_BITS(load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_FINI))
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
 
+    if (WOLFSENTRY_CHECK_BITS(load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY) &&
+        WOLFSENTRY_MASKIN_BITS(load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT|WOLFSENTRY_CONFIG_LOAD_FLAG_INCREMENTAL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
     if ((*jps = (struct wolfsentry_json_process_state *)wolfsentry_malloc(wolfsentry, sizeof **jps)) == NULL)
         WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
     memset(*jps, 0, sizeof **jps);
+    (*jps)->load_flags = load_flags;
     (*jps)->wolfsentry_actual = wolfsentry;
-    if (! WOLFSENTRY_MASKIN_BITS(load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_DRY_RUN|WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT))
+    if (WOLFSENTRY_CHECK_BITS(load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY)) {
+        (*jps)->wolfsentry = wolfsentry;
+        if ((ret = json_validate_init(*jps)) < 0)
+            goto out;
+    } else if (! WOLFSENTRY_MASKIN_BITS(load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_DRY_RUN|WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT|WOLFSENTRY_CONFIG_LOAD_FLAG_INCREMENTAL))
         (*jps)->wolfsentry = wolfsentry;
     else {
         ret = wolfsentry_context_clone(
@@ -987,19 +1576,10 @@ wolfsentry_errcode_t wolfsentry_config_json_init(
             goto out;
     }
 
-    ret = json_init(&(*jps)->parser,
-                    &json_callbacks,
-                    &json_config,
-                    *jps);
-    if (ret != JSON_ERR_SUCCESS) {
-        if (ret == JSON_ERR_OUTOFMEMORY)
-            ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
-        else
-            ret = WOLFSENTRY_ERROR_ENCODE(SYS_OP_FATAL);
+    if ((ret = json_parser_init(*jps)) < 0)
         goto out;
-    }
 
-    if (! WOLFSENTRY_MASKIN_BITS(load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_NO_FLUSH|WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT)) {
+    if (! WOLFSENTRY_MASKIN_BITS(load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_NO_FLUSH|WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT|WOLFSENTRY_CONFIG_LOAD_FLAG_INCREMENTAL|WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY)) {
         if ((ret = wolfsentry_context_flush(wolfsentry)) < 0)
             goto out;
     }
@@ -1007,9 +1587,9 @@ wolfsentry_errcode_t wolfsentry_config_json_init(
   out:
 
     if (ret < 0) {
-        if (WOLFSENTRY_MASKIN_BITS(load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_DRY_RUN|WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT) &&
-            ((*jps)->wolfsentry != NULL))
+        if (((*jps)->wolfsentry != NULL) && ((*jps)->wolfsentry != wolfsentry))
             (void)wolfsentry_context_free(&(*jps)->wolfsentry);
+        json_validate_free(*jps);
         wolfsentry_free(wolfsentry, *jps);
         *jps = NULL;
         return ret;
@@ -1097,12 +1677,18 @@ wolfsentry_errcode_t wolfsentry_config_json_fini(
         }
     }
 
-    if (WOLFSENTRY_CHECK_BITS((*jps)->load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_DRY_RUN)) {
+    if (WOLFSENTRY_MASKIN_BITS((*jps)->load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_DRY_RUN|WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY)) {
         ret = WOLFSENTRY_ERROR_ENCODE(OK);
         goto out;
     }
 
-    if (WOLFSENTRY_CHECK_BITS((*jps)->load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT)) {
+    if (WOLFSENTRY_CHECK_BITS((*jps)->load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_INCREMENTAL)) {
+        /* the clone has the complete new config, so the live context needs only
+         * what differs from it.  actions are still on in the live context, so
+         * they run for just the routes that come and go.
+         */
+        ret = wolfsentry_context_merge((*jps)->wolfsentry_actual, NULL /* caller_arg */, (*jps)->wolfsentry);
+    } else if (WOLFSENTRY_CHECK_BITS((*jps)->load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT)) {
         int flush_routes_p = ! WOLFSENTRY_MASKIN_BITS((*jps)->load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_NO_FLUSH);
         struct wolfsentry_route_table *old_static_route_table, *new_static_route_table;
         if ((ret = wolfsentry_route_get_table_static((*jps)->wolfsentry_actual, &old_static_route_table)) < 0)
@@ -1140,6 +1726,8 @@ wolfsentry_errcode_t wolfsentry_config_json_fini(
     if ((*jps)->wolfsentry && ((*jps)->wolfsentry != (*jps)->wolfsentry_actual))
         (void)wolfsentry_context_free(&(*jps)->wolfsentry);
 
+    json_validate_free(*jps);
+
     wolfsentry_free((*jps)->wolfsentry_actual, *jps);
 
     *jps = NULL;
@@ -1168,3 +1756,404 @@ wolfsentry_errcode_t wolfsentry_config_json_oneshot(
     }
     return wolfsentry_config_json_fini(&jps, err_buf, err_buf_size);
 }
+
+#ifndef WOLFSENTRY_JSON_LOAD_FILE_CHUNK_SIZE
+#define WOLFSENTRY_JSON_LOAD_FILE_CHUNK_SIZE (1U << 20) /* a multiple of the page size. */
+#endif
+
+static wolfsentry_errcode_t json_load_file_error(const char *path, char *err_buf, size_t err_buf_size) {
+    if (err_buf)
+        snprintf(err_buf, err_buf_size, "%s: %s", path, strerror(errno));
+    WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+}
+
+#ifndef WOLFSENTRY_NO_MMAP
+
+wolfsentry_errcode_t wolfsentry_config_json_load_file(
+    struct wolfsentry_context *wolfsentry,
+    const char *path,
+    wolfsentry_config_load_flags_t load_flags,
+    char *err_buf,
+    size_t err_buf_size)
+{
+    wolfsentry_errcode_t ret;
+    struct wolfsentry_json_process_state *jps;
+    struct stat st;
+    const char *json = NULL;
+    size_t json_len, off, n;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return json_load_file_error(path, err_buf, err_buf_size);
+    if (fstat(fd, &st) < 0) {
+        ret = json_load_file_error(path, err_buf, err_buf_size);
+        (void)close(fd);
+        return ret;
+    }
+    json_len = (size_t)st.st_size;
+    if (json_len > 0) {
+        void *map = mmap(NULL, json_len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            ret = json_load_file_error(path, err_buf, err_buf_size);
+            (void)close(fd);
+            return ret;
+        }
+        (void)posix_madvise(map, json_len, POSIX_MADV_SEQUENTIAL);
+        json = (const char *)map;
+    }
+    (void)close(fd);
+
+    if ((ret = wolfsentry_config_json_init(wolfsentry, load_flags, &jps)) < 0)
+        goto out;
+    /* fed in large chunks rather than all at once, so that the pages behind
+     * the parser can be dropped as it goes.
+     */
+    for (off = 0; off < json_len; off += n) {
+        n = (json_len - off < WOLFSENTRY_JSON_LOAD_FILE_CHUNK_SIZE) ? json_len - off : WOLFSENTRY_JSON_LOAD_FILE_CHUNK_SIZE;
+        if ((ret = wolfsentry_config_json_feed(jps, json + off, n, err_buf, err_buf_size)) < 0) {
+            (void)wolfsentry_config_json_fini(&jps, NULL, 0);
+            goto out;
+        }
+#ifdef MADV_DONTNEED
+        (void)madvise((void *)(json + off), n, MADV_DONTNEED);
+#endif
+    }
+    ret = wolfsentry_config_json_fini(&jps, err_buf, err_buf_size);
+
+  out:
+
+    if (json)
+        (void)munmap((void *)json, json_len);
+
+    return ret;
+}
+
+#else /* WOLFSENTRY_NO_MMAP */
+
+wolfsentry_errcode_t wolfsentry_config_json_load_file(
+    struct wolfsentry_context *wolfsentry,
+    const char *path,
+    wolfsentry_config_load_flags_t load_flags,
+    char *err_buf,
+    size_t err_buf_size)
+{
+    wolfsentry_errcode_t ret;
+    struct wolfsentry_json_process_state *jps;
+    FILE *f;
+    char *buf;
+    size_t n;
+
+    if ((f = fopen(path, "rb")) == NULL)
+        return json_load_file_error(path, err_buf, err_buf_size);
+    if ((buf = (char *)wolfsentry_malloc(wolfsentry, WOLFSENTRY_JSON_LOAD_FILE_CHUNK_SIZE)) == NULL) {
+        (void)fclose(f);
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    }
+    if ((ret = wolfsentry_config_json_init(wolfsentry, load_flags, &jps)) < 0)
+        goto out;
+    while ((n = fread(buf, 1, WOLFSENTRY_JSON_LOAD_FILE_CHUNK_SIZE, f)) > 0) {
+        if ((ret = wolfsentry_config_json_feed(jps, buf, n, err_buf, err_buf_size)) < 0) {
+            (void)wolfsentry_config_json_fini(&jps, NULL, 0);
+            goto out;
+        }
+    }
+    if (ferror(f)) {
+        ret = json_load_file_error(path, err_buf, err_buf_size);
+        (void)wolfsentry_config_json_fini(&jps, NULL, 0);
+        goto out;
+    }
+    ret = wolfsentry_config_json_fini(&jps, err_buf, err_buf_size);
+
+  out:
+
+    wolfsentry_free(wolfsentry, buf);
+    (void)fclose(f);
+
+    return ret;
+}
+
+#endif /* WOLFSENTRY_NO_MMAP */
+
+static inline int json_is_space(char c) {
+    return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+}
+
+/* moves pos across [from, to), counting lines as the parser does. */
+static void json_pos_advance(JSON_INPUT_POS *pos, const char *from, const char *to) {
+    const char *nl;
+    pos->offset += (size_t)(to - from);
+    while ((nl = (const char *)memchr(from, '\n', (size_t)(to - from))) != NULL) {
+        ++pos->line_number;
+        pos->column_number = 1;
+        from = nl + 1;
+    }
+    pos->column_number += (unsigned)(to - from);
+}
+
+/* skips the string starting at the quote at p, returning its closing quote, or
+ * null if it isn't closed.
+ */
+static const char *json_skip_string(const char *p, const char *end) {
+    const char *q;
+    for (++p; (q = (const char *)memchr(p, '"', (size_t)(end - p))) != NULL; p = q + 1) {
+        const char *r = q;
+        while ((r > p) && (r[-1] == '\\'))
+            --r;
+        if (((q - r) & 1) == 0)
+            return q;
+    }
+    return NULL;
+}
+
+/* finds the top level static-routes-insert array, and splits its elements into
+ * up to max_chunks runs of about the same length.  *routes_beg is set just
+ * past the opening bracket, and chunk_ends[i] to the comma or closing bracket
+ * that ends each run.  this only tracks strings and nesting, so it's much
+ * quicker than a parse, and anything malformed is left for the parser to
+ * report.  returns the number of chunks, or 0 if there's no such array.
+ */
+static int json_split_routes_array(const char *json, size_t json_len, int max_chunks, const char **routes_beg, const char **chunk_ends) {
+    static const char key[] = "\"static-routes-insert\"";
+    static const byte structural[256] = { ['"'] = 1, ['{'] = 1, ['}'] = 1, ['['] = 1, [']'] = 1, [','] = 1 };
+    const char *p, *q, *str_beg, *chunk_beg = NULL, *end = json + json_len;
+    size_t chunk_target = 0;
+    int depth = 0, n_chunks = 0;
+
+    for (p = json; p < end; ++p) {
+        while (! structural[(byte)*p]) {
+            if (++p == end)
+                return 0;
+        }
+        switch (*p) {
+        case '"':
+            str_beg = p;
+            if ((p = json_skip_string(p, end)) == NULL)
+                return 0;
+            if ((chunk_beg != NULL) || (depth != 1) ||
+                ((size_t)(p + 1 - str_beg) != sizeof key - 1) ||
+                (memcmp(str_beg, key, sizeof key - 1) != 0))
+                break;
+            for (q = p + 1; (q < end) && json_is_space(*q); ++q)
+                ;
+            if ((q == end) || (*q != ':'))
+                break;
+            for (++q; (q < end) && json_is_space(*q); ++q)
+                ;
+            if ((q == end) || (*q != '['))
+                break;
+            p = q;
+            ++depth;
+            *routes_beg = chunk_beg = p + 1;
+            chunk_target = (size_t)(end - chunk_beg) / (size_t)max_chunks;
+            break;
+        case '{':
+        case '[':
+            ++depth;
+            break;
+        case '}':
+        case ']':
+            if ((--depth == 1) && chunk_beg) {
+                chunk_ends[n_chunks++] = p;
+                return n_chunks;
+            }
+            break;
+        case ',':
+            if ((depth != 2) || (chunk_beg == NULL) || (n_chunks == max_chunks - 1) ||
+                ((size_t)(p - chunk_beg) < chunk_target))
+                break;
+            /* a run must hold at least one element, or the parser wouldn't see the stray comma. */
+            for (q = p + 1; (q < end) && json_is_space(*q); ++q)
+                ;
+            if ((q == end) || (*q == ',') || (*q == ']'))
+                break;
+            chunk_ends[n_chunks++] = p;
+            chunk_beg = p + 1;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+struct json_route_chunk {
+    struct wolfsentry_context *wolfsentry;
+    const char *json;
+    size_t json_len;
+    JSON_INPUT_POS pos; /* where json starts in the whole config, for error reporting. */
+    struct wolfsentry_route_batch *batch;
+    wolfsentry_errcode_t ret;
+    char err_buf[256];
+#ifdef WOLFSENTRY_JSON_PARALLEL_THREADS
+    pthread_t thread;
+    int threaded_p;
+#endif
+};
+
+/* the chunk is fed to a parser of its own, inside just enough of a config to
+ * put it in a static-routes-insert array, with the parser's position set so
+ * that errors are reported where they are in the whole config.
+ */
+static void *json_parse_route_chunk(void *arg) {
+    static const char prefix[] = "{\"wolfsentry-config-version\":1,\"static-routes-insert\":[";
+    static const char suffix[] = "]}";
+    struct json_route_chunk *chunk = (struct json_route_chunk *)arg;
+    struct wolfsentry_json_process_state *jps;
+
+    if ((jps = (struct wolfsentry_json_process_state *)wolfsentry_malloc(chunk->wolfsentry, sizeof *jps)) == NULL) {
+        chunk->ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
+        return NULL;
+    }
+    memset(jps, 0, sizeof *jps);
+    jps->load_flags = WOLFSENTRY_CONFIG_LOAD_FLAG_DRY_RUN; /* so that fini just finishes the parse. */
+    jps->wolfsentry_actual = jps->wolfsentry = chunk->wolfsentry;
+    jps->route_batch = chunk->batch;
+    if ((chunk->ret = json_parser_init(jps)) < 0) {
+        wolfsentry_free(chunk->wolfsentry, jps);
+        return NULL;
+    }
+
+    if ((chunk->ret = wolfsentry_config_json_feed(jps, prefix, sizeof prefix - 1, chunk->err_buf, sizeof chunk->err_buf)) >= 0) {
+        jps->parser.pos = chunk->pos;
+        if ((chunk->ret = wolfsentry_config_json_feed(jps, chunk->json, chunk->json_len, chunk->err_buf, sizeof chunk->err_buf)) >= 0)
+            chunk->ret = wolfsentry_config_json_feed(jps, suffix, sizeof suffix - 1, chunk->err_buf, sizeof chunk->err_buf);
+    }
+    if (chunk->ret < 0)
+        (void)wolfsentry_config_json_fini(&jps, NULL, 0);
+    else
+        chunk->ret = wolfsentry_config_json_fini(&jps, chunk->err_buf, sizeof chunk->err_buf);
+
+    /* sorting here keeps it off the thread that does the inserts. */
+    if (chunk->ret >= 0)
+        chunk->ret = wolfsentry_route_batch_sort(chunk->batch);
+
+    return NULL;
+}
+
+wolfsentry_errcode_t wolfsentry_config_json_oneshot_parallel(
+    struct wolfsentry_context *wolfsentry,
+    const char *json_in,
+    size_t json_in_len,
+    wolfsentry_config_load_flags_t load_flags,
+    int n_threads,
+    char *err_buf,
+    size_t err_buf_size)
+{
+    wolfsentry_errcode_t ret;
+    struct wolfsentry_json_process_state *jps = NULL;
+    struct json_route_chunk *chunks = NULL;
+    struct wolfsentry_route_batch **batches = NULL;
+    const char **chunk_ends = NULL;
+    const char *routes_beg = NULL, *routes_end;
+    wolfsentry_action_res_t action_results;
+    JSON_INPUT_POS pos;
+    int n_chunks = 0, i;
+
+    if (n_threads < 1)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    /* the route chunks are parsed into batches, which validation has no use for. */
+    if ((n_threads == 1) || WOLFSENTRY_CHECK_BITS(load_flags, WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY))
+        return wolfsentry_config_json_oneshot(wolfsentry, json_in, json_in_len, load_flags, err_buf, err_buf_size);
+
+    if ((chunk_ends = (const char **)wolfsentry_malloc(wolfsentry, sizeof *chunk_ends * (size_t)n_threads)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    if ((n_chunks = json_split_routes_array(json_in, json_in_len, n_threads, &routes_beg, chunk_ends)) == 0) {
+        wolfsentry_free(wolfsentry, chunk_ends);
+        return wolfsentry_config_json_oneshot(wolfsentry, json_in, json_in_len, load_flags, err_buf, err_buf_size);
+    }
+    routes_end = chunk_ends[n_chunks - 1];
+
+    if ((chunks = (struct json_route_chunk *)wolfsentry_malloc(wolfsentry, sizeof *chunks * (size_t)n_chunks)) == NULL) {
+        ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
+        goto out;
+    }
+    memset(chunks, 0, sizeof *chunks * (size_t)n_chunks);
+    if ((batches = (struct wolfsentry_route_batch **)wolfsentry_malloc(wolfsentry, sizeof *batches * (size_t)n_chunks)) == NULL) {
+        ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
+        goto out;
+    }
+
+    if ((ret = wolfsentry_config_json_init(wolfsentry, load_flags, &jps)) < 0)
+        goto out;
+
+    /* the config around the routes goes through the usual parser, what comes
+     * before them first and what comes after them last, just as in a serial
+     * load.  the parser sees an empty array in between.
+     */
+    if ((ret = wolfsentry_config_json_feed(jps, json_in, (size_t)(routes_beg - json_in), err_buf, err_buf_size)) < 0)
+        goto out;
+    pos = jps->parser.pos;
+    for (i = 0; i < n_chunks; ++i) {
+        chunks[i].wolfsentry = jps->wolfsentry;
+        chunks[i].json = (i == 0) ? routes_beg : chunk_ends[i - 1] + 1;
+        chunks[i].json_len = (size_t)(chunk_ends[i] - chunks[i].json);
+        chunks[i].pos = pos;
+        json_pos_advance(&pos, chunks[i].json, chunk_ends[i]);
+        if (i < n_chunks - 1)
+            json_pos_advance(&pos, chunk_ends[i], chunk_ends[i] + 1);
+        if ((ret = wolfsentry_route_batch_new(jps->wolfsentry, &chunks[i].batch)) < 0)
+            goto out;
+    }
+
+    /* the first chunk is parsed on the calling thread, and any chunk that can't
+     * get a thread of its own is parsed there too.
+     */
+    for (i = 1; i < n_chunks; ++i) {
+#ifdef WOLFSENTRY_JSON_PARALLEL_THREADS
+        if (pthread_create(&chunks[i].thread, NULL /* attr */, json_parse_route_chunk, &chunks[i]) == 0) {
+            chunks[i].threaded_p = 1;
+            continue;
+        }
+#endif
+        (void)json_parse_route_chunk(&chunks[i]);
+    }
+    (void)json_parse_route_chunk(&chunks[0]);
+#ifdef WOLFSENTRY_JSON_PARALLEL_THREADS
+    for (i = 1; i < n_chunks; ++i) {
+        if (chunks[i].threaded_p)
+            (void)pthread_join(chunks[i].thread, NULL /* retval */);
+    }
+#endif
+
+    /* the error reported is the first one in the config, as with a serial load. */
+    for (i = 0; i < n_chunks; ++i) {
+        if (chunks[i].ret < 0) {
+            ret = chunks[i].ret;
+            if (err_buf)
+                snprintf(err_buf, err_buf_size, "%s", chunks[i].err_buf);
+            goto out;
+        }
+    }
+
+    for (i = 0; i < n_chunks; ++i) {
+        batches[i] = chunks[i].batch;
+        chunks[i].batch = NULL;
+    }
+    if ((ret = wolfsentry_route_batch_insert_static(jps->wolfsentry, NULL /* caller_arg */, batches, n_chunks, &action_results)) < 0) {
+        if (err_buf)
+            snprintf(err_buf, err_buf_size, "static route insert failed with " WOLFSENTRY_ERROR_FMT, WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        goto out;
+    }
+
+    jps->parser.pos = pos;
+    if ((ret = wolfsentry_config_json_feed(jps, routes_end, json_in_len - (size_t)(routes_end - json_in), err_buf, err_buf_size)) < 0)
+        goto out;
+
+    ret = wolfsentry_config_json_fini(&jps, err_buf, err_buf_size);
+
+  out:
+
+    if (jps)
+        (void)wolfsentry_config_json_fini(&jps, NULL, 0);
+    if (chunks) {
+        for (i = 0; i < n_chunks; ++i) {
+            if (chunks[i].batch)
+                (void)wolfsentry_route_batch_free(chunks[i].wolfsentry, &chunks[i].batch);
+        }
+        wolfsentry_free(wolfsentry, chunks);
+    }
+    if (batches)
+        wolfsentry_free(wolfsentry, batches);
+    wolfsentry_free(wolfsentry, chunk_ends);
+
+    return ret;
+}
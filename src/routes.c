@@ -24,6 +24,95 @@
 
 #define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_ROUTES_C
 
+#ifndef WOLFSENTRY_NO_SIMD
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define WOLFSENTRY_ADDR_CMP_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define WOLFSENTRY_ADDR_CMP_NEON
+#endif
+#endif
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define ADDR_WORD32_TO_BE(x) __builtin_bswap32(x)
+#define ADDR_WORD64_TO_BE(x) __builtin_bswap64(x)
+#elif defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define ADDR_WORD32_TO_BE(x) (x)
+#define ADDR_WORD64_TO_BE(x) (x)
+#endif
+
+/* same sign as memcmp(left, right, n_bytes).  IPv4 and IPv6 addresses are
+ * compared a word or a vector at a time -- route lookups and sorted inserts
+ * make one of these calls per route visited.
+ */
+static inline int addr_bytes_cmp(const byte *left, const byte *right, size_t n_bytes)
+{
+    switch (n_bytes) {
+#ifdef ADDR_WORD32_TO_BE
+    case 4: {
+        uint32_t l, r;
+        memcpy(&l, left, sizeof l);
+        memcpy(&r, right, sizeof r);
+        if (l == r)
+            return 0;
+        return (ADDR_WORD32_TO_BE(l) < ADDR_WORD32_TO_BE(r)) ? -1 : 1;
+    }
+#endif
+    case 16: {
+#if defined(WOLFSENTRY_ADDR_CMP_SSE2)
+        __m128i l = _mm_loadu_si128((const __m128i *)(const void *)left);
+        __m128i r = _mm_loadu_si128((const __m128i *)(const void *)right);
+        unsigned int neq = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(l, r)) ^ 0xffffU;
+        unsigned int i;
+        if (neq == 0)
+            return 0;
+        i = (unsigned int)__builtin_ctz(neq);
+        return (left[i] < right[i]) ? -1 : 1;
+#else
+#if defined(WOLFSENTRY_ADDR_CMP_NEON)
+        if (vminvq_u8(vceqq_u8(vld1q_u8(left), vld1q_u8(right))) == 0xff)
+            return 0;
+#endif
+#ifdef ADDR_WORD64_TO_BE
+        uint64_t l[2], r[2];
+        memcpy(l, left, sizeof l);
+        memcpy(r, right, sizeof r);
+        if (l[0] != r[0])
+            return (ADDR_WORD64_TO_BE(l[0]) < ADDR_WORD64_TO_BE(r[0])) ? -1 : 1;
+        if (l[1] != r[1])
+            return (ADDR_WORD64_TO_BE(l[1]) < ADDR_WORD64_TO_BE(r[1])) ? -1 : 1;
+        return 0;
+#else
+        break;
+#endif
+#endif
+    }
+    default:
+        break;
+    }
+    return memcmp(left, right, n_bytes);
+}
+
+/* compares the leading n_bits of each address, in memcmp order.  the partial
+ * byte keeps its high bits, as wolfsentry_route_init() pads it.
+ */
+static inline int addr_prefix_cmp(const byte *left, const byte *right, size_t n_bits)
+{
+    size_t whole_bytes = n_bits / BITS_PER_BYTE;
+    unsigned int left_over_bits = (unsigned int)(n_bits % BITS_PER_BYTE);
+    int cmp;
+
+    if ((cmp = addr_bytes_cmp(left, right, whole_bytes)))
+        return cmp;
+    if (left_over_bits) {
+        byte mask = (byte)(0xffu << (BITS_PER_BYTE - left_over_bits));
+        if ((left[whole_bytes] & mask) != (right[whole_bytes] & mask))
+            return ((left[whole_bytes] & mask) < (right[whole_bytes] & mask)) ? -1 : 1;
+    }
+    return 0;
+}
+
 static inline int cmp_addrs(
     byte *left_addr,
     int left_addr_len,
@@ -43,27 +132,12 @@ static inline int cmp_addrs(
         if (wildcard_p || (min_addr_len == 0))
             *inexact_p = 1;
         else if (match_subnets_p) {
-            size_t min_bytes = WOLFSENTRY_BITS_TO_BYTES((size_t)min_addr_len);
-            if ((min_addr_len & 0x7) == 0) {
-                if ((cmp = memcmp(left_addr, right_addr, min_bytes)))
-                    return cmp;
-                else
-                    *inexact_p = 1;
-            } else {
-                if (min_bytes > 1) {
-                    if ((cmp = memcmp(left_addr, right_addr, min_bytes - 1)))
-                        return cmp;
-                }
-                if ((left_addr[min_bytes - 1] >> (min_addr_len & 0x7)) ==
-                    (right_addr[min_bytes - 1] >> (min_addr_len & 0x7)))
-                    *inexact_p = 1;
-                else if (left_addr[min_bytes - 1] < right_addr[min_bytes - 1])
-                    return -1;
-                else
-                    return 1;
-            }
+            if ((cmp = addr_prefix_cmp(left_addr, right_addr, (size_t)min_addr_len)))
+                return cmp;
+            else
+                *inexact_p = 1;
         } else {
-            if ((cmp = memcmp(left_addr, right_addr, WOLFSENTRY_BITS_TO_BYTES((size_t)min_addr_len))))
+            if ((cmp = addr_bytes_cmp(left_addr, right_addr, WOLFSENTRY_BITS_TO_BYTES((size_t)min_addr_len))))
                 return cmp;
             else if (left_addr_len < right_addr_len)
                 return -1;
@@ -71,7 +145,7 @@ static inline int cmp_addrs(
                 return 1;
         }
     } else {
-        if ((cmp = memcmp(left_addr, right_addr, WOLFSENTRY_BITS_TO_BYTES((size_t)left_addr_len)))) {
+        if ((cmp = addr_bytes_cmp(left_addr, right_addr, WOLFSENTRY_BITS_TO_BYTES((size_t)left_addr_len)))) {
             if (wildcard_p)
                 *inexact_p = 1;
             else
@@ -262,6 +336,8 @@ static void wolfsentry_route_free_1(
     struct wolfsentry_eventconfig_internal *config,
     struct wolfsentry_route *route)
 {
+    if (wolfsentry_image_owns(wolfsentry, route))
+        return;
     if (config->config.route_private_data_alignment == 0)
         WOLFSENTRY_FREE(route);
     else
@@ -336,26 +412,27 @@ static wolfsentry_errcode_t wolfsentry_route_init(
     memcpy(WOLFSENTRY_ROUTE_REMOTE_ADDR(new), remote->addr, WOLFSENTRY_BITS_TO_BYTES((size_t)remote->addr_len));
     memcpy(WOLFSENTRY_ROUTE_LOCAL_ADDR(new), local->addr, WOLFSENTRY_BITS_TO_BYTES((size_t)local->addr_len));
 
-    /* make sure the pad bits in the addresses are zero. */
+    /* make sure the pad bits in the addresses, below the prefix, are zero. */
     {
         int left_over_bits = remote->addr_len % BITS_PER_BYTE;
         if (left_over_bits) {
             byte *remote_lsb = WOLFSENTRY_ROUTE_REMOTE_ADDR(new) + WOLFSENTRY_BITS_TO_BYTES(remote->addr_len) - 1;
-            if (*remote_lsb & (0xffu >> (BITS_PER_BYTE - left_over_bits)))
-                *remote_lsb = (byte)(*remote_lsb & (0xffu << left_over_bits));
+            if (*remote_lsb & (0xffu >> left_over_bits))
+                *remote_lsb = (byte)(*remote_lsb & (0xffu << (BITS_PER_BYTE - left_over_bits)));
         }
     }
     {
         int left_over_bits = local->addr_len % BITS_PER_BYTE;
         if (left_over_bits) {
             byte *local_lsb = WOLFSENTRY_ROUTE_LOCAL_ADDR(new) + WOLFSENTRY_BITS_TO_BYTES(local->addr_len) - 1;
-            if (*local_lsb & (0xffu >> (BITS_PER_BYTE - left_over_bits)))
-                *local_lsb = (byte)(*local_lsb & (0xffu << left_over_bits));
+            if (*local_lsb & (0xffu >> left_over_bits))
+                *local_lsb = (byte)(*local_lsb & (0xffu << (BITS_PER_BYTE - left_over_bits)));
         }
     }
 
     new->header.refcount = 1;
     new->header.id = WOLFSENTRY_ENT_ID_NONE;
+    new->purge_slot = WOLFSENTRY_ROUTE_PURGE_SLOT_NONE;
 
     WOLFSENTRY_RETURN_OK;
 }
@@ -388,7 +465,11 @@ static wolfsentry_errcode_t wolfsentry_route_new(
         *new = WOLFSENTRY_MEMALIGN(config->config.route_private_data_alignment, new_size);
     if (*new == NULL)
         WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
-    return wolfsentry_route_init(parent_event, remote, local, flags, (int)config->config.route_private_data_size, (int)(new_size - offsetof(struct wolfsentry_route, data)), *new);
+    ret = wolfsentry_route_init(parent_event, remote, local, flags, (int)config->config.route_private_data_size, (int)(new_size - offsetof(struct wolfsentry_route, data)), *new);
+    if (ret < 0) {
+        wolfsentry_route_free_1(wolfsentry, config, *new);
+        *new = NULL;
+    }
 
     return ret;
 }
@@ -416,10 +497,20 @@ wolfsentry_errcode_t wolfsentry_route_clone(
         ++new_size;
     /* extra_ports storage will go here. */
 
-    if ((*new_route = dest_context->allocator.malloc(dest_context->allocator.context, new_size)) == NULL)
+    if (config->config.route_private_data_alignment == 0)
+        *new_route = dest_context->allocator.malloc(dest_context->allocator.context, new_size);
+    else if (dest_context->allocator.memalign)
+        *new_route = dest_context->allocator.memalign(dest_context->allocator.context, config->config.route_private_data_alignment, new_size);
+    else
+        *new_route = NULL;
+    if (*new_route == NULL)
         WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
     memcpy(*new_route, src_route, new_size);
     WOLFSENTRY_TABLE_ENT_HEADER_RESET(**new_ent);
+    (*new_route)->purge_link.prev = (*new_route)->purge_link.next = NULL;
+    (*new_route)->purge_slot = WOLFSENTRY_ROUTE_PURGE_SLOT_NONE;
+    (*new_route)->penaltybox_link.prev = (*new_route)->penaltybox_link.next = NULL;
+    (*new_route)->penaltybox_release_time = 0;
 
     if (src_route->parent_event) {
         wolfsentry_errcode_t ret;
@@ -434,14 +525,366 @@ wolfsentry_errcode_t wolfsentry_route_clone(
     WOLFSENTRY_RETURN_OK;
 }
 
+#define WOLFSENTRY_ROUTE_FROM_PURGE_LINK(ent) ((struct wolfsentry_route *)((byte *)(ent) - offsetof(struct wolfsentry_route, purge_link)))
+
+static inline wolfsentry_time_t wolfsentry_route_purge_wheel_tick(
+    const struct wolfsentry_route_purge_wheel *wheel,
+    wolfsentry_time_t when)
+{
+    if (when <= 0)
+        return 0;
+    return when / wheel->resolution;
+}
+
+/* routes that have never been hit age from their insert time. */
+static inline wolfsentry_time_t wolfsentry_route_last_activity(const struct wolfsentry_route *route) {
+    return route->meta.last_hit_time ? route->meta.last_hit_time : route->meta.insert_time;
+}
+
+static inline struct wolfsentry_list_header *wolfsentry_route_purge_wheel_list(
+    struct wolfsentry_route_purge_wheel *wheel,
+    unsigned int purge_slot)
+{
+    if (purge_slot == WOLFSENTRY_ROUTE_PURGE_SLOT_DUE)
+        return &wheel->due;
+    return &wheel->slots[purge_slot / WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS][purge_slot % WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS];
+}
+
+static void wolfsentry_route_purge_wheel_link(
+    struct wolfsentry_route_purge_wheel *wheel,
+    struct wolfsentry_route *route,
+    unsigned int purge_slot)
+{
+    wolfsentry_list_ent_append(wolfsentry_route_purge_wheel_list(wheel, purge_slot), &route->purge_link);
+    route->purge_slot = (uint16_t)purge_slot;
+    ++wheel->n_scheduled;
+}
+
+static void wolfsentry_route_purge_wheel_unlink(
+    struct wolfsentry_route_purge_wheel *wheel,
+    struct wolfsentry_route *route)
+{
+    if (route->purge_slot == WOLFSENTRY_ROUTE_PURGE_SLOT_NONE)
+        return;
+    wolfsentry_list_ent_delete(wolfsentry_route_purge_wheel_list(wheel, route->purge_slot), &route->purge_link);
+    route->purge_link.prev = route->purge_link.next = NULL;
+    route->purge_slot = WOLFSENTRY_ROUTE_PURGE_SLOT_NONE;
+    --wheel->n_scheduled;
+}
+
+/* file the route in the lowest level whose current span contains its due tick.
+ * slots are never reused within a span, so the chosen slot is always one that
+ * has yet to be processed or cascaded.
+ */
+static void wolfsentry_route_purge_wheel_place(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    struct wolfsentry_route *route)
+{
+    struct wolfsentry_route_purge_wheel *wheel = &table->purge_wheel;
+    /* round up, so that a route is never examined before it can have gone stale. */
+    wolfsentry_time_t due_tick = wolfsentry_route_purge_wheel_tick(
+        wheel,
+        WOLFSENTRY_ADD_TIME(WOLFSENTRY_ADD_TIME(wolfsentry_route_last_activity(route), table->purge_age), wheel->resolution - 1));
+    unsigned int level;
+    wolfsentry_time_t slot_index;
+
+    if (due_tick < wheel->next_tick)
+        due_tick = wheel->next_tick;
+
+    for (level = 0; level < WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS - 1; ++level) {
+        if ((due_tick >> (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS * (level + 1))) ==
+            (wheel->next_tick >> (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS * (level + 1))))
+            break;
+    }
+
+    slot_index = due_tick >> (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS * level);
+    if ((level == WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS - 1) &&
+        (slot_index - (wheel->next_tick >> (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS * level)) >= WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS))
+    {
+        /* beyond the horizon -- park it in the top-level slot that will be
+         * cascaded last, and recompute its due tick then.
+         */
+        slot_index = (wheel->next_tick >> (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS * level)) - 1;
+    }
+
+    wolfsentry_route_purge_wheel_link(
+        wheel,
+        route,
+        (level * WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS) + (unsigned int)(slot_index & (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS - 1)));
+}
+
+static void wolfsentry_route_purge_wheel_schedule(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    struct wolfsentry_route *route,
+    wolfsentry_time_t now)
+{
+    struct wolfsentry_route_purge_wheel *wheel = &table->purge_wheel;
+    /* an empty wheel can be anchored anywhere -- keep it at the present, so
+     * the next purge doesn't have to walk through idle ticks.
+     */
+    if (wheel->n_scheduled == 0)
+        wheel->next_tick = wolfsentry_route_purge_wheel_tick(wheel, now);
+    wolfsentry_route_purge_wheel_place(wolfsentry, table, route);
+}
+
+/* the slot moves below each cost one unit of *budget, if it's non-null, and
+ * return zero if it runs out before the slot is empty.  they leave the rest
+ * where it is, to be moved by a later call.
+ */
+static int wolfsentry_route_purge_wheel_move_to_due(
+    struct wolfsentry_route_purge_wheel *wheel,
+    unsigned int purge_slot,
+    wolfsentry_hitcount_t *budget)
+{
+    struct wolfsentry_list_header *list = wolfsentry_route_purge_wheel_list(wheel, purge_slot);
+    struct wolfsentry_list_ent_header *i;
+    while ((i = list->head) != NULL) {
+        struct wolfsentry_route *route = WOLFSENTRY_ROUTE_FROM_PURGE_LINK(i);
+        if (budget) {
+            if (*budget == 0)
+                return 0;
+            --*budget;
+        }
+        wolfsentry_route_purge_wheel_unlink(wheel, route);
+        wolfsentry_route_purge_wheel_link(wheel, route, WOLFSENTRY_ROUTE_PURGE_SLOT_DUE);
+    }
+    return 1;
+}
+
+static int wolfsentry_route_purge_wheel_cascade(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    unsigned int purge_slot,
+    wolfsentry_hitcount_t *budget)
+{
+    struct wolfsentry_route_purge_wheel *wheel = &table->purge_wheel;
+    struct wolfsentry_list_header *list = wolfsentry_route_purge_wheel_list(wheel, purge_slot);
+    struct wolfsentry_list_ent_header *i;
+    while ((i = list->head) != NULL) {
+        struct wolfsentry_route *route = WOLFSENTRY_ROUTE_FROM_PURGE_LINK(i);
+        if (budget) {
+            if (*budget == 0)
+                return 0;
+            --*budget;
+        }
+        wolfsentry_route_purge_wheel_unlink(wheel, route);
+        wolfsentry_route_purge_wheel_place(wolfsentry, table, route);
+    }
+    return 1;
+}
+
+wolfsentry_errcode_t wolfsentry_route_table_purge_wheel_rebuild(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table)
+{
+    struct wolfsentry_route_purge_wheel *wheel = &table->purge_wheel;
+    struct wolfsentry_table_ent_header *i;
+    wolfsentry_time_t now;
+    wolfsentry_errcode_t ret;
+
+    if ((ret = WOLFSENTRY_GET_TIME(&now)) < 0)
+        return ret;
+
+    memset(wheel, 0, sizeof *wheel);
+    wheel->resolution = table->purge_age >> WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS;
+    if (wheel->resolution < 1)
+        wheel->resolution = 1;
+    wheel->next_tick = wolfsentry_route_purge_wheel_tick(wheel, now);
+    wheel->sweep_slot = WOLFSENTRY_ROUTE_PURGE_SLOT_DUE;
+
+    for (i = table->header.head; i; i = i->next) {
+        struct wolfsentry_route *route = (struct wolfsentry_route *)i;
+        route->purge_slot = WOLFSENTRY_ROUTE_PURGE_SLOT_NONE;
+        wolfsentry_route_purge_wheel_place(wolfsentry, table, route);
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* penalty boxes released by a dispatch that finds their deadlines passed,
+ * besides the dispatched route's own.
+ */
+#ifndef WOLFSENTRY_PENALTYBOX_RELEASES_PER_DISPATCH
+#define WOLFSENTRY_PENALTYBOX_RELEASES_PER_DISPATCH 4
+#endif
+
+#define WOLFSENTRY_ROUTE_FROM_PENALTYBOX_LINK(ent) ((struct wolfsentry_route *)((byte *)(ent) - offsetof(struct wolfsentry_route, penaltybox_link)))
+
+static void wolfsentry_route_penaltybox_unschedule(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route *route)
+{
+    if (route->penaltybox_release_time == 0)
+        return;
+    wolfsentry_list_ent_delete(&wolfsentry->penaltybox_queue, &route->penaltybox_link);
+    route->penaltybox_link.prev = route->penaltybox_link.next = NULL;
+    route->penaltybox_release_time = 0;
+}
+
+/* queue a boxed route for release.  routes boxed without a
+ * last_penaltybox_time, or under a time-unbounded config, stay boxed until
+ * explicitly released.
+ */
+void wolfsentry_route_penaltybox_schedule(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route *route)
+{
+    const struct wolfsentry_eventconfig_internal *config = (route->parent_event && route->parent_event->config) ? route->parent_event->config : &wolfsentry->config;
+    struct wolfsentry_list_ent_header *point;
+
+    wolfsentry_route_penaltybox_unschedule(wolfsentry, route);
+
+    if ((! (route->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED)) ||
+        (! (route->flags & WOLFSENTRY_ROUTE_FLAG_IN_TABLE)) ||
+        (config->config.penaltybox_duration <= 0) ||
+        (route->meta.last_penaltybox_time == 0))
+        return;
+
+    route->penaltybox_release_time = WOLFSENTRY_ADD_TIME(route->meta.last_penaltybox_time, config->config.penaltybox_duration);
+    if (route->penaltybox_release_time == 0)
+        route->penaltybox_release_time = 1;
+
+    /* boxings mostly arrive in time order with a shared duration, so the
+     * insertion point is usually the tail.
+     */
+    for (wolfsentry_list_ent_get_last(&wolfsentry->penaltybox_queue, &point);
+         point;
+         wolfsentry_list_ent_get_prev(&wolfsentry->penaltybox_queue, &point))
+    {
+        if (WOLFSENTRY_ROUTE_FROM_PENALTYBOX_LINK(point)->penaltybox_release_time <= route->penaltybox_release_time)
+            break;
+    }
+    wolfsentry_list_ent_insert_after(&wolfsentry->penaltybox_queue, point, &route->penaltybox_link);
+}
+
+void wolfsentry_route_penaltybox_queue_rebuild(struct wolfsentry_context *wolfsentry) {
+    struct wolfsentry_route_table *tables[] = { &wolfsentry->routes_static, &wolfsentry->routes_dynamic };
+    struct wolfsentry_table_ent_header *i;
+    size_t table_i;
+
+    WOLFSENTRY_LIST_HEADER_RESET(wolfsentry->penaltybox_queue);
+    for (table_i = 0; table_i < sizeof tables / sizeof tables[0]; ++table_i) {
+        for (i = tables[table_i]->header.head; i; i = i->next) {
+            ((struct wolfsentry_route *)i)->penaltybox_release_time = 0;
+            wolfsentry_route_penaltybox_schedule(wolfsentry, (struct wolfsentry_route *)i);
+        }
+    }
+}
+
+static wolfsentry_errcode_t wolfsentry_route_penaltybox_release_1(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    struct wolfsentry_route *route)
+{
+    wolfsentry_route_flags_t flags_before, flags_after;
+    wolfsentry_errcode_t ret;
+
+    /* dequeues the route. */
+    if ((ret = wolfsentry_route_update_flags(
+             wolfsentry,
+             route,
+             WOLFSENTRY_ROUTE_FLAG_NONE,
+             WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED,
+             &flags_before,
+             &flags_after)) < 0)
+        return ret;
+
+    if (route->parent_event && route->parent_event->release_event) {
+        wolfsentry_action_res_t action_results = WOLFSENTRY_ACTION_RES_NONE;
+        WOLFSENTRY_WARN_ON_FAILURE(
+            wolfsentry_action_list_dispatch(
+                wolfsentry,
+                caller_arg,
+                route->parent_event->release_event,
+                NULL /* trigger_event */,
+                WOLFSENTRY_ACTION_TYPE_RELEASE,
+                (struct wolfsentry_route_table *)route->header.parent_table,
+                route,
+                &action_results));
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_route_penaltybox_release_due(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_time_t now,
+    wolfsentry_hitcount_t *budget,
+    int *n_released,
+    int *done)
+{
+    struct wolfsentry_list_ent_header *i;
+    wolfsentry_errcode_t ret;
+
+    while ((i = wolfsentry->penaltybox_queue.head) != NULL) {
+        struct wolfsentry_route *route = WOLFSENTRY_ROUTE_FROM_PENALTYBOX_LINK(i);
+
+        if (WOLFSENTRY_DIFF_TIME(now, route->penaltybox_release_time) < 0)
+            break;
+
+        if (budget) {
+            if (*budget == 0) {
+                if (done)
+                    *done = 0;
+                break;
+            }
+            --*budget;
+        }
+
+        if ((ret = wolfsentry_route_penaltybox_release_1(wolfsentry, caller_arg, route)) < 0)
+            return ret;
+
+        if (n_released)
+            ++*n_released;
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* a route's changes are stamped in strict order, even within a clock tick, so
+ * that a peer applying them never takes a later one for a tie.
+ */
+static wolfsentry_errcode_t wolfsentry_route_stamp_change(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route *route)
+{
+    wolfsentry_time_t now;
+    wolfsentry_errcode_t ret;
+    if ((ret = WOLFSENTRY_GET_TIME(&now)) < 0)
+        return ret;
+    if (WOLFSENTRY_DIFF_TIME(now, route->meta.last_change_time) <= 0)
+        now = WOLFSENTRY_ADD_TIME(route->meta.last_change_time, 1);
+    route->meta.last_change_time = now;
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* only dynamic routes are journaled -- static routes come from the config --
+ * and changes applied from a peer aren't, so that they don't echo back to it.
+ */
+static inline void wolfsentry_route_journal_note(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_route_table *route_table,
+    wolfsentry_journal_record_type_t type,
+    const struct wolfsentry_route *route,
+    int from_peer_p)
+{
+    if (wolfsentry->journal && (route_table == &wolfsentry->routes_dynamic) && (! from_peer_p))
+        wolfsentry_journal_note(wolfsentry, type, route);
+}
+
 static wolfsentry_errcode_t wolfsentry_route_insert_1(
     struct wolfsentry_context *wolfsentry,
     void *caller_arg, /* passed to action callback(s) as the caller_arg. */
     struct wolfsentry_route_table *route_table,
     struct wolfsentry_route *route,
     struct wolfsentry_event *trigger_event,
+    int from_peer_p, /* the change came from wolfsentry_journal_apply(), and isn't journaled. */
     wolfsentry_action_res_t *action_results)
 {
+    wolfsentry_time_t now;
     wolfsentry_errcode_t ret;
 
     /* make sure fields marked as wildcards are set to zero. */
@@ -473,13 +916,20 @@ static wolfsentry_errcode_t wolfsentry_route_insert_1(
 
     if ((ret = wolfsentry_id_generate(wolfsentry, WOLFSENTRY_OBJECT_TYPE_ROUTE, &route->header.id)) < 0)
         return ret;
-    if ((ret = WOLFSENTRY_GET_TIME(&route->meta.insert_time)) < 0)
+    if ((ret = WOLFSENTRY_GET_TIME(&now)) < 0)
         return ret;
+    /* routes restored from a snapshot keep their insert time. */
+    if (route->meta.insert_time == 0)
+        route->meta.insert_time = now;
+    if (route->meta.last_change_time == 0)
+        route->meta.last_change_time = route->meta.insert_time;
     WOLFSENTRY_SET_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
     if ((ret = wolfsentry_table_ent_insert(wolfsentry, &route->header, &route_table->header, 1 /* unique_p */)) < 0) {
         WOLFSENTRY_CLEAR_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE);
         return ret;
     }
+    wolfsentry_route_purge_wheel_schedule(wolfsentry, route_table, route, now);
+    wolfsentry_route_penaltybox_schedule(wolfsentry, route);
 
     if (route->parent_event && route->parent_event->insert_event) {
         ret = wolfsentry_action_list_dispatch(
@@ -493,15 +943,19 @@ static wolfsentry_errcode_t wolfsentry_route_insert_1(
             action_results);
         if (ret < 0) {
             wolfsentry_route_flags_t flags_before, flags_after;
+            wolfsentry_route_purge_wheel_unlink(&route_table->purge_wheel, route);
+            wolfsentry_route_penaltybox_unschedule(wolfsentry, route);
             (void)wolfsentry_table_ent_delete_1(wolfsentry, &route->header);
             wolfsentry_route_update_flags_1(route, WOLFSENTRY_ROUTE_FLAG_NONE, WOLFSENTRY_ROUTE_FLAG_IN_TABLE, &flags_before, &flags_after);
-        }
+        } else
+            wolfsentry_route_journal_note(wolfsentry, route_table, WOLFSENTRY_JOURNAL_RECORD_INSERT, route, from_peer_p);
         return ret;
     } else {
         if (route->parent_event) {
             if (! WOLFSENTRY_CHECK_BITS(route->parent_event->flags, WOLFSENTRY_EVENT_FLAG_IS_PARENT_EVENT))
                 WOLFSENTRY_SET_BITS(route->parent_event->flags, WOLFSENTRY_EVENT_FLAG_IS_PARENT_EVENT);
         }
+        wolfsentry_route_journal_note(wolfsentry, route_table, WOLFSENTRY_JOURNAL_RECORD_INSERT, route, from_peer_p);
         WOLFSENTRY_RETURN_OK;
     }
 }
@@ -527,7 +981,7 @@ static wolfsentry_errcode_t wolfsentry_route_insert_2(
     if ((ret = wolfsentry_route_new(wolfsentry, parent_event, remote, local, flags, &new)) < 0)
         return ret;
 
-    if ((ret = wolfsentry_route_insert_1(wolfsentry, caller_arg, route_table, new, parent_event, action_results)) < 0)
+    if ((ret = wolfsentry_route_insert_1(wolfsentry, caller_arg, route_table, new, parent_event, 0 /* from_peer_p */, action_results)) < 0)
         goto out;
 
     if (id)
@@ -549,6 +1003,41 @@ static wolfsentry_errcode_t wolfsentry_route_insert_2(
 }
 
 
+/* everything but the key, the parent event, and the private data is state, and starts fresh. */
+static void wolfsentry_route_reset_state(struct wolfsentry_route *route) {
+    WOLFSENTRY_TABLE_ENT_HEADER_RESET(route->header);
+    route->header.hitcount = 0;
+    route->header.id = WOLFSENTRY_ENT_ID_NONE;
+    route->purge_link.prev = route->purge_link.next = NULL;
+    route->purge_slot = WOLFSENTRY_ROUTE_PURGE_SLOT_NONE;
+    route->penaltybox_link.prev = route->penaltybox_link.next = NULL;
+    route->penaltybox_release_time = 0;
+    WOLFSENTRY_CLEAR_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_IN_TABLE | WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE | WOLFSENTRY_ROUTE_FLAG_INSERT_ACTIONS_CALLED | WOLFSENTRY_ROUTE_FLAG_DELETE_ACTIONS_CALLED);
+    memset(&route->meta, 0, sizeof route->meta);
+}
+
+wolfsentry_errcode_t wolfsentry_route_insert_in_place(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *route,
+    struct wolfsentry_event *parent_event,
+    wolfsentry_action_res_t *action_results)
+{
+    wolfsentry_errcode_t ret;
+
+    wolfsentry_route_reset_state(route);
+    route->parent_event = parent_event;
+
+    if ((ret = wolfsentry_route_insert_1(wolfsentry, caller_arg, route_table, route, parent_event, 0 /* from_peer_p */, action_results)) < 0)
+        return ret;
+
+    if (parent_event)
+        WOLFSENTRY_REFCOUNT_INCREMENT(parent_event->header.refcount);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
 wolfsentry_errcode_t wolfsentry_route_insert_static(
     struct wolfsentry_context *wolfsentry,
     void *caller_arg, /* passed to action callback(s) as the caller_arg. */
@@ -573,46 +1062,301 @@ wolfsentry_errcode_t wolfsentry_route_insert_static(
     return ret;
 }
 
-static wolfsentry_errcode_t wolfsentry_route_lookup_1(
+static wolfsentry_errcode_t wolfsentry_route_new_static(
     struct wolfsentry_context *wolfsentry,
-    const struct wolfsentry_route_table *table,
     const struct wolfsentry_sockaddr *remote,
     const struct wolfsentry_sockaddr *local,
     wolfsentry_route_flags_t flags,
-    struct wolfsentry_event *parent_event,
-    int exact_p,
-    wolfsentry_route_flags_t *inexact_matches,
+    const char *event_label,
+    int event_label_len,
     struct wolfsentry_route **route)
 {
-    struct {
-        struct wolfsentry_route route;
-        byte buf[WOLFSENTRY_MAX_ADDR_BYTES * 2];
-    } target;
-    struct wolfsentry_cursor cursor;
-    int cursor_position;
-    struct wolfsentry_route *i;
-    wolfsentry_priority_t highest_priority_seen = 0;
-    struct wolfsentry_route *highest_priority_match_seen = NULL;
-    wolfsentry_route_flags_t highest_priority_inexact_matches = 0;
     wolfsentry_errcode_t ret;
+    struct wolfsentry_event *event = NULL;
 
-    if ((ret = wolfsentry_table_cursor_init(wolfsentry, &cursor)) < 0)
-        goto out;
-
-    if (! exact_p)
-        WOLFSENTRY_SET_BITS(flags, WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD);
+    if ((remote->sa_family != local->sa_family) ||
+        (remote->sa_proto != local->sa_proto))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
 
-    if ((ret = wolfsentry_route_init(parent_event, remote, local, flags, 0 /* data_addr_offset */, sizeof target.buf, &target.route)) < 0)
-        goto out;
+    if (event_label) {
+        if ((ret = wolfsentry_event_get_reference(wolfsentry, event_label, event_label_len, &event)) < 0)
+            return ret;
+    }
+    /* on success, the route keeps the event reference, as an inserted route does. */
+    if (((ret = wolfsentry_route_new(wolfsentry, event, remote, local, flags, route)) < 0) && event)
+        (void)wolfsentry_event_drop_reference(wolfsentry, event, NULL /* action_results */);
+    return ret;
+}
 
-    if ((ret = wolfsentry_table_cursor_seek(&table->header, &target.route.header, &cursor, &cursor_position)) < 0)
-        goto out;
+wolfsentry_errcode_t wolfsentry_route_batch_new(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_batch **batch)
+{
+    if ((*batch = (struct wolfsentry_route_batch *)WOLFSENTRY_MALLOC(sizeof **batch)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(*batch, 0, sizeof **batch);
+    (*batch)->routes.cmp_fn = (wolfsentry_ent_cmp_fn_t)wolfsentry_route_key_cmp;
+    (*batch)->routes.free_fn = (wolfsentry_ent_free_fn_t)wolfsentry_route_drop_reference;
+    (*batch)->routes.ent_type = WOLFSENTRY_OBJECT_TYPE_ROUTE;
+    (*batch)->ascending_p = (*batch)->descending_p = 1;
+    WOLFSENTRY_RETURN_OK;
+}
 
-    if (inexact_matches)
-        *inexact_matches = WOLFSENTRY_ROUTE_FLAG_NONE;
+wolfsentry_errcode_t wolfsentry_route_batch_add_static(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_batch *batch,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    const char *event_label,
+    int event_label_len)
+{
+    struct wolfsentry_route *new;
+    wolfsentry_errcode_t ret;
 
-    /* return exact match immediately. */
-    if ((cursor_position == 0) && (exact_p || (! WOLFSENTRY_CHECK_BITS(((struct wolfsentry_route *)cursor.point)->flags, WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE)))) {
+    if ((ret = wolfsentry_route_new_static(wolfsentry, remote, local, flags, event_label, event_label_len, &new)) < 0)
+        return ret;
+    new->header.prev = batch->routes.tail;
+    if (batch->routes.tail) {
+        int cmp = wolfsentry_route_key_cmp((struct wolfsentry_route *)batch->routes.tail, new);
+        if (cmp >= 0)
+            batch->ascending_p = 0;
+        if (cmp <= 0)
+            batch->descending_p = 0;
+        batch->routes.tail->next = &new->header;
+    } else
+        batch->routes.head = &new->header;
+    batch->routes.tail = &new->header;
+    ++batch->routes.n_ents;
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* big rule sets are often generated in order, so a batch that's already in
+ * order, or in reverse order, is sorted in one pass.
+ */
+wolfsentry_errcode_t wolfsentry_route_batch_sort(
+    struct wolfsentry_route_batch *batch)
+{
+    struct wolfsentry_table_ent_header *i, *next;
+
+    if (batch->ascending_p)
+        WOLFSENTRY_RETURN_OK;
+    if (batch->descending_p) {
+        for (i = batch->routes.head; i; i = next) {
+            next = i->next;
+            i->next = i->prev;
+            i->prev = next;
+        }
+        i = batch->routes.head;
+        batch->routes.head = batch->routes.tail;
+        batch->routes.tail = i;
+    } else
+        wolfsentry_table_sort(&batch->routes);
+    batch->ascending_p = 1;
+    batch->descending_p = 0;
+    WOLFSENTRY_RETURN_OK;
+}
+
+wolfsentry_errcode_t wolfsentry_route_batch_free(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_batch **batch)
+{
+    wolfsentry_errcode_t ret;
+    if ((ret = wolfsentry_table_free_ents(wolfsentry, &(*batch)->routes)) < 0)
+        return ret;
+    WOLFSENTRY_FREE(*batch);
+    *batch = NULL;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static struct wolfsentry_subnet_slot *wolfsentry_route_subnet_slot(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_route *route,
+    const struct wolfsentry_sockaddr *remote,
+    int claim_p,
+    int *full);
+
+static inline wolfsentry_errcode_t wolfsentry_route_delete_0(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_event *trigger_event,
+    struct wolfsentry_route *route,
+    int from_peer_p,
+    wolfsentry_action_res_t *action_results);
+
+/* a restored route's connections are still open, so they count against its
+ * subnet too.  returns the subnet slot charged, if any.
+ */
+static struct wolfsentry_subnet_slot *wolfsentry_route_batch_subnet_slot(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_route *route,
+    int claim_p)
+{
+    int full;
+    if ((route->meta.connection_count == 0) ||
+        (route->flags & WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_CURRENT_CONNECTIONS))
+        return NULL;
+    return wolfsentry_route_subnet_slot(wolfsentry, route, NULL /* remote */, claim_p, &full);
+}
+
+/* the batches are merged in key order, with ties going to the earlier batch,
+ * so that a route that collides with another fails just as it would have if
+ * the routes had been inserted one by one in batch order.  the new routes
+ * arrive in key order, so each insert is at or near the tail of the table.
+ */
+wolfsentry_errcode_t wolfsentry_route_batch_insert_1(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route_batch **batches,
+    int n_batches,
+    int all_or_none_p,
+    int from_peer_p,
+    wolfsentry_action_res_t *action_results)
+{
+    wolfsentry_errcode_t ret = WOLFSENTRY_ERROR_ENCODE(OK);
+    struct wolfsentry_table_ent_header *next;
+    struct wolfsentry_route *route;
+    struct wolfsentry_route **inserted = NULL;
+    size_t n_inserted = 0;
+    struct wolfsentry_subnet_slot *subnet_slot;
+    int i, min_i;
+
+    for (i = 0; i < n_batches; ++i)
+        (void)wolfsentry_route_batch_sort(batches[i]);
+
+    /* to take the routes back out, they have to be found again, and the ones
+     * that went in aren't adjacent in the table.
+     */
+    if (all_or_none_p) {
+        size_t n_routes = 0;
+        for (i = 0; i < n_batches; ++i)
+            n_routes += (size_t)batches[i]->routes.n_ents;
+        if ((n_routes > 0) &&
+            ((inserted = (struct wolfsentry_route **)WOLFSENTRY_MALLOC(sizeof *inserted * n_routes)) == NULL))
+        {
+            ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
+            goto out;
+        }
+    }
+
+    for (;;) {
+        min_i = -1;
+        for (i = 0; i < n_batches; ++i) {
+            if (batches[i]->routes.head == NULL)
+                continue;
+            if ((min_i < 0) ||
+                (wolfsentry_route_key_cmp((struct wolfsentry_route *)batches[i]->routes.head, (struct wolfsentry_route *)batches[min_i]->routes.head) < 0))
+                min_i = i;
+        }
+        if (min_i < 0)
+            break;
+
+        route = (struct wolfsentry_route *)batches[min_i]->routes.head;
+        next = route->header.next;
+        batches[min_i]->routes.head = next;
+        if (next)
+            next->prev = NULL;
+        else
+            batches[min_i]->routes.tail = NULL;
+        --batches[min_i]->routes.n_ents;
+        route->header.prev = route->header.next = NULL;
+
+        WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+        if ((ret = wolfsentry_route_insert_1(wolfsentry, caller_arg, route_table, route, route->parent_event, from_peer_p, action_results)) < 0) {
+            (void)wolfsentry_route_drop_reference(wolfsentry, route, NULL /* action_results */);
+            break;
+        }
+
+        if ((subnet_slot = wolfsentry_route_batch_subnet_slot(wolfsentry, route, 1 /* claim_p */)) != NULL) {
+            if ((uint32_t)subnet_slot->count + route->meta.connection_count > MAX_UINT_OF(subnet_slot->count))
+                subnet_slot->count = (uint16_t)MAX_UINT_OF(subnet_slot->count);
+            else
+                subnet_slot->count = (uint16_t)(subnet_slot->count + route->meta.connection_count);
+        }
+
+        if (inserted)
+            inserted[n_inserted++] = route;
+    }
+
+    if ((ret < 0) && inserted) {
+        while (n_inserted > 0) {
+            wolfsentry_action_res_t rollback_results = WOLFSENTRY_ACTION_RES_NONE;
+            route = inserted[--n_inserted];
+            if ((subnet_slot = wolfsentry_route_batch_subnet_slot(wolfsentry, route, 0 /* claim_p */)) != NULL)
+                subnet_slot->count = (subnet_slot->count > route->meta.connection_count) ? (uint16_t)(subnet_slot->count - route->meta.connection_count) : 0;
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_delete_0(wolfsentry, caller_arg, route_table, NULL /* trigger_event */, route, from_peer_p, &rollback_results));
+        }
+    }
+
+  out:
+
+    if (inserted)
+        WOLFSENTRY_FREE(inserted);
+
+    /* whatever wasn't inserted is discarded. */
+    for (i = 0; i < n_batches; ++i) {
+        wolfsentry_errcode_t free_ret = wolfsentry_route_batch_free(wolfsentry, &batches[i]);
+        if ((free_ret < 0) && (ret >= 0))
+            ret = free_ret;
+    }
+
+    return ret;
+}
+
+wolfsentry_errcode_t wolfsentry_route_batch_insert(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route_batch **batches,
+    int n_batches,
+    int all_or_none_p,
+    wolfsentry_action_res_t *action_results)
+{
+    return wolfsentry_route_batch_insert_1(wolfsentry, caller_arg, route_table, batches, n_batches, all_or_none_p, 0 /* from_peer_p */, action_results);
+}
+
+wolfsentry_errcode_t wolfsentry_route_batch_insert_static(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_batch **batches,
+    int n_batches,
+    wolfsentry_action_res_t *action_results)
+{
+    return wolfsentry_route_batch_insert(wolfsentry, caller_arg, &wolfsentry->routes_static, batches, n_batches, 0 /* all_or_none_p */, action_results);
+}
+
+/* target must have been through wolfsentry_route_init(), with
+ * WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD set unless exact_p.
+ */
+static wolfsentry_errcode_t wolfsentry_route_lookup_0(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_route_table *table,
+    const struct wolfsentry_route *target,
+    int exact_p,
+    wolfsentry_route_flags_t *inexact_matches,
+    struct wolfsentry_route **route)
+{
+    struct wolfsentry_cursor cursor;
+    int cursor_position;
+    struct wolfsentry_route *i;
+    wolfsentry_priority_t highest_priority_seen = 0;
+    struct wolfsentry_route *highest_priority_match_seen = NULL;
+    wolfsentry_route_flags_t highest_priority_inexact_matches = 0;
+    wolfsentry_errcode_t ret;
+
+    if ((ret = wolfsentry_table_cursor_init(wolfsentry, &cursor)) < 0)
+        goto out;
+
+    if ((ret = wolfsentry_table_cursor_seek(&table->header, &target->header, &cursor, &cursor_position)) < 0)
+        goto out;
+
+    if (inexact_matches)
+        *inexact_matches = WOLFSENTRY_ROUTE_FLAG_NONE;
+
+    /* return exact match immediately. */
+    if ((cursor_position == 0) && (exact_p || (! WOLFSENTRY_CHECK_BITS(((struct wolfsentry_route *)cursor.point)->flags, WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE)))) {
         *route = (struct wolfsentry_route *)cursor.point;
         ret = WOLFSENTRY_ERROR_ENCODE(OK);
         goto out;
@@ -634,7 +1378,7 @@ static wolfsentry_errcode_t wolfsentry_route_lookup_1(
     for (; i; i = (struct wolfsentry_route *)wolfsentry_table_cursor_prev(&cursor)) {
         if (WOLFSENTRY_CHECK_BITS(i->flags, WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE))
             continue;
-        cursor_position = wolfsentry_route_key_cmp_1(i, &target.route, 1 /* match_wildcards_p */, inexact_matches);
+        cursor_position = wolfsentry_route_key_cmp_1(i, (struct wolfsentry_route *)target, 1 /* match_wildcards_p */, inexact_matches);
         if (cursor_position == 0) {
             if (i->parent_event == NULL) {
                 *route = i;
@@ -665,13 +1409,39 @@ static wolfsentry_errcode_t wolfsentry_route_lookup_1(
   out:
 
     if (ret >= 0) {
-        if (! (flags & WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS))
+        if (! (target->flags & WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS))
             WOLFSENTRY_ATOMIC_INCREMENT((*route)->header.hitcount, 1);
     }
 
     return ret;
 }
 
+static wolfsentry_errcode_t wolfsentry_route_lookup_1(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_route_table *table,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    struct wolfsentry_event *parent_event,
+    int exact_p,
+    wolfsentry_route_flags_t *inexact_matches,
+    struct wolfsentry_route **route)
+{
+    struct {
+        struct wolfsentry_route route;
+        byte buf[WOLFSENTRY_MAX_ADDR_BYTES * 2];
+    } target;
+    wolfsentry_errcode_t ret;
+
+    if (! exact_p)
+        WOLFSENTRY_SET_BITS(flags, WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD);
+
+    if ((ret = wolfsentry_route_init(parent_event, remote, local, flags, 0 /* data_addr_offset */, sizeof target.buf, &target.route)) < 0)
+        return ret;
+
+    return wolfsentry_route_lookup_0(wolfsentry, table, &target.route, exact_p, inexact_matches, route);
+}
+
 wolfsentry_errcode_t wolfsentry_route_get_table_static(
     struct wolfsentry_context *wolfsentry,
     struct wolfsentry_route_table **table)
@@ -710,6 +1480,28 @@ wolfsentry_errcode_t wolfsentry_route_table_default_policy_get(
     WOLFSENTRY_RETURN_OK;
 }
 
+wolfsentry_errcode_t wolfsentry_route_table_purge_age_set(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    wolfsentry_time_t purge_age)
+{
+    if (purge_age < 0)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    table->purge_age = purge_age;
+    /* the tick length is derived from purge_age, so everything has to be refiled. */
+    return wolfsentry_route_table_purge_wheel_rebuild(wolfsentry, table);
+}
+
+wolfsentry_errcode_t wolfsentry_route_table_purge_age_get(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    wolfsentry_time_t *purge_age)
+{
+    (void)wolfsentry;
+    *purge_age = table->purge_age;
+    WOLFSENTRY_RETURN_OK;
+}
+
 wolfsentry_errcode_t wolfsentry_route_get_reference(
     struct wolfsentry_context *wolfsentry,
     const struct wolfsentry_route_table *table,
@@ -743,8 +1535,10 @@ static inline wolfsentry_errcode_t wolfsentry_route_delete_0(
     struct wolfsentry_route_table *route_table,
     struct wolfsentry_event *trigger_event,
     struct wolfsentry_route *route,
+    int from_peer_p,
     wolfsentry_action_res_t *action_results)
 {
+    struct wolfsentry_route_table *parent_table;
     wolfsentry_errcode_t ret;
 
     if (route->parent_event && route->parent_event->delete_event) {
@@ -761,9 +1555,17 @@ static inline wolfsentry_errcode_t wolfsentry_route_delete_0(
             WOLFSENTRY_WARN("wolfsentry_route_delete_0 returned " WOLFSENTRY_ERROR_FMT, WOLFSENTRY_ERROR_FMT_ARGS(ret));
     }
 
+    /* route_table isn't necessarily the table the route is in -- see wolfsentry_route_delete_1(). */
+    parent_table = (struct wolfsentry_route_table *)route->header.parent_table;
+    if (parent_table)
+        wolfsentry_route_purge_wheel_unlink(&parent_table->purge_wheel, route);
+    wolfsentry_route_penaltybox_unschedule(wolfsentry, route);
+
     if ((ret = wolfsentry_table_ent_delete_1(wolfsentry, &route->header)) < 0)
         return ret;
 
+    wolfsentry_route_journal_note(wolfsentry, parent_table, WOLFSENTRY_JOURNAL_RECORD_DELETE, route, from_peer_p);
+
     {
         wolfsentry_route_flags_t flags_before, flags_after;
         wolfsentry_route_update_flags_1(route, WOLFSENTRY_ROUTE_FLAG_NONE, WOLFSENTRY_ROUTE_FLAG_IN_TABLE, &flags_before, &flags_after);
@@ -792,7 +1594,7 @@ static inline wolfsentry_errcode_t wolfsentry_route_delete_1(
         if (lookup_ret < 0)
             break;
         WOLFSENTRY_CLEAR_BITS(*action_results, WOLFSENTRY_ACTION_RES_STOP);
-        ret = wolfsentry_route_delete_0(wolfsentry, caller_arg, route_table, NULL /* trigger_event */, route, action_results);
+        ret = wolfsentry_route_delete_0(wolfsentry, caller_arg, route_table, NULL /* trigger_event */, route, 0 /* from_peer_p */, action_results);
         if (ret < 0)
             break;
         else
@@ -880,12 +1682,13 @@ wolfsentry_errcode_t wolfsentry_route_delete_everywhere(
     return ret;
 }
 
-wolfsentry_errcode_t wolfsentry_route_delete_by_id(
+wolfsentry_errcode_t wolfsentry_route_delete_by_id_1(
     struct wolfsentry_context *wolfsentry,
     void *caller_arg, /* passed to action callback(s) as the caller_arg. */
     wolfsentry_ent_id_t id,
     const char *event_label,
     int event_label_len,
+    int from_peer_p,
     wolfsentry_action_res_t *action_results)
 {
     wolfsentry_errcode_t ret;
@@ -909,7 +1712,7 @@ wolfsentry_errcode_t wolfsentry_route_delete_by_id(
         goto out;
     }
 
-    ret = wolfsentry_route_delete_0(wolfsentry, caller_arg, (struct wolfsentry_route_table *)route->header.parent_table, event, route, action_results);
+    ret = wolfsentry_route_delete_0(wolfsentry, caller_arg, (struct wolfsentry_route_table *)route->header.parent_table, event, route, from_peer_p, action_results);
 
   out:
     if (event)
@@ -917,13 +1720,207 @@ wolfsentry_errcode_t wolfsentry_route_delete_by_id(
     return ret;
 }
 
+wolfsentry_errcode_t wolfsentry_route_delete_by_id(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t id,
+    const char *event_label,
+    int event_label_len,
+    wolfsentry_action_res_t *action_results)
+{
+    return wolfsentry_route_delete_by_id_1(wolfsentry, caller_arg, id, event_label, event_label_len, 0 /* from_peer_p */, action_results);
+}
+
+/* FNV-1a over the family and the leading addr_bits of the address, masked as
+ * addr_prefix_cmp() masks it.
+ */
+static inline uint64_t wolfsentry_addr_hash(wolfsentry_family_t sa_family, const byte *addr, wolfsentry_addr_bits_t addr_bits) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t whole_bytes = (size_t)addr_bits / BITS_PER_BYTE, i;
+    unsigned int left_over_bits = addr_bits % BITS_PER_BYTE;
+
+    hash = (hash ^ sa_family) * 1099511628211ULL;
+    for (i = 0; i < whole_bytes; ++i)
+        hash = (hash ^ addr[i]) * 1099511628211ULL;
+    if (left_over_bits)
+        hash = (hash ^ (addr[whole_bytes] & (byte)(0xffu << (BITS_PER_BYTE - left_over_bits)))) * 1099511628211ULL;
+    return hash;
+}
+
+/* returns the subnet slot for the remote address, or null if connections
+ * from its family aren't tracked by subnet, or if its prefix has no slot.
+ * with claim_p, a prefix without a slot claims the first free one it probes,
+ * and *full is set if they're all held by other subnets.
+ */
+static struct wolfsentry_subnet_slot *wolfsentry_route_subnet_slot(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_route *route,
+    const struct wolfsentry_sockaddr *remote,
+    int claim_p,
+    int *full)
+{
+    struct wolfsentry_subnet_connections *subnets = wolfsentry->subnet_connections;
+    wolfsentry_family_t sa_family = remote ? remote->sa_family : route->sa_family;
+    wolfsentry_addr_bits_t addr_len = remote ? remote->addr_len : route->remote.addr_len;
+    const byte *addr = remote ? remote->addr : WOLFSENTRY_ROUTE_REMOTE_ADDR(route);
+    struct wolfsentry_subnet_slot *slot, *free_slot = NULL;
+    byte prefix[WOLFSENTRY_MAX_ADDR_BYTES];
+    wolfsentry_addr_bits_t prefix_bits;
+    size_t prefix_bytes;
+    uint64_t hash;
+    unsigned int i;
+
+    *full = 0;
+
+    if (subnets == NULL)
+        return NULL;
+    for (i = 0; i < subnets->n_prefixes; ++i) {
+        if (subnets->prefixes[i].sa_family == sa_family)
+            break;
+    }
+    if ((i == subnets->n_prefixes) || (addr_len < subnets->prefixes[i].prefix_bits))
+        return NULL;
+    prefix_bits = subnets->prefixes[i].prefix_bits;
+
+    prefix_bytes = WOLFSENTRY_BITS_TO_BYTES((size_t)prefix_bits);
+    memset(prefix, 0, sizeof prefix);
+    memcpy(prefix, addr, prefix_bytes);
+    if (prefix_bits % BITS_PER_BYTE)
+        prefix[prefix_bytes - 1] &= (byte)(0xffu << (BITS_PER_BYTE - (prefix_bits % BITS_PER_BYTE)));
+
+    hash = wolfsentry_addr_hash(sa_family, prefix, prefix_bits);
+    for (i = 0; i < WOLFSENTRY_SUBNET_CONNECTION_PROBES; ++i) {
+        slot = &subnets->slots[(hash + i) & (WOLFSENTRY_SUBNET_CONNECTION_BUCKETS - 1)];
+        if (slot->count == 0) {
+            if (free_slot == NULL)
+                free_slot = slot;
+            continue;
+        }
+        if ((slot->sa_family == sa_family) && (memcmp(slot->prefix, prefix, prefix_bytes) == 0))
+            return slot;
+    }
+
+    if (! claim_p)
+        return NULL;
+    if (free_slot == NULL) {
+        *full = 1;
+        return NULL;
+    }
+    free_slot->sa_family = sa_family;
+    memcpy(free_slot->prefix, prefix, sizeof free_slot->prefix);
+    return free_slot;
+}
+
+wolfsentry_errcode_t wolfsentry_route_subnet_prefix_set(
+    struct wolfsentry_context *wolfsentry,
+    wolfsentry_family_t sa_family,
+    wolfsentry_addr_bits_t prefix_bits)
+{
+    struct wolfsentry_subnet_connections *subnets = wolfsentry->subnet_connections;
+    unsigned int i;
+
+    if (prefix_bits > WOLFSENTRY_MAX_ADDR_BYTES * BITS_PER_BYTE)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if (subnets == NULL) {
+        if (prefix_bits == 0)
+            WOLFSENTRY_RETURN_OK;
+        if ((subnets = (struct wolfsentry_subnet_connections *)WOLFSENTRY_MALLOC(sizeof *subnets)) == NULL)
+            WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+        memset(subnets, 0, sizeof *subnets);
+        wolfsentry->subnet_connections = subnets;
+    }
+
+    for (i = 0; i < subnets->n_prefixes; ++i) {
+        if (subnets->prefixes[i].sa_family == sa_family)
+            break;
+    }
+    if (i == subnets->n_prefixes) {
+        if (prefix_bits == 0)
+            WOLFSENTRY_RETURN_OK;
+        if (i == WOLFSENTRY_SUBNET_PREFIXES_MAX)
+            WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
+        ++subnets->n_prefixes;
+    } else if (subnets->prefixes[i].prefix_bits == prefix_bits)
+        WOLFSENTRY_RETURN_OK;
+
+    if (prefix_bits == 0) {
+        --subnets->n_prefixes;
+        subnets->prefixes[i] = subnets->prefixes[subnets->n_prefixes];
+    } else {
+        subnets->prefixes[i].sa_family = sa_family;
+        subnets->prefixes[i].prefix_bits = prefix_bits;
+    }
+
+    /* counts taken under the old prefixes no longer mean anything, and
+     * connections made under them mustn't be taken off the new ones.
+     */
+    memset(subnets->slots, 0, sizeof subnets->slots);
+    ++subnets->epoch;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+wolfsentry_errcode_t wolfsentry_route_subnet_prefix_get(
+    struct wolfsentry_context *wolfsentry,
+    wolfsentry_family_t sa_family,
+    wolfsentry_addr_bits_t *prefix_bits)
+{
+    unsigned int i;
+
+    *prefix_bits = 0;
+    if (wolfsentry->subnet_connections == NULL)
+        WOLFSENTRY_RETURN_OK;
+    for (i = 0; i < wolfsentry->subnet_connections->n_prefixes; ++i) {
+        if (wolfsentry->subnet_connections->prefixes[i].sa_family == sa_family) {
+            *prefix_bits = wolfsentry->subnet_connections->prefixes[i].prefix_bits;
+            break;
+        }
+    }
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* sliding-window count, approximated from fixed windows by weighting the
+ * previous window's count by the share of it still inside the sliding window.
+ */
+static uint32_t wolfsentry_route_derogatory_window_note(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route *route,
+    wolfsentry_time_t window)
+{
+    wolfsentry_time_t elapsed;
+
+    if (window <= 0)
+        return route->meta.derogatory_count;
+
+    elapsed = WOLFSENTRY_DIFF_TIME(route->meta.last_hit_time, route->meta.derogatory_window_start);
+    if ((route->meta.derogatory_window_start == 0) || (elapsed < 0) || (elapsed >= window * 2)) {
+        route->meta.derogatory_window_start = route->meta.last_hit_time;
+        route->meta.derogatory_window_count = 0;
+        route->meta.derogatory_window_prev_count = 0;
+        elapsed = 0;
+    } else if (elapsed >= window) {
+        route->meta.derogatory_window_start = WOLFSENTRY_ADD_TIME(route->meta.derogatory_window_start, window);
+        route->meta.derogatory_window_prev_count = route->meta.derogatory_window_count;
+        route->meta.derogatory_window_count = 0;
+        elapsed -= window;
+    }
+    if (route->meta.derogatory_window_count < MAX_UINT_OF(route->meta.derogatory_window_count))
+        ++route->meta.derogatory_window_count;
+
+    return route->meta.derogatory_window_count +
+        (uint32_t)(((uint64_t)route->meta.derogatory_window_prev_count * (uint64_t)(window - elapsed)) / (uint64_t)window);
+}
+
 static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
     struct wolfsentry_context *wolfsentry,
     struct wolfsentry_event *trigger_event,
     void *caller_arg, /* passed to action callback(s) as the caller_arg. */
     struct wolfsentry_route_table *route_table,
     struct wolfsentry_route *route,
+    const struct wolfsentry_sockaddr *remote, /* null to account the connection to the route's own remote address. */
     int inserted,
+    struct wolfsentry_route_connection *connection, /* if non-null, filled in when a connection is counted. */
     wolfsentry_action_res_t *action_results
     )
 {
@@ -962,8 +1959,29 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
             WOLFSENTRY_CLEAR_BITS(*action_results, WOLFSENTRY_ACTION_RES_STOP);
     }
 
+    /* token bucket -- an event is admitted if rate_limit_full_time is no more
+     * than rate_limit_tolerance ahead of now, and each admission spends one
+     * token interval.  disconnects always pass, so that connection counts stay
+     * balanced.
+     */
+    if ((config->rate_limit_interval > 0) &&
+        (! (route->flags & (WOLFSENTRY_ROUTE_FLAG_GREENLISTED|WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED))) &&
+        (! (*action_results & WOLFSENTRY_ACTION_RES_DISCONNECT)))
+    {
+        wolfsentry_time_t full_time = route->meta.rate_limit_full_time;
+        if (WOLFSENTRY_DIFF_TIME(full_time, route->meta.last_hit_time) < 0)
+            full_time = route->meta.last_hit_time;
+        else if (WOLFSENTRY_DIFF_TIME(full_time, route->meta.last_hit_time) > config->rate_limit_tolerance) {
+            *action_results |= WOLFSENTRY_ACTION_RES_REJECT;
+            WOLFSENTRY_RETURN_OK;
+        }
+        route->meta.rate_limit_full_time = WOLFSENTRY_ADD_TIME(full_time, config->rate_limit_interval);
+    }
+
     if (! (route->flags & WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_CURRENT_CONNECTIONS)) {
         if (*action_results & WOLFSENTRY_ACTION_RES_CONNECT) {
+            struct wolfsentry_subnet_slot *subnet_slot;
+            int subnet_full;
             if (route->meta.connection_count >= config->config.max_connection_count) {
                 *action_results |= WOLFSENTRY_ACTION_RES_REJECT;
                 WOLFSENTRY_RETURN_OK;
@@ -973,34 +1991,72 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
                 *action_results |= WOLFSENTRY_ACTION_RES_REJECT;
                 WOLFSENTRY_RETURN_OK;
             }
-        } else if (*action_results & WOLFSENTRY_ACTION_RES_DISCONNECT)
+            /* subnet counts are kept whether or not this event limits them, so
+             * that connects and disconnects pair up.  a subnet that can't get a
+             * slot can't be held to a limit, so it's refused under one.
+             */
+            subnet_slot = wolfsentry_route_subnet_slot(wolfsentry, route, remote, 1 /* claim_p */, &subnet_full);
+            if (subnet_full && (config->config.max_subnet_connection_count > 0)) {
+                WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(route->meta.connection_count);
+                *action_results |= WOLFSENTRY_ACTION_RES_REJECT;
+                WOLFSENTRY_RETURN_OK;
+            }
+            if (subnet_slot != NULL) {
+                if ((WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(subnet_slot->count) > config->config.max_subnet_connection_count) &&
+                    (config->config.max_subnet_connection_count > 0))
+                {
+                    WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(subnet_slot->count);
+                    WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(route->meta.connection_count);
+                    *action_results |= WOLFSENTRY_ACTION_RES_REJECT;
+                    WOLFSENTRY_RETURN_OK;
+                }
+            }
+            if (connection) {
+                connection->route = route;
+                if (subnet_slot) {
+                    connection->subnet_slot = (int)(subnet_slot - wolfsentry->subnet_connections->slots);
+                    connection->subnet_epoch = wolfsentry->subnet_connections->epoch;
+                } else
+                    connection->subnet_slot = -1;
+            }
+        } else if (*action_results & WOLFSENTRY_ACTION_RES_DISCONNECT) {
+            struct wolfsentry_subnet_slot *subnet_slot;
+            int subnet_full;
             WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(route->meta.connection_count);
+            if ((subnet_slot = wolfsentry_route_subnet_slot(wolfsentry, route, remote, 0 /* claim_p */, &subnet_full)) != NULL)
+                WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(subnet_slot->count);
+        }
     }
-    if (*action_results & WOLFSENTRY_ACTION_RES_DEROGATORY)
+    if (*action_results & WOLFSENTRY_ACTION_RES_DEROGATORY) {
         WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(route->meta.derogatory_count);
+        if ((config->config.derogatory_threshold_for_penaltybox > 0) &&
+            (! (route->flags & (WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED|WOLFSENTRY_ROUTE_FLAG_GREENLISTED))) &&
+            (wolfsentry_route_derogatory_window_note(wolfsentry, route, config->config.derogatory_window) >= config->config.derogatory_threshold_for_penaltybox))
+        {
+            wolfsentry_route_flags_t flags_before, flags_after;
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, route, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+        }
+    }
     if (*action_results & WOLFSENTRY_ACTION_RES_COMMENDABLE)
         WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(route->meta.commendable_count);
 
+    /* dispatch releases bounded penalty boxes as their deadlines pass, a few
+     * at a time from the head of the release queue, and always this route's
+     * own.  wolfsentry_route_penaltybox_release_expired() and the maintenance
+     * thread release them with no traffic.
+     */
+    if ((wolfsentry->penaltybox_queue.head != NULL) && (route->meta.last_hit_time != 0)) {
+        wolfsentry_hitcount_t budget = WOLFSENTRY_PENALTYBOX_RELEASES_PER_DISPATCH;
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_penaltybox_release_due(wolfsentry, caller_arg, route->meta.last_hit_time, &budget, NULL /* n_released */, NULL /* done */));
+        if ((route->penaltybox_release_time != 0) &&
+            (WOLFSENTRY_DIFF_TIME(route->meta.last_hit_time, route->penaltybox_release_time) >= 0))
+        {
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_penaltybox_release_1(wolfsentry, caller_arg, route));
+        }
+    }
+
     if ((route->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED)) {
-        if ((config->config.penaltybox_duration > 0) && (route->meta.last_penaltybox_time != 0)) {
-            wolfsentry_time_t now;
-            wolfsentry_errcode_t ret = WOLFSENTRY_GET_TIME(&now);
-            if (ret < 0)
-                return ret;
-            if (WOLFSENTRY_DIFF_TIME(now, route->meta.last_penaltybox_time) > config->config.penaltybox_duration) {
-                wolfsentry_route_flags_t flags_before, flags_after;
-                WOLFSENTRY_WARN_ON_FAILURE(
-                    wolfsentry_route_update_flags(
-                        wolfsentry,
-                        route,
-                        WOLFSENTRY_ROUTE_FLAG_NONE,
-                        WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED,
-                        &flags_before,
-                        &flags_after));
-            } else
-                *action_results |= WOLFSENTRY_ACTION_RES_REJECT;
-        } else
-            *action_results |= WOLFSENTRY_ACTION_RES_REJECT;
+        *action_results |= WOLFSENTRY_ACTION_RES_REJECT;
         WOLFSENTRY_RETURN_OK;
     } else if ((route->flags & WOLFSENTRY_ROUTE_FLAG_GREENLISTED)) {
         *action_results |= WOLFSENTRY_ACTION_RES_ACCEPT;
@@ -1015,53 +2071,118 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_0(
     WOLFSENTRY_RETURN_OK;
 }
 
-static wolfsentry_errcode_t wolfsentry_route_event_dispatch_1(
+/* conservative-update count-min sketch -- only the counters at the current
+ * minimum are raised, which keeps collisions from inflating the estimate for
+ * heavy hitters.
+ */
+static wolfsentry_errcode_t wolfsentry_route_admission_check(
     struct wolfsentry_context *wolfsentry,
-    const struct wolfsentry_sockaddr *remote,
-    const struct wolfsentry_sockaddr *local,
-    wolfsentry_route_flags_t flags,
-    const char *event_label,
-    int event_label_len,
-    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
-    wolfsentry_ent_id_t *id,
+    struct wolfsentry_event *parent_event,
+    const struct wolfsentry_flow_key *flow,
+    int *admit)
+{
+    struct wolfsentry_eventconfig_internal *config = parent_event->config ? parent_event->config : &wolfsentry->config;
+    struct wolfsentry_admission_sketch *sketch;
+    uint64_t hash;
+    uint32_t h1, h2;
+    unsigned int slots[WOLFSENTRY_ADMISSION_SKETCH_DEPTH];
+    unsigned int row, slot;
+    byte estimate = WOLFSENTRY_ADMISSION_SKETCH_COUNT_MAX;
+
+    if (config->config.route_admission_threshold == 0) {
+        *admit = 1;
+        WOLFSENTRY_RETURN_OK;
+    }
+
+    if ((sketch = parent_event->admission_sketch) == NULL) {
+        if ((sketch = (struct wolfsentry_admission_sketch *)WOLFSENTRY_MALLOC(sizeof *sketch)) == NULL)
+            WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+        memset(sketch, 0, sizeof *sketch);
+        parent_event->admission_sketch = sketch;
+    }
+
+    if (flow->remote_hash_valid)
+        hash = flow->remote_hash;
+    else
+        hash = wolfsentry_addr_hash(flow->remote->sa_family, flow->remote->addr, flow->remote->addr_len);
+    h1 = (uint32_t)hash;
+    h2 = (uint32_t)(hash >> 32) | 1U;
+
+    for (row = 0; row < WOLFSENTRY_ADMISSION_SKETCH_DEPTH; ++row) {
+        slots[row] = (h1 + row * h2) & (WOLFSENTRY_ADMISSION_SKETCH_WIDTH - 1);
+        if (sketch->counts[row][slots[row]] < estimate)
+            estimate = sketch->counts[row][slots[row]];
+    }
+    if (estimate < WOLFSENTRY_ADMISSION_SKETCH_COUNT_MAX) {
+        for (row = 0; row < WOLFSENTRY_ADMISSION_SKETCH_DEPTH; ++row) {
+            if (sketch->counts[row][slots[row]] == estimate)
+                ++sketch->counts[row][slots[row]];
+        }
+        ++estimate;
+    }
+
+    if (++sketch->n_since_decay >= WOLFSENTRY_ADMISSION_SKETCH_DECAY_PERIOD) {
+        for (row = 0; row < WOLFSENTRY_ADMISSION_SKETCH_DEPTH; ++row) {
+            for (slot = 0; slot < WOLFSENTRY_ADMISSION_SKETCH_WIDTH; ++slot)
+                sketch->counts[row][slot] >>= 1;
+        }
+        sketch->n_since_decay = 0;
+    }
+
+    *admit = (estimate > config->config.route_admission_threshold);
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* consumes the caller's reference to trigger_event, if any. */
+static wolfsentry_errcode_t wolfsentry_route_event_dispatch_2(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_flow_key *flow,
+    struct wolfsentry_event *trigger_event,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    struct wolfsentry_route_connection *connection,
+    wolfsentry_ent_id_t *id,
     wolfsentry_route_flags_t *inexact_matches,
     wolfsentry_action_res_t *action_results
     )
 {
     struct wolfsentry_route_table *route_table = NULL;
     struct wolfsentry_route *route;
-    struct wolfsentry_event *trigger_event = NULL;
     int inserted = 0;
     wolfsentry_errcode_t ret;
 
-    if (event_label) {
-        if ((ret = wolfsentry_event_get_reference(wolfsentry, event_label, event_label_len, &trigger_event)) < 0)
-            return ret;
-    }
-
     if (id)
         *id = WOLFSENTRY_ENT_ID_NONE;
 
-    if ((ret = wolfsentry_route_lookup_1(wolfsentry, &wolfsentry->routes_static, remote, local, flags, NULL /* event */, 0 /* exact_p */, inexact_matches, &route)) >= 0) {
+    if ((ret = wolfsentry_route_lookup_0(wolfsentry, &wolfsentry->routes_static, &flow->target, 0 /* exact_p */, inexact_matches, &route)) >= 0) {
         route_table = &wolfsentry->routes_static;
     } else if (WOLFSENTRY_CHECK_BITS(wolfsentry->routes_static.default_policy, WOLFSENTRY_ACTION_RES_STOP)) {
         ret = WOLFSENTRY_ERROR_ENCODE(OK);
         goto out;
-    } else if ((ret = wolfsentry_route_lookup_1(wolfsentry, &wolfsentry->routes_dynamic, remote, local, flags, NULL /* event */, 0 /* exact_p */, inexact_matches, &route)) >= 0) {
+    } else if ((ret = wolfsentry_route_lookup_0(wolfsentry, &wolfsentry->routes_dynamic, &flow->target, 0 /* exact_p */, inexact_matches, &route)) >= 0) {
         route_table = &wolfsentry->routes_dynamic;
     } else if (trigger_event || wolfsentry->routes_dynamic.default_event) {
         struct wolfsentry_event *parent_event;
-
-        route_table = &wolfsentry->routes_dynamic;
+        int admit;
 
         if (trigger_event)
             parent_event = trigger_event;
-        else {
-            parent_event = route_table->default_event;
-            WOLFSENTRY_REFCOUNT_INCREMENT(parent_event->header.refcount);
+        else
+            parent_event = wolfsentry->routes_dynamic.default_event;
+
+        if ((ret = wolfsentry_route_admission_check(wolfsentry, parent_event, flow, &admit)) < 0)
+            goto out;
+        if (! admit) {
+            /* handled as if no route matched, without allocating one. */
+            ret = WOLFSENTRY_ERROR_ENCODE(NOT_INSERTED); /* not an error */
+            goto out;
         }
 
-        if ((ret = wolfsentry_route_new(wolfsentry, parent_event, remote, local, flags, &route)) < 0) {
+        route_table = &wolfsentry->routes_dynamic;
+
+        if (! trigger_event)
+            WOLFSENTRY_REFCOUNT_INCREMENT(parent_event->header.refcount);
+
+        if ((ret = wolfsentry_route_new(wolfsentry, parent_event, flow->remote, flow->local, flow->flags, &route)) < 0) {
             WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(wolfsentry, parent_event, NULL /* action_results */));
             return ret;
         }
@@ -1080,7 +2201,7 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_1(
             WOLFSENTRY_SET_BITS(*action_results, WOLFSENTRY_ACTION_RES_INSERT);
 
         if ((ret >= 0) && (*action_results & WOLFSENTRY_ACTION_RES_INSERT)) {
-            WOLFSENTRY_WARN_ON_FAILURE(ret = wolfsentry_route_insert_1(wolfsentry, caller_arg, route_table, route, parent_event, action_results));
+            WOLFSENTRY_WARN_ON_FAILURE(ret = wolfsentry_route_insert_1(wolfsentry, caller_arg, route_table, route, parent_event, 0 /* from_peer_p */, action_results));
             if (ret < 0) {
                 WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_drop_reference_1(wolfsentry, route, NULL /* action_results */));
                 return ret;
@@ -1103,7 +2224,7 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_1(
     if (id)
         *id = route->header.id;
 
-    ret = wolfsentry_route_event_dispatch_0(wolfsentry, trigger_event, caller_arg, route_table, route, inserted, action_results);
+    ret = wolfsentry_route_event_dispatch_0(wolfsentry, trigger_event, caller_arg, route_table, route, flow->remote, inserted, connection, action_results);
 
   out:
 
@@ -1123,6 +2244,56 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_1(
     return ret;
 }
 
+/* flow must have room after it for the remote and local addresses.  the
+ * sockaddrs are referenced, not copied.
+ */
+static wolfsentry_errcode_t wolfsentry_flow_key_init(
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    int data_addr_size,
+    struct wolfsentry_flow_key *flow)
+{
+    flow->remote = remote;
+    flow->local = local;
+    flow->flags = flags;
+    flow->remote_hash = 0;
+    flow->remote_hash_valid = 0;
+    WOLFSENTRY_SET_BITS(flags, WOLFSENTRY_ROUTE_FLAG_PARENT_EVENT_WILDCARD);
+    return wolfsentry_route_init(NULL /* parent_event */, remote, local, flags, 0 /* data_addr_offset */, data_addr_size, &flow->target);
+}
+
+static wolfsentry_errcode_t wolfsentry_route_event_dispatch_1(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results
+    )
+{
+    struct {
+        struct wolfsentry_flow_key flow;
+        byte buf[WOLFSENTRY_MAX_ADDR_BYTES * 2];
+    } flow;
+    struct wolfsentry_event *trigger_event = NULL;
+    wolfsentry_errcode_t ret;
+
+    if ((ret = wolfsentry_flow_key_init(remote, local, flags, sizeof flow.buf, &flow.flow)) < 0)
+        return ret;
+
+    if (event_label) {
+        if ((ret = wolfsentry_event_get_reference(wolfsentry, event_label, event_label_len, &trigger_event)) < 0)
+            return ret;
+    }
+
+    return wolfsentry_route_event_dispatch_2(wolfsentry, &flow.flow, trigger_event, caller_arg, NULL /* connection */, id, inexact_matches, action_results);
+}
+
 wolfsentry_errcode_t wolfsentry_route_event_dispatch(
     struct wolfsentry_context *wolfsentry,
     const struct wolfsentry_sockaddr *remote,
@@ -1171,6 +2342,283 @@ wolfsentry_errcode_t wolfsentry_route_event_dispatch_with_inited_result(
     return wolfsentry_route_event_dispatch_1(wolfsentry, remote, local, flags, event_label, event_label_len, caller_arg, id, inexact_matches, action_results);
 }
 
+/* the handle is allocated up front, so that a connection is never counted
+ * without one to release it.
+ */
+wolfsentry_errcode_t wolfsentry_route_event_dispatch_connect(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    struct wolfsentry_route_connection **connection,
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results
+    )
+{
+    struct {
+        struct wolfsentry_flow_key flow;
+        byte buf[WOLFSENTRY_MAX_ADDR_BYTES * 2];
+    } flow;
+    struct wolfsentry_event *trigger_event = NULL;
+    struct wolfsentry_route_connection *new_connection;
+    wolfsentry_errcode_t ret;
+
+    if (connection == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    *connection = NULL;
+    if ((ret = check_user_inited_result(*action_results)) < 0)
+        return ret;
+    WOLFSENTRY_SET_BITS(*action_results, WOLFSENTRY_ACTION_RES_CONNECT);
+
+    if ((ret = wolfsentry_flow_key_init(remote, local, flags, sizeof flow.buf, &flow.flow)) < 0)
+        return ret;
+
+    if ((new_connection = (struct wolfsentry_route_connection *)WOLFSENTRY_MALLOC(sizeof *new_connection)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    new_connection->route = NULL;
+    new_connection->subnet_slot = -1;
+    new_connection->subnet_epoch = 0;
+
+    if (event_label) {
+        if ((ret = wolfsentry_event_get_reference(wolfsentry, event_label, event_label_len, &trigger_event)) < 0) {
+            WOLFSENTRY_FREE(new_connection);
+            return ret;
+        }
+    }
+
+    ret = wolfsentry_route_event_dispatch_2(wolfsentry, &flow.flow, trigger_event, caller_arg, new_connection, id, inexact_matches, action_results);
+
+    if (new_connection->route) {
+        WOLFSENTRY_REFCOUNT_INCREMENT(new_connection->route->header.refcount);
+        *connection = new_connection;
+    } else
+        WOLFSENTRY_FREE(new_connection);
+
+    return ret;
+}
+
+/* the O(1) counterpart of a DISCONNECT dispatch -- no lookup, and no actions
+ * are dispatched.
+ */
+wolfsentry_errcode_t wolfsentry_route_disconnect(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_connection **connection,
+    wolfsentry_action_res_t *action_results)
+{
+    struct wolfsentry_route_connection *c;
+    struct wolfsentry_subnet_connections *subnets = wolfsentry->subnet_connections;
+    wolfsentry_errcode_t ret;
+
+    if ((connection == NULL) || ((c = *connection) == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (action_results)
+        WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+
+    if (c->route->meta.connection_count > 0)
+        WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(c->route->meta.connection_count);
+    /* a prefix change since the connect cleared the subnet slots, and the
+     * slot may now count other connections.
+     */
+    if ((c->subnet_slot >= 0) && subnets && (c->subnet_epoch == subnets->epoch) && (subnets->slots[c->subnet_slot].count > 0))
+        WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(subnets->slots[c->subnet_slot].count);
+
+    ret = wolfsentry_route_drop_reference_1(wolfsentry, c->route, action_results);
+    WOLFSENTRY_FREE(c);
+    *connection = NULL;
+    return ret;
+}
+
+/* the event label is resolved once for the whole batch, and each entry
+ * borrows a reference to it.  the next entry's flow key is built while the
+ * current one is still to be dispatched, and the heads of the route tables,
+ * where every lookup's walk starts, are prefetched ahead of each dispatch.
+ */
+wolfsentry_errcode_t wolfsentry_route_event_dispatch_batch(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_sockaddr * const *remotes,
+    const struct wolfsentry_sockaddr * const *locals,
+    const wolfsentry_route_flags_t *flags,
+    size_t n_dispatches,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *ids,
+    wolfsentry_action_res_t *action_results,
+    wolfsentry_errcode_t *rets)
+{
+    struct {
+        struct wolfsentry_flow_key flow;
+        byte buf[WOLFSENTRY_MAX_ADDR_BYTES * 2];
+    } flows[2];
+    wolfsentry_errcode_t flow_rets[2];
+    struct wolfsentry_event *trigger_event = NULL;
+    wolfsentry_errcode_t ret, first_error = WOLFSENTRY_ERROR_ENCODE(OK);
+    size_t i;
+
+    if ((remotes == NULL) || (locals == NULL) || (flags == NULL) || (action_results == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if (event_label) {
+        if ((ret = wolfsentry_event_get_reference(wolfsentry, event_label, event_label_len, &trigger_event)) < 0)
+            return ret;
+    }
+
+    if (n_dispatches > 0)
+        flow_rets[0] = wolfsentry_flow_key_init(remotes[0], locals[0], flags[0], sizeof flows[0].buf, &flows[0].flow);
+
+    for (i = 0; i < n_dispatches; ++i) {
+        size_t cur = i & 1U;
+        if (i + 1 < n_dispatches)
+            flow_rets[cur ^ 1U] = wolfsentry_flow_key_init(remotes[i + 1], locals[i + 1], flags[i + 1], sizeof flows[0].buf, &flows[cur ^ 1U].flow);
+        WOLFSENTRY_PREFETCH(wolfsentry->routes_static.header.head);
+        WOLFSENTRY_PREFETCH(wolfsentry->routes_dynamic.header.head);
+        WOLFSENTRY_CLEAR_ALL_BITS(action_results[i]);
+        if ((ret = flow_rets[cur]) >= 0) {
+            if (trigger_event)
+                WOLFSENTRY_REFCOUNT_INCREMENT(trigger_event->header.refcount);
+            ret = wolfsentry_route_event_dispatch_2(
+                wolfsentry,
+                &flows[cur].flow,
+                trigger_event,
+                caller_arg,
+                NULL /* connection */,
+                ids ? &ids[i] : NULL,
+                NULL /* inexact_matches */,
+                &action_results[i]);
+        }
+        if (rets)
+            rets[i] = ret;
+        else if ((ret < 0) && (first_error >= 0))
+            first_error = ret;
+    }
+
+    if (trigger_event)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(wolfsentry, trigger_event, NULL /* action_results */));
+
+    /* without rets, a failed dispatch would otherwise go unreported. */
+    if (first_error < 0)
+        return first_error;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* one allocation holds the key, its route buffer, and the copies of the
+ * sockaddrs that it references.
+ */
+struct wolfsentry_flow_key_alloc {
+    struct wolfsentry_flow_key flow; /* must be first -- callers get &flow. */
+    byte buf[WOLFSENTRY_MAX_ADDR_BYTES * 2];
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[WOLFSENTRY_MAX_ADDR_BYTES];
+    } remote, local;
+};
+
+wolfsentry_errcode_t wolfsentry_flow_key_new(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    struct wolfsentry_flow_key **flow_key)
+{
+    struct wolfsentry_flow_key_alloc *alloc;
+    wolfsentry_errcode_t ret;
+
+    if ((remote == NULL) || (local == NULL) || (flow_key == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if ((WOLFSENTRY_BITS_TO_BYTES((size_t)remote->addr_len) > WOLFSENTRY_MAX_ADDR_BYTES) ||
+        (WOLFSENTRY_BITS_TO_BYTES((size_t)local->addr_len) > WOLFSENTRY_MAX_ADDR_BYTES))
+        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+
+    if ((alloc = (struct wolfsentry_flow_key_alloc *)WOLFSENTRY_MALLOC(sizeof *alloc)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+
+    memcpy(&alloc->remote.sa, remote, offsetof(struct wolfsentry_sockaddr, addr) + WOLFSENTRY_BITS_TO_BYTES((size_t)remote->addr_len));
+    memcpy(&alloc->local.sa, local, offsetof(struct wolfsentry_sockaddr, addr) + WOLFSENTRY_BITS_TO_BYTES((size_t)local->addr_len));
+
+    if ((ret = wolfsentry_flow_key_init(&alloc->remote.sa, &alloc->local.sa, flags, sizeof alloc->buf, &alloc->flow)) < 0) {
+        WOLFSENTRY_FREE(alloc);
+        return ret;
+    }
+    alloc->flow.remote_hash = wolfsentry_addr_hash(remote->sa_family, remote->addr, remote->addr_len);
+    alloc->flow.remote_hash_valid = 1;
+
+    *flow_key = &alloc->flow;
+    WOLFSENTRY_RETURN_OK;
+}
+
+wolfsentry_errcode_t wolfsentry_flow_key_free(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_flow_key **flow_key)
+{
+    if ((flow_key == NULL) || (*flow_key == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    WOLFSENTRY_FREE(*flow_key);
+    *flow_key = NULL;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_flow_key_1(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_flow_key *flow_key,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results
+    )
+{
+    struct wolfsentry_event *trigger_event = NULL;
+
+    if (flow_key == NULL)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if (event_label) {
+        wolfsentry_errcode_t ret;
+        if ((ret = wolfsentry_event_get_reference(wolfsentry, event_label, event_label_len, &trigger_event)) < 0)
+            return ret;
+    }
+
+    return wolfsentry_route_event_dispatch_2(wolfsentry, flow_key, trigger_event, caller_arg, NULL /* connection */, id, inexact_matches, action_results);
+}
+
+wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_flow_key(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_flow_key *flow_key,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results
+    )
+{
+    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+    return wolfsentry_route_event_dispatch_by_flow_key_1(wolfsentry, flow_key, event_label, event_label_len, caller_arg, id, inexact_matches, action_results);
+}
+
+wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_flow_key_with_inited_result(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_flow_key *flow_key,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results
+    )
+{
+    int ret = check_user_inited_result(*action_results);
+    if (ret < 0)
+        return ret;
+    return wolfsentry_route_event_dispatch_by_flow_key_1(wolfsentry, flow_key, event_label, event_label_len, caller_arg, id, inexact_matches, action_results);
+}
+
 static wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_id_1(
     struct wolfsentry_context *wolfsentry,
     wolfsentry_ent_id_t id,
@@ -1200,7 +2648,7 @@ static wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_id_1(
         goto out;
     }
 
-    ret = wolfsentry_route_event_dispatch_0(wolfsentry, trigger_event, caller_arg, (struct wolfsentry_route_table *)route->header.parent_table, route, 0 /* inserted */, action_results);
+    ret = wolfsentry_route_event_dispatch_0(wolfsentry, trigger_event, caller_arg, (struct wolfsentry_route_table *)route->header.parent_table, route, NULL /* remote */, 0 /* inserted */, NULL /* connection */, action_results);
 
   out:
     if (trigger_event)
@@ -1237,52 +2685,435 @@ wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_id_with_inited_result(
 }
 
 
-struct check_if_route_expired_args {
-    struct wolfsentry_context *wolfsentry;
-    struct wolfsentry_route_table *table;
-    wolfsentry_time_t now;
-};
-
-static wolfsentry_errcode_t check_if_route_expired(struct check_if_route_expired_args *args, struct wolfsentry_route *route, wolfsentry_action_res_t *action_results) {
-    (void)action_results;
-    if (args->wolfsentry->timecbs.diff_time(args->now, route->meta.last_hit_time) < args->table->purge_age)
-        return 1;
-    else
-        return 0;
-}
-
 static wolfsentry_errcode_t wolfsentry_route_delete_for_filter(
     struct wolfsentry_context *wolfsentry,
     struct wolfsentry_route *route,
     wolfsentry_action_res_t *action_results)
 {
+    wolfsentry_action_res_t local_action_results = WOLFSENTRY_ACTION_RES_NONE;
+    /* wolfsentry_table_map() passes no action_results. */
+    if (action_results == NULL)
+        action_results = &local_action_results;
     return wolfsentry_route_delete_0(
         wolfsentry,
         NULL /* caller_arg */,
         (struct wolfsentry_route_table *)route->header.parent_table,
         NULL /* trigger_event */,
         route,
+        0 /* from_peer_p */,
         action_results
         );
 }
 
+/* delete the routes on the due list that have gone stale, and put the rest
+ * back on the wheel at their current deadlines.  stops early, leaving the
+ * remainder on the due list, if *budget runs out.
+ */
+static wolfsentry_errcode_t wolfsentry_route_purge_wheel_process_due(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    wolfsentry_time_t now,
+    wolfsentry_hitcount_t *budget)
+{
+    struct wolfsentry_route_purge_wheel *wheel = &table->purge_wheel;
+    struct wolfsentry_list_ent_header *i;
+    wolfsentry_errcode_t ret;
+
+    while ((i = wheel->due.head) != NULL) {
+        struct wolfsentry_route *route = WOLFSENTRY_ROUTE_FROM_PURGE_LINK(i);
+        if (budget) {
+            if (*budget == 0)
+                break;
+            --*budget;
+        }
+        wolfsentry_route_purge_wheel_unlink(wheel, route);
+        if (WOLFSENTRY_DIFF_TIME(now, wolfsentry_route_last_activity(route)) >= table->purge_age) {
+            wolfsentry_action_res_t action_results = WOLFSENTRY_ACTION_RES_NONE;
+            if ((ret = wolfsentry_route_delete_0(wolfsentry, NULL /* caller_arg */, table, NULL /* trigger_event */, route, 0 /* from_peer_p */, &action_results)) < 0)
+                return ret;
+        } else
+            wolfsentry_route_purge_wheel_place(wolfsentry, table, route);
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+wolfsentry_errcode_t wolfsentry_route_stale_purge_1(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    wolfsentry_hitcount_t *budget,
+    int *done)
+{
+    struct wolfsentry_route_purge_wheel *wheel = &table->purge_wheel;
+    wolfsentry_time_t now, now_tick;
+    unsigned int level;
+    wolfsentry_errcode_t ret;
+
+    if (done)
+        *done = 0;
+
+    if ((ret = WOLFSENTRY_GET_TIME(&now)) < 0)
+        return ret;
+    now_tick = wolfsentry_route_purge_wheel_tick(wheel, now);
+
+    /* finish off anything left over from a previous call that ran out of budget. */
+    if ((ret = wolfsentry_route_purge_wheel_process_due(wolfsentry, table, now, budget)) < 0)
+        return ret;
+    if (wheel->due.head)
+        WOLFSENTRY_RETURN_OK;
+
+    if ((wheel->sweep_slot == WOLFSENTRY_ROUTE_PURGE_SLOT_DUE) &&
+        (now_tick - wheel->next_tick >= ((wolfsentry_time_t)WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS << WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS)))
+    {
+        /* too far behind to step tick by tick -- reconsider everything.  the
+         * wheel is anchored at the present before the sweep starts, so routes
+         * placed while it's under way land where the tick walk will find them,
+         * or in a slot it has yet to empty.
+         */
+        wheel->sweep_slot = 0;
+        wheel->next_tick = now_tick + 1;
+    }
+
+    while (wheel->sweep_slot < WOLFSENTRY_ROUTE_PURGE_SLOT_DUE) {
+        if (! wolfsentry_route_purge_wheel_move_to_due(wheel, wheel->sweep_slot, budget))
+            break;
+        ++wheel->sweep_slot;
+    }
+    if ((ret = wolfsentry_route_purge_wheel_process_due(wolfsentry, table, now, budget)) < 0)
+        return ret;
+    if (wheel->due.head || (wheel->sweep_slot < WOLFSENTRY_ROUTE_PURGE_SLOT_DUE))
+        WOLFSENTRY_RETURN_OK;
+
+    while ((wheel->next_tick <= now_tick) && (wheel->n_scheduled > 0)) {
+        wolfsentry_time_t tick = wheel->next_tick;
+
+        /* a tick whose moves run out of budget is done over by the next call.
+         * the cascades are safe to repeat -- nothing is placed in the slots
+         * they empty until the tick has passed.
+         */
+        for (level = WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS - 1; level > 0; --level) {
+            if ((tick & (((wolfsentry_time_t)1 << (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS * level)) - 1)) != 0)
+                continue;
+            if (! wolfsentry_route_purge_wheel_cascade(
+                    wolfsentry,
+                    table,
+                    (level * WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS) + (unsigned int)((tick >> (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS * level)) & (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS - 1)),
+                    budget))
+                WOLFSENTRY_RETURN_OK;
+        }
+
+        if (! wolfsentry_route_purge_wheel_move_to_due(wheel, (unsigned int)(tick & (WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS - 1)), budget))
+            WOLFSENTRY_RETURN_OK;
+        wheel->next_tick = tick + 1;
+        if ((ret = wolfsentry_route_purge_wheel_process_due(wolfsentry, table, now, budget)) < 0)
+            return ret;
+        if (wheel->due.head)
+            WOLFSENTRY_RETURN_OK;
+    }
+
+    if (wheel->n_scheduled == 0)
+        wheel->next_tick = now_tick + 1;
+
+    if (done)
+        *done = 1;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
 wolfsentry_errcode_t wolfsentry_route_stale_purge(
     struct wolfsentry_context *wolfsentry,
     struct wolfsentry_route_table *table)
 {
-    struct check_if_route_expired_args check_if_route_expired_args;
+    return wolfsentry_route_stale_purge_1(wolfsentry, table, NULL /* budget */, NULL /* done */);
+}
+
+wolfsentry_errcode_t wolfsentry_route_stale_purge_incremental(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    wolfsentry_hitcount_t max_entries,
+    int *done)
+{
+    /* the resume position is the wheel itself -- routes examined are
+     * removed from the due list, and inserts and deletes keep it current.
+     */
+    return wolfsentry_route_stale_purge_1(wolfsentry, table, max_entries ? &max_entries : NULL, done);
+}
+
+wolfsentry_errcode_t wolfsentry_route_penaltybox_release_expired_1(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_hitcount_t *budget,
+    int *n_released,
+    int *done)
+{
+    wolfsentry_time_t now;
     wolfsentry_errcode_t ret;
-    if ((ret = WOLFSENTRY_GET_TIME(&check_if_route_expired_args.now)) < 0)
+
+    if (n_released)
+        *n_released = 0;
+    if (done)
+        *done = 1;
+
+    if (wolfsentry->penaltybox_queue.head == NULL)
+        WOLFSENTRY_RETURN_OK;
+
+    if ((ret = WOLFSENTRY_GET_TIME(&now)) < 0)
         return ret;
-    check_if_route_expired_args.wolfsentry = wolfsentry;
-    check_if_route_expired_args.table = table;
-    return wolfsentry_table_filter(
-        wolfsentry,
-        &table->header,
-        (wolfsentry_filter_function_t)check_if_route_expired,
-        &check_if_route_expired_args,
-        (wolfsentry_dropper_function_t)wolfsentry_route_delete_for_filter,
-        wolfsentry);
+
+    return wolfsentry_route_penaltybox_release_due(wolfsentry, caller_arg, now, budget, n_released, done);
+}
+
+wolfsentry_errcode_t wolfsentry_route_penaltybox_release_expired(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    int *n_released)
+{
+    return wolfsentry_route_penaltybox_release_expired_1(wolfsentry, caller_arg, NULL /* budget */, n_released, NULL /* done */);
+}
+
+/* groups per block tracked on the stack -- blocks with more spill to the
+ * heap.  the groups differ only in their local side, so their number is set
+ * by the local configuration, not by the remote addresses being boxed.
+ */
+#ifndef WOLFSENTRY_ROUTE_AGGREGATE_MAX_KEYS
+#define WOLFSENTRY_ROUTE_AGGREGATE_MAX_KEYS 4
+#endif
+
+struct wolfsentry_route_aggregate_key {
+    struct wolfsentry_route *leader;
+    struct wolfsentry_route *aggregate;
+    int n_members;
+};
+
+static int wolfsentry_route_remote_prefix_eq(
+    struct wolfsentry_route *left,
+    struct wolfsentry_route *right,
+    wolfsentry_addr_bits_t prefix_bits)
+{
+    return addr_prefix_cmp(WOLFSENTRY_ROUTE_REMOTE_ADDR(left), WOLFSENTRY_ROUTE_REMOTE_ADDR(right), (size_t)prefix_bits) == 0;
+}
+
+/* everything but the remote address and port must match for routes to share
+ * an aggregate.
+ */
+static int wolfsentry_route_aggregate_key_eq(
+    struct wolfsentry_route *left,
+    struct wolfsentry_route *right)
+{
+    wolfsentry_route_flags_t key_flags = WOLFSENTRY_ROUTE_IMMUTABLE_FLAGS & ~(wolfsentry_route_flags_t)WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD;
+
+    return (left->sa_family == right->sa_family) &&
+        (left->sa_proto == right->sa_proto) &&
+        (left->parent_event == right->parent_event) &&
+        ((left->flags & key_flags) == (right->flags & key_flags)) &&
+        (left->remote.interface == right->remote.interface) &&
+        (left->local.interface == right->local.interface) &&
+        (left->local.sa_port == right->local.sa_port) &&
+        (left->local.addr_len == right->local.addr_len) &&
+        (! memcmp(WOLFSENTRY_ROUTE_LOCAL_ADDR(left), WOLFSENTRY_ROUTE_LOCAL_ADDR(right), WOLFSENTRY_BITS_TO_BYTES((size_t)left->local.addr_len)));
+}
+
+static inline uint16_t wolfsentry_route_aggregate_sum(uint16_t left, uint16_t right) {
+    return (left > MAX_UINT_OF(left) - right) ? (uint16_t)MAX_UINT_OF(left) : (uint16_t)(left + right);
+}
+
+static void wolfsentry_route_aggregate_merge(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route *into,
+    const struct wolfsentry_route *from)
+{
+    if (WOLFSENTRY_DIFF_TIME(from->meta.insert_time, into->meta.insert_time) < 0)
+        into->meta.insert_time = from->meta.insert_time;
+    if (WOLFSENTRY_DIFF_TIME(from->meta.last_hit_time, into->meta.last_hit_time) > 0)
+        into->meta.last_hit_time = from->meta.last_hit_time;
+    if (WOLFSENTRY_DIFF_TIME(from->meta.last_penaltybox_time, into->meta.last_penaltybox_time) > 0)
+        into->meta.last_penaltybox_time = from->meta.last_penaltybox_time;
+    into->header.hitcount += from->header.hitcount;
+    into->meta.derogatory_count = wolfsentry_route_aggregate_sum(into->meta.derogatory_count, from->meta.derogatory_count);
+    into->meta.commendable_count = wolfsentry_route_aggregate_sum(into->meta.commendable_count, from->meta.commendable_count);
+}
+
+static wolfsentry_errcode_t wolfsentry_route_aggregate_new(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *leader,
+    wolfsentry_addr_bits_t prefix_bits,
+    struct wolfsentry_route **aggregate)
+{
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte buf[WOLFSENTRY_MAX_ADDR_BYTES];
+    } remote, local;
+    wolfsentry_route_flags_t flags =
+        (leader->flags & (WOLFSENTRY_ROUTE_IMMUTABLE_FLAGS | WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS | WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_CURRENT_CONNECTIONS)) |
+        WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD |
+        WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED;
+    wolfsentry_action_res_t action_results = WOLFSENTRY_ACTION_RES_NONE;
+    wolfsentry_errcode_t ret;
+
+    if (WOLFSENTRY_BITS_TO_BYTES((size_t)leader->local.addr_len) > sizeof local.buf)
+        WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
+
+    remote.sa.sa_family = local.sa.sa_family = leader->sa_family;
+    remote.sa.sa_proto = local.sa.sa_proto = leader->sa_proto;
+    remote.sa.sa_port = 0;
+    remote.sa.addr_len = prefix_bits;
+    remote.sa.interface = leader->remote.interface;
+    memcpy(remote.sa.addr, WOLFSENTRY_ROUTE_REMOTE_ADDR(leader), WOLFSENTRY_BITS_TO_BYTES((size_t)prefix_bits));
+    local.sa.sa_port = leader->local.sa_port;
+    local.sa.addr_len = leader->local.addr_len;
+    local.sa.interface = leader->local.interface;
+    memcpy(local.sa.addr, WOLFSENTRY_ROUTE_LOCAL_ADDR(leader), WOLFSENTRY_BITS_TO_BYTES((size_t)leader->local.addr_len));
+
+    if ((ret = wolfsentry_route_new(wolfsentry, leader->parent_event, &remote.sa, &local.sa, flags, aggregate)) < 0)
+        return ret;
+    (*aggregate)->meta.last_penaltybox_time = leader->meta.last_penaltybox_time;
+
+    if ((ret = wolfsentry_route_insert_1(wolfsentry, caller_arg, route_table, *aggregate, NULL /* trigger_event */, 0 /* from_peer_p */, &action_results)) < 0) {
+        struct wolfsentry_eventconfig_internal *config = (leader->parent_event && leader->parent_event->config) ? leader->parent_event->config : &wolfsentry->config;
+        wolfsentry_route_free_1(wolfsentry, config, *aggregate);
+        *aggregate = NULL;
+        return ret;
+    }
+    if ((*aggregate)->parent_event)
+        WOLFSENTRY_REFCOUNT_INCREMENT((*aggregate)->parent_event->header.refcount);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* the dynamic table is sorted by family then remote address, so the routes
+ * under a given prefix are contiguous.  each such block is scanned once to
+ * group its boxed routes by the rest of their keys, then again to fold the
+ * qualifying groups into their aggregates.
+ */
+wolfsentry_errcode_t wolfsentry_route_penaltybox_aggregate(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg, /* passed to action callback(s) as the caller_arg. */
+    wolfsentry_family_t sa_family,
+    wolfsentry_addr_bits_t prefix_bits,
+    int min_routes,
+    int *n_aggregated)
+{
+    struct wolfsentry_route_table *route_table = &wolfsentry->routes_dynamic;
+    struct wolfsentry_route *block_start, *block_end, *i, *next;
+    struct wolfsentry_route_aggregate_key keys_buf[WOLFSENTRY_ROUTE_AGGREGATE_MAX_KEYS], *keys = keys_buf;
+    int max_keys = WOLFSENTRY_ROUTE_AGGREGATE_MAX_KEYS;
+    int n_keys, key_i;
+    wolfsentry_errcode_t ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+    if (n_aggregated)
+        *n_aggregated = 0;
+
+    if ((prefix_bits == 0) || (prefix_bits >= WOLFSENTRY_MAX_ADDR_BYTES * BITS_PER_BYTE) || (min_routes < 2))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+/* connection handles point at their route, so routes with live connections
+ * stay put until those connections are released.
+ */
+#define WOLFSENTRY_ROUTE_AGGREGATE_MEMBER_P(r) \
+    (((r)->remote.addr_len > prefix_bits) && \
+     ((r)->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED) && \
+     ((r)->meta.connection_count == 0) && \
+     (! ((r)->flags & (WOLFSENTRY_ROUTE_FLAG_GREENLISTED | WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE))))
+#define WOLFSENTRY_ROUTE_AGGREGATE_P(r) \
+    (((r)->remote.addr_len == prefix_bits) && \
+     ((r)->flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD) && \
+     (! ((r)->flags & (WOLFSENTRY_ROUTE_FLAG_GREENLISTED | WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE))))
+
+    for (block_start = (struct wolfsentry_route *)route_table->header.head; block_start; block_start = block_end) {
+        if ((block_start->sa_family != sa_family) || (block_start->remote.addr_len < prefix_bits)) {
+            block_end = (struct wolfsentry_route *)block_start->header.next;
+            continue;
+        }
+
+        n_keys = 0;
+        for (i = block_start;
+             i && (i->sa_family == sa_family) && (i->remote.addr_len >= prefix_bits) && wolfsentry_route_remote_prefix_eq(i, block_start, prefix_bits);
+             i = (struct wolfsentry_route *)i->header.next)
+        {
+            int aggregate_p = WOLFSENTRY_ROUTE_AGGREGATE_P(i);
+            if ((! aggregate_p) && (! WOLFSENTRY_ROUTE_AGGREGATE_MEMBER_P(i)))
+                continue;
+            for (key_i = 0; key_i < n_keys; ++key_i) {
+                if (wolfsentry_route_aggregate_key_eq(keys[key_i].leader, i))
+                    break;
+            }
+            if (key_i == n_keys) {
+                if (n_keys == max_keys) {
+                    struct wolfsentry_route_aggregate_key *more_keys = (struct wolfsentry_route_aggregate_key *)WOLFSENTRY_MALLOC(sizeof *keys * (size_t)max_keys * 2);
+                    if (more_keys == NULL) {
+                        ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
+                        goto out;
+                    }
+                    memcpy(more_keys, keys, sizeof *keys * (size_t)n_keys);
+                    if (keys != keys_buf)
+                        WOLFSENTRY_FREE(keys);
+                    keys = more_keys;
+                    max_keys *= 2;
+                }
+                keys[key_i].leader = i;
+                keys[key_i].aggregate = NULL;
+                keys[key_i].n_members = 0;
+                ++n_keys;
+            }
+            if (aggregate_p)
+                keys[key_i].aggregate = i;
+            else
+                ++keys[key_i].n_members;
+        }
+        block_end = i;
+
+        for (key_i = 0; key_i < n_keys; ++key_i) {
+            if ((keys[key_i].aggregate == NULL) && (keys[key_i].n_members >= min_routes)) {
+                if ((ret = wolfsentry_route_aggregate_new(wolfsentry, caller_arg, route_table, keys[key_i].leader, prefix_bits, &keys[key_i].aggregate)) < 0)
+                    goto out;
+            }
+        }
+
+        for (i = block_start; i != block_end; i = next) {
+            next = (struct wolfsentry_route *)i->header.next;
+            if (! WOLFSENTRY_ROUTE_AGGREGATE_MEMBER_P(i))
+                continue;
+            for (key_i = 0; key_i < n_keys; ++key_i) {
+                if (keys[key_i].aggregate && wolfsentry_route_aggregate_key_eq(keys[key_i].aggregate, i))
+                    break;
+            }
+            if (key_i == n_keys)
+                continue;
+            wolfsentry_route_aggregate_merge(wolfsentry, keys[key_i].aggregate, i);
+            {
+                wolfsentry_action_res_t action_results = WOLFSENTRY_ACTION_RES_NONE;
+                if ((ret = wolfsentry_route_delete_0(wolfsentry, caller_arg, route_table, NULL /* trigger_event */, i, 0 /* from_peer_p */, &action_results)) < 0)
+                    goto out;
+            }
+            if (n_aggregated)
+                ++*n_aggregated;
+        }
+
+        /* the merged last_penaltybox_time decides when the aggregate is released. */
+        for (key_i = 0; key_i < n_keys; ++key_i) {
+            if (keys[key_i].aggregate) {
+                if (! (keys[key_i].aggregate->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED)) {
+                    wolfsentry_route_flags_t flags_before, flags_after;
+                    wolfsentry_route_update_flags_1(keys[key_i].aggregate, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after);
+                    WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_stamp_change(wolfsentry, keys[key_i].aggregate));
+                    wolfsentry_route_journal_note(wolfsentry, route_table, WOLFSENTRY_JOURNAL_RECORD_FLAGS, keys[key_i].aggregate, 0 /* from_peer_p */);
+                }
+                wolfsentry_route_penaltybox_schedule(wolfsentry, keys[key_i].aggregate);
+            }
+        }
+    }
+
+  out:
+
+#undef WOLFSENTRY_ROUTE_AGGREGATE_MEMBER_P
+#undef WOLFSENTRY_ROUTE_AGGREGATE_P
+
+    if (keys != keys_buf)
+        WOLFSENTRY_FREE(keys);
+
+    return ret;
 }
 
 wolfsentry_errcode_t wolfsentry_route_flush_table(
@@ -1321,7 +3152,7 @@ wolfsentry_errcode_t wolfsentry_route_bulk_clear_insert_action_status(
         return ret;
     return wolfsentry_table_map(
         wolfsentry,
-        &wolfsentry->routes_dynamic.header,
+        &wolfsentry->routes_static.header,
         (wolfsentry_map_function_t)wolfsentry_route_clear_insert_action_status,
         wolfsentry);
 }
@@ -1331,6 +3162,9 @@ static wolfsentry_errcode_t wolfsentry_route_call_insert_action(
     struct wolfsentry_route *route,
     wolfsentry_action_res_t *action_results)
 {
+    wolfsentry_action_res_t local_action_results = WOLFSENTRY_ACTION_RES_NONE;
+    if (action_results == NULL)
+        action_results = &local_action_results;
     if (route->parent_event && route->parent_event->insert_event) {
         wolfsentry_errcode_t ret = wolfsentry_action_list_dispatch(
             wolfsentry,
@@ -1364,11 +3198,108 @@ wolfsentry_errcode_t wolfsentry_route_bulk_insert_actions(
         return ret;
     return wolfsentry_table_map(
         wolfsentry,
-        &wolfsentry->routes_dynamic.header,
+        &wolfsentry->routes_static.header,
         (wolfsentry_map_function_t)wolfsentry_route_call_insert_action,
         wolfsentry);
 }
 
+/* both tables are sorted by wolfsentry_route_key_cmp(), so one pass through
+ * them in step finds the difference.  routes only in route_table are deleted,
+ * routes only in staged_table are copied in and get their insert actions, and
+ * routes in both keep their ID, hit count and metadata, with just their mutable
+ * flags brought up to date.  staged's events must already be merged.
+ *
+ * the new routes are all copied, and the flag changes checked, before
+ * route_table is touched, and if a new route fails to go in, the ones that
+ * went in before it are taken back out.  the flag changes and deletes that
+ * follow can fail only if the table is damaged.
+ */
+wolfsentry_errcode_t wolfsentry_route_table_merge(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_context *staged,
+    struct wolfsentry_route_table *staged_table)
+{
+    struct wolfsentry_table_ent_header *i, *j, *next;
+    struct wolfsentry_route **new_routes = NULL;
+    size_t n_new = 0, n_inserted = 0, n;
+    wolfsentry_route_flags_t flags_before, flags_after;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_errcode_t ret = WOLFSENTRY_ERROR_ENCODE(OK);
+    int cmp;
+
+    if ((staged_table->header.n_ents > 0) &&
+        ((new_routes = (struct wolfsentry_route **)WOLFSENTRY_MALLOC(sizeof *new_routes * (size_t)staged_table->header.n_ents)) == NULL))
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+
+    for (i = route_table->header.head, j = staged_table->header.head; j; ) {
+        cmp = i ? wolfsentry_route_key_cmp((struct wolfsentry_route *)i, (struct wolfsentry_route *)j) : 1;
+        if (cmp < 0)
+            i = i->next;
+        else if (cmp > 0) {
+            if ((ret = wolfsentry_route_clone(staged, j, wolfsentry, (struct wolfsentry_table_ent_header **)&new_routes[n_new], WOLFSENTRY_CLONE_FLAG_NONE)) < 0)
+                goto out;
+            wolfsentry_route_reset_state(new_routes[n_new++]);
+            j = j->next;
+        } else {
+            wolfsentry_route_flags_t flags = ((struct wolfsentry_route *)j)->flags & WOLFSENTRY_ROUTE_MUTABLE_FLAGS;
+            if ((flags & (WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED|WOLFSENTRY_ROUTE_FLAG_GREENLISTED)) ==
+                (WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED|WOLFSENTRY_ROUTE_FLAG_GREENLISTED))
+            {
+                ret = WOLFSENTRY_ERROR_ENCODE(INVALID_ARG);
+                goto out;
+            }
+            i = i->next;
+            j = j->next;
+        }
+    }
+
+    for (n_inserted = 0; n_inserted < n_new; ++n_inserted) {
+        WOLFSENTRY_CLEAR_ALL_BITS(action_results);
+        if ((ret = wolfsentry_route_insert_1(wolfsentry, caller_arg, route_table, new_routes[n_inserted], new_routes[n_inserted]->parent_event, 0 /* from_peer_p */, &action_results)) < 0)
+            goto out;
+    }
+
+    /* the new routes are in both tables now, so just the deletes and flag changes are left. */
+    for (i = route_table->header.head, j = staged_table->header.head; i || j; ) {
+        cmp = (i == NULL) ? 1 : (j == NULL) ? -1 : wolfsentry_route_key_cmp((struct wolfsentry_route *)i, (struct wolfsentry_route *)j);
+        WOLFSENTRY_CLEAR_ALL_BITS(action_results);
+        if (cmp < 0) {
+            next = i->next;
+            if ((ret = wolfsentry_route_delete_0(wolfsentry, caller_arg, route_table, NULL /* trigger_event */, (struct wolfsentry_route *)i, 0 /* from_peer_p */, &action_results)) < 0)
+                break;
+            i = next;
+        } else if (cmp > 0) {
+            ret = WOLFSENTRY_ERROR_ENCODE(INTERNAL_CHECK_FATAL);
+            break;
+        } else {
+            wolfsentry_route_flags_t flags = ((struct wolfsentry_route *)j)->flags & WOLFSENTRY_ROUTE_MUTABLE_FLAGS;
+            wolfsentry_route_flags_t old_flags = ((struct wolfsentry_route *)i)->flags & WOLFSENTRY_ROUTE_MUTABLE_FLAGS;
+            if ((flags != old_flags) &&
+                ((ret = wolfsentry_route_update_flags(wolfsentry, (struct wolfsentry_route *)i, flags, (wolfsentry_route_flags_t)(old_flags & ~flags), &flags_before, &flags_after)) < 0))
+                break;
+            i = i->next;
+            j = j->next;
+        }
+    }
+    n_new = n_inserted = 0;
+
+  out:
+
+    /* the route that failed to go in, and the ones after it, were never in the table. */
+    for (n = n_inserted; n < n_new; ++n)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_drop_reference_1(wolfsentry, new_routes[n], NULL /* action_results */));
+    for (n = 0; n < n_inserted; ++n) {
+        WOLFSENTRY_CLEAR_ALL_BITS(action_results);
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_delete_0(wolfsentry, caller_arg, route_table, NULL /* trigger_event */, new_routes[n], 0 /* from_peer_p */, &action_results));
+    }
+    if (new_routes)
+        WOLFSENTRY_FREE(new_routes);
+
+    return ret;
+}
+
 wolfsentry_errcode_t wolfsentry_route_get_private_data(
     struct wolfsentry_context *wolfsentry,
     struct wolfsentry_route *route,
@@ -1402,13 +3333,14 @@ static void wolfsentry_route_update_flags_1(
     WOLFSENTRY_ATOMIC_UPDATE(route->flags, flags_to_set, flags_to_clear, flags_before, flags_after);
 }
 
-wolfsentry_errcode_t wolfsentry_route_update_flags(
+wolfsentry_errcode_t wolfsentry_route_update_flags_2(
     struct wolfsentry_context *wolfsentry,
     struct wolfsentry_route *route,
     wolfsentry_route_flags_t flags_to_set,
     wolfsentry_route_flags_t flags_to_clear,
     wolfsentry_route_flags_t *flags_before,
-    wolfsentry_route_flags_t *flags_after)
+    wolfsentry_route_flags_t *flags_after,
+    int from_peer_p)
 {
     if ((flags_to_set & (WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED|WOLFSENTRY_ROUTE_FLAG_GREENLISTED)) ==
         (WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED|WOLFSENTRY_ROUTE_FLAG_GREENLISTED))
@@ -1418,15 +3350,35 @@ wolfsentry_errcode_t wolfsentry_route_update_flags(
         WOLFSENTRY_ERROR_RETURN(NOT_PERMITTED);
 
     wolfsentry_route_update_flags_1(route, flags_to_set, flags_to_clear, flags_before, flags_after);
-    if ((*flags_after & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED) && (! (*flags_before & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED)))
+    if (*flags_after != *flags_before)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_stamp_change(wolfsentry, route));
+    if ((*flags_after & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED) && (! (*flags_before & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED))) {
         WOLFSENTRY_WARN_ON_FAILURE(WOLFSENTRY_GET_TIME(&route->meta.last_penaltybox_time));
-    else if ((*flags_before & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED) && (! (*flags_after & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED))) {
+        wolfsentry_route_penaltybox_schedule(wolfsentry, route);
+    } else if ((*flags_before & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED) && (! (*flags_after & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED))) {
+        wolfsentry_route_penaltybox_unschedule(wolfsentry, route);
         WOLFSENTRY_ATOMIC_DECREMENT(route->meta.derogatory_count, route->meta.derogatory_count);
         WOLFSENTRY_ATOMIC_DECREMENT(route->meta.commendable_count, route->meta.commendable_count);
+        route->meta.derogatory_window_start = 0;
+        route->meta.derogatory_window_count = 0;
+        route->meta.derogatory_window_prev_count = 0;
     }
+    if ((*flags_after != *flags_before) && (*flags_after & WOLFSENTRY_ROUTE_FLAG_IN_TABLE))
+        wolfsentry_route_journal_note(wolfsentry, (struct wolfsentry_route_table *)route->header.parent_table, WOLFSENTRY_JOURNAL_RECORD_FLAGS, route, from_peer_p);
     WOLFSENTRY_RETURN_OK;
 }
 
+wolfsentry_errcode_t wolfsentry_route_update_flags(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route *route,
+    wolfsentry_route_flags_t flags_to_set,
+    wolfsentry_route_flags_t flags_to_clear,
+    wolfsentry_route_flags_t *flags_before,
+    wolfsentry_route_flags_t *flags_after)
+{
+    return wolfsentry_route_update_flags_2(wolfsentry, route, flags_to_set, flags_to_clear, flags_before, flags_after, 0 /* from_peer_p */);
+}
+
 /* only possible before route is inserted. */
 wolfsentry_errcode_t wolfsentry_route_set_wildcard(
     struct wolfsentry_route *route,
@@ -1613,6 +3565,159 @@ wolfsentry_errcode_t wolfsentry_route_table_iterate_end(
     WOLFSENTRY_RETURN_OK;
 }
 
+/* digit values plus one, so that zero means "not a digit". */
+static const byte addr_hex_digits[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+};
+
+#define ADDR_DEC_DIGIT(c) ((unsigned int)((c) - '0') < 10U)
+#define ADDR_HEX_DIGIT(c) (addr_hex_digits[(byte)(c)])
+
+/* strict dotted quad, as inet_pton(AF_INET): four decimal octets with no
+ * leading zeros.
+ */
+static int addr_pton_ipv4(const char *s, const char *end, byte *out) {
+    int n;
+
+    for (n = 0; ; ) {
+        unsigned int v;
+        if ((s == end) || (! ADDR_DEC_DIGIT(*s)))
+            return -1;
+        v = (unsigned int)(*s++ - '0');
+        if ((v == 0) && (s < end) && ADDR_DEC_DIGIT(*s))
+            return -1;
+        while ((s < end) && ADDR_DEC_DIGIT(*s)) {
+            v = v * 10U + (unsigned int)(*s++ - '0');
+            if (v > 255U)
+                return -1;
+        }
+        out[n++] = (byte)v;
+        if (s == end)
+            return (n == 4) ? 0 : -1;
+        if ((n == 4) || (*s++ != '.'))
+            return -1;
+    }
+}
+
+/* RFC 4291 text form, as inet_pton(AF_INET6): up to eight groups of one to
+ * four hex digits, at most one "::", and optionally a trailing dotted quad.
+ */
+static int addr_pton_ipv6(const char *s, const char *end, byte *out) {
+    byte buf[16];
+    int n = 0, gap = -1;
+
+    if ((s < end) && (*s == ':')) {
+        if ((end - s < 2) || (s[1] != ':'))
+            return -1;
+        gap = 0;
+        s += 2;
+        if (s == end)
+            goto done;
+    }
+
+    for (;;) {
+        const char *group = s;
+        unsigned int v = 0, d;
+        while ((s < end) && (s - group < 4) && ((d = ADDR_HEX_DIGIT(*s)) != 0)) {
+            v = (v << 4) | (d - 1);
+            ++s;
+        }
+        if (s == group)
+            return -1;
+        if ((s < end) && (*s == '.')) {
+            if ((n > 12) || (addr_pton_ipv4(group, end, buf + n) < 0))
+                return -1;
+            n += 4;
+            break;
+        }
+        if (n == 16)
+            return -1;
+        buf[n++] = (byte)(v >> 8);
+        buf[n++] = (byte)v;
+        if (s == end)
+            break;
+        if ((*s++ != ':') || (s == end))
+            return -1;
+        if (*s == ':') {
+            if (gap >= 0)
+                return -1;
+            gap = n;
+            if (++s == end)
+                break;
+        }
+    }
+
+  done:
+
+    if (gap >= 0) {
+        if (n == 16)
+            return -1;
+        memcpy(out, buf, (size_t)gap);
+        memset(out + gap, 0, (size_t)(16 - n));
+        memcpy(out + 16 - (n - gap), buf + gap, (size_t)(n - gap));
+    } else if (n == 16)
+        memcpy(out, buf, 16);
+    else
+        return -1;
+
+    return 0;
+}
+
+/* six or eight colon-separated pairs of hex digits. */
+static int addr_pton_link(const char *s, const char *end, byte *out) {
+    int n;
+
+    for (n = 0; ; ) {
+        unsigned int hi, lo;
+        if ((end - s < 2) || (n == 8))
+            return -1;
+        hi = ADDR_HEX_DIGIT(s[0]);
+        lo = ADDR_HEX_DIGIT(s[1]);
+        if ((hi == 0) || (lo == 0))
+            return -1;
+        out[n++] = (byte)(((hi - 1) << 4) | (lo - 1));
+        s += 2;
+        if (s == end)
+            return ((n == 6) || (n == 8)) ? n : -1;
+        if (*s++ != ':')
+            return -1;
+    }
+}
+
+wolfsentry_errcode_t wolfsentry_addr_pton(
+    wolfsentry_family_t sa_family,
+    const char *addr_string,
+    size_t addr_string_len,
+    byte *addr,
+    wolfsentry_addr_bits_t *addr_bits)
+{
+    const char *end = addr_string + addr_string_len;
+    int n;
+
+    switch (sa_family) {
+    case WOLFSENTRY_AF_INET:
+        if (addr_pton_ipv4(addr_string, end, addr) < 0)
+            WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+        *addr_bits = 32;
+        WOLFSENTRY_RETURN_OK;
+    case WOLFSENTRY_AF_INET6:
+        if (addr_pton_ipv6(addr_string, end, addr) < 0)
+            WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+        *addr_bits = 128;
+        WOLFSENTRY_RETURN_OK;
+    case WOLFSENTRY_AF_LINK:
+        if ((n = addr_pton_link(addr_string, end, addr)) < 0)
+            WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+        *addr_bits = (wolfsentry_addr_bits_t)(n * 8);
+        WOLFSENTRY_RETURN_OK;
+    default:
+        WOLFSENTRY_ERROR_RETURN(OP_NOT_SUPP_FOR_PROTO);
+    }
+}
+
 #ifdef WOLFSENTRY_PROTOCOL_NAMES
 
 wolfsentry_family_t wolfsentry_family_pton(const char *family_name, size_t family_name_len) {
@@ -0,0 +1,510 @@
+/*
+ * snapshot.c
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfSentry.
+ *
+ * wolfSentry is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSentry is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#include "wolfsentry_internal.h"
+
+#define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_SNAPSHOT_C
+
+/* a snapshot is a header, then a record for each route in table order, packed
+ * without padding, then zeros up to a multiple of 8 bytes.  a record is
+ *
+ *   parent (1): none, the previous record's, or a new one whose label follows
+ *   [label_len (1), label]
+ *   flags (4), family (2), proto (2), remote port (2), local port (2),
+ *   remote addr_len (2), local addr_len (2), remote interface (1),
+ *   local interface (1), hitcount (8),
+ *   times present (1), then the age in nanoseconds (8, signed) of each,
+ *   derogatory_window_count, derogatory_window_prev_count, connection_count,
+ *   derogatory_count, commendable_count (2 each),
+ *   private data size (2), remote address, local address, private data
+ *
+ * with multibyte fields in host byte order.  times that are zero ("never")
+ * are left out.
+ */
+
+#define WOLFSENTRY_SNAPSHOT_MAGIC 0x57535331U /* "WSS1" */
+#define WOLFSENTRY_SNAPSHOT_MAGIC_SWAPPED 0x31535357U
+
+struct wolfsentry_snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size; /* with the header and the padding. */
+    uint64_t checksum; /* of everything after the header. */
+    uint64_t n_routes;
+};
+
+enum {
+    WOLFSENTRY_SNAPSHOT_PARENT_NONE = 0,
+    WOLFSENTRY_SNAPSHOT_PARENT_PREVIOUS = 1,
+    WOLFSENTRY_SNAPSHOT_PARENT_LABEL = 2
+};
+
+#define WOLFSENTRY_SNAPSHOT_N_TIMES 6
+#define WOLFSENTRY_SNAPSHOT_N_COUNTS 5
+
+/* a record, as read from a snapshot. */
+struct wolfsentry_snapshot_route {
+    const byte *label;
+    byte label_len; /* 0 if the route has no parent event. */
+    uint32_t flags;
+    uint16_t sa_family, sa_proto, remote_port, local_port, remote_addr_len, local_addr_len;
+    byte remote_interface, local_interface;
+    uint64_t hitcount;
+    byte times_present;
+    int64_t ages[WOLFSENTRY_SNAPSHOT_N_TIMES];
+    uint16_t counts[WOLFSENTRY_SNAPSHOT_N_COUNTS];
+    uint16_t private_data_size;
+    const byte *remote_addr, *local_addr, *private_data;
+};
+
+static inline wolfsentry_time_t *wolfsentry_snapshot_time(struct wolfsentry_route *route, int i) {
+    wolfsentry_time_t * const times[WOLFSENTRY_SNAPSHOT_N_TIMES] = {
+        &route->meta.insert_time,
+        &route->meta.last_hit_time,
+        &route->meta.last_penaltybox_time,
+        &route->meta.rate_limit_full_time,
+        &route->meta.derogatory_window_start,
+        &route->meta.last_change_time
+    };
+    return times[i];
+}
+
+static inline uint16_t *wolfsentry_snapshot_count(struct wolfsentry_route *route, int i) {
+    uint16_t * const counts[WOLFSENTRY_SNAPSHOT_N_COUNTS] = {
+        &route->meta.derogatory_window_count,
+        &route->meta.derogatory_window_prev_count,
+        &route->meta.connection_count,
+        &route->meta.derogatory_count,
+        &route->meta.commendable_count
+    };
+    return counts[i];
+}
+
+/* with base null, only advances *offset, for sizing. */
+static inline void wolfsentry_snapshot_put(byte *base, size_t *offset, const void *src, size_t len) {
+    if (base)
+        memcpy(base + *offset, src, len);
+    *offset += len;
+}
+
+static inline int wolfsentry_snapshot_get(const byte **p, const byte *end, void *dst, size_t len) {
+    if ((size_t)(end - *p) < len)
+        return -1;
+    memcpy(dst, *p, len);
+    *p += len;
+    return 0;
+}
+
+static inline int wolfsentry_snapshot_skip(const byte **p, const byte *end, const byte **start, size_t len) {
+    if ((size_t)(end - *p) < len)
+        return -1;
+    *start = *p;
+    *p += len;
+    return 0;
+}
+
+static wolfsentry_errcode_t wolfsentry_snapshot_age_export(struct wolfsentry_context *wolfsentry, wolfsentry_time_t now, wolfsentry_time_t when, int64_t *age_nsecs) {
+    wolfsentry_time_t age = WOLFSENTRY_DIFF_TIME(now, when);
+    int negative_p = (age < 0);
+    long secs, nsecs;
+    wolfsentry_errcode_t ret;
+
+    if ((ret = WOLFSENTRY_INTERVAL_TO_SECONDS(negative_p ? -age : age, &secs, &nsecs)) < 0)
+        return ret;
+    *age_nsecs = ((int64_t)secs * 1000000000LL) + (int64_t)nsecs;
+    if (negative_p)
+        *age_nsecs = -*age_nsecs;
+    WOLFSENTRY_RETURN_OK;
+}
+
+wolfsentry_errcode_t wolfsentry_snapshot_time_rebase(struct wolfsentry_context *wolfsentry, wolfsentry_time_t now, int64_t age_nsecs, wolfsentry_time_t *when) {
+    uint64_t magnitude = (age_nsecs < 0) ? (uint64_t)0 - (uint64_t)age_nsecs : (uint64_t)age_nsecs;
+    wolfsentry_time_t age;
+    wolfsentry_errcode_t ret;
+
+    if ((ret = WOLFSENTRY_INTERVAL_FROM_SECONDS((long)(magnitude / 1000000000ULL), (long)(magnitude % 1000000000ULL), &age)) < 0)
+        return ret;
+    *when = WOLFSENTRY_ADD_TIME(now, (age_nsecs < 0) ? age : -age);
+    /* zero means never. */
+    if (*when == 0)
+        *when = 1;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static inline const struct wolfsentry_eventconfig_internal *wolfsentry_snapshot_route_config(struct wolfsentry_context *wolfsentry, const struct wolfsentry_route *route) {
+    return (route->parent_event && route->parent_event->config) ? route->parent_event->config : &wolfsentry->config;
+}
+
+static wolfsentry_errcode_t wolfsentry_snapshot_route_put(
+    struct wolfsentry_context *wolfsentry,
+    wolfsentry_time_t now,
+    struct wolfsentry_route *route,
+    const struct wolfsentry_event *prev_parent,
+    byte *base,
+    size_t *offset)
+{
+    const struct wolfsentry_eventconfig_internal *config = wolfsentry_snapshot_route_config(wolfsentry, route);
+    uint16_t private_data_size = (uint16_t)(config->config.route_private_data_size - config->route_private_data_padding);
+    uint32_t flags = (uint32_t)(route->flags & ~WOLFSENTRY_ROUTE_INTERNAL_FLAGS);
+    uint64_t hitcount = route->header.hitcount;
+    byte parent, times_present = 0;
+    int i;
+    wolfsentry_errcode_t ret;
+
+    if (route->parent_event == NULL)
+        parent = WOLFSENTRY_SNAPSHOT_PARENT_NONE;
+    else if (route->parent_event == prev_parent)
+        parent = WOLFSENTRY_SNAPSHOT_PARENT_PREVIOUS;
+    else
+        parent = WOLFSENTRY_SNAPSHOT_PARENT_LABEL;
+    wolfsentry_snapshot_put(base, offset, &parent, sizeof parent);
+    if (parent == WOLFSENTRY_SNAPSHOT_PARENT_LABEL) {
+        byte label_len = (byte)route->parent_event->label_len;
+        wolfsentry_snapshot_put(base, offset, &label_len, sizeof label_len);
+        wolfsentry_snapshot_put(base, offset, route->parent_event->label, label_len);
+    }
+
+    wolfsentry_snapshot_put(base, offset, &flags, sizeof flags);
+    wolfsentry_snapshot_put(base, offset, &route->sa_family, sizeof route->sa_family);
+    wolfsentry_snapshot_put(base, offset, &route->sa_proto, sizeof route->sa_proto);
+    wolfsentry_snapshot_put(base, offset, &route->remote.sa_port, sizeof route->remote.sa_port);
+    wolfsentry_snapshot_put(base, offset, &route->local.sa_port, sizeof route->local.sa_port);
+    wolfsentry_snapshot_put(base, offset, &route->remote.addr_len, sizeof route->remote.addr_len);
+    wolfsentry_snapshot_put(base, offset, &route->local.addr_len, sizeof route->local.addr_len);
+    wolfsentry_snapshot_put(base, offset, &route->remote.interface, sizeof route->remote.interface);
+    wolfsentry_snapshot_put(base, offset, &route->local.interface, sizeof route->local.interface);
+    wolfsentry_snapshot_put(base, offset, &hitcount, sizeof hitcount);
+
+    for (i = 0; i < WOLFSENTRY_SNAPSHOT_N_TIMES; ++i) {
+        if (*wolfsentry_snapshot_time(route, i) != 0)
+            times_present |= (byte)(1U << i);
+    }
+    wolfsentry_snapshot_put(base, offset, &times_present, sizeof times_present);
+    for (i = 0; i < WOLFSENTRY_SNAPSHOT_N_TIMES; ++i) {
+        int64_t age = 0;
+        if (! (times_present & (1U << i)))
+            continue;
+        /* sizing needs only the count. */
+        if (base && ((ret = wolfsentry_snapshot_age_export(wolfsentry, now, *wolfsentry_snapshot_time(route, i), &age)) < 0))
+            return ret;
+        wolfsentry_snapshot_put(base, offset, &age, sizeof age);
+    }
+    for (i = 0; i < WOLFSENTRY_SNAPSHOT_N_COUNTS; ++i)
+        wolfsentry_snapshot_put(base, offset, wolfsentry_snapshot_count(route, i), sizeof(uint16_t));
+
+    wolfsentry_snapshot_put(base, offset, &private_data_size, sizeof private_data_size);
+    wolfsentry_snapshot_put(base, offset, WOLFSENTRY_ROUTE_REMOTE_ADDR(route), (size_t)WOLFSENTRY_ROUTE_REMOTE_ADDR_BYTES(route));
+    wolfsentry_snapshot_put(base, offset, WOLFSENTRY_ROUTE_LOCAL_ADDR(route), (size_t)WOLFSENTRY_ROUTE_LOCAL_ADDR_BYTES(route));
+    wolfsentry_snapshot_put(base, offset, (byte *)route->data + config->route_private_data_padding, private_data_size);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+wolfsentry_errcode_t wolfsentry_route_table_snapshot_save(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    void *snapshot,
+    size_t *snapshot_size)
+{
+    struct wolfsentry_snapshot_header header;
+    struct wolfsentry_table_ent_header *i;
+    const struct wolfsentry_event *prev_parent;
+    byte *base = (byte *)snapshot;
+    wolfsentry_time_t now = 0;
+    size_t size, padded_size;
+    wolfsentry_errcode_t ret;
+
+    if ((table == NULL) || (snapshot_size == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    /* first pass: the size. */
+    size = sizeof header;
+    for (i = table->header.head, prev_parent = NULL; i; i = i->next) {
+        struct wolfsentry_route *route = (struct wolfsentry_route *)i;
+        if (route->remote.extra_port_count || route->local.extra_port_count)
+            WOLFSENTRY_ERROR_RETURN(IMPLEMENTATION_MISSING);
+        if ((ret = wolfsentry_snapshot_route_put(wolfsentry, now, route, prev_parent, NULL, &size)) < 0)
+            return ret;
+        if (route->parent_event)
+            prev_parent = route->parent_event;
+    }
+    padded_size = (size + 7U) & ~(size_t)7U;
+
+    if ((base == NULL) || (*snapshot_size < padded_size)) {
+        *snapshot_size = padded_size;
+        WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
+    }
+    *snapshot_size = padded_size;
+
+    if ((ret = WOLFSENTRY_GET_TIME(&now)) < 0)
+        return ret;
+
+    size = sizeof header;
+    memset(&header, 0, sizeof header);
+    for (i = table->header.head, prev_parent = NULL; i; i = i->next) {
+        struct wolfsentry_route *route = (struct wolfsentry_route *)i;
+        if ((ret = wolfsentry_snapshot_route_put(wolfsentry, now, route, prev_parent, base, &size)) < 0)
+            return ret;
+        if (route->parent_event)
+            prev_parent = route->parent_event;
+        ++header.n_routes;
+    }
+    memset(base + size, 0, padded_size - size);
+
+    header.magic = WOLFSENTRY_SNAPSHOT_MAGIC;
+    header.version = WOLFSENTRY_ROUTE_SNAPSHOT_VERSION;
+    header.size = padded_size;
+    header.checksum = wolfsentry_image_checksum(base + sizeof header, padded_size - sizeof header);
+    memcpy(base, &header, sizeof header);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_snapshot_route_get(
+    const byte **p,
+    const byte *end,
+    const struct wolfsentry_snapshot_route *prev,
+    struct wolfsentry_snapshot_route *rec)
+{
+    byte parent;
+    int i;
+
+    if (wolfsentry_snapshot_get(p, end, &parent, sizeof parent) < 0)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    switch (parent) {
+    case WOLFSENTRY_SNAPSHOT_PARENT_NONE:
+        rec->label = NULL;
+        rec->label_len = 0;
+        break;
+    case WOLFSENTRY_SNAPSHOT_PARENT_PREVIOUS:
+        if (prev->label_len == 0)
+            WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+        rec->label = prev->label;
+        rec->label_len = prev->label_len;
+        break;
+    case WOLFSENTRY_SNAPSHOT_PARENT_LABEL:
+        if ((wolfsentry_snapshot_get(p, end, &rec->label_len, sizeof rec->label_len) < 0) ||
+            (rec->label_len == 0) ||
+            (rec->label_len > WOLFSENTRY_MAX_LABEL_BYTES) ||
+            (wolfsentry_snapshot_skip(p, end, &rec->label, rec->label_len) < 0))
+            WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+        break;
+    default:
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    }
+
+    if ((wolfsentry_snapshot_get(p, end, &rec->flags, sizeof rec->flags) < 0) ||
+        (wolfsentry_snapshot_get(p, end, &rec->sa_family, sizeof rec->sa_family) < 0) ||
+        (wolfsentry_snapshot_get(p, end, &rec->sa_proto, sizeof rec->sa_proto) < 0) ||
+        (wolfsentry_snapshot_get(p, end, &rec->remote_port, sizeof rec->remote_port) < 0) ||
+        (wolfsentry_snapshot_get(p, end, &rec->local_port, sizeof rec->local_port) < 0) ||
+        (wolfsentry_snapshot_get(p, end, &rec->remote_addr_len, sizeof rec->remote_addr_len) < 0) ||
+        (wolfsentry_snapshot_get(p, end, &rec->local_addr_len, sizeof rec->local_addr_len) < 0) ||
+        (wolfsentry_snapshot_get(p, end, &rec->remote_interface, sizeof rec->remote_interface) < 0) ||
+        (wolfsentry_snapshot_get(p, end, &rec->local_interface, sizeof rec->local_interface) < 0) ||
+        (wolfsentry_snapshot_get(p, end, &rec->hitcount, sizeof rec->hitcount) < 0) ||
+        (wolfsentry_snapshot_get(p, end, &rec->times_present, sizeof rec->times_present) < 0))
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    if ((rec->remote_addr_len > WOLFSENTRY_MAX_ADDR_BYTES * BITS_PER_BYTE) ||
+        (rec->local_addr_len > WOLFSENTRY_MAX_ADDR_BYTES * BITS_PER_BYTE) ||
+        (rec->flags & (uint32_t)WOLFSENTRY_ROUTE_INTERNAL_FLAGS) ||
+        (rec->times_present >> WOLFSENTRY_SNAPSHOT_N_TIMES))
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+
+    for (i = 0; i < WOLFSENTRY_SNAPSHOT_N_TIMES; ++i) {
+        rec->ages[i] = 0;
+        if ((rec->times_present & (1U << i)) && (wolfsentry_snapshot_get(p, end, &rec->ages[i], sizeof rec->ages[i]) < 0))
+            WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    }
+    for (i = 0; i < WOLFSENTRY_SNAPSHOT_N_COUNTS; ++i) {
+        if (wolfsentry_snapshot_get(p, end, &rec->counts[i], sizeof rec->counts[i]) < 0)
+            WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    }
+
+    if ((wolfsentry_snapshot_get(p, end, &rec->private_data_size, sizeof rec->private_data_size) < 0) ||
+        (wolfsentry_snapshot_skip(p, end, &rec->remote_addr, WOLFSENTRY_BITS_TO_BYTES((size_t)rec->remote_addr_len)) < 0) ||
+        (wolfsentry_snapshot_skip(p, end, &rec->local_addr, WOLFSENTRY_BITS_TO_BYTES((size_t)rec->local_addr_len)) < 0) ||
+        (wolfsentry_snapshot_skip(p, end, &rec->private_data, rec->private_data_size) < 0))
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* the private data size a route with this parent would have. */
+static wolfsentry_errcode_t wolfsentry_snapshot_private_data_size(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_snapshot_route *rec,
+    size_t *private_data_size)
+{
+    const struct wolfsentry_eventconfig_internal *config = &wolfsentry->config;
+    struct wolfsentry_event *event = NULL;
+    wolfsentry_errcode_t ret;
+
+    if (rec->label_len) {
+        if ((ret = wolfsentry_event_get_reference(wolfsentry, (const char *)rec->label, (int)rec->label_len, &event)) < 0)
+            return ret;
+        if (event->config)
+            config = event->config;
+    }
+    *private_data_size = config->config.route_private_data_size - config->route_private_data_padding;
+    if (event)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_drop_reference(wolfsentry, event, NULL /* action_results */));
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* everything that can be checked without building routes, so that a bad
+ * snapshot is turned away before anything is allocated.
+ */
+static wolfsentry_errcode_t wolfsentry_snapshot_check(
+    struct wolfsentry_context *wolfsentry,
+    const byte *base,
+    size_t snapshot_size,
+    struct wolfsentry_snapshot_header *header,
+    const byte **records_end)
+{
+    struct wolfsentry_snapshot_route prev, rec;
+    const byte *p, *end;
+    uint64_t n;
+    size_t private_data_size = 0;
+    wolfsentry_errcode_t ret;
+
+    if (snapshot_size < sizeof *header)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    memcpy(header, base, sizeof *header);
+    if (header->magic == WOLFSENTRY_SNAPSHOT_MAGIC_SWAPPED)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INCOMPATIBLE);
+    if (header->magic != WOLFSENTRY_SNAPSHOT_MAGIC)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    if (header->version != WOLFSENTRY_ROUTE_SNAPSHOT_VERSION)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INCOMPATIBLE);
+    if ((header->size > snapshot_size) || (header->size < sizeof *header) || (header->size & 7U))
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    if (wolfsentry_image_checksum(base + sizeof *header, (size_t)header->size - sizeof *header) != header->checksum)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_CHECKSUM);
+
+    p = base + sizeof *header;
+    end = base + header->size;
+    memset(&prev, 0, sizeof prev);
+    for (n = 0; n < header->n_routes; ++n) {
+        if ((ret = wolfsentry_snapshot_route_get(&p, end, &prev, &rec)) < 0)
+            return ret;
+        /* the parent is looked up only when it changes. */
+        if ((n == 0) || (rec.label != prev.label)) {
+            if ((ret = wolfsentry_snapshot_private_data_size(wolfsentry, &rec, &private_data_size)) < 0)
+                return ret;
+        }
+        if (rec.private_data_size != private_data_size)
+            WOLFSENTRY_ERROR_RETURN(IMAGE_INCOMPATIBLE);
+        prev = rec;
+    }
+    /* nothing but the padding after the last record. */
+    if ((size_t)(end - p) > 7U)
+        WOLFSENTRY_ERROR_RETURN(IMAGE_INVALID);
+    *records_end = p;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+wolfsentry_errcode_t wolfsentry_route_table_snapshot_restore(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_table *table,
+    const void *snapshot,
+    size_t snapshot_size,
+    wolfsentry_action_res_t *action_results)
+{
+    const byte *base = (const byte *)snapshot;
+    struct wolfsentry_snapshot_header header;
+    struct wolfsentry_snapshot_route prev, rec;
+    struct wolfsentry_route_batch *batch = NULL;
+    WOLFSENTRY_SOCKADDR(WOLFSENTRY_MAX_ADDR_BYTES * BITS_PER_BYTE) remote, local;
+    const byte *p, *end;
+    wolfsentry_time_t now;
+    uint64_t n;
+    wolfsentry_errcode_t ret;
+
+    if ((snapshot == NULL) || (table == NULL) || (action_results == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    WOLFSENTRY_CLEAR_ALL_BITS(*action_results);
+
+    if ((ret = wolfsentry_snapshot_check(wolfsentry, base, snapshot_size, &header, &end)) < 0)
+        return ret;
+    if ((ret = WOLFSENTRY_GET_TIME(&now)) < 0)
+        return ret;
+    if ((ret = wolfsentry_route_batch_new(wolfsentry, &batch)) < 0)
+        return ret;
+
+    p = base + sizeof header;
+    memset(&prev, 0, sizeof prev);
+    for (n = 0; n < header.n_routes; ++n) {
+        struct wolfsentry_route *route;
+        const struct wolfsentry_eventconfig_internal *config;
+        int i;
+
+        (void)wolfsentry_snapshot_route_get(&p, end, &prev, &rec);
+        prev = rec;
+
+        remote.sa_family = local.sa_family = rec.sa_family;
+        remote.sa_proto = local.sa_proto = rec.sa_proto;
+        remote.sa_port = rec.remote_port;
+        local.sa_port = rec.local_port;
+        remote.addr_len = rec.remote_addr_len;
+        local.addr_len = rec.local_addr_len;
+        remote.interface = rec.remote_interface;
+        local.interface = rec.local_interface;
+        memcpy(remote.addr, rec.remote_addr, WOLFSENTRY_BITS_TO_BYTES((size_t)rec.remote_addr_len));
+        memcpy(local.addr, rec.local_addr, WOLFSENTRY_BITS_TO_BYTES((size_t)rec.local_addr_len));
+
+        if ((ret = wolfsentry_route_batch_add_static(
+                 wolfsentry,
+                 batch,
+                 (const struct wolfsentry_sockaddr *)&remote,
+                 (const struct wolfsentry_sockaddr *)&local,
+                 (wolfsentry_route_flags_t)rec.flags,
+                 (const char *)rec.label,
+                 (int)rec.label_len)) < 0)
+            goto out;
+
+        /* the route is new, so its state is filled in directly. */
+        route = (struct wolfsentry_route *)batch->routes.tail;
+        route->header.hitcount = (wolfsentry_hitcount_t)rec.hitcount;
+        for (i = 0; i < WOLFSENTRY_SNAPSHOT_N_TIMES; ++i) {
+            if ((rec.times_present & (1U << i)) &&
+                ((ret = wolfsentry_snapshot_time_rebase(wolfsentry, now, rec.ages[i], wolfsentry_snapshot_time(route, i))) < 0))
+                goto out;
+        }
+        for (i = 0; i < WOLFSENTRY_SNAPSHOT_N_COUNTS; ++i)
+            *wolfsentry_snapshot_count(route, i) = rec.counts[i];
+        config = wolfsentry_snapshot_route_config(wolfsentry, route);
+        memcpy((byte *)route->data + config->route_private_data_padding, rec.private_data, rec.private_data_size);
+    }
+
+    /* consumes the batch. */
+    ret = wolfsentry_route_batch_insert(wolfsentry, caller_arg, table, &batch, 1, 1 /* all_or_none_p */, action_results);
+
+  out:
+
+    if (batch)
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_route_batch_free(wolfsentry, &batch));
+
+    return ret;
+}
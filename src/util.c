@@ -22,6 +22,10 @@
 
 #include "wolfsentry_internal.h"
 
+#if defined(WOLFSENTRY_CLOCK_BUILTINS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
 #define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_UTIL_C
 
 #ifdef WOLFSENTRY_ERROR_STRINGS
@@ -57,6 +61,14 @@ const char *wolfsentry_errcode_source_string(wolfsentry_errcode_t e)
         return "util.c";
     case WOLFSENTRY_SOURCE_ID_JSON_LOAD_CONFIG_C:
         return "json/load_config.c";
+    case WOLFSENTRY_SOURCE_ID_IMAGE_C:
+        return "image.c";
+    case WOLFSENTRY_SOURCE_ID_JSON_EXPORT_CONFIG_C:
+        return "json/export_config.c";
+    case WOLFSENTRY_SOURCE_ID_SNAPSHOT_C:
+        return "snapshot.c";
+    case WOLFSENTRY_SOURCE_ID_JOURNAL_C:
+        return "journal.c";
     case WOLFSENTRY_SOURCE_ID_USER_BASE:
         break;
     }
@@ -146,6 +158,12 @@ const char *wolfsentry_errcode_error_string(wolfsentry_errcode_t e)
         return "Configuration parsing failed";
     case WOLFSENTRY_ERROR_ID_OP_NOT_SUPP_FOR_PROTO:
         return "Operation not supported for protocol";
+    case WOLFSENTRY_ERROR_ID_IMAGE_INVALID:
+        return "Ruleset image is malformed";
+    case WOLFSENTRY_ERROR_ID_IMAGE_CHECKSUM:
+        return "Ruleset image checksum mismatch";
+    case WOLFSENTRY_ERROR_ID_IMAGE_INCOMPATIBLE:
+        return "Ruleset image is from an incompatible build";
     case WOLFSENTRY_ERROR_ID_USER_BASE:
         break;
     }
@@ -1725,6 +1743,201 @@ static const struct wolfsentry_timecbs default_timecbs = {
 #endif
 };
 
+/* alternative clocks, cheaper to read than CLOCK_REALTIME.  all of them count
+ * microseconds, and the monotonic ones are mapped onto the epoch at conversion
+ * time.
+ */
+
+static wolfsentry_errcode_t wolfsentry_builtin_clock_now(clockid_t clk, wolfsentry_time_t *now) {
+    struct timespec ts;
+    if (clock_gettime(clk, &ts) < 0)
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
+    *now = ((wolfsentry_time_t)ts.tv_sec * (wolfsentry_time_t)1000000) + ((wolfsentry_time_t)ts.tv_nsec / (wolfsentry_time_t)1000);
+    WOLFSENTRY_RETURN_OK;
+}
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#define WOLFSENTRY_BUILTIN_MONOTONIC_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define WOLFSENTRY_BUILTIN_MONOTONIC_CLOCK CLOCK_MONOTONIC
+#endif
+
+static wolfsentry_errcode_t wolfsentry_builtin_get_time_monotonic(void *context, wolfsentry_time_t *now) {
+    (void)context;
+    return wolfsentry_builtin_clock_now(WOLFSENTRY_BUILTIN_MONOTONIC_CLOCK, now);
+}
+
+static wolfsentry_errcode_t wolfsentry_builtin_monotonic_epoch_offset(wolfsentry_time_t *offset) {
+    wolfsentry_time_t realtime, monotonic;
+    wolfsentry_errcode_t ret;
+    if ((ret = wolfsentry_builtin_clock_now(CLOCK_REALTIME, &realtime)) < 0)
+        return ret;
+    if ((ret = wolfsentry_builtin_clock_now(WOLFSENTRY_BUILTIN_MONOTONIC_CLOCK, &monotonic)) < 0)
+        return ret;
+    *offset = realtime - monotonic;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_builtin_monotonic_to_epoch_time(wolfsentry_time_t when, long *epoch_secs, long *epoch_nsecs) {
+    wolfsentry_time_t offset;
+    wolfsentry_errcode_t ret = wolfsentry_builtin_monotonic_epoch_offset(&offset);
+    if (ret < 0)
+        return ret;
+    return wolfsentry_builtin_to_epoch_time(when + offset, epoch_secs, epoch_nsecs);
+}
+
+static wolfsentry_errcode_t wolfsentry_builtin_monotonic_from_epoch_time(long epoch_secs, long epoch_nsecs, wolfsentry_time_t *when) {
+    wolfsentry_time_t offset;
+    wolfsentry_errcode_t ret = wolfsentry_builtin_monotonic_epoch_offset(&offset);
+    if (ret < 0)
+        return ret;
+    if ((ret = wolfsentry_builtin_from_epoch_time(epoch_secs, epoch_nsecs, when)) < 0)
+        return ret;
+    *when -= offset;
+    WOLFSENTRY_RETURN_OK;
+}
+
+#ifdef WOLFSENTRY_THREADSAFE
+#define WOLFSENTRY_THREAD_LOCAL __thread
+#else
+#define WOLFSENTRY_THREAD_LOCAL
+#endif
+
+static WOLFSENTRY_THREAD_LOCAL wolfsentry_time_t wolfsentry_builtin_cached_time = 0;
+
+wolfsentry_errcode_t wolfsentry_builtin_time_cache_refresh(void) {
+    return wolfsentry_builtin_clock_now(WOLFSENTRY_BUILTIN_MONOTONIC_CLOCK, &wolfsentry_builtin_cached_time);
+}
+
+static wolfsentry_errcode_t wolfsentry_builtin_get_time_cached(void *context, wolfsentry_time_t *now) {
+    (void)context;
+    if (wolfsentry_builtin_cached_time == 0) {
+        wolfsentry_errcode_t ret = wolfsentry_builtin_time_cache_refresh();
+        if (ret < 0)
+            return ret;
+    }
+    *now = wolfsentry_builtin_cached_time;
+    WOLFSENTRY_RETURN_OK;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* the TSC is assumed to be invariant and synchronized across cores, as it is
+ * on all x86 CPUs of the last decade.  timestamps are monotonic microseconds,
+ * anchored to the monotonic clock at calibration.
+ */
+static struct {
+    uint64_t tsc_base;
+    wolfsentry_time_t monotonic_base;
+    uint64_t ticks_per_ms;
+} wolfsentry_builtin_tsc_calibration;
+
+static wolfsentry_errcode_t wolfsentry_builtin_tsc_calibrate(void) {
+    wolfsentry_time_t start, now;
+    uint64_t tsc_start, tsc_end;
+    wolfsentry_errcode_t ret;
+
+    if (wolfsentry_builtin_tsc_calibration.ticks_per_ms != 0)
+        WOLFSENTRY_RETURN_OK;
+
+    if ((ret = wolfsentry_builtin_clock_now(CLOCK_MONOTONIC, &start)) < 0)
+        return ret;
+    tsc_start = __rdtsc();
+    do {
+        if ((ret = wolfsentry_builtin_clock_now(CLOCK_MONOTONIC, &now)) < 0)
+            return ret;
+    } while (now - start < WOLFSENTRY_TSC_CALIBRATION_USECS);
+    tsc_end = __rdtsc();
+
+    if (tsc_end <= tsc_start)
+        WOLFSENTRY_ERROR_RETURN(IMPLEMENTATION_MISSING);
+
+    wolfsentry_builtin_tsc_calibration.tsc_base = tsc_end;
+    wolfsentry_builtin_tsc_calibration.monotonic_base = now;
+    wolfsentry_builtin_tsc_calibration.ticks_per_ms = ((tsc_end - tsc_start) * 1000U) / (uint64_t)(now - start);
+    if (wolfsentry_builtin_tsc_calibration.ticks_per_ms == 0)
+        WOLFSENTRY_ERROR_RETURN(IMPLEMENTATION_MISSING);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_builtin_get_time_tsc(void *context, wolfsentry_time_t *now) {
+    uint64_t ticks = __rdtsc() - wolfsentry_builtin_tsc_calibration.tsc_base;
+    uint64_t ticks_per_ms = wolfsentry_builtin_tsc_calibration.ticks_per_ms;
+    (void)context;
+    /* split to keep ticks * 1000 from overflowing on long uptimes. */
+    *now = wolfsentry_builtin_tsc_calibration.monotonic_base +
+        (wolfsentry_time_t)(((ticks / ticks_per_ms) * 1000U) + (((ticks % ticks_per_ms) * 1000U) / ticks_per_ms));
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_builtin_tsc_epoch_offset(wolfsentry_time_t *offset) {
+    wolfsentry_time_t realtime, tsc_time;
+    wolfsentry_errcode_t ret;
+    if ((ret = wolfsentry_builtin_clock_now(CLOCK_REALTIME, &realtime)) < 0)
+        return ret;
+    if ((ret = wolfsentry_builtin_get_time_tsc(NULL, &tsc_time)) < 0)
+        return ret;
+    *offset = realtime - tsc_time;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t wolfsentry_builtin_tsc_to_epoch_time(wolfsentry_time_t when, long *epoch_secs, long *epoch_nsecs) {
+    wolfsentry_time_t offset;
+    wolfsentry_errcode_t ret = wolfsentry_builtin_tsc_epoch_offset(&offset);
+    if (ret < 0)
+        return ret;
+    return wolfsentry_builtin_to_epoch_time(when + offset, epoch_secs, epoch_nsecs);
+}
+
+static wolfsentry_errcode_t wolfsentry_builtin_tsc_from_epoch_time(long epoch_secs, long epoch_nsecs, wolfsentry_time_t *when) {
+    wolfsentry_time_t offset;
+    wolfsentry_errcode_t ret = wolfsentry_builtin_tsc_epoch_offset(&offset);
+    if (ret < 0)
+        return ret;
+    if ((ret = wolfsentry_builtin_from_epoch_time(epoch_secs, epoch_nsecs, when)) < 0)
+        return ret;
+    *when -= offset;
+    WOLFSENTRY_RETURN_OK;
+}
+
+#endif /* __x86_64__ || __i386__ */
+
+wolfsentry_errcode_t wolfsentry_builtin_timecbs_get(wolfsentry_time_mode_t mode, struct wolfsentry_timecbs *timecbs) {
+    *timecbs = default_timecbs;
+
+    switch (mode) {
+    case WOLFSENTRY_TIME_MODE_REALTIME:
+        WOLFSENTRY_RETURN_OK;
+    case WOLFSENTRY_TIME_MODE_MONOTONIC_COARSE:
+        timecbs->get_time = wolfsentry_builtin_get_time_monotonic;
+        break;
+    case WOLFSENTRY_TIME_MODE_CACHED:
+        timecbs->get_time = wolfsentry_builtin_get_time_cached;
+        break;
+    case WOLFSENTRY_TIME_MODE_TSC:
+#if defined(__x86_64__) || defined(__i386__)
+    {
+        wolfsentry_errcode_t ret = wolfsentry_builtin_tsc_calibrate();
+        if (ret < 0)
+            return ret;
+        timecbs->get_time = wolfsentry_builtin_get_time_tsc;
+        timecbs->to_epoch_time = wolfsentry_builtin_tsc_to_epoch_time;
+        timecbs->from_epoch_time = wolfsentry_builtin_tsc_from_epoch_time;
+        WOLFSENTRY_RETURN_OK;
+    }
+#else
+        WOLFSENTRY_ERROR_RETURN(IMPLEMENTATION_MISSING);
+#endif
+    default:
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    }
+
+    timecbs->to_epoch_time = wolfsentry_builtin_monotonic_to_epoch_time;
+    timecbs->from_epoch_time = wolfsentry_builtin_monotonic_from_epoch_time;
+    WOLFSENTRY_RETURN_OK;
+}
+
 #endif /* WOLFSENTRY_CLOCK_BUILTINS */
 
 wolfsentry_errcode_t wolfsentry_time_now_plus_delta(struct wolfsentry_context *wolfsentry, wolfsentry_time_t td, wolfsentry_time_t *res) {
@@ -1832,9 +2045,44 @@ wolfsentry_errcode_t wolfsentry_eventconfig_check(
         }
     }
 
+    if (config->rate_limit_tokens == 0) {
+        if (config->rate_limit_burst != 0)
+            WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    } else if (config->rate_limit_period <= 0)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if (config->derogatory_window < 0)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (config->derogatory_threshold_for_penaltybox > MAX_UINT_OF(((struct wolfsentry_route_metadata *)0)->derogatory_count))
+        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+
+    if (config->route_admission_threshold >= WOLFSENTRY_ADMISSION_SKETCH_COUNT_MAX)
+        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+
     WOLFSENTRY_RETURN_OK;
 }
 
+/* the route token buckets are kept in virtual-scheduling form -- each route
+ * records only the time its bucket will be full again, and each admitted event
+ * pushes that time out by one token interval.  precompute the interval and
+ * the burst allowance here so dispatch needs no division.
+ */
+static void wolfsentry_eventconfig_rate_limit_load(struct wolfsentry_eventconfig_internal *internal) {
+    uint32_t burst;
+
+    if ((internal->config.rate_limit_tokens == 0) || (internal->config.rate_limit_period <= 0)) {
+        internal->rate_limit_interval = 0;
+        internal->rate_limit_tolerance = 0;
+        return;
+    }
+
+    internal->rate_limit_interval = internal->config.rate_limit_period / (wolfsentry_time_t)internal->config.rate_limit_tokens;
+    if (internal->rate_limit_interval == 0)
+        internal->rate_limit_interval = 1;
+    burst = internal->config.rate_limit_burst ? internal->config.rate_limit_burst : internal->config.rate_limit_tokens;
+    internal->rate_limit_tolerance = internal->rate_limit_interval * (wolfsentry_time_t)(burst - 1);
+}
+
 wolfsentry_errcode_t wolfsentry_eventconfig_load(
     const struct wolfsentry_eventconfig *supplied,
     struct wolfsentry_eventconfig_internal *internal)
@@ -1852,6 +2100,7 @@ wolfsentry_errcode_t wolfsentry_eventconfig_load(
             internal->config.route_private_data_size += private_data_slop;
         }
     }
+    wolfsentry_eventconfig_rate_limit_load(internal);
 
     WOLFSENTRY_RETURN_OK;
 }
@@ -1864,8 +2113,24 @@ wolfsentry_errcode_t wolfsentry_eventconfig_update_1(
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
     if (internal == NULL)
         WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if ((supplied->rate_limit_tokens == 0) ? (supplied->rate_limit_burst != 0) : (supplied->rate_limit_period <= 0))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (supplied->route_admission_threshold >= WOLFSENTRY_ADMISSION_SKETCH_COUNT_MAX)
+        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
+    if (supplied->derogatory_window < 0)
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+    if (supplied->derogatory_threshold_for_penaltybox > MAX_UINT_OF(((struct wolfsentry_route_metadata *)0)->derogatory_count))
+        WOLFSENTRY_ERROR_RETURN(NUMERIC_ARG_TOO_BIG);
     internal->config.max_connection_count = supplied->max_connection_count;
+    internal->config.max_subnet_connection_count = supplied->max_subnet_connection_count;
     internal->config.penaltybox_duration = supplied->penaltybox_duration;
+    internal->config.rate_limit_tokens = supplied->rate_limit_tokens;
+    internal->config.rate_limit_period = supplied->rate_limit_period;
+    internal->config.rate_limit_burst = supplied->rate_limit_burst;
+    internal->config.route_admission_threshold = supplied->route_admission_threshold;
+    internal->config.derogatory_threshold_for_penaltybox = supplied->derogatory_threshold_for_penaltybox;
+    internal->config.derogatory_window = supplied->derogatory_window;
+    wolfsentry_eventconfig_rate_limit_load(internal);
     WOLFSENTRY_RETURN_OK;
 }
 
@@ -1981,6 +2246,10 @@ wolfsentry_errcode_t wolfsentry_init(
         goto out;
     if ((ret = wolfsentry_id_generate(*wolfsentry, WOLFSENTRY_OBJECT_TYPE_TABLE, &(*wolfsentry)->routes_dynamic.header.id)) < 0)
         goto out;
+    if ((ret = wolfsentry_route_table_purge_wheel_rebuild(*wolfsentry, &(*wolfsentry)->routes_static)) < 0)
+        goto out;
+    if ((ret = wolfsentry_route_table_purge_wheel_rebuild(*wolfsentry, &(*wolfsentry)->routes_dynamic)) < 0)
+        goto out;
 
     ret = WOLFSENTRY_ERROR_ENCODE(OK);
 
@@ -1994,6 +2263,7 @@ wolfsentry_errcode_t wolfsentry_init(
 
 wolfsentry_errcode_t wolfsentry_context_flush(struct wolfsentry_context *wolfsentry) {
     wolfsentry_errcode_t ret;
+    struct wolfsentry_table_ent_header *i, *next;
 
     if ((ret = wolfsentry_route_flush_table(wolfsentry, &wolfsentry->routes_static)) < 0)
         return ret;
@@ -2001,15 +2271,223 @@ wolfsentry_errcode_t wolfsentry_context_flush(struct wolfsentry_context *wolfsen
     if ((ret = wolfsentry_route_flush_table(wolfsentry, &wolfsentry->routes_dynamic)) < 0)
         return ret;
 
-    if ((ret = wolfsentry_table_free_ents(wolfsentry, &wolfsentry->events.header)) < 0)
-        return ret;
+    /* the context lives on, so the events have to come out of the ID index too. */
+    for (i = wolfsentry->events.header.head; i; i = next) {
+        next = i->next;
+        if ((ret = wolfsentry_table_ent_delete_1(wolfsentry, i)) < 0)
+            return ret;
+        if ((ret = wolfsentry_event_drop_reference(wolfsentry, (struct wolfsentry_event *)i, NULL /* action_results */)) < 0)
+            return ret;
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+#ifndef WOLFSENTRY_MAINTENANCE_CHUNK
+#define WOLFSENTRY_MAINTENANCE_CHUNK 32
+#endif
+
+/* a unit of maintenance work, consuming *budget and setting *done if it's caught up. */
+typedef wolfsentry_errcode_t (*wolfsentry_maintenance_task_t)(struct wolfsentry_context *wolfsentry, struct wolfsentry_route_table *table, wolfsentry_hitcount_t *budget, int *done);
+
+static wolfsentry_errcode_t wolfsentry_maintenance_penaltybox_task(struct wolfsentry_context *wolfsentry, struct wolfsentry_route_table *table, wolfsentry_hitcount_t *budget, int *done) {
+    (void)table;
+    return wolfsentry_route_penaltybox_release_expired_1(wolfsentry, NULL /* caller_arg */, budget, NULL /* n_released */, done);
+}
+
+static wolfsentry_errcode_t wolfsentry_maintenance_purge_task(struct wolfsentry_context *wolfsentry, struct wolfsentry_route_table *table, wolfsentry_hitcount_t *budget, int *done) {
+    if (table->purge_age <= 0) {
+        *done = 1;
+        WOLFSENTRY_RETURN_OK;
+    }
+    return wolfsentry_route_stale_purge_1(wolfsentry, table, budget, done);
+}
+
+wolfsentry_errcode_t wolfsentry_maintenance_slice(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_maintenance_config *config,
+    int *done)
+{
+    const struct {
+        wolfsentry_maintenance_task_t fn;
+        struct wolfsentry_route_table *table;
+    } tasks[] = {
+        { wolfsentry_maintenance_penaltybox_task, NULL },
+        { wolfsentry_maintenance_purge_task, &wolfsentry->routes_dynamic },
+        { wolfsentry_maintenance_purge_task, &wolfsentry->routes_static }
+    };
+    wolfsentry_hitcount_t budget = config->max_entries_per_slice;
+    wolfsentry_time_t deadline = 0;
+    size_t task_i;
+    wolfsentry_errcode_t ret;
+
+    *done = 0;
+
+    if (config->max_slice_time > 0) {
+        if ((ret = wolfsentry_time_now_plus_delta(wolfsentry, config->max_slice_time, &deadline)) < 0)
+            return ret;
+    }
+
+    /* work in chunks, so that the clock is read only every
+     * WOLFSENTRY_MAINTENANCE_CHUNK entries.
+     */
+    for (task_i = 0; task_i < sizeof tasks / sizeof tasks[0]; ) {
+        wolfsentry_hitcount_t chunk = WOLFSENTRY_MAINTENANCE_CHUNK, chunk_left;
+        int task_done;
+
+        if ((config->max_entries_per_slice > 0) && (budget < chunk)) {
+            if (budget == 0)
+                WOLFSENTRY_RETURN_OK;
+            chunk = budget;
+        }
+
+        chunk_left = chunk;
+        if ((ret = tasks[task_i].fn(wolfsentry, tasks[task_i].table, &chunk_left, &task_done)) < 0)
+            return ret;
+        if (config->max_entries_per_slice > 0)
+            budget -= chunk - chunk_left;
+        if (task_done)
+            ++task_i;
+
+        if (config->max_slice_time > 0) {
+            wolfsentry_time_t now;
+            if ((ret = WOLFSENTRY_GET_TIME(&now)) < 0)
+                return ret;
+            if (WOLFSENTRY_DIFF_TIME(now, deadline) >= 0)
+                break;
+        }
+    }
+
+    if (task_i == sizeof tasks / sizeof tasks[0])
+        *done = 1;
 
     WOLFSENTRY_RETURN_OK;
 }
 
+#ifdef WOLFSENTRY_MAINTENANCE_THREAD
+
+#include <sched.h>
+
+static void *wolfsentry_maintenance_thread(void *arg) {
+    struct wolfsentry_context *wolfsentry = (struct wolfsentry_context *)arg;
+    struct wolfsentry_maintenance *maintenance = wolfsentry->maintenance;
+    wolfsentry_errcode_t ret;
+
+    while (! maintenance->stop) {
+        wolfsentry_time_t wake_time;
+        struct timespec abs_timeout;
+        int done = 0;
+
+#ifdef WOLFSENTRY_CLOCK_BUILTINS
+        /* this thread's cached time, if the context uses one, would otherwise stand still. */
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_builtin_time_cache_refresh());
+#endif
+
+        /* the mutex is dropped between slices, to let waiting dispatchers in. */
+        while ((! done) && (! maintenance->stop)) {
+            if ((ret = wolfsentry_context_lock_mutex(wolfsentry)) < 0) {
+                WOLFSENTRY_WARN("wolfsentry_context_lock_mutex returned " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+                break;
+            }
+            ret = wolfsentry_maintenance_slice(wolfsentry, &maintenance->config, &done);
+            WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_unlock(wolfsentry));
+            if (ret < 0) {
+                WOLFSENTRY_WARN("wolfsentry_maintenance_slice returned " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+                break;
+            }
+            if (! done)
+                (void)sched_yield();
+        }
+
+        if ((ret = wolfsentry_time_now_plus_delta(wolfsentry, maintenance->config.interval, &wake_time)) < 0) {
+            WOLFSENTRY_WARN("wolfsentry_time_now_plus_delta returned " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+            break;
+        }
+        if ((ret = wolfsentry_time_to_timespec(wolfsentry, wake_time, &abs_timeout)) < 0) {
+            WOLFSENTRY_WARN("wolfsentry_time_to_timespec returned " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+            break;
+        }
+        while ((sem_timedwait(&maintenance->wakeup, &abs_timeout) < 0) && (errno == EINTR))
+            ;
+    }
+
+    return NULL;
+}
+
+wolfsentry_errcode_t wolfsentry_maintenance_start(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_maintenance_config *config)
+{
+    struct wolfsentry_maintenance *maintenance;
+    int pthread_ret;
+
+    if (wolfsentry->maintenance)
+        WOLFSENTRY_ERROR_RETURN(ALREADY);
+    if (config && ((config->interval <= 0) || (config->max_slice_time < 0)))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if ((maintenance = (struct wolfsentry_maintenance *)WOLFSENTRY_MALLOC(sizeof *maintenance)) == NULL)
+        WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+    memset(maintenance, 0, sizeof *maintenance);
+
+    if (config)
+        maintenance->config = *config;
+    else {
+        maintenance->config.interval = WOLFSENTRY_MAINTENANCE_DEFAULT_INTERVAL;
+        maintenance->config.max_entries_per_slice = WOLFSENTRY_MAINTENANCE_DEFAULT_MAX_ENTRIES_PER_SLICE;
+        maintenance->config.max_slice_time = WOLFSENTRY_MAINTENANCE_DEFAULT_MAX_SLICE_TIME;
+    }
+
+    if (sem_init(&maintenance->wakeup, 0 /* pshared */, 0 /* value */) < 0) {
+        WOLFSENTRY_FREE(maintenance);
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+    }
+
+    wolfsentry->maintenance = maintenance;
+    if ((pthread_ret = pthread_create(&maintenance->thread, NULL /* attr */, wolfsentry_maintenance_thread, wolfsentry)) != 0) {
+        wolfsentry->maintenance = NULL;
+        (void)sem_destroy(&maintenance->wakeup);
+        WOLFSENTRY_FREE(maintenance);
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+wolfsentry_errcode_t wolfsentry_maintenance_stop(struct wolfsentry_context *wolfsentry) {
+    struct wolfsentry_maintenance *maintenance = wolfsentry->maintenance;
+
+    if (maintenance == NULL)
+        WOLFSENTRY_ERROR_RETURN(ALREADY);
+
+    maintenance->stop = 1;
+    if (sem_post(&maintenance->wakeup) < 0)
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
+    if (pthread_join(maintenance->thread, NULL /* retval */) != 0)
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FATAL);
+
+    wolfsentry->maintenance = NULL;
+    (void)sem_destroy(&maintenance->wakeup);
+    WOLFSENTRY_FREE(maintenance);
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+#endif /* WOLFSENTRY_MAINTENANCE_THREAD */
+
 wolfsentry_errcode_t wolfsentry_context_free(struct wolfsentry_context **wolfsentry) {
     wolfsentry_free_cb_t free_cb = (*wolfsentry)->allocator.free;
     wolfsentry_errcode_t ret;
+#ifdef WOLFSENTRY_MAINTENANCE_THREAD
+    if ((*wolfsentry)->maintenance) {
+        if ((ret = wolfsentry_maintenance_stop(*wolfsentry)) < 0)
+            return ret;
+    }
+#endif
+    if ((*wolfsentry)->journal) {
+        if ((ret = wolfsentry_journal_stop(*wolfsentry)) < 0)
+            return ret;
+    }
     if ((ret = wolfsentry_table_free_ents(*wolfsentry, &(*wolfsentry)->routes_static.header)) < 0)
         return ret;
     if ((ret = wolfsentry_table_free_ents(*wolfsentry, &(*wolfsentry)->routes_dynamic.header)) < 0)
@@ -2019,9 +2497,15 @@ wolfsentry_errcode_t wolfsentry_context_free(struct wolfsentry_context **wolfsen
     if ((ret = wolfsentry_table_free_ents(*wolfsentry, &(*wolfsentry)->events.header)) < 0)
         return ret;
 
+    wolfsentry_image_release_all(*wolfsentry);
+
     if ((ret = wolfsentry_lock_destroy(&(*wolfsentry)->lock)) < 0)
         return ret;
 
+    if ((*wolfsentry)->subnet_connections)
+        free_cb((*wolfsentry)->allocator.context, (*wolfsentry)->subnet_connections);
+    if ((*wolfsentry)->journal_tombstones)
+        free_cb((*wolfsentry)->allocator.context, (*wolfsentry)->journal_tombstones);
     free_cb((*wolfsentry)->allocator.context, *wolfsentry);
     *wolfsentry = NULL;
     WOLFSENTRY_RETURN_OK;
@@ -2084,6 +2568,24 @@ wolfsentry_errcode_t wolfsentry_context_clone(
     WOLFSENTRY_TABLE_HEADER_RESET((*clone)->routes_static.header); /* xxx default_event */
     WOLFSENTRY_TABLE_HEADER_RESET((*clone)->routes_dynamic.header); /* xxx default_event */
     WOLFSENTRY_TABLE_HEADER_RESET((*clone)->ents_by_id);
+    WOLFSENTRY_LIST_HEADER_RESET((*clone)->penaltybox_queue);
+    WOLFSENTRY_LIST_HEADER_RESET((*clone)->images); /* routes are cloned onto the heap. */
+#ifdef WOLFSENTRY_MAINTENANCE_THREAD
+    (*clone)->maintenance = NULL;
+#endif
+    (*clone)->journal = NULL;
+    if (wolfsentry->subnet_connections) {
+        if (((*clone)->subnet_connections = (struct wolfsentry_subnet_connections *)WOLFSENTRY_MALLOC(sizeof *(*clone)->subnet_connections)) == NULL) {
+            ret = WOLFSENTRY_ERROR_ENCODE(SYS_RESOURCE_FAILED);
+            goto out;
+        }
+        memcpy((*clone)->subnet_connections, wolfsentry->subnet_connections, sizeof *(*clone)->subnet_connections);
+    }
+    /* the wheels were copied along with the rest of the context, and still link the source routes. */
+    if ((ret = wolfsentry_route_table_purge_wheel_rebuild(*clone, &(*clone)->routes_static)) < 0)
+        goto out;
+    if ((ret = wolfsentry_route_table_purge_wheel_rebuild(*clone, &(*clone)->routes_dynamic)) < 0)
+        goto out;
 
     if ((ret = wolfsentry_table_clone(wolfsentry, &wolfsentry->actions.header, *clone, &(*clone)->actions.header, wolfsentry_action_clone, flags)) < 0)
         goto out;
@@ -2103,18 +2605,69 @@ wolfsentry_errcode_t wolfsentry_context_clone(
         goto out;
     if ((ret = wolfsentry_table_clone(wolfsentry, &wolfsentry->routes_dynamic.header, *clone, &(*clone)->routes_dynamic.header, wolfsentry_route_clone, flags)) < 0)
         goto out;
+    if ((ret = wolfsentry_route_table_purge_wheel_rebuild(*clone, &(*clone)->routes_static)) < 0)
+        goto out;
+    if ((ret = wolfsentry_route_table_purge_wheel_rebuild(*clone, &(*clone)->routes_dynamic)) < 0)
+        goto out;
+    wolfsentry_route_penaltybox_queue_rebuild(*clone);
 
     ret = WOLFSENTRY_ERROR_ENCODE(OK);
 
   out:
 
     if ((ret < 0) && (*clone != NULL)) {
+        if ((*clone)->subnet_connections && ((*clone)->subnet_connections != wolfsentry->subnet_connections))
+            WOLFSENTRY_FREE((*clone)->subnet_connections);
         WOLFSENTRY_FREE(*clone);
     }
 
     return ret;
 }
 
+wolfsentry_errcode_t wolfsentry_context_merge(struct wolfsentry_context *wolfsentry, void *caller_arg, struct wolfsentry_context *staged) {
+    wolfsentry_eventconfig_flags_t inhibit_actions = wolfsentry->config.config.flags & WOLFSENTRY_EVENTCONFIG_FLAG_INHIBIT_ACTIONS;
+    struct wolfsentry_event_merge *event_merge;
+    wolfsentry_errcode_t ret;
+    int reordered_p;
+
+    if ((wolfsentry == staged) || (staged == NULL))
+        WOLFSENTRY_ERROR_RETURN(INVALID_ARG);
+
+    if ((ret = wolfsentry_event_table_merge(wolfsentry, staged, &reordered_p, &event_merge)) < 0)
+        return ret;
+    if (reordered_p) {
+        wolfsentry_table_sort(&wolfsentry->routes_static.header);
+        wolfsentry_table_sort(&wolfsentry->routes_dynamic.header);
+    }
+
+    if ((ret = wolfsentry_route_table_merge(wolfsentry, caller_arg, &wolfsentry->routes_static, staged, &staged->routes_static)) < 0) {
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_event_table_merge_rollback(wolfsentry, &event_merge));
+        if (reordered_p) {
+            wolfsentry_table_sort(&wolfsentry->routes_static.header);
+            wolfsentry_table_sort(&wolfsentry->routes_dynamic.header);
+        }
+        return ret;
+    }
+
+    if ((ret = wolfsentry_event_table_merge_commit(wolfsentry, staged, &event_merge)) < 0)
+        return ret;
+
+    /* the config is taken whole, as by wolfsentry_context_exchange(), but actions stay as they were. */
+    wolfsentry->config = staged->config;
+    wolfsentry->config.config.flags = (wolfsentry_eventconfig_flags_t)((wolfsentry->config.config.flags & ~(wolfsentry_eventconfig_flags_t)WOLFSENTRY_EVENTCONFIG_FLAG_INHIBIT_ACTIONS) | inhibit_actions);
+    wolfsentry->routes_static.default_policy = staged->routes_static.default_policy;
+    wolfsentry->routes_dynamic.default_policy = staged->routes_dynamic.default_policy;
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+/* the tables are exchanged by value, so their ents have to be pointed at their new home. */
+static void wolfsentry_table_reparent_ents(struct wolfsentry_table_header *table) {
+    struct wolfsentry_table_ent_header *i;
+    for (i = table->head; i; i = i->next)
+        i->parent_table = table;
+}
+
 wolfsentry_errcode_t wolfsentry_context_exchange(struct wolfsentry_context *wolfsentry1, struct wolfsentry_context *wolfsentry2) {
     struct wolfsentry_context scratch;
 
@@ -2133,6 +2686,9 @@ wolfsentry_errcode_t wolfsentry_context_exchange(struct wolfsentry_context *wolf
     wolfsentry1->routes_static = wolfsentry2->routes_static;
     wolfsentry1->routes_dynamic = wolfsentry2->routes_dynamic;
     wolfsentry1->ents_by_id = wolfsentry2->ents_by_id;
+    wolfsentry1->penaltybox_queue = wolfsentry2->penaltybox_queue;
+    wolfsentry1->subnet_connections = wolfsentry2->subnet_connections;
+    wolfsentry1->images = wolfsentry2->images;
 
     wolfsentry2->timecbs = scratch.timecbs;
     wolfsentry2->mk_id_cb_state = scratch.mk_id_cb_state;
@@ -2143,6 +2699,18 @@ wolfsentry_errcode_t wolfsentry_context_exchange(struct wolfsentry_context *wolf
     wolfsentry2->routes_static = scratch.routes_static;
     wolfsentry2->routes_dynamic = scratch.routes_dynamic;
     wolfsentry2->ents_by_id = scratch.ents_by_id;
+    wolfsentry2->penaltybox_queue = scratch.penaltybox_queue;
+    wolfsentry2->subnet_connections = scratch.subnet_connections;
+    wolfsentry2->images = scratch.images;
+
+    wolfsentry_table_reparent_ents(&wolfsentry1->events.header);
+    wolfsentry_table_reparent_ents(&wolfsentry1->actions.header);
+    wolfsentry_table_reparent_ents(&wolfsentry1->routes_static.header);
+    wolfsentry_table_reparent_ents(&wolfsentry1->routes_dynamic.header);
+    wolfsentry_table_reparent_ents(&wolfsentry2->events.header);
+    wolfsentry_table_reparent_ents(&wolfsentry2->actions.header);
+    wolfsentry_table_reparent_ents(&wolfsentry2->routes_static.header);
+    wolfsentry_table_reparent_ents(&wolfsentry2->routes_dynamic.header);
 
     WOLFSENTRY_RETURN_OK;
 }
@@ -132,6 +132,7 @@ typedef wolfsentry_errcode_t (*wolfsentry_table_ent_clone_map_fn_t)(
 
 struct wolfsentry_table_header {
     struct wolfsentry_table_ent_header *head, *tail; /* these will be replaced by red-black table elements later. */
+    struct wolfsentry_table_ent_header *last_insert; /* in-order inserts among existing ents pick up from here. */
     wolfsentry_ent_cmp_fn_t cmp_fn;
     wolfsentry_ent_free_fn_t free_fn;
     wolfsentry_ent_id_t id;
@@ -143,6 +144,7 @@ struct wolfsentry_table_header {
 
 #define WOLFSENTRY_TABLE_HEADER_RESET(table) do { \
         (table).head = (table).tail = NULL;       \
+        (table).last_insert = NULL;               \
         (table).n_ents = 0;                       \
     } while (0)
 
@@ -177,6 +179,29 @@ struct wolfsentry_eventconfig_internal {
     size_t route_private_data_padding; /* with top of struct wolfsentry_route aligned to private_data_alignment, this is the padding needed in addr_buf to get aligned.
                                         * note, struct wolfsentry_route is 8-byte-aligned by default, so there are no holes with normal sizeof(void *) alignment.
                                         */
+    wolfsentry_time_t rate_limit_interval; /* time to earn one token, derived from rate_limit_tokens and rate_limit_period.  zero if rate limiting is off. */
+    wolfsentry_time_t rate_limit_tolerance; /* how far rate_limit_full_time can run ahead of now with at least one token left in the bucket. */
+};
+
+#ifndef WOLFSENTRY_ADMISSION_SKETCH_DEPTH
+#define WOLFSENTRY_ADMISSION_SKETCH_DEPTH 4
+#endif
+#ifndef WOLFSENTRY_ADMISSION_SKETCH_WIDTH_BITS
+#define WOLFSENTRY_ADMISSION_SKETCH_WIDTH_BITS 12
+#endif
+#define WOLFSENTRY_ADMISSION_SKETCH_WIDTH (1U << WOLFSENTRY_ADMISSION_SKETCH_WIDTH_BITS)
+#ifndef WOLFSENTRY_ADMISSION_SKETCH_DECAY_PERIOD
+#define WOLFSENTRY_ADMISSION_SKETCH_DECAY_PERIOD WOLFSENTRY_ADMISSION_SKETCH_WIDTH
+#endif
+#define WOLFSENTRY_ADMISSION_SKETCH_COUNT_MAX 0xffU
+
+/* count-min sketch of recent sightings of sources with no route, per parent
+ * event.  all counters are halved every WOLFSENTRY_ADMISSION_SKETCH_DECAY_PERIOD
+ * sightings, so a flood of one-off sources can't saturate it.
+ */
+struct wolfsentry_admission_sketch {
+    uint32_t n_since_decay;
+    byte counts[WOLFSENTRY_ADMISSION_SKETCH_DEPTH][WOLFSENTRY_ADMISSION_SKETCH_WIDTH];
 };
 
 struct wolfsentry_event {
@@ -186,12 +211,15 @@ struct wolfsentry_event {
 
     struct wolfsentry_eventconfig_internal *config;
 
+    struct wolfsentry_admission_sketch *admission_sketch; /* allocated on first use when config->route_admission_threshold is nonzero. */
+
     struct wolfsentry_action_list action_list; /* in parent/trigger events, this decides whether to insert the route, and/or updates route state.
                                               * in child events, this does the work described immediately below.
                                               */
     struct wolfsentry_event *insert_event; /* child event with setup routines (if any) for routes inserted with this as parent_event. */
     struct wolfsentry_event *match_event; /* child event with state management for routes inserted with this as parent_event. */
     struct wolfsentry_event *delete_event; /* child event with cleanup routines (if any) for routes inserted with this as parent_event. */
+    struct wolfsentry_event *release_event; /* child event with routines (if any) to run when routes inserted with this as parent_event leave the penalty box by expiry. */
 
     wolfsentry_priority_t priority;
 
@@ -203,9 +231,26 @@ struct wolfsentry_event_table {
     struct wolfsentry_table_header header;
 };
 
+#ifndef WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS
+#define WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS 6
+#endif
+#ifndef WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS
+#define WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS 4
+#endif
+#define WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS (1U << WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS)
+#if WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS * WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS > 48
+#error WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOT_BITS * WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS must not exceed 48.
+#endif
+#define WOLFSENTRY_ROUTE_PURGE_SLOT_DUE (WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS * WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS)
+#define WOLFSENTRY_ROUTE_PURGE_SLOT_NONE 0xffffU
+
 struct wolfsentry_route {
     struct wolfsentry_table_ent_header header;
 
+    struct wolfsentry_list_ent_header purge_link; /* membership in the parent table's purge_wheel slot purge_slot. */
+    struct wolfsentry_list_ent_header penaltybox_link; /* membership in the context's penaltybox_queue. */
+    wolfsentry_time_t penaltybox_release_time; /* zero if not in the penaltybox_queue. */
+
     struct wolfsentry_event *parent_event; /* applicable config is parent_event->config or if null, wolfsentry->config */
 
     wolfsentry_route_flags_t flags;
@@ -215,6 +260,7 @@ struct wolfsentry_route {
     struct wolfsentry_route_endpoint remote, local;
     uint16_t data_addr_offset; /* 0 if there's no private_data */
     uint16_t data_addr_size;
+    uint16_t purge_slot; /* level * WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS + slot, WOLFSENTRY_ROUTE_PURGE_SLOT_DUE, or WOLFSENTRY_ROUTE_PURGE_SLOT_NONE. */
 
     struct wolfsentry_route_metadata meta;
 
@@ -225,6 +271,26 @@ struct wolfsentry_route {
                    */
 };
 
+/* a counted connection, from wolfsentry_route_event_dispatch_connect(). */
+struct wolfsentry_route_connection {
+    struct wolfsentry_route *route; /* holds a reference, so the route outlives its deletion from the table. */
+    int subnet_slot; /* index into wolfsentry->subnet_connections->slots, or -1. */
+    uint32_t subnet_epoch; /* the subnet_connections epoch subnet_slot belongs to. */
+};
+
+/* the lookup key for a dispatch, normalized once.  dispatches build one on the
+ * stack; wolfsentry_flow_key_new() builds one that callers can reuse for the
+ * life of a connection.
+ */
+struct wolfsentry_flow_key {
+    const struct wolfsentry_sockaddr *remote;
+    const struct wolfsentry_sockaddr *local;
+    wolfsentry_route_flags_t flags; /* as passed by the caller -- target.flags has the lookup wildcards added. */
+    uint64_t remote_hash; /* only valid if remote_hash_valid. */
+    int remote_hash_valid;
+    struct wolfsentry_route target; /* must be last -- its data[] carries the addresses. */
+};
+
 #define WOLFSENTRY_ROUTE_REMOTE_ADDR(r) ((byte *)(r)->data + (r)->data_addr_offset)
 #define WOLFSENTRY_ROUTE_REMOTE_ADDR_BYTES(r) WOLFSENTRY_BITS_TO_BYTES((r)->remote.addr_len)
 #define WOLFSENTRY_ROUTE_LOCAL_ADDR(r) ((byte *)(r)->data + (r)->data_addr_offset + WOLFSENTRY_ROUTE_REMOTE_ADDR_BYTES(r))
@@ -238,16 +304,89 @@ struct wolfsentry_route {
 #define WOLFSENTRY_ROUTE_REMOTE_PORT_GET(r, i) (i ? WOLFSENTRY_ROUTE_REMOTE_EXTRA_PORTS(r)[i-1] : (r)->sa_remote_port)
 #define WOLFSENTRY_ROUTE_LOCAL_PORT_GET(r, i) (i ? WOLFSENTRY_ROUTE_LOCAL_EXTRA_PORTS(r)[i-1] : (r)->sa_local_port)
 
+/* hierarchical timing wheel of the routes in a table, keyed by the tick at
+ * which each becomes eligible for purge.  the scheduled tick is only a lower
+ * bound -- hits update last_hit_time without touching the wheel, and a route
+ * found to be still fresh when its slot comes due is rescheduled then.
+ */
+struct wolfsentry_route_purge_wheel {
+    wolfsentry_time_t resolution; /* length of a tick, derived from purge_age. */
+    wolfsentry_time_t next_tick; /* ticks before this have been processed, including cascades. */
+    wolfsentry_hitcount_t n_scheduled;
+    unsigned int sweep_slot; /* next slot a catch-up sweep empties into due, or WOLFSENTRY_ROUTE_PURGE_SLOT_DUE if no sweep is under way. */
+    struct wolfsentry_list_header slots[WOLFSENTRY_ROUTE_PURGE_WHEEL_LEVELS][WOLFSENTRY_ROUTE_PURGE_WHEEL_SLOTS];
+    struct wolfsentry_list_header due; /* routes pulled from expired slots, pending a staleness check. */
+};
+
 struct wolfsentry_route_table {
     struct wolfsentry_table_header header;
     struct wolfsentry_event *default_event; /* used as the event by wolfsentry_route_dispatch() for a static route match with a null parent_event. */
     wolfsentry_time_t purge_age; /* when now - last_transition_time >= purge_age, purge from the route table. */
     wolfsentry_action_res_t default_policy;
+    struct wolfsentry_route_purge_wheel purge_wheel;
+};
+
+/* routes built apart from any table, for wolfsentry_route_batch_insert_static(). */
+struct wolfsentry_route_batch {
+    struct wolfsentry_table_header routes; /* in the order added, until sorted. */
+    int ascending_p, descending_p; /* whether the routes are in key order, or its reverse, as they stand. */
+};
+
+/* flags that only mean something while the route is in a table. */
+#define WOLFSENTRY_ROUTE_INTERNAL_FLAGS ((wolfsentry_route_flags_t)(WOLFSENTRY_ROUTE_FLAG_IN_TABLE | WOLFSENTRY_ROUTE_FLAG_PENDING_DELETE | WOLFSENTRY_ROUTE_FLAG_INSERT_ACTIONS_CALLED | WOLFSENTRY_ROUTE_FLAG_DELETE_ACTIONS_CALLED))
+#define WOLFSENTRY_ROUTE_MUTABLE_FLAGS ((wolfsentry_route_flags_t)(WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED | WOLFSENTRY_ROUTE_FLAG_GREENLISTED | WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_HITS | WOLFSENTRY_ROUTE_FLAG_DONT_COUNT_CURRENT_CONNECTIONS))
+
+#ifdef WOLFSENTRY_MAINTENANCE_THREAD
+#include <pthread.h>
+
+struct wolfsentry_maintenance {
+    pthread_t thread;
+    sem_t wakeup;
+    volatile int stop;
+    struct wolfsentry_maintenance_config config;
+};
+#endif
+
+#ifndef WOLFSENTRY_SUBNET_CONNECTION_BUCKETS_BITS
+#define WOLFSENTRY_SUBNET_CONNECTION_BUCKETS_BITS 12
+#endif
+#define WOLFSENTRY_SUBNET_CONNECTION_BUCKETS (1U << WOLFSENTRY_SUBNET_CONNECTION_BUCKETS_BITS)
+#ifndef WOLFSENTRY_SUBNET_PREFIXES_MAX
+#define WOLFSENTRY_SUBNET_PREFIXES_MAX 4
+#endif
+
+#ifndef WOLFSENTRY_SUBNET_CONNECTION_PROBES
+#define WOLFSENTRY_SUBNET_CONNECTION_PROBES 8
+#endif
+
+struct wolfsentry_subnet_slot {
+    uint16_t count; /* zero if the slot is free. */
+    wolfsentry_family_t sa_family;
+    byte prefix[WOLFSENTRY_MAX_ADDR_BYTES]; /* masked to the family's prefix_bits, zero-padded. */
+};
+
+/* current connections summed by remote prefix, in an open-addressed table of
+ * WOLFSENTRY_SUBNET_CONNECTION_BUCKETS slots.  each slot holds its prefix, so
+ * subnets that hash alike keep separate counts.  a prefix lives in one of the
+ * WOLFSENTRY_SUBNET_CONNECTION_PROBES slots after its hash, and a slot whose
+ * count drops to zero is free for the next prefix that probes it.
+ */
+struct wolfsentry_subnet_connections {
+    struct {
+        wolfsentry_family_t sa_family;
+        wolfsentry_addr_bits_t prefix_bits;
+    } prefixes[WOLFSENTRY_SUBNET_PREFIXES_MAX];
+    unsigned int n_prefixes;
+    uint32_t epoch; /* advanced by each prefix change, which clears the slots. */
+    struct wolfsentry_subnet_slot slots[WOLFSENTRY_SUBNET_CONNECTION_BUCKETS];
 };
 
 struct wolfsentry_context {
 #ifdef WOLFSENTRY_THREADSAFE
     struct wolfsentry_rwlock lock;
+#endif
+#ifdef WOLFSENTRY_MAINTENANCE_THREAD
+    struct wolfsentry_maintenance *maintenance;
 #endif
     struct wolfsentry_allocator allocator;
     struct wolfsentry_timecbs timecbs;
@@ -262,6 +401,22 @@ struct wolfsentry_context {
     struct wolfsentry_route_table routes_static;
     struct wolfsentry_route_table routes_dynamic;
     struct wolfsentry_table_header ents_by_id;
+    struct wolfsentry_list_header penaltybox_queue; /* penalty-boxed routes with a bounded penaltybox_duration, in order of penaltybox_release_time. */
+    struct wolfsentry_subnet_connections *subnet_connections; /* null until a subnet prefix is set. */
+    struct wolfsentry_list_header images; /* ruleset images loaded with wolfsentry_image_load(), whose routes are used in place. */
+    struct wolfsentry_journal *journal; /* null unless wolfsentry_journal_start() has been called. */
+    struct wolfsentry_journal_tombstones *journal_tombstones; /* null until a journal is started or applied. */
+};
+
+/* a ruleset image held by a context.  the image memory is released when the
+ * context is freed, not when its routes are deleted.
+ */
+struct wolfsentry_image_ent {
+    struct wolfsentry_list_ent_header header;
+    byte *image;
+    size_t image_size;
+    wolfsentry_image_release_cb_t release;
+    void *release_arg;
 };
 
 #define WOLFSENTRY_MALLOC(size) wolfsentry->allocator.malloc(wolfsentry->allocator.context, size)
@@ -339,7 +494,136 @@ wolfsentry_errcode_t wolfsentry_route_clone(
     struct wolfsentry_table_ent_header **new_ent,
     wolfsentry_clone_flags_t flags);
 
+wolfsentry_errcode_t wolfsentry_route_table_purge_wheel_rebuild(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table);
+
+void wolfsentry_route_penaltybox_queue_rebuild(struct wolfsentry_context *wolfsentry);
+void wolfsentry_route_penaltybox_schedule(struct wolfsentry_context *wolfsentry, struct wolfsentry_route *route);
+
+/* route was laid out in place by wolfsentry_image_load(), and is never freed. */
+wolfsentry_errcode_t wolfsentry_route_insert_in_place(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route *route,
+    struct wolfsentry_event *parent_event,
+    wolfsentry_action_res_t *action_results);
+
+/* wolfsentry_route_batch_insert_static() for any table of the context.  with
+ * all_or_none_p, a failure takes back out the routes already put in.
+ */
+wolfsentry_errcode_t wolfsentry_route_batch_insert(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route_batch **batches,
+    int n_batches,
+    int all_or_none_p,
+    wolfsentry_action_res_t *action_results);
+
+/* as their public namesakes, but with from_peer_p, the changes are left out of
+ * the journal -- they came from wolfsentry_journal_apply(), and would echo
+ * back to the peer.
+ */
+wolfsentry_errcode_t wolfsentry_route_batch_insert_1(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_route_batch **batches,
+    int n_batches,
+    int all_or_none_p,
+    int from_peer_p,
+    wolfsentry_action_res_t *action_results);
+
+wolfsentry_errcode_t wolfsentry_route_delete_by_id_1(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    wolfsentry_ent_id_t id,
+    const char *event_label,
+    int event_label_len,
+    int from_peer_p,
+    wolfsentry_action_res_t *action_results);
+
+wolfsentry_errcode_t wolfsentry_route_update_flags_2(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route *route,
+    wolfsentry_route_flags_t flags_to_set,
+    wolfsentry_route_flags_t flags_to_clear,
+    wolfsentry_route_flags_t *flags_before,
+    wolfsentry_route_flags_t *flags_after,
+    int from_peer_p);
+
+/* these bring the events and static routes of wolfsentry in line with those of
+ * staged, for wolfsentry_context_merge().  the event changes made by
+ * wolfsentry_event_table_merge() are held in *merge until they're committed,
+ * once the routes are merged, or rolled back if the routes can't be.
+ */
+struct wolfsentry_event_merge;
+
+wolfsentry_errcode_t wolfsentry_event_table_merge(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_context *staged,
+    int *reordered_p,
+    struct wolfsentry_event_merge **merge);
+
+wolfsentry_errcode_t wolfsentry_event_table_merge_rollback(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_event_merge **merge);
+
+wolfsentry_errcode_t wolfsentry_event_table_merge_commit(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_context *staged,
+    struct wolfsentry_event_merge **merge);
+
+wolfsentry_errcode_t wolfsentry_route_table_merge(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_table *route_table,
+    struct wolfsentry_context *staged,
+    struct wolfsentry_route_table *staged_table);
+
+int wolfsentry_image_owns(struct wolfsentry_context *wolfsentry, const void *ptr);
+/* len must be a multiple of 8. */
+uint64_t wolfsentry_image_checksum(const byte *buf, size_t len);
+void wolfsentry_image_release_all(struct wolfsentry_context *wolfsentry);
+
+/* *when is now less age_nsecs, as for times recorded as ages at the moment of
+ * a snapshot, and never zero.
+ */
+wolfsentry_errcode_t wolfsentry_snapshot_time_rebase(struct wolfsentry_context *wolfsentry, wolfsentry_time_t now, int64_t age_nsecs, wolfsentry_time_t *when);
+
+typedef enum {
+    WOLFSENTRY_JOURNAL_RECORD_INSERT = 1,
+    WOLFSENTRY_JOURNAL_RECORD_DELETE = 2,
+    WOLFSENTRY_JOURNAL_RECORD_FLAGS = 3,
+    WOLFSENTRY_JOURNAL_RECORD_GAP = 4
+} wolfsentry_journal_record_type_t;
+
+/* appends a record of a change to a dynamic route to the running journal.
+ * never blocks -- if the ring is full, the record is dropped and counted, and
+ * a gap record goes ahead of the next one that gets in.
+ */
+void wolfsentry_journal_note(struct wolfsentry_context *wolfsentry, wolfsentry_journal_record_type_t type, const struct wolfsentry_route *route);
+
+/* *budget is decremented for each entry examined, and the work stops when it
+ * reaches zero, with *done cleared.  a null budget means no limit.
+ */
+wolfsentry_errcode_t wolfsentry_route_stale_purge_1(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    wolfsentry_hitcount_t *budget,
+    int *done);
+
+wolfsentry_errcode_t wolfsentry_route_penaltybox_release_expired_1(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    wolfsentry_hitcount_t *budget,
+    int *n_released,
+    int *done);
+
 wolfsentry_errcode_t wolfsentry_table_free_ents(struct wolfsentry_context *wolfsentry, struct wolfsentry_table_header *table);
+void wolfsentry_table_sort(struct wolfsentry_table_header *table);
 
 wolfsentry_errcode_t wolfsentry_table_cursor_init(struct wolfsentry_context *wolfsentry, struct wolfsentry_cursor *cursor);
 wolfsentry_errcode_t wolfsentry_table_cursor_seek_to_head(const struct wolfsentry_table_header *table, struct wolfsentry_cursor *cursor);
@@ -64,8 +64,9 @@ static inline void wolfsentry_list_ent_insert_after(struct wolfsentry_list_heade
         return;
     }
     new_ent->prev = point_ent;
+    new_ent->next = point_ent->next;
     if (point_ent->next)
-        new_ent->next = point_ent->next;
+        point_ent->next->prev = new_ent;
     else
         list->tail = new_ent;
     point_ent->next = new_ent;
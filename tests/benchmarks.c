@@ -0,0 +1,752 @@
+/*
+ * benchmarks.c
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfSentry.
+ *
+ * wolfSentry is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSentry is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#define _GNU_SOURCE
+
+#define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_USER_BASE
+
+#include "src/wolfsentry_internal.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define WOLFSENTRY_EXIT_ON_FAILURE(...) do { wolfsentry_errcode_t _retval = (__VA_ARGS__); if (_retval < 0) { WOLFSENTRY_WARN(#__VA_ARGS__ ": " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(_retval)); exit(1); }} while(0)
+
+static double bench_now(void) {
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* the count of whatever is being benchmarked, from argv[1], or dflt. */
+static unsigned long bench_count(int argc, char **argv, unsigned long dflt) {
+    if (argc > 1)
+        return strtoul(argv[1], NULL, 0);
+    return dflt;
+}
+
+#ifdef BENCH_JSON_LOAD
+
+#include "wolfsentry/wolfsentry_json.h"
+
+#define BENCH_JSON_LOAD_ROUTES_DEFAULT 1000000UL
+
+/* routes are emitted in descending address order, which the sorted route list
+ * takes at its head, so the timing is dominated by parsing rather than by
+ * insertion.  the JSON is generated in chunks, and only the feeding of each
+ * chunk is timed.
+ */
+static int bench_json_load(unsigned long n_routes) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_json_process_state *jps;
+    char err_buf[512];
+    static char chunk[1 << 16];
+    size_t chunk_len = 0, total_len = 0;
+    double elapsed = 0.0, start;
+    unsigned long i;
+
+#define BENCH_FEED() do {                                               \
+        start = bench_now();                                            \
+        if (wolfsentry_config_json_feed(jps, chunk, chunk_len, err_buf, sizeof err_buf) < 0) { \
+            fprintf(stderr, "%s\n", err_buf);                           \
+            exit(1);                                                    \
+        }                                                               \
+        elapsed += bench_now() - start;                                 \
+        total_len += chunk_len;                                         \
+        chunk_len = 0;                                                  \
+    } while (0)
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, NULL /* config */, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_init(wolfsentry, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, &jps));
+
+    chunk_len += (size_t)snprintf(chunk, sizeof chunk,
+                                  "{\n"
+                                  "    \"wolfsentry-config-version\" : 1,\n"
+                                  "    \"config-update\" : {\n"
+                                  "        \"max-connection-count\" : 5,\n"
+                                  "        \"penalty-box-duration\" : \"1h\",\n"
+                                  "        \"default-policy-static\" : \"reject\"\n"
+                                  "    },\n"
+                                  "    \"events-insert\" : [\n"
+                                  "        { \"label\" : \"static-route-parent\", \"priority\" : 1 }\n"
+                                  "    ],\n"
+                                  "    \"static-routes-insert\" : [\n");
+
+    for (i = 0; i < n_routes; ++i) {
+        unsigned long addr = 0xdfffffffUL - i;
+        if (sizeof chunk - chunk_len < 512)
+            BENCH_FEED();
+        chunk_len += (size_t)snprintf(chunk + chunk_len, sizeof chunk - chunk_len,
+                                      "%s        {\n"
+                                      "            \"parent-event\" : \"static-route-parent\",\n"
+                                      "            \"direction-in\" : true,\n"
+                                      "            \"penalty-boxed\" : true,\n"
+                                      "            \"family\" : 2,\n"
+                                      "            \"protocol\" : 6,\n"
+                                      "            \"remote\" : { \"address\" : \"%lu.%lu.%lu.%lu\", \"prefix-bits\" : 32 },\n"
+                                      "            \"local\" : { \"port\" : 443 }\n"
+                                      "        }",
+                                      i ? ",\n" : "",
+                                      (addr >> 24) & 0xff, (addr >> 16) & 0xff, (addr >> 8) & 0xff, addr & 0xff);
+    }
+    chunk_len += (size_t)snprintf(chunk + chunk_len, sizeof chunk - chunk_len, "\n    ]\n}\n");
+    BENCH_FEED();
+
+    start = bench_now();
+    if (wolfsentry_config_json_fini(&jps, err_buf, sizeof err_buf) < 0) {
+        fprintf(stderr, "%s\n", err_buf);
+        exit(1);
+    }
+    elapsed += bench_now() - start;
+
+#undef BENCH_FEED
+
+    if (wolfsentry->routes_static.header.n_ents != n_routes) {
+        fprintf(stderr, "loaded %lu routes, expected %lu\n", (unsigned long)wolfsentry->routes_static.header.n_ents, n_routes);
+        exit(1);
+    }
+
+    printf("json load: %lu routes, %zu bytes in %.3f s -- %.1f MB/s, %.0f routes/s\n",
+           n_routes, total_len, elapsed, (double)total_len / elapsed / 1e6, (double)n_routes / elapsed);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+#endif /* BENCH_JSON_LOAD */
+
+#if defined(BENCH_JSON_LOAD_PARALLEL) || defined(BENCH_JSON_LOAD_FILE)
+
+#include "wolfsentry/wolfsentry_json.h"
+
+/* the whole config, generated up front. */
+static char *bench_json_config(unsigned long n_routes, size_t *json_len) {
+    size_t json_size = 512 + n_routes * 320;
+    char *json;
+    unsigned long i;
+
+    if ((json = malloc(json_size)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    *json_len = (size_t)snprintf(json, json_size,
+                                 "{\n"
+                                 "    \"wolfsentry-config-version\" : 1,\n"
+                                 "    \"events-insert\" : [\n"
+                                 "        { \"label\" : \"static-route-parent\", \"priority\" : 1 }\n"
+                                 "    ],\n"
+                                 "    \"static-routes-insert\" : [\n");
+    for (i = 0; i < n_routes; ++i) {
+        unsigned long addr = 0xdfffffffUL - i;
+        *json_len += (size_t)snprintf(json + *json_len, json_size - *json_len,
+                                      "%s        {\n"
+                                      "            \"parent-event\" : \"static-route-parent\",\n"
+                                      "            \"direction-in\" : true,\n"
+                                      "            \"penalty-boxed\" : true,\n"
+                                      "            \"family\" : 2,\n"
+                                      "            \"protocol\" : 6,\n"
+                                      "            \"remote\" : { \"address\" : \"%lu.%lu.%lu.%lu\", \"prefix-bits\" : 32 },\n"
+                                      "            \"local\" : { \"port\" : 443 }\n"
+                                      "        }",
+                                      i ? ",\n" : "",
+                                      (addr >> 24) & 0xff, (addr >> 16) & 0xff, (addr >> 8) & 0xff, addr & 0xff);
+    }
+    *json_len += (size_t)snprintf(json + *json_len, json_size - *json_len, "\n    ]\n}\n");
+
+    return json;
+}
+
+static void bench_json_check_routes(struct wolfsentry_context *wolfsentry, unsigned long n_routes) {
+    if (wolfsentry->routes_static.header.n_ents != n_routes) {
+        fprintf(stderr, "loaded %lu routes, expected %lu\n", (unsigned long)wolfsentry->routes_static.header.n_ents, n_routes);
+        exit(1);
+    }
+}
+
+#endif /* BENCH_JSON_LOAD_PARALLEL || BENCH_JSON_LOAD_FILE */
+
+#ifdef BENCH_JSON_LOAD_PARALLEL
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define BENCH_JSON_LOAD_PARALLEL_ROUTES_DEFAULT 1000000UL
+
+/* the whole config is loaded once serially and once split across a thread per
+ * CPU, each into a fresh context.
+ */
+static double bench_json_load_parallel_1(const char *json, size_t json_len, int n_threads, unsigned long n_routes) {
+    struct wolfsentry_context *wolfsentry;
+    char err_buf[512];
+    double start, elapsed;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, NULL /* config */, &wolfsentry));
+    start = bench_now();
+    if (wolfsentry_config_json_oneshot_parallel(wolfsentry, json, json_len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, n_threads, err_buf, sizeof err_buf) < 0) {
+        fprintf(stderr, "%s\n", err_buf);
+        exit(1);
+    }
+    elapsed = bench_now() - start;
+    bench_json_check_routes(wolfsentry, n_routes);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    printf("json load, %d thread%s: %lu routes, %zu bytes in %.3f s -- %.1f MB/s, %.0f routes/s\n",
+           n_threads, n_threads == 1 ? "" : "s", n_routes, json_len, elapsed, (double)json_len / elapsed / 1e6, (double)n_routes / elapsed);
+
+    return elapsed;
+}
+
+/* the part of a split load that stays on one thread: the routes of the bench
+ * config, prebuilt in one batch, merged into the static table.
+ */
+static double bench_json_load_parallel_merge(unsigned long n_routes) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_route_batch *batch;
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[4];
+    } remote, local;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_ent_id_t id;
+    unsigned long i;
+    double start, elapsed;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, NULL /* config */, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "static-route-parent", -1 /* label_len */, 1, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_batch_new(wolfsentry, &batch));
+    memset(&remote, 0, sizeof remote);
+    memset(&local, 0, sizeof local);
+    remote.sa.sa_family = local.sa.sa_family = AF_INET;
+    remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+    remote.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+    local.sa.sa_port = 443;
+    for (i = 0; i < n_routes; ++i) {
+        unsigned long addr = 0xdfffffffUL - i;
+        remote.sa.addr[0] = (byte)(addr >> 24);
+        remote.sa.addr[1] = (byte)(addr >> 16);
+        remote.sa.addr[2] = (byte)(addr >> 8);
+        remote.sa.addr[3] = (byte)addr;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_batch_add_static(
+            wolfsentry, batch, &remote.sa, &local.sa,
+            WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED |
+            WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD | WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD |
+            WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD,
+            "static-route-parent", -1 /* event_label_len */));
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_batch_sort(batch));
+
+    start = bench_now();
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_batch_insert_static(wolfsentry, NULL /* caller_arg */, &batch, 1, &action_results));
+    elapsed = bench_now() - start;
+    bench_json_check_routes(wolfsentry, n_routes);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return elapsed;
+}
+
+/* with fewer than two CPUs online the threads just take turns, so rather than
+ * a speedup, what's reported is the cost of the split, and the Amdahl bound on
+ * the speedup with more CPUs: the serial load, less its one-thread merge,
+ * divided among them, which can't be faster than n CPUs' worth.
+ */
+static int bench_json_load_parallel(unsigned long n_routes) {
+    size_t json_len;
+    char *json = bench_json_config(n_routes, &json_len);
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    double serial, parallel, merge, bound;
+    static const int projected_cpus[] = { 2, 4, 8 };
+    unsigned int i;
+
+    serial = bench_json_load_parallel_1(json, json_len, 1, n_routes);
+    parallel = bench_json_load_parallel_1(json, json_len, n_cpus < 2 ? 2 : (int)n_cpus, n_routes);
+    merge = bench_json_load_parallel_merge(n_routes);
+    printf("json load, one-thread merge of %lu routes: %.3f s, %.1f%% of the serial load\n", n_routes, merge, merge * 100.0 / serial);
+
+    if (n_cpus >= 2)
+        printf("json load speedup with %ld threads: %.2fx\n", n_cpus, serial / parallel);
+    else {
+        printf("json load speedup: not measurable with one CPU online; the split costs %.1f%% there\n", (parallel / serial - 1.0) * 100.0);
+        for (i = 0; i < sizeof projected_cpus / sizeof projected_cpus[0]; ++i) {
+            bound = serial / ((serial - merge) / projected_cpus[i] + merge);
+            if (bound > projected_cpus[i])
+                bound = projected_cpus[i];
+            printf("json load speedup bound with %d CPUs: %.2fx\n", projected_cpus[i], bound);
+        }
+    }
+
+    free(json);
+
+    return 0;
+}
+
+#endif /* BENCH_JSON_LOAD_PARALLEL */
+
+#ifdef BENCH_JSON_LOAD_FILE
+
+#include <unistd.h>
+
+#define BENCH_JSON_LOAD_FILE_ROUTES_DEFAULT 1000000UL
+
+/* the pattern in json_feed_file() in the unit tests and the examples. */
+static void bench_json_load_file_fread(struct wolfsentry_context *wolfsentry, const char *path) {
+    struct wolfsentry_json_process_state *jps;
+    char buf[512], err_buf[512];
+    size_t n;
+    FILE *f;
+
+    if ((f = fopen(path, "r")) == NULL) {
+        perror(path);
+        exit(1);
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_init(wolfsentry, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, &jps));
+    while ((n = fread(buf, 1, sizeof buf, f)) > 0) {
+        if (wolfsentry_config_json_feed(jps, buf, n, err_buf, sizeof err_buf) < 0) {
+            fprintf(stderr, "%s\n", err_buf);
+            exit(1);
+        }
+    }
+    (void)fclose(f);
+    if (wolfsentry_config_json_fini(&jps, err_buf, sizeof err_buf) < 0) {
+        fprintf(stderr, "%s\n", err_buf);
+        exit(1);
+    }
+}
+
+/* the config is written to a file, which is loaded once with 512-byte freads
+ * and once with wolfsentry_config_json_load_file(), each into a fresh context.
+ * the file is in the page cache both times.
+ */
+static int bench_json_load_file(unsigned long n_routes) {
+    struct wolfsentry_context *wolfsentry;
+    char path[] = "/tmp/wolfsentry-bench-json-XXXXXX";
+    char err_buf[512];
+    size_t json_len;
+    char *json = bench_json_config(n_routes, &json_len);
+    double start, freads, mapped;
+    int fd;
+
+    if (((fd = mkstemp(path)) < 0) || (write(fd, json, json_len) != (ssize_t)json_len)) {
+        perror(path);
+        exit(1);
+    }
+    (void)close(fd);
+    free(json);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, NULL /* config */, &wolfsentry));
+    start = bench_now();
+    bench_json_load_file_fread(wolfsentry, path);
+    freads = bench_now() - start;
+    bench_json_check_routes(wolfsentry, n_routes);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, NULL /* config */, &wolfsentry));
+    start = bench_now();
+    if (wolfsentry_config_json_load_file(wolfsentry, path, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, err_buf, sizeof err_buf) < 0) {
+        fprintf(stderr, "%s\n", err_buf);
+        exit(1);
+    }
+    mapped = bench_now() - start;
+    bench_json_check_routes(wolfsentry, n_routes);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    (void)unlink(path);
+
+    printf("json file load, 512-byte freads: %lu routes, %zu bytes in %.3f s -- %.1f MB/s\n",
+           n_routes, json_len, freads, (double)json_len / freads / 1e6);
+    printf("json file load, wolfsentry_config_json_load_file(): %lu routes, %zu bytes in %.3f s -- %.1f MB/s\n",
+           n_routes, json_len, mapped, (double)json_len / mapped / 1e6);
+    printf("json file load speedup: %.2fx\n", freads / mapped);
+
+    return 0;
+}
+
+#endif /* BENCH_JSON_LOAD_FILE */
+
+#ifdef BENCH_ADDR_PTON
+
+#include <arpa/inet.h>
+
+#define BENCH_ADDR_PTON_ADDRS_DEFAULT 1000000UL
+
+/* what load_config.c did before wolfsentry_addr_pton(). */
+static int bench_addr_pton_inet_pton(wolfsentry_family_t family, const char *s, size_t len, byte *addr) {
+    char d_buf[64];
+    if (len >= sizeof d_buf)
+        return -1;
+    memcpy(d_buf, s, len);
+    d_buf[len] = 0;
+    return inet_pton(family == WOLFSENTRY_AF_INET ? AF_INET : AF_INET6, d_buf, addr) == 1 ? 0 : -1;
+}
+
+/* addresses are formatted up front into one buffer, then parsed in a tight
+ * loop by wolfsentry_addr_pton() and by inet_pton() on a NUL-terminated copy.
+ */
+static int bench_addr_pton_1(const char *name, wolfsentry_family_t family, unsigned long n_addrs) {
+    char *strs;
+    size_t *lens, off = 0;
+    unsigned long i;
+    unsigned int sum = 0;
+    byte addr[16];
+    wolfsentry_addr_bits_t addr_bits;
+    double start, ours, theirs = 0.0;
+
+    if (((strs = malloc(n_addrs * 48)) == NULL) || ((lens = malloc(n_addrs * sizeof *lens)) == NULL)) {
+        perror("malloc");
+        exit(1);
+    }
+    for (i = 0; i < n_addrs; ++i) {
+        unsigned long a = 0xdfffffffUL - i * 2654435761UL % 0xdfffffffUL;
+        if (family == WOLFSENTRY_AF_INET)
+            lens[i] = (size_t)sprintf(strs + off, "%lu.%lu.%lu.%lu", (a >> 24) & 0xff, (a >> 16) & 0xff, (a >> 8) & 0xff, a & 0xff);
+        else if (family == WOLFSENTRY_AF_INET6)
+            lens[i] = (size_t)sprintf(strs + off, "2001:db8:%lx::%lx:%lx", i & 0xffff, (a >> 16) & 0xffff, a & 0xffff);
+        else
+            lens[i] = (size_t)sprintf(strs + off, "02:00:%02lx:%02lx:%02lx:%02lx", (a >> 24) & 0xff, (a >> 16) & 0xff, (a >> 8) & 0xff, a & 0xff);
+        off += lens[i];
+    }
+
+    start = bench_now();
+    for (i = 0, off = 0; i < n_addrs; off += lens[i++]) {
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_addr_pton(family, strs + off, lens[i], addr, &addr_bits));
+        sum += addr[addr_bits / 8 - 1];
+    }
+    ours = bench_now() - start;
+
+    if (family != WOLFSENTRY_AF_LINK) {
+        start = bench_now();
+        for (i = 0, off = 0; i < n_addrs; off += lens[i++]) {
+            if (bench_addr_pton_inet_pton(family, strs + off, lens[i], addr) < 0) {
+                fprintf(stderr, "inet_pton(\"%.*s\") failed\n", (int)lens[i], strs + off);
+                exit(1);
+            }
+            sum -= addr[(family == WOLFSENTRY_AF_INET ? 4 : 16) - 1];
+        }
+        theirs = bench_now() - start;
+    }
+
+    free(strs);
+    free(lens);
+
+    if ((family != WOLFSENTRY_AF_LINK) && (sum != 0)) {
+        fprintf(stderr, "%s: wolfsentry_addr_pton() and inet_pton() disagree\n", name);
+        exit(1);
+    }
+
+    printf("addr pton, %s: %lu addresses in %.3f s -- %.1f ns/address", name, n_addrs, ours, ours * 1e9 / (double)n_addrs);
+    if (family != WOLFSENTRY_AF_LINK)
+        printf(", inet_pton %.1f ns/address -- %.2fx", theirs * 1e9 / (double)n_addrs, theirs / ours);
+    printf("\n");
+
+    return 0;
+}
+
+static int bench_addr_pton(unsigned long n_addrs) {
+    int err = 0;
+    err |= bench_addr_pton_1("IPv4", WOLFSENTRY_AF_INET, n_addrs);
+    err |= bench_addr_pton_1("IPv6", WOLFSENTRY_AF_INET6, n_addrs);
+    err |= bench_addr_pton_1("MAC", WOLFSENTRY_AF_LINK, n_addrs);
+    return err;
+}
+
+#endif /* BENCH_ADDR_PTON */
+
+#ifdef BENCH_IMAGE_LOAD
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define BENCH_IMAGE_LOAD_ROUTES_DEFAULT 500000UL
+
+/* the rules are built through the API rather than from JSON, compiled to an
+ * image file, and then only the cold start from that file is timed.
+ */
+static int bench_image_load(unsigned long n_routes) {
+    struct wolfsentry_context *wolfsentry;
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[4];
+    } remote, local;
+    wolfsentry_ent_id_t id;
+    wolfsentry_action_res_t action_results;
+    char image_path[] = "/tmp/wolfsentry-bench-image-XXXXXX";
+    void *image;
+    size_t image_size = 0;
+    double start, elapsed;
+    unsigned long i;
+    int fd;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, NULL /* config */, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "static-route-parent", WOLFSENTRY_LENGTH_NULL_TERMINATED, 1 /* priority */, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, NULL /* id */));
+
+    memset(&remote, 0, sizeof remote);
+    memset(&local, 0, sizeof local);
+    remote.sa.sa_family = local.sa.sa_family = AF_INET;
+    remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+    remote.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+    local.sa.sa_port = 443;
+
+    for (i = 0; i < n_routes; ++i) {
+        unsigned long addr = 0xdfffffffUL - i;
+        remote.sa.addr[0] = (byte)(addr >> 24);
+        remote.sa.addr[1] = (byte)(addr >> 16);
+        remote.sa.addr[2] = (byte)(addr >> 8);
+        remote.sa.addr[3] = (byte)addr;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert_static(
+                                       wolfsentry, NULL /* caller_arg */, &remote.sa, &local.sa,
+                                       WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED | WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD | WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD,
+                                       "static-route-parent", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+    }
+
+    (void)wolfsentry_image_compile(wolfsentry, NULL, &image_size);
+    if ((image = malloc(image_size)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_image_compile(wolfsentry, image, &image_size));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    if (((fd = mkstemp(image_path)) < 0) || (write(fd, image, image_size) != (ssize_t)image_size)) {
+        perror(image_path);
+        exit(1);
+    }
+    (void)close(fd);
+    free(image);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, NULL /* config */, &wolfsentry));
+    start = bench_now();
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_image_load_file(wolfsentry, NULL /* caller_arg */, image_path, &action_results));
+    elapsed = bench_now() - start;
+    (void)unlink(image_path);
+
+    if (wolfsentry->routes_static.header.n_ents != n_routes) {
+        fprintf(stderr, "loaded %lu routes, expected %lu\n", (unsigned long)wolfsentry->routes_static.header.n_ents, n_routes);
+        exit(1);
+    }
+
+    printf("image load: %lu routes, %zu bytes in %.3f ms -- %.0f routes/s\n",
+           n_routes, image_size, elapsed * 1e3, (double)n_routes / elapsed);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+#endif /* BENCH_IMAGE_LOAD */
+
+#ifdef BENCH_ROUTE_SNAPSHOT
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define BENCH_ROUTE_SNAPSHOT_ROUTES_DEFAULT 500000UL
+
+/* the routes are inserted in ascending order, then saved, and restored into a
+ * fresh context, each step timed separately.
+ */
+static int bench_route_snapshot(unsigned long n_routes) {
+    struct wolfsentry_context *wolfsentry;
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[4];
+    } remote, local;
+    wolfsentry_ent_id_t id;
+    wolfsentry_action_res_t action_results;
+    void *snapshot;
+    size_t snapshot_size = 0;
+    double start, save_elapsed, restore_elapsed;
+    unsigned long i;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, NULL /* config */, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", WOLFSENTRY_LENGTH_NULL_TERMINATED, 1 /* priority */, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, NULL /* id */));
+
+    memset(&remote, 0, sizeof remote);
+    memset(&local, 0, sizeof local);
+    remote.sa.sa_family = local.sa.sa_family = AF_INET;
+    remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+    remote.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+    local.sa.sa_port = 443;
+
+    for (i = 0; i < n_routes; ++i) {
+        unsigned long addr = 0x0a000000UL + i;
+        remote.sa.addr[0] = (byte)(addr >> 24);
+        remote.sa.addr[1] = (byte)(addr >> 16);
+        remote.sa.addr[2] = (byte)(addr >> 8);
+        remote.sa.addr[3] = (byte)addr;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert_static(
+                                       wolfsentry, NULL /* caller_arg */, &remote.sa, &local.sa,
+                                       WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED | WOLFSENTRY_ROUTE_FLAG_REMOTE_INTERFACE_WILDCARD | WOLFSENTRY_ROUTE_FLAG_LOCAL_INTERFACE_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_LOCAL_ADDR_WILDCARD | WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD,
+                                       "connect", WOLFSENTRY_LENGTH_NULL_TERMINATED, &id, &action_results));
+    }
+
+    (void)wolfsentry_route_table_snapshot_save(wolfsentry, &wolfsentry->routes_static, NULL, &snapshot_size);
+    if ((snapshot = malloc(snapshot_size)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    start = bench_now();
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_snapshot_save(wolfsentry, &wolfsentry->routes_static, snapshot, &snapshot_size));
+    save_elapsed = bench_now() - start;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, NULL /* config */, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", WOLFSENTRY_LENGTH_NULL_TERMINATED, 1 /* priority */, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, NULL /* id */));
+    start = bench_now();
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_snapshot_restore(wolfsentry, NULL /* caller_arg */, &wolfsentry->routes_static, snapshot, snapshot_size, &action_results));
+    restore_elapsed = bench_now() - start;
+    free(snapshot);
+
+    if (wolfsentry->routes_static.header.n_ents != n_routes) {
+        fprintf(stderr, "restored %lu routes, expected %lu\n", (unsigned long)wolfsentry->routes_static.header.n_ents, n_routes);
+        exit(1);
+    }
+
+    printf("route snapshot: %lu routes, %zu bytes, saved in %.3f ms, restored in %.3f ms -- %.0f routes/s\n",
+           n_routes, snapshot_size, save_elapsed * 1e3, restore_elapsed * 1e3, (double)n_routes / restore_elapsed);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+#endif /* BENCH_ROUTE_SNAPSHOT */
+
+#ifdef BENCH_ROUTE_JOURNAL
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define BENCH_ROUTE_JOURNAL_CHANGES_DEFAULT 1000000UL
+
+static wolfsentry_errcode_t bench_route_journal_write(void *sink_context, const void *buf, size_t len) {
+    (void)buf;
+    *(size_t *)sink_context += len;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static int bench_route_journal_1(unsigned long n_changes, const struct wolfsentry_journal_config *journal_config, double *elapsed, struct wolfsentry_journal_stats *stats) {
+    struct wolfsentry_context *wolfsentry;
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[4];
+    } remote, local;
+    struct wolfsentry_route *route;
+    wolfsentry_route_flags_t inexact_matches, flags_before, flags_after;
+    wolfsentry_ent_id_t id;
+    wolfsentry_action_res_t action_results = WOLFSENTRY_ACTION_RES_NONE;
+    double start;
+    unsigned long i;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, NULL /* config */, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", WOLFSENTRY_LENGTH_NULL_TERMINATED, 1 /* priority */, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, NULL /* id */));
+
+    memset(&remote, 0, sizeof remote);
+    memset(&local, 0, sizeof local);
+    remote.sa.sa_family = local.sa.sa_family = AF_INET;
+    remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+    remote.sa.addr_len = local.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+    remote.sa.sa_port = 12345;
+    local.sa.sa_port = 443;
+    memcpy(remote.sa.addr, "\12\0\0\1", sizeof remote.addr_buf);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(
+                                   wolfsentry, &remote.sa, &local.sa,
+                                   WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN,
+                                   "connect", WOLFSENTRY_LENGTH_NULL_TERMINATED, NULL /* caller_arg */, &id, &inexact_matches, &action_results));
+    route = (struct wolfsentry_route *)wolfsentry->routes_dynamic.header.head;
+
+    if (journal_config)
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_start(wolfsentry, journal_config));
+
+    start = bench_now();
+    for (i = 0; i < n_changes; ++i) {
+        if (i & 1)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, route, WOLFSENTRY_ROUTE_FLAG_NONE, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, &flags_before, &flags_after));
+        else
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, route, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    }
+    *elapsed = bench_now() - start;
+
+    if (journal_config) {
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(wolfsentry));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_get_stats(wolfsentry, stats));
+    }
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+/* penalty-box changes to a dynamic route, timed without and then with the
+ * journal, to show what the journal adds to the path that makes them.
+ */
+static int bench_route_journal(unsigned long n_changes) {
+    size_t written = 0;
+    struct wolfsentry_journal_config journal_config = { .write = bench_route_journal_write, .sink_context = &written, .ring_size = 1U << 20 };
+    struct wolfsentry_journal_stats stats;
+    double plain_elapsed, journal_elapsed;
+
+    if (bench_route_journal_1(n_changes, NULL, &plain_elapsed, NULL) != 0)
+        return 1;
+    if (bench_route_journal_1(n_changes, &journal_config, &journal_elapsed, &stats) != 0)
+        return 1;
+
+    printf("route journal: %lu flag changes, %.1f ns each without the journal, %.1f ns with it; %lu records, %lu dropped, %lu bytes in %lu writes\n",
+           n_changes, plain_elapsed * 1e9 / (double)n_changes, journal_elapsed * 1e9 / (double)n_changes,
+           (unsigned long)stats.n_records, (unsigned long)stats.n_dropped, (unsigned long)stats.n_bytes_written, (unsigned long)stats.n_writes);
+
+    return 0;
+}
+
+#endif /* BENCH_ROUTE_JOURNAL */
+
+int main (int argc, char* argv[]) {
+    int err = 0;
+    (void)argc;
+    (void)argv;
+
+#ifdef BENCH_JSON_LOAD
+    err |= bench_json_load(bench_count(argc, argv, BENCH_JSON_LOAD_ROUTES_DEFAULT));
+#endif
+#ifdef BENCH_JSON_LOAD_PARALLEL
+    err |= bench_json_load_parallel(bench_count(argc, argv, BENCH_JSON_LOAD_PARALLEL_ROUTES_DEFAULT));
+#endif
+#ifdef BENCH_JSON_LOAD_FILE
+    err |= bench_json_load_file(bench_count(argc, argv, BENCH_JSON_LOAD_FILE_ROUTES_DEFAULT));
+#endif
+#ifdef BENCH_ADDR_PTON
+    err |= bench_addr_pton(bench_count(argc, argv, BENCH_ADDR_PTON_ADDRS_DEFAULT));
+#endif
+#ifdef BENCH_IMAGE_LOAD
+    err |= bench_image_load(bench_count(argc, argv, BENCH_IMAGE_LOAD_ROUTES_DEFAULT));
+#endif
+#ifdef BENCH_ROUTE_SNAPSHOT
+    err |= bench_route_snapshot(bench_count(argc, argv, BENCH_ROUTE_SNAPSHOT_ROUTES_DEFAULT));
+#endif
+#ifdef BENCH_ROUTE_JOURNAL
+    err |= bench_route_journal(bench_count(argc, argv, BENCH_ROUTE_JOURNAL_CHANGES_DEFAULT));
+#endif
+
+    return err;
+}
@@ -83,6 +83,52 @@ static wolfsentry_errcode_t test_init (void) {
     return ret;
 }
 
+#ifdef WOLFSENTRY_CLOCK_BUILTINS
+
+#include <time.h>
+
+static wolfsentry_errcode_t test_time_modes (void) {
+    static const wolfsentry_time_mode_t modes[] = { WOLFSENTRY_TIME_MODE_REALTIME, WOLFSENTRY_TIME_MODE_MONOTONIC_COARSE, WOLFSENTRY_TIME_MODE_CACHED, WOLFSENTRY_TIME_MODE_TSC };
+    struct wolfsentry_timecbs timecbs;
+    struct wolfsentry_host_platform_interface hpi = { .allocator = NULL, .timecbs = &timecbs };
+    size_t i;
+
+    for (i = 0; i < sizeof modes / sizeof modes[0]; ++i) {
+        struct wolfsentry_context *wolfsentry;
+        wolfsentry_time_t t1, t2;
+        long epoch_secs, epoch_nsecs;
+        struct timespec ts;
+        wolfsentry_errcode_t ret = wolfsentry_builtin_timecbs_get(modes[i], &timecbs);
+
+        if ((modes[i] == WOLFSENTRY_TIME_MODE_TSC) && WOLFSENTRY_ERROR_CODE_IS(ret, IMPLEMENTATION_MISSING))
+            continue;
+        WOLFSENTRY_EXIT_ON_FAILURE(ret);
+        if (modes[i] == WOLFSENTRY_TIME_MODE_CACHED)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_builtin_time_cache_refresh());
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, NULL /* config */, &wolfsentry));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_get_time(wolfsentry, &t1));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_get_time(wolfsentry, &t2));
+        WOLFSENTRY_EXIT_ON_TRUE(wolfsentry_diff_time(wolfsentry, t2, t1) < 0);
+        if (modes[i] == WOLFSENTRY_TIME_MODE_CACHED)
+            WOLFSENTRY_EXIT_ON_FALSE(t1 == t2);
+
+        /* every mode maps onto the realtime epoch. */
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_to_epoch_time(wolfsentry, t2, &epoch_secs, &epoch_nsecs));
+        WOLFSENTRY_EXIT_ON_FALSE(clock_gettime(CLOCK_REALTIME, &ts) == 0);
+        WOLFSENTRY_EXIT_ON_TRUE(labs(ts.tv_sec - epoch_secs) > 1);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_from_epoch_time(wolfsentry, epoch_secs, epoch_nsecs, &t1));
+        WOLFSENTRY_EXIT_ON_TRUE(llabs(wolfsentry_diff_time(wolfsentry, t2, t1)) > 1000);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+    }
+
+    WOLFSENTRY_RETURN_OK;
+}
+
+#endif /* WOLFSENTRY_CLOCK_BUILTINS */
+
 #endif /* TEST_INIT */
 
 #if defined(TEST_RWLOCKS)
@@ -478,6 +524,50 @@ TEST_SKIP(test_rw_locks)
 #define PRIVATE_DATA_SIZE 32
 #define PRIVATE_DATA_ALIGNMENT 16
 
+/* a system allocator that keeps count of what it has outstanding. */
+static int test_counting_n_outstanding;
+
+static void *test_counting_malloc(void *context, size_t size) {
+    void *ret = malloc(size);
+    (void)context;
+    if (ret)
+        ++test_counting_n_outstanding;
+    return ret;
+}
+
+static void test_counting_free(void *context, void *ptr) {
+    (void)context;
+    if (ptr)
+        --test_counting_n_outstanding;
+    free(ptr);
+}
+
+static void *test_counting_realloc(void *context, void *ptr, size_t size) {
+    void *ret = realloc(ptr, size);
+    (void)context;
+    if (ret && (ptr == NULL))
+        ++test_counting_n_outstanding;
+    return ret;
+}
+
+static void *test_counting_memalign(void *context, size_t alignment, size_t size) {
+    void *ret = NULL;
+    (void)context;
+    if (posix_memalign(&ret, alignment < sizeof(void *) ? sizeof(void *) : alignment, size) != 0)
+        return NULL;
+    ++test_counting_n_outstanding;
+    return ret;
+}
+
+static struct wolfsentry_allocator test_counting_allocator = {
+    .context = NULL,
+    .malloc = test_counting_malloc,
+    .free = test_counting_free,
+    .realloc = test_counting_realloc,
+    .memalign = test_counting_memalign,
+    .free_aligned = test_counting_free
+};
+
 static int test_static_routes (void) {
 
     struct wolfsentry_context *wolfsentry;
@@ -980,6 +1070,54 @@ static int test_static_routes (void) {
 
     WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes_static.header.n_ents == 0);
 
+    /* ids resolve through the ID index, not through whichever table holds the
+     * first ent in it.
+     */
+    {
+        struct wolfsentry_table_ent_header *ent;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "by_id", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert_static(wolfsentry, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &id, &action_results));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_table_ent_get_by_id(wolfsentry, id, &ent));
+        WOLFSENTRY_EXIT_ON_FALSE(ent->id == id);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(wolfsentry, NULL /* caller_arg */, id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_delete(wolfsentry, "by_id", -1 /* label_len */, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->events.header.n_ents == 0);
+    }
+
+    /* a route that fails its checks after allocation is freed. */
+    {
+        struct wolfsentry_host_platform_interface hpi = { .allocator = &test_counting_allocator, .timecbs = NULL };
+        struct wolfsentry_context *counted;
+
+        test_counting_n_outstanding = 0;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, &config, &counted));
+        WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_route_insert_static(counted, NULL /* caller_arg */, &remote.sa, &local.sa, flags & ~(wolfsentry_route_flags_t)(WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_DIRECTION_OUT), 0 /* event_label_len */, 0 /* event_label */, &id, &action_results));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&counted));
+        WOLFSENTRY_EXIT_ON_FALSE(test_counting_n_outstanding == 0);
+    }
+
+    /* cloned routes keep the private data alignment. */
+    {
+        struct wolfsentry_eventconfig aligned_config = { .route_private_data_size = PRIVATE_DATA_SIZE, .route_private_data_alignment = 256, .max_connection_count = 10 };
+        struct wolfsentry_context *aligned, *clone;
+        struct wolfsentry_table_ent_header *i;
+        byte octet;
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI, &aligned_config, &aligned));
+        for (octet = 1; octet <= 4; ++octet) {
+            remote.sa.addr[3] = octet;
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert_static(aligned, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &id, &action_results));
+        }
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_clone(aligned, &clone, WOLFSENTRY_CLONE_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FALSE(clone->routes_static.header.n_ents == 4);
+        for (i = clone->routes_static.header.head; i; i = i->next) {
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_private_data(clone, (struct wolfsentry_route *)i, (void **)&private_data, &private_data_size));
+            WOLFSENTRY_EXIT_ON_FALSE(((uintptr_t)private_data & 0xffU) == 0);
+        }
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_free(&clone));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&aligned));
+    }
+
     printf("all subtests succeeded -- %d distinct ents inserted and deleted.\n",wolfsentry->mk_id_cb_state.id_counter);
 
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
@@ -987,9 +1125,241 @@ static int test_static_routes (void) {
     return 0;
 }
 
+/* IPv6 keys take the 16 byte compare path -- make sure the table still comes
+ * out in memcmp order, and that exact and prefix lookups still land.
+ */
+static int test_static_routes_inet6 (void) {
+    struct wolfsentry_context *wolfsentry;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_ent_id_t id, ids[4], route_id;
+    wolfsentry_route_flags_t inexact_matches;
+    int n_deleted;
+    size_t i;
+    struct wolfsentry_route *prev_route = NULL, *route;
+    static const char * const remote_addrs[4] = {
+        "\xfd\0\0\0\0\0\0\0\0\0\0\0\0\0\0\x02",
+        "\x20\x01\x0d\xb8\0\0\0\0\0\x01\0\0\0\0\0\x01",
+        "\xfd\0\0\0\0\0\0\0\0\0\0\0\0\0\0\x01",
+        "\x20\x01\x0d\xb8\0\0\0\0\0\0\0\0\0\0\0\x01"
+    };
+
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[16];
+    } remote, local;
+
+    struct wolfsentry_eventconfig config = { .route_private_data_size = PRIVATE_DATA_SIZE, .route_private_data_alignment = PRIVATE_DATA_ALIGNMENT, .max_connection_count = 10 };
+
+    WOLFSENTRY_EXIT_ON_FAILURE(
+        wolfsentry_init(
+            WOLFSENTRY_TEST_HPI,
+            &config,
+            &wolfsentry));
+
+    remote.sa.sa_family = local.sa.sa_family = AF_INET6;
+    remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+    remote.sa.sa_port = 12345;
+    local.sa.sa_port = 443;
+    remote.sa.addr_len = local.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+    remote.sa.interface = local.sa.interface = 1;
+    memcpy(local.sa.addr,"\xfd\0\0\0\0\0\0\0\0\0\0\0\0\0\0\xff",sizeof local.addr_buf);
+
+    wolfsentry_route_flags_t flags = WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN | WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED;
+
+    for (i = 0; i < sizeof remote_addrs / sizeof remote_addrs[0]; ++i) {
+        memcpy(remote.sa.addr, remote_addrs[i], sizeof remote.addr_buf);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert_static(wolfsentry, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &ids[i], &action_results));
+    }
+
+    for (route = (struct wolfsentry_route *)wolfsentry->routes_static.header.head;
+         route;
+         route = (struct wolfsentry_route *)route->header.next) {
+        if (prev_route)
+            WOLFSENTRY_EXIT_ON_FALSE(memcmp(WOLFSENTRY_ROUTE_REMOTE_ADDR(prev_route), WOLFSENTRY_ROUTE_REMOTE_ADDR(route), sizeof remote.addr_buf) < 0);
+        prev_route = route;
+    }
+
+    for (i = 0; i < sizeof remote_addrs / sizeof remote_addrs[0]; ++i) {
+        memcpy(remote.sa.addr, remote_addrs[i], sizeof remote.addr_buf);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(wolfsentry, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */,
+                                                                   &route_id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(route_id == ids[i]);
+        WOLFSENTRY_EXIT_ON_FALSE(inexact_matches == 0);
+    }
+
+    /* a /60 covering the 2001:db8::/60 pair catches a neighbor that no exact
+     * route covers.
+     */
+    memcpy(remote.sa.addr, remote_addrs[3], sizeof remote.addr_buf);
+    remote.sa.addr_len = 60;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert_static(wolfsentry, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &id, &action_results));
+    remote.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+    remote.sa.addr[15] = 0x77;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(wolfsentry, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */,
+                                                               &route_id, &inexact_matches, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(route_id == id);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(inexact_matches, WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_ADDR_WILDCARD));
+    remote.sa.addr[0] = 0x30;
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_route_event_dispatch(wolfsentry, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */,
+                                                               &route_id, &inexact_matches, &action_results));
+
+    memcpy(remote.sa.addr, remote_addrs[3], sizeof remote.addr_buf);
+    remote.sa.addr_len = 60;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_static(wolfsentry, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &action_results, &n_deleted));
+    WOLFSENTRY_EXIT_ON_FALSE(n_deleted == 1);
+    remote.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+
+    for (i = 0; i < sizeof remote_addrs / sizeof remote_addrs[0]; ++i) {
+        memcpy(remote.sa.addr, remote_addrs[i], sizeof remote.addr_buf);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_static(wolfsentry, NULL /* caller_arg */, &remote.sa, &local.sa, flags, 0 /* event_label_len */, 0 /* event_label */, &action_results, &n_deleted));
+        WOLFSENTRY_EXIT_ON_FALSE(n_deleted == 1);
+    }
+
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes_static.header.n_ents == 0);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
 #undef PRIVATE_DATA_SIZE
 #undef PRIVATE_DATA_ALIGNMENT
 
+/* a prefix that ends mid-byte covers just the addresses that share all of
+ * its bits -- 10.0.4.0/22 is 10.0.4.0 to 10.0.7.255, and 10.0.8.0/22 is a
+ * route of its own.
+ */
+static int test_static_routes_partial_prefix (void) {
+    struct wolfsentry_context *wolfsentry;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_ent_id_t id;
+    wolfsentry_route_flags_t inexact_matches;
+    wolfsentry_route_flags_t flags = WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN;
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[4];
+    } remote, local;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI, NULL /* config */, &wolfsentry));
+
+    remote.sa.sa_family = local.sa.sa_family = AF_INET;
+    remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+    remote.sa.sa_port = 12345;
+    local.sa.sa_port = 443;
+    remote.sa.interface = local.sa.interface = 1;
+    local.sa.addr_len = sizeof local.addr_buf * BITS_PER_BYTE;
+    memcpy(local.sa.addr, "\377\376\375\374", sizeof local.addr_buf);
+
+    remote.sa.addr_len = 22;
+    memcpy(remote.sa.addr, "\12\0\4\0", sizeof remote.addr_buf);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert_static(wolfsentry, NULL /* caller_arg */, &remote.sa, &local.sa, flags | WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, 0 /* event_label_len */, 0 /* event_label */, &id, &action_results));
+    memcpy(remote.sa.addr, "\12\0\10\0", sizeof remote.addr_buf);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_insert_static(wolfsentry, NULL /* caller_arg */, &remote.sa, &local.sa, flags | WOLFSENTRY_ROUTE_FLAG_GREENLISTED, 0 /* event_label_len */, 0 /* event_label */, &id, &action_results));
+
+    remote.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+    memcpy(remote.sa.addr, "\12\0\6\1", sizeof remote.addr_buf);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(wolfsentry, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */,
+                                                               &id, &inexact_matches, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    memcpy(remote.sa.addr, "\12\0\13\1", sizeof remote.addr_buf);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(wolfsentry, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */,
+                                                               &id, &inexact_matches, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT));
+    /* outside both, though it shares the top two bits of their third byte. */
+    memcpy(remote.sa.addr, "\12\0\50\1", sizeof remote.addr_buf);
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_route_event_dispatch(wolfsentry, &remote.sa, &local.sa, flags, NULL /* event_label */, 0 /* event_label_len */, NULL /* caller_arg */,
+                                                               &id, &inexact_matches, &action_results));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+#ifndef LWIP
+#include <arpa/inet.h>
+
+/* checked against inet_pton(), strings and all. */
+static int test_addr_pton (void) {
+    static const struct {
+        wolfsentry_family_t family;
+        const char *addr;
+    } cases[] = {
+        { WOLFSENTRY_AF_INET, "0.0.0.0" },
+        { WOLFSENTRY_AF_INET, "192.168.1.255" },
+        { WOLFSENTRY_AF_INET, "255.255.255.255" },
+        { WOLFSENTRY_AF_INET, "256.0.0.1" },
+        { WOLFSENTRY_AF_INET, "1.2.3" },
+        { WOLFSENTRY_AF_INET, "1.2.3.4.5" },
+        { WOLFSENTRY_AF_INET, "01.2.3.4" },
+        { WOLFSENTRY_AF_INET, "1.2.3.4." },
+        { WOLFSENTRY_AF_INET, "1..3.4" },
+        { WOLFSENTRY_AF_INET, "1.2.3.x" },
+        { WOLFSENTRY_AF_INET, "" },
+        { WOLFSENTRY_AF_INET6, "::" },
+        { WOLFSENTRY_AF_INET6, "::1" },
+        { WOLFSENTRY_AF_INET6, "fe80::" },
+        { WOLFSENTRY_AF_INET6, "2001:db8::1:0:0:1" },
+        { WOLFSENTRY_AF_INET6, "2001:DB8:0:0:1:0:0:1" },
+        { WOLFSENTRY_AF_INET6, "1:2:3:4:5:6:7::" },
+        { WOLFSENTRY_AF_INET6, "::2:3:4:5:6:7:8" },
+        { WOLFSENTRY_AF_INET6, "::ffff:192.168.1.1" },
+        { WOLFSENTRY_AF_INET6, "64:ff9b::10.0.0.1" },
+        { WOLFSENTRY_AF_INET6, "1:2:3:4:5:6:1.2.3.4" },
+        { WOLFSENTRY_AF_INET6, "1:2:3:4:5:6:7:8" },
+        { WOLFSENTRY_AF_INET6, "1:2:3:4:5:6:7:8:9" },
+        { WOLFSENTRY_AF_INET6, "1:2:3:4:5:6:7:8::" },
+        { WOLFSENTRY_AF_INET6, "1:2:3:4:5:6:7" },
+        { WOLFSENTRY_AF_INET6, "1:2:3:4:5:6::1.2.3.4" },
+        { WOLFSENTRY_AF_INET6, "1:2:3:4:5:6:7:1.2.3.4" },
+        { WOLFSENTRY_AF_INET6, "1::2::3" },
+        { WOLFSENTRY_AF_INET6, ":::" },
+        { WOLFSENTRY_AF_INET6, ":1::" },
+        { WOLFSENTRY_AF_INET6, "1:" },
+        { WOLFSENTRY_AF_INET6, "12345::" },
+        { WOLFSENTRY_AF_INET6, "::1.2.3" },
+        { WOLFSENTRY_AF_INET6, "::1.2.3.4:5" },
+        { WOLFSENTRY_AF_INET6, "::g" },
+        { WOLFSENTRY_AF_INET6, "" }
+    };
+    byte addr[16], expected[16];
+    wolfsentry_addr_bits_t addr_bits;
+    size_t i;
+
+    for (i = 0; i < sizeof cases / sizeof cases[0]; ++i) {
+        int af = cases[i].family == WOLFSENTRY_AF_INET ? AF_INET : AF_INET6;
+        wolfsentry_errcode_t ret = wolfsentry_addr_pton(cases[i].family, cases[i].addr, strlen(cases[i].addr), addr, &addr_bits);
+        if (inet_pton(af, cases[i].addr, expected) == 1) {
+            if (ret < 0) {
+                printf("wolfsentry_addr_pton(\"%s\") failed, " WOLFSENTRY_ERROR_FMT "\n", cases[i].addr, WOLFSENTRY_ERROR_FMT_ARGS(ret));
+                return 1;
+            }
+            WOLFSENTRY_EXIT_ON_FALSE(addr_bits == (af == AF_INET ? 32 : 128));
+            WOLFSENTRY_EXIT_ON_FALSE(memcmp(addr, expected, addr_bits / 8) == 0);
+        } else if (! WOLFSENTRY_ERROR_CODE_IS(ret, INVALID_ARG)) {
+            printf("wolfsentry_addr_pton(\"%s\") should have failed\n", cases[i].addr);
+            return 1;
+        }
+    }
+
+    /* not NUL-terminated. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_addr_pton(WOLFSENTRY_AF_INET, "10.0.0.1/8", 8, addr, &addr_bits));
+    WOLFSENTRY_EXIT_ON_FALSE(memcmp(addr, "\x0a\x00\x00\x01", 4) == 0);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_addr_pton(WOLFSENTRY_AF_LINK, "00:1A:2b:3c:4d:5e", 17, addr, &addr_bits));
+    WOLFSENTRY_EXIT_ON_FALSE((addr_bits == 48) && (memcmp(addr, "\x00\x1a\x2b\x3c\x4d\x5e", 6) == 0));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_addr_pton(WOLFSENTRY_AF_LINK, "00:1a:2b:3c:4d:5e:6f:70", 23, addr, &addr_bits));
+    WOLFSENTRY_EXIT_ON_FALSE(addr_bits == 64);
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_addr_pton(WOLFSENTRY_AF_LINK, "00:1a:2b:3c:4d", 14, addr, &addr_bits));
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_addr_pton(WOLFSENTRY_AF_LINK, "00:1a:2b:3c:4d:5", 16, addr, &addr_bits));
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_addr_pton(WOLFSENTRY_AF_LINK, "00-1a-2b-3c-4d-5e", 17, addr, &addr_bits));
+
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_addr_pton(WOLFSENTRY_AF_UNIX, "x", 1, addr, &addr_bits), OP_NOT_SUPP_FOR_PROTO));
+
+    return 0;
+}
+
+#endif /* !LWIP */
+
 #endif /* TEST_STATIC_ROUTES */
 
 #ifdef TEST_DYNAMIC_RULES
@@ -1434,138 +1804,1830 @@ int wolfsentry_event_set_subevent(
 #undef PRIVATE_DATA_SIZE
 #undef PRIVATE_DATA_ALIGNMENT
 
-#endif /* TEST_DYNAMIC_RULES */
+static wolfsentry_time_t test_purge_now;
 
-#ifdef TEST_JSON
+static wolfsentry_errcode_t test_purge_get_time(void *context, wolfsentry_time_t *now) {
+    (void)context;
+    *now = test_purge_now;
+    WOLFSENTRY_RETURN_OK;
+}
 
-#include "wolfsentry/wolfsentry_json.h"
+static wolfsentry_time_t test_purge_diff_time(wolfsentry_time_t later, wolfsentry_time_t earlier) {
+    return later - earlier;
+}
 
-#ifdef LWIP
-#include "lwip-socket.h"
-#else
-#include <sys/socket.h>
-#include <netinet/in.h>
-#endif
+static wolfsentry_time_t test_purge_add_time(wolfsentry_time_t start_time, wolfsentry_time_t time_interval) {
+    return start_time + time_interval;
+}
 
-#define PRIVATE_DATA_SIZE 32
-#define PRIVATE_DATA_ALIGNMENT 16
+static wolfsentry_errcode_t test_purge_to_epoch_time(wolfsentry_time_t when, long *epoch_secs, long *epoch_nsecs) {
+    *epoch_secs = (long)(when / 1000000);
+    *epoch_nsecs = (long)((when % 1000000) * 1000);
+    WOLFSENTRY_RETURN_OK;
+}
 
-static wolfsentry_errcode_t test_action(
-    struct wolfsentry_context *wolfsentry,
-    const struct wolfsentry_action *action,
-    void *handler_arg,
-    void *caller_arg,
-    const struct wolfsentry_event *trigger_event,
-    wolfsentry_action_type_t action_type,
-    struct wolfsentry_route_table *route_table,
-    const struct wolfsentry_route *route,
-    wolfsentry_action_res_t *action_results)
-{
-    const struct wolfsentry_event *parent_event = wolfsentry_route_parent_event(route);
-    (void)wolfsentry;
-    (void)handler_arg;
-    (void)route_table;
-    (void)action_results;
-    printf("action callback: a=\"%s\" parent_event=\"%s\" trigger=\"%s\" t=%u r_id=%u caller_arg=%p\n",
-           wolfsentry_action_get_label(action),
-           wolfsentry_event_get_label(parent_event),
-           wolfsentry_event_get_label(trigger_event),
-           action_type,
-           wolfsentry_get_object_id(route),
-           caller_arg);
-    return 0;
+static wolfsentry_errcode_t test_purge_from_epoch_time(long epoch_secs, long epoch_nsecs, wolfsentry_time_t *when) {
+    *when = ((wolfsentry_time_t)epoch_secs * 1000000) + (epoch_nsecs / 1000);
+    WOLFSENTRY_RETURN_OK;
 }
 
-static wolfsentry_errcode_t json_feed_file(struct wolfsentry_context *wolfsentry, const char *fname, wolfsentry_config_load_flags_t flags) {
-    wolfsentry_errcode_t ret;
-    struct wolfsentry_json_process_state *jps;
-    FILE *f;
-    char buf[512], err_buf[512];
+static wolfsentry_errcode_t test_dispatch_from_addr_port_1(struct wolfsentry_context *wolfsentry, const byte *remote_addr, wolfsentry_port_t local_port, wolfsentry_action_res_t *action_results) {
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[4];
+    } remote, local;
+    wolfsentry_route_flags_t inexact_matches;
+    wolfsentry_ent_id_t id;
 
-    if (strcmp(fname,"-"))
-        f = fopen(fname, "r");
-    else
-        f = stdin; // GCOV_EXCL_LINE
-    if (! f) {
-    // GCOV_EXCL_START
-        fprintf(stderr, "fopen(%s): %s\n",fname,strerror(errno));
-        WOLFSENTRY_ERROR_RETURN(UNIT_TEST_FAILURE);
-    // GCOV_EXCL_STOP
-    }
+    remote.sa.sa_family = local.sa.sa_family = AF_INET;
+    remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+    remote.sa.sa_port = 12345;
+    local.sa.sa_port = local_port;
+    remote.sa.addr_len = local.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+    remote.sa.interface = local.sa.interface = 1;
+    memcpy(remote.sa.addr, remote_addr, sizeof remote.addr_buf);
+    memcpy(local.sa.addr, "\300\250\1\1", sizeof local.addr_buf);
+    *action_results = WOLFSENTRY_ACTION_RES_NONE;
 
-    ret = wolfsentry_config_json_init(
+    return wolfsentry_route_event_dispatch(
         wolfsentry,
-        flags,
-        &jps);
-    if (ret < 0)
-        goto out;
-
-    for (;;) {
-        size_t n = fread(buf, 1, sizeof buf, f);
-        if ((n < sizeof buf) && ferror(f)) {
-        // GCOV_EXCL_START
-            fprintf(stderr,"fread(%s): %s\n",fname, strerror(errno));
-            ret = WOLFSENTRY_ERROR_ENCODE(UNIT_TEST_FAILURE);
-            goto out;
-        // GCOV_EXCL_STOP
-        }
-
-        ret = wolfsentry_config_json_feed(jps, buf, n, err_buf, sizeof err_buf);
-        if (ret < 0) {
-        // GCOV_EXCL_START
-            fprintf(stderr, "%.*s\n", (int)sizeof err_buf, err_buf);
-            goto out;
-        // GCOV_EXCL_STOP
-        }
-        if ((n < sizeof buf) && feof(f))
-            break;
-    }
-    ret = wolfsentry_config_json_fini(&jps, err_buf, sizeof err_buf);
-    if (ret < 0) {
-    // GCOV_EXCL_START
-        fprintf(stderr, "%.*s\n", (int)sizeof err_buf, err_buf);
-        goto out;
-    // GCOV_EXCL_STOP
-    }
+        &remote.sa,
+        &local.sa,
+        WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN,
+        "connect",
+        -1 /* event_label_len */,
+        NULL /* caller_arg */,
+        &id,
+        &inexact_matches,
+        action_results);
+}
 
-    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+static wolfsentry_errcode_t test_dispatch_from_addr_1(struct wolfsentry_context *wolfsentry, const byte *remote_addr, wolfsentry_action_res_t *action_results) {
+    return test_dispatch_from_addr_port_1(wolfsentry, remote_addr, 443, action_results);
+}
 
-  out:
+static wolfsentry_errcode_t test_dispatch_from_1(struct wolfsentry_context *wolfsentry, byte last_octet, wolfsentry_action_res_t *action_results) {
+    byte remote_addr[4] = { 10, 0, 0, 0 };
+    remote_addr[3] = last_octet;
+    return test_dispatch_from_addr_1(wolfsentry, remote_addr, action_results);
+}
 
-    if (f != stdin)
-        fclose(f);
+static int test_dispatch_from_addr(struct wolfsentry_context *wolfsentry, const byte *remote_addr, wolfsentry_action_res_t *action_results) {
+    WOLFSENTRY_EXIT_ON_FAILURE(test_dispatch_from_addr_1(wolfsentry, remote_addr, action_results));
+    return 0;
+}
 
-    return ret;
+static int test_dispatch_from_addr_port(struct wolfsentry_context *wolfsentry, const byte *remote_addr, wolfsentry_port_t local_port, wolfsentry_action_res_t *action_results) {
+    WOLFSENTRY_EXIT_ON_FAILURE(test_dispatch_from_addr_port_1(wolfsentry, remote_addr, local_port, action_results));
+    return 0;
 }
 
+static int test_dispatch_from(struct wolfsentry_context *wolfsentry, byte last_octet, wolfsentry_action_res_t *action_results) {
+    WOLFSENTRY_EXIT_ON_FAILURE(test_dispatch_from_1(wolfsentry, last_octet, action_results));
+    return 0;
+}
 
-static int test_json(const char *fname) {
-    wolfsentry_errcode_t ret;
+static int test_route_purge (void) {
     struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_timecbs timecbs = {
+        .context = NULL,
+        .get_time = test_purge_get_time,
+        .diff_time = test_purge_diff_time,
+        .add_time = test_purge_add_time,
+        .to_epoch_time = test_purge_to_epoch_time,
+        .from_epoch_time = test_purge_from_epoch_time,
+        .interval_to_seconds = test_purge_to_epoch_time,
+        .interval_from_seconds = test_purge_from_epoch_time
+    };
+    struct wolfsentry_host_platform_interface hpi = { .allocator = NULL, .timecbs = &timecbs };
+    struct wolfsentry_route_table *dynamic_routes;
+    wolfsentry_time_t purge_age;
+    wolfsentry_action_res_t action_results;
     wolfsentry_ent_id_t id;
+    byte i;
 
-    struct wolfsentry_eventconfig config = { .route_private_data_size = PRIVATE_DATA_SIZE, .route_private_data_alignment = PRIVATE_DATA_ALIGNMENT };
-
-    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI,
-                                               &config,
-                                               &wolfsentry));
+    test_purge_now = 1000000000;
 
-    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(
-                                   wolfsentry,
-                                   "handle-insert",
-                                   WOLFSENTRY_LENGTH_NULL_TERMINATED,
-                                   WOLFSENTRY_ACTION_FLAG_NONE,
-                                   test_action,
-                                   NULL,
-                                   &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, NULL /* config */, &wolfsentry));
 
-    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(
-                                   wolfsentry,
-                                   "handle-delete",
-                                   WOLFSENTRY_LENGTH_NULL_TERMINATED,
-                                   WOLFSENTRY_ACTION_FLAG_NONE,
-                                   test_action,
-                                   NULL,
+    WOLFSENTRY_EXIT_ON_FAILURE(
+        wolfsentry_event_insert(
+            wolfsentry,
+            "connect",
+            -1 /* label_len */,
+            10,
+            NULL /* config */,
+            WOLFSENTRY_EVENT_FLAG_NONE,
+            &id));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_route_table_purge_age_set(wolfsentry, dynamic_routes, -1));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_purge_age_set(wolfsentry, dynamic_routes, 10000000));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_purge_age_get(wolfsentry, dynamic_routes, &purge_age));
+    WOLFSENTRY_EXIT_ON_FALSE(purge_age == 10000000);
+
+    for (i = 1; i <= 3; ++i) {
+        if (test_dispatch_from(wolfsentry, i, &action_results) != 0)
+            return 1;
+    }
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 3);
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->purge_wheel.n_scheduled == 3);
+
+    /* nothing is stale yet. */
+    test_purge_now += 6000000;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge(wolfsentry, dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 3);
+
+    /* a hit keeps 10.0.0.1 fresh past its original deadline. */
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    test_purge_now += 5000000;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge(wolfsentry, dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 1);
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->purge_wheel.n_scheduled == 1);
+
+    /* deadlines are rounded up to the next tick (purge_age / 64). */
+    test_purge_now += 5000000;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge(wolfsentry, dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 1);
+    test_purge_now += 200000;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge(wolfsentry, dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 0);
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->purge_wheel.n_scheduled == 0);
+
+    /* a long idle gap is handled by a single sweep. */
+    for (i = 1; i <= 3; ++i) {
+        if (test_dispatch_from(wolfsentry, i, &action_results) != 0)
+            return 1;
+    }
+    test_purge_now += 5000000;
+    if (test_dispatch_from(wolfsentry, 4, &action_results) != 0)
+        return 1;
+    test_purge_now += 1000000000;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge(wolfsentry, dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 0);
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->purge_wheel.n_scheduled == 0);
+
+    /* purge_age longer than the lower levels of the wheel can span. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_purge_age_set(wolfsentry, dynamic_routes, 86400000000LL));
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    for (i = 0; i < 47; ++i) {
+        test_purge_now += 1800000000LL;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge(wolfsentry, dynamic_routes));
+    }
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 1);
+    test_purge_now += 3600000000LL;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge(wolfsentry, dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 0);
+
+    /* incremental purges pick up where they left off, across inserts and
+     * deletes.  moves between wheel slots count against the budget too.
+     */
+    {
+        wolfsentry_hitcount_t n_before;
+        int done, tries;
+
+        for (i = 1; i <= 10; ++i) {
+            if (test_dispatch_from(wolfsentry, i, &action_results) != 0)
+                return 1;
+        }
+        test_purge_now += 90000000000LL;
+        for (tries = 0; dynamic_routes->purge_wheel.due.head == NULL; ++tries) {
+            WOLFSENTRY_EXIT_ON_TRUE(tries == 10);
+            n_before = dynamic_routes->header.n_ents;
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge_incremental(wolfsentry, dynamic_routes, 3, &done));
+            WOLFSENTRY_EXIT_ON_TRUE(done);
+            WOLFSENTRY_EXIT_ON_TRUE(n_before - dynamic_routes->header.n_ents > 3);
+        }
+
+        n_before = dynamic_routes->header.n_ents;
+        WOLFSENTRY_EXIT_ON_FAILURE(
+            wolfsentry_route_delete_by_id(
+                wolfsentry,
+                NULL /* caller_arg */,
+                ((struct wolfsentry_route *)((byte *)dynamic_routes->purge_wheel.due.head - offsetof(struct wolfsentry_route, purge_link)))->header.id,
+                NULL /* event_label */,
+                0 /* event_label_len */,
+                &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == n_before - 1);
+        if (test_dispatch_from(wolfsentry, 200, &action_results) != 0)
+            return 1;
+
+        for (tries = 0; ; ++tries) {
+            WOLFSENTRY_EXIT_ON_TRUE(tries == 20);
+            n_before = dynamic_routes->header.n_ents;
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge_incremental(wolfsentry, dynamic_routes, 3, &done));
+            WOLFSENTRY_EXIT_ON_TRUE(n_before - dynamic_routes->header.n_ents > 3);
+            if (done)
+                break;
+        }
+        /* only the fresh route is left. */
+        WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 1);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_flush_table(wolfsentry, dynamic_routes));
+    }
+
+    /* so is the catch-up sweep of a wheel left idle past its horizon. */
+    {
+        struct wolfsentry_list_ent_header *due_i;
+        wolfsentry_hitcount_t n_due;
+        int done, tries;
+
+        for (i = 1; i <= 100; ++i) {
+            if (test_dispatch_from(wolfsentry, i, &action_results) != 0)
+                return 1;
+        }
+        test_purge_now += 100LL * 86400000000LL;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge_incremental(wolfsentry, dynamic_routes, 10, &done));
+        WOLFSENTRY_EXIT_ON_TRUE(done);
+        for (n_due = 0, due_i = dynamic_routes->purge_wheel.due.head; due_i; due_i = due_i->next)
+            ++n_due;
+        WOLFSENTRY_EXIT_ON_TRUE(n_due + (100 - dynamic_routes->header.n_ents) > 10);
+        for (tries = 0; ! done; ++tries) {
+            WOLFSENTRY_EXIT_ON_TRUE(tries == 30);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_stale_purge_incremental(wolfsentry, dynamic_routes, 10, &done));
+        }
+        WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 0);
+        WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->purge_wheel.n_scheduled == 0);
+    }
+
+    /* maintenance slices do a bounded share of the work. */
+    {
+        struct wolfsentry_maintenance_config maintenance_config = { .interval = 1000000, .max_entries_per_slice = 40, .max_slice_time = 0 };
+        wolfsentry_hitcount_t n_before;
+        int done, tries;
+
+        for (i = 1; i <= 100; ++i) {
+            if (test_dispatch_from(wolfsentry, i, &action_results) != 0)
+                return 1;
+        }
+        test_purge_now += 90000000000LL;
+        for (tries = 0; ; ++tries) {
+            WOLFSENTRY_EXIT_ON_TRUE(tries == 10);
+            n_before = dynamic_routes->header.n_ents;
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_maintenance_slice(wolfsentry, &maintenance_config, &done));
+            WOLFSENTRY_EXIT_ON_TRUE(n_before - dynamic_routes->header.n_ents > 40);
+            if (done)
+                break;
+        }
+        WOLFSENTRY_EXIT_ON_TRUE(tries < 2);
+        WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 0);
+    }
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+#ifdef WOLFSENTRY_MAINTENANCE_THREAD
+
+static int test_maintenance_thread (void) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_maintenance_config maintenance_config = { .interval = 10000, .max_entries_per_slice = 4, .max_slice_time = 1000 };
+    struct wolfsentry_route_table *dynamic_routes;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_hitcount_t n_ents;
+    wolfsentry_ent_id_t id;
+    byte i;
+    int tries;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI, NULL /* config */, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_purge_age_set(wolfsentry, dynamic_routes, 50000));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_maintenance_start(wolfsentry, &maintenance_config));
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_maintenance_start(wolfsentry, &maintenance_config));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_lock_mutex(wolfsentry));
+    for (i = 1; i <= 20; ++i) {
+        if (test_dispatch_from(wolfsentry, i, &action_results) != 0)
+            return 1;
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_unlock(wolfsentry));
+
+    for (tries = 0; tries < 200; ++tries) {
+        usleep(10000);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_lock_mutex(wolfsentry));
+        n_ents = dynamic_routes->header.n_ents;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_unlock(wolfsentry));
+        if (n_ents == 0)
+            break;
+    }
+    WOLFSENTRY_EXIT_ON_FALSE(n_ents == 0);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_maintenance_stop(wolfsentry));
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_maintenance_stop(wolfsentry));
+
+    /* shutdown stops a running thread. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_maintenance_start(wolfsentry, NULL /* config */));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+#ifdef WOLFSENTRY_CLOCK_BUILTINS
+    /* with a cached clock, the thread has to keep its own moving. */
+    {
+        struct wolfsentry_timecbs timecbs;
+        struct wolfsentry_host_platform_interface hpi = { .allocator = NULL, .timecbs = &timecbs };
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_builtin_timecbs_get(WOLFSENTRY_TIME_MODE_CACHED, &timecbs));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_builtin_time_cache_refresh());
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, NULL /* config */, &wolfsentry));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_purge_age_set(wolfsentry, dynamic_routes, 50000));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_maintenance_start(wolfsentry, &maintenance_config));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_lock_mutex(wolfsentry));
+        for (i = 1; i <= 4; ++i) {
+            if (test_dispatch_from(wolfsentry, i, &action_results) != 0)
+                return 1;
+        }
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_unlock(wolfsentry));
+
+        for (tries = 0; tries < 200; ++tries) {
+            usleep(10000);
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_lock_mutex(wolfsentry));
+            n_ents = dynamic_routes->header.n_ents;
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_unlock(wolfsentry));
+            if (n_ents == 0)
+                break;
+        }
+        WOLFSENTRY_EXIT_ON_FALSE(n_ents == 0);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+    }
+#endif
+
+    return 0;
+}
+
+#endif /* WOLFSENTRY_MAINTENANCE_THREAD */
+
+static int test_release_action_calls;
+
+static wolfsentry_errcode_t test_release_action(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_action *action,
+    void *handler_context,
+    void *caller_arg,
+    const struct wolfsentry_event *event,
+    wolfsentry_action_type_t action_type,
+    struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_route *route,
+    wolfsentry_action_res_t *action_results)
+{
+    (void)wolfsentry;
+    (void)action;
+    (void)handler_context;
+    (void)caller_arg;
+    (void)event;
+    (void)route_table;
+    (void)action_results;
+
+    if ((action_type == WOLFSENTRY_ACTION_TYPE_RELEASE) && (! (route->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED)))
+        ++test_release_action_calls;
+
+    return 0;
+}
+
+static int test_penaltybox_release (void) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_timecbs timecbs = {
+        .context = NULL,
+        .get_time = test_purge_get_time,
+        .diff_time = test_purge_diff_time,
+        .add_time = test_purge_add_time,
+        .to_epoch_time = test_purge_to_epoch_time,
+        .from_epoch_time = test_purge_from_epoch_time,
+        .interval_to_seconds = test_purge_to_epoch_time,
+        .interval_from_seconds = test_purge_from_epoch_time
+    };
+    struct wolfsentry_host_platform_interface hpi = { .allocator = NULL, .timecbs = &timecbs };
+    struct wolfsentry_eventconfig config = { .max_connection_count = 10, .penaltybox_duration = 10000000 };
+    struct wolfsentry_route_table *dynamic_routes;
+    struct wolfsentry_table_ent_header *i;
+    wolfsentry_route_flags_t flags_before, flags_after;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_ent_id_t id;
+    int n_released;
+
+    test_purge_now = 1000000000;
+    test_release_action_calls = 0;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, &config, &wolfsentry));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect_released", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(wolfsentry, "count_releases", -1 /* label_len */, WOLFSENTRY_ACTION_FLAG_NONE, test_release_action, NULL /* handler_context */, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_action_append(wolfsentry, "connect_released", -1, "count_releases", -1));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_set_subevent(wolfsentry, "connect", -1, WOLFSENTRY_ACTION_TYPE_RELEASE, "connect_released", -1));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    if (test_dispatch_from(wolfsentry, 2, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 2);
+
+    /* box the routes 4 seconds apart. */
+    i = dynamic_routes->header.head;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, (struct wolfsentry_route *)i, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    test_purge_now += 4000000;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, (struct wolfsentry_route *)i->next, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->penaltybox_queue.head == &((struct wolfsentry_route *)i)->penaltybox_link);
+
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    test_purge_now += 5000000;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_penaltybox_release_expired(wolfsentry, NULL /* caller_arg */, &n_released));
+    WOLFSENTRY_EXIT_ON_FALSE(n_released == 0);
+
+    /* the boxes lapse without any traffic, one at a time. */
+    test_purge_now += 1000000;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_penaltybox_release_expired(wolfsentry, NULL /* caller_arg */, &n_released));
+    WOLFSENTRY_EXIT_ON_FALSE(n_released == 1);
+    WOLFSENTRY_EXIT_ON_FALSE(test_release_action_calls == 1);
+    WOLFSENTRY_EXIT_ON_TRUE(((struct wolfsentry_route *)i)->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED);
+    WOLFSENTRY_EXIT_ON_FALSE(((struct wolfsentry_route *)i->next)->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED);
+
+    test_purge_now += 4000000;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_penaltybox_release_expired(wolfsentry, NULL /* caller_arg */, &n_released));
+    WOLFSENTRY_EXIT_ON_FALSE(n_released == 1);
+    WOLFSENTRY_EXIT_ON_FALSE(test_release_action_calls == 2);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->penaltybox_queue.head == NULL);
+
+    if (test_dispatch_from(wolfsentry, 2, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    /* with no driver, a dispatch past the deadlines releases its own route and the others due. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, (struct wolfsentry_route *)i, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, (struct wolfsentry_route *)i->next, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    test_purge_now += 9000000;
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    WOLFSENTRY_EXIT_ON_FALSE(test_release_action_calls == 2);
+    test_purge_now += 1000000;
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    WOLFSENTRY_EXIT_ON_FALSE(test_release_action_calls == 4);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->penaltybox_queue.head == NULL);
+    WOLFSENTRY_EXIT_ON_TRUE(((struct wolfsentry_route *)i->next)->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED);
+
+    /* deleting a boxed route takes it off the queue. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, (struct wolfsentry_route *)i, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->penaltybox_queue.head != NULL);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_flush_table(wolfsentry, dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->penaltybox_queue.head == NULL);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+static int test_rate_limit (void) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_timecbs timecbs = {
+        .context = NULL,
+        .get_time = test_purge_get_time,
+        .diff_time = test_purge_diff_time,
+        .add_time = test_purge_add_time,
+        .to_epoch_time = test_purge_to_epoch_time,
+        .from_epoch_time = test_purge_from_epoch_time,
+        .interval_to_seconds = test_purge_to_epoch_time,
+        .interval_from_seconds = test_purge_from_epoch_time
+    };
+    struct wolfsentry_host_platform_interface hpi = { .allocator = NULL, .timecbs = &timecbs };
+    struct wolfsentry_eventconfig config = { .max_connection_count = 10, .rate_limit_burst = 4 };
+    wolfsentry_action_res_t action_results;
+    wolfsentry_ent_id_t id;
+    int i;
+
+    test_purge_now = 1000000000;
+
+    /* a burst without a rate is refused. */
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_init(&hpi, &config, &wolfsentry));
+
+    /* 2 per second, up to 4 at once. */
+    config.rate_limit_tokens = 2;
+    config.rate_limit_period = 1000000;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->config.rate_limit_interval == 500000);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+
+    for (i = 0; i < 4; ++i) {
+        if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+            return 1;
+        WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    }
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    /* buckets are per route. */
+    if (test_dispatch_from(wolfsentry, 2, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    /* one token comes back every half second. */
+    test_purge_now += 500000;
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    /* a long idle spell refills the bucket only to its depth. */
+    test_purge_now += 60000000;
+    for (i = 0; i < 4; ++i) {
+        if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+            return 1;
+        WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    }
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+static int test_route_admission (void) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_eventconfig config = { .max_connection_count = 10, .route_admission_threshold = 255 };
+    struct wolfsentry_route_table *dynamic_routes;
+    struct wolfsentry_event *event;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_ent_id_t id;
+    wolfsentry_errcode_t ret;
+    unsigned int i;
+
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_init(NULL /* hpi */, &config, &wolfsentry));
+
+    config.route_admission_threshold = 2;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+
+    /* the first two sightings are turned away without a route. */
+    for (i = 0; i < 2; ++i) {
+        ret = test_dispatch_from_1(wolfsentry, 1, &action_results);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, NOT_INSERTED));
+        WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 0);
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_get_reference(wolfsentry, "connect", -1 /* label_len */, &event));
+    WOLFSENTRY_EXIT_ON_TRUE(event->admission_sketch == NULL);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_drop_reference(wolfsentry, event, NULL /* action_results */));
+
+    /* the third gets one. */
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 1);
+
+    /* a spray of one-off sources leaves the table alone. */
+    for (i = 2; i < 250; ++i) {
+        ret = test_dispatch_from_1(wolfsentry, (byte)i, &action_results);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, NOT_INSERTED));
+    }
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 1);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+static wolfsentry_errcode_t test_derogatory_action(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_action *action,
+    void *handler_context,
+    void *caller_arg,
+    const struct wolfsentry_event *event,
+    wolfsentry_action_type_t action_type,
+    struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_route *route,
+    wolfsentry_action_res_t *action_results)
+{
+    (void)wolfsentry;
+    (void)action;
+    (void)handler_context;
+    (void)caller_arg;
+    (void)event;
+    (void)action_type;
+    (void)route_table;
+    (void)route;
+
+    *action_results |= WOLFSENTRY_ACTION_RES_INSERT | WOLFSENTRY_ACTION_RES_DEROGATORY;
+
+    return 0;
+}
+
+static int test_derogatory_penaltybox (void) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_timecbs timecbs = {
+        .context = NULL,
+        .get_time = test_purge_get_time,
+        .diff_time = test_purge_diff_time,
+        .add_time = test_purge_add_time,
+        .to_epoch_time = test_purge_to_epoch_time,
+        .from_epoch_time = test_purge_from_epoch_time,
+        .interval_to_seconds = test_purge_to_epoch_time,
+        .interval_from_seconds = test_purge_from_epoch_time
+    };
+    struct wolfsentry_host_platform_interface hpi = { .allocator = NULL, .timecbs = &timecbs };
+    struct wolfsentry_eventconfig config = { .max_connection_count = 10, .penaltybox_duration = 600000000, .derogatory_threshold_for_penaltybox = 3, .derogatory_window = 10000000 };
+    struct wolfsentry_route_table *dynamic_routes;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_ent_id_t id;
+
+    test_purge_now = 1000000000;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(wolfsentry, "derogate", -1 /* label_len */, WOLFSENTRY_ACTION_FLAG_NONE, test_derogatory_action, NULL /* handler_context */, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_action_append(wolfsentry, "connect", -1, "derogate", -1));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    if (test_dispatch_from(wolfsentry, 2, &action_results) != 0)
+        return 1;
+    test_purge_now += 4000000;
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+
+    /* the window has rolled over, and 2 + 2 * 9/10 rounds down to 2. */
+    test_purge_now += 7000000;
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->penaltybox_queue.head == NULL);
+
+    /* 2 + 2 * 8/10 reaches the threshold. */
+    test_purge_now += 1000000;
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->penaltybox_queue.head != NULL);
+
+    /* results spread wider than the window never add up. */
+    test_purge_now += 25000000;
+    if (test_dispatch_from(wolfsentry, 2, &action_results) != 0)
+        return 1;
+    test_purge_now += 25000000;
+    if (test_dispatch_from(wolfsentry, 2, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+static int test_penaltybox_aggregate (void) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_timecbs timecbs = {
+        .context = NULL,
+        .get_time = test_purge_get_time,
+        .diff_time = test_purge_diff_time,
+        .add_time = test_purge_add_time,
+        .to_epoch_time = test_purge_to_epoch_time,
+        .from_epoch_time = test_purge_from_epoch_time,
+        .interval_to_seconds = test_purge_to_epoch_time,
+        .interval_from_seconds = test_purge_from_epoch_time
+    };
+    struct wolfsentry_host_platform_interface hpi = { .allocator = NULL, .timecbs = &timecbs };
+    struct wolfsentry_eventconfig config = { .max_connection_count = 10, .penaltybox_duration = 10000000 };
+    struct wolfsentry_route_table *dynamic_routes;
+    struct wolfsentry_table_ent_header *i;
+    struct wolfsentry_route *aggregate;
+    wolfsentry_route_flags_t flags_before, flags_after;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_ent_id_t id;
+    static const byte boxed_addrs[][4] = { { 10, 0, 4, 1 }, { 10, 0, 5, 1 }, { 10, 0, 7, 1 }, { 10, 0, 8, 1 }, { 10, 0, 11, 1 } };
+    int n_aggregated, n_released;
+    byte octet;
+
+    test_purge_now = 1000000000;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+
+    for (octet = 1; octet <= 6; ++octet) {
+        if (test_dispatch_from(wolfsentry, octet, &action_results) != 0)
+            return 1;
+    }
+
+    /* box all but 10.0.0.6, a second apart. */
+    for (i = dynamic_routes->header.head; i; i = i->next) {
+        if (WOLFSENTRY_ROUTE_REMOTE_ADDR((struct wolfsentry_route *)i)[3] == 6)
+            continue;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, (struct wolfsentry_route *)i, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+        ((struct wolfsentry_route *)i)->meta.derogatory_count = 2;
+        test_purge_now += 1000000;
+    }
+
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_route_penaltybox_aggregate(wolfsentry, NULL /* caller_arg */, AF_INET, 24, 1, &n_aggregated));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_penaltybox_aggregate(wolfsentry, NULL /* caller_arg */, AF_INET, 24, 6, &n_aggregated));
+    WOLFSENTRY_EXIT_ON_FALSE(n_aggregated == 0);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_penaltybox_aggregate(wolfsentry, NULL /* caller_arg */, AF_INET6, 64, 2, &n_aggregated));
+    WOLFSENTRY_EXIT_ON_FALSE(n_aggregated == 0);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_penaltybox_aggregate(wolfsentry, NULL /* caller_arg */, AF_INET, 24, 4, &n_aggregated));
+    WOLFSENTRY_EXIT_ON_FALSE(n_aggregated == 5);
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 2);
+    aggregate = (struct wolfsentry_route *)dynamic_routes->header.head;
+    WOLFSENTRY_EXIT_ON_FALSE(aggregate->remote.addr_len == 24);
+    WOLFSENTRY_EXIT_ON_FALSE(aggregate->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED);
+    WOLFSENTRY_EXIT_ON_FALSE(aggregate->flags & WOLFSENTRY_ROUTE_FLAG_SA_REMOTE_PORT_WILDCARD);
+    WOLFSENTRY_EXIT_ON_FALSE(aggregate->meta.derogatory_count == 10);
+    WOLFSENTRY_EXIT_ON_FALSE(aggregate->meta.last_penaltybox_time == test_purge_now - 1000000);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->penaltybox_queue.head == &aggregate->penaltybox_link);
+
+    /* boxed sources now land on the aggregate, and get no new routes. */
+    if (test_dispatch_from(wolfsentry, 3, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 2);
+    if (test_dispatch_from(wolfsentry, 6, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    /* a later boxing under the prefix is folded in. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, (struct wolfsentry_route *)aggregate->header.next, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_penaltybox_aggregate(wolfsentry, NULL /* caller_arg */, AF_INET, 24, 4, &n_aggregated));
+    WOLFSENTRY_EXIT_ON_FALSE(n_aggregated == 1);
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 1);
+    WOLFSENTRY_EXIT_ON_FALSE(aggregate->meta.last_penaltybox_time == test_purge_now);
+
+    test_purge_now += 10000000;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_penaltybox_release_expired(wolfsentry, NULL /* caller_arg */, &n_released));
+    WOLFSENTRY_EXIT_ON_FALSE(n_released == 1);
+    WOLFSENTRY_EXIT_ON_TRUE(aggregate->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    /* a /22 groups on its leading 22 bits -- 10.0.4-7.x apart from 10.0.8-11.x
+     * -- and each aggregate covers just its own /22.
+     */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+    for (octet = 0; octet < sizeof boxed_addrs / sizeof boxed_addrs[0]; ++octet) {
+        if (test_dispatch_from_addr(wolfsentry, boxed_addrs[octet], &action_results) != 0)
+            return 1;
+    }
+    for (i = dynamic_routes->header.head; i; i = i->next) {
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, (struct wolfsentry_route *)i, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+        test_purge_now += 1000000;
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_penaltybox_aggregate(wolfsentry, NULL /* caller_arg */, AF_INET, 22, 2, &n_aggregated));
+    WOLFSENTRY_EXIT_ON_FALSE(n_aggregated == 5);
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 2);
+    aggregate = (struct wolfsentry_route *)dynamic_routes->header.head;
+    WOLFSENTRY_EXIT_ON_FALSE(aggregate->remote.addr_len == 22);
+    WOLFSENTRY_EXIT_ON_FALSE(memcmp(WOLFSENTRY_ROUTE_REMOTE_ADDR(aggregate), "\12\0\4", 3) == 0);
+    aggregate = (struct wolfsentry_route *)aggregate->header.next;
+    WOLFSENTRY_EXIT_ON_FALSE(memcmp(WOLFSENTRY_ROUTE_REMOTE_ADDR(aggregate), "\12\0\10", 3) == 0);
+
+    if (test_dispatch_from_addr(wolfsentry, (const byte *)"\12\0\6\1", &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    if (test_dispatch_from_addr(wolfsentry, (const byte *)"\12\0\3\1", &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    if (test_dispatch_from_addr(wolfsentry, (const byte *)"\12\0\14\1", &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    /* six groups under one /24, told apart by local port -- more than are
+     * tracked on the stack -- all aggregate in one pass, except where a live
+     * connection holds a member in place.
+     */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+    for (octet = 1; octet <= 12; ++octet) {
+        byte remote_addr[4] = { 10, 0, 0, 0 };
+        remote_addr[3] = octet;
+        if (test_dispatch_from_addr_port(wolfsentry, remote_addr, (wolfsentry_port_t)(1000 + (octet - 1) / 2), &action_results) != 0)
+            return 1;
+    }
+    for (i = dynamic_routes->header.head; i; i = i->next) {
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, (struct wolfsentry_route *)i, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+        if (WOLFSENTRY_ROUTE_REMOTE_ADDR((struct wolfsentry_route *)i)[3] == 12)
+            ((struct wolfsentry_route *)i)->meta.connection_count = 1;
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_penaltybox_aggregate(wolfsentry, NULL /* caller_arg */, AF_INET, 24, 2, &n_aggregated));
+    WOLFSENTRY_EXIT_ON_FALSE(n_aggregated == 10);
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 7);
+    for (i = dynamic_routes->header.head; i; i = i->next) {
+        if (((struct wolfsentry_route *)i)->remote.addr_len == 24)
+            WOLFSENTRY_EXIT_ON_FALSE(((struct wolfsentry_route *)i)->meta.connection_count == 0);
+    }
+
+    /* once released, the held route and its partner fold in. */
+    for (i = dynamic_routes->header.head; i; i = i->next) {
+        if (((struct wolfsentry_route *)i)->remote.addr_len == 32)
+            ((struct wolfsentry_route *)i)->meta.connection_count = 0;
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_penaltybox_aggregate(wolfsentry, NULL /* caller_arg */, AF_INET, 24, 2, &n_aggregated));
+    WOLFSENTRY_EXIT_ON_FALSE(n_aggregated == 2);
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 6);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+static int test_dispatch_connection_addr(struct wolfsentry_context *wolfsentry, const byte *remote_addr, wolfsentry_action_res_t result, wolfsentry_action_res_t *action_results) {
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[4];
+    } remote, local;
+    wolfsentry_route_flags_t inexact_matches;
+    wolfsentry_ent_id_t id;
+
+    remote.sa.sa_family = local.sa.sa_family = AF_INET;
+    remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+    remote.sa.sa_port = 12345;
+    local.sa.sa_port = 443;
+    remote.sa.addr_len = local.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+    remote.sa.interface = local.sa.interface = 1;
+    memcpy(remote.sa.addr, remote_addr, sizeof remote.addr_buf);
+    memcpy(local.sa.addr, "\300\250\1\1", sizeof local.addr_buf);
+    *action_results = result;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(
+        wolfsentry_route_event_dispatch_with_inited_result(
+            wolfsentry,
+            &remote.sa,
+            &local.sa,
+            WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN,
+            "connect",
+            -1 /* event_label_len */,
+            NULL /* caller_arg */,
+            &id,
+            &inexact_matches,
+            action_results));
+
+    return 0;
+}
+
+static int test_dispatch_connection(struct wolfsentry_context *wolfsentry, byte last_octet, wolfsentry_action_res_t result, wolfsentry_action_res_t *action_results) {
+    byte remote_addr[4] = { 10, 0, 0, 0 };
+    remote_addr[3] = last_octet;
+    return test_dispatch_connection_addr(wolfsentry, remote_addr, result, action_results);
+}
+
+static int test_subnet_connections (void) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_eventconfig config = { .max_connection_count = 10, .max_subnet_connection_count = 3 };
+    wolfsentry_action_res_t action_results;
+    wolfsentry_addr_bits_t prefix_bits;
+    wolfsentry_ent_id_t id;
+    byte octet;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+
+    /* no prefix for the family, no subnet limit. */
+    for (octet = 1; octet <= 4; ++octet) {
+        if (test_dispatch_connection(wolfsentry, octet, WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+            return 1;
+        WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+        if (test_dispatch_connection(wolfsentry, octet, WOLFSENTRY_ACTION_RES_DISCONNECT, &action_results) != 0)
+            return 1;
+    }
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_subnet_prefix_set(wolfsentry, AF_INET, 24));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_subnet_prefix_get(wolfsentry, AF_INET, &prefix_bits));
+    WOLFSENTRY_EXIT_ON_FALSE(prefix_bits == 24);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_subnet_prefix_get(wolfsentry, AF_INET6, &prefix_bits));
+    WOLFSENTRY_EXIT_ON_FALSE(prefix_bits == 0);
+
+    /* three connections from three addresses fill the /24. */
+    for (octet = 1; octet <= 3; ++octet) {
+        if (test_dispatch_connection(wolfsentry, octet, WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+            return 1;
+        WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    }
+    if (test_dispatch_connection(wolfsentry, 4, WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    /* a disconnect anywhere in the /24 makes room. */
+    if (test_dispatch_connection(wolfsentry, 2, WOLFSENTRY_ACTION_RES_DISCONNECT, &action_results) != 0)
+        return 1;
+    if (test_dispatch_connection(wolfsentry, 4, WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    /* a /22 counts 10.0.4-7.x together, apart from the /22s on either side. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_subnet_prefix_set(wolfsentry, AF_INET, 22));
+    if (test_dispatch_connection_addr(wolfsentry, (const byte *)"\12\0\4\1", WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    if (test_dispatch_connection_addr(wolfsentry, (const byte *)"\12\0\5\1", WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    if (test_dispatch_connection_addr(wolfsentry, (const byte *)"\12\0\7\1", WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    if (test_dispatch_connection_addr(wolfsentry, (const byte *)"\12\0\6\1", WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    if (test_dispatch_connection_addr(wolfsentry, (const byte *)"\12\0\10\1", WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    if (test_dispatch_connection_addr(wolfsentry, (const byte *)"\12\0\3\1", WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    /* subnets that hash alike keep separate counts.  among this many
+     * scattered ones, some are sure to share a bucket.
+     */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_subnet_prefix_set(wolfsentry, AF_INET, 24));
+    {
+        byte addr[4] = { 11, 0, 0, 1 };
+        unsigned int scatter = 1;
+        int subnet, conn;
+        for (subnet = 0; subnet < 300; ++subnet) {
+            scatter = (scatter * 25173U + 13849U) & 0xffffU;
+            addr[1] = (byte)(scatter >> 8);
+            addr[2] = (byte)scatter;
+            for (conn = 0; conn < 3; ++conn) {
+                if (test_dispatch_connection_addr(wolfsentry, addr, WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+                    return 1;
+                WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+            }
+            if (test_dispatch_connection_addr(wolfsentry, addr, WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+                return 1;
+            WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+        }
+    }
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_subnet_prefix_set(wolfsentry, AF_INET, 0));
+    if (test_dispatch_connection(wolfsentry, 5, WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+static int test_dispatch_batch (void) {
+    struct wolfsentry_context *wolfsentry;
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[4];
+    } remote[4], local;
+    const struct wolfsentry_sockaddr *remotes[4], *locals[4];
+    wolfsentry_route_flags_t flags[4];
+    wolfsentry_action_res_t action_results[4];
+    wolfsentry_errcode_t rets[4];
+    wolfsentry_ent_id_t ids[4];
+    struct wolfsentry_route_table *dynamic_routes;
+    wolfsentry_ent_id_t id;
+    static const byte octets[4] = { 1, 2, 1, 3 };
+    size_t i;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, NULL /* config */, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+
+    local.sa.sa_family = AF_INET;
+    local.sa.sa_proto = IPPROTO_TCP;
+    local.sa.sa_port = 443;
+    local.sa.addr_len = sizeof local.addr_buf * BITS_PER_BYTE;
+    local.sa.interface = 1;
+    memcpy(local.sa.addr, "\300\250\1\1", sizeof local.addr_buf);
+    for (i = 0; i < 4; ++i) {
+        remote[i].sa = local.sa;
+        remote[i].sa.sa_port = 12345;
+        memcpy(remote[i].sa.addr, "\12\0\0\0", sizeof remote[i].addr_buf);
+        remote[i].sa.addr[3] = octets[i];
+        remotes[i] = &remote[i].sa;
+        locals[i] = &local.sa;
+        flags[i] = WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN;
+    }
+
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_route_event_dispatch_batch(wolfsentry, remotes, locals, flags, 4, "nonexistent", -1, NULL /* caller_arg */, ids, action_results, rets));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch_batch(wolfsentry, remotes, locals, flags, 4, "connect", -1, NULL /* caller_arg */, ids, action_results, rets));
+    for (i = 0; i < 4; ++i)
+        WOLFSENTRY_EXIT_ON_FAILURE(rets[i]);
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 3);
+    WOLFSENTRY_EXIT_ON_FALSE(ids[0] == ids[2]);
+    WOLFSENTRY_EXIT_ON_TRUE(ids[0] == ids[1]);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results[0], WOLFSENTRY_ACTION_RES_INSERT));
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results[2], WOLFSENTRY_ACTION_RES_INSERT));
+
+    /* a bad entry fails on its own, and is reported in the return value when
+     * there's no rets.
+     */
+    flags[3] = WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch_batch(wolfsentry, remotes, locals, flags, 4, "connect", -1, NULL /* caller_arg */, ids, action_results, rets));
+    for (i = 0; i < 3; ++i)
+        WOLFSENTRY_EXIT_ON_FAILURE(rets[i]);
+    WOLFSENTRY_EXIT_ON_FALSE(rets[3] < 0);
+    memset(ids, 0, sizeof ids);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry_route_event_dispatch_batch(wolfsentry, remotes, locals, flags, 4, "connect", -1, NULL /* caller_arg */, ids, action_results, NULL /* rets */) < 0);
+    WOLFSENTRY_EXIT_ON_FALSE(ids[0] == ids[2]);
+    WOLFSENTRY_EXIT_ON_TRUE(ids[0] == 0);
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 3);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+static int test_flow_key (void) {
+    struct wolfsentry_context *wolfsentry;
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[4];
+    } remote, local;
+    struct wolfsentry_flow_key *flow_key;
+    struct wolfsentry_route_table *dynamic_routes;
+    wolfsentry_route_flags_t inexact_matches;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_ent_id_t id, flow_id;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, NULL /* config */, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+
+    remote.sa.sa_family = local.sa.sa_family = AF_INET;
+    remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+    remote.sa.sa_port = 12345;
+    local.sa.sa_port = 443;
+    remote.sa.addr_len = local.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+    remote.sa.interface = local.sa.interface = 1;
+    memcpy(remote.sa.addr, "\12\0\0\1", sizeof remote.addr_buf);
+    memcpy(local.sa.addr, "\300\250\1\1", sizeof local.addr_buf);
+
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_flow_key_new(wolfsentry, &remote.sa, &local.sa, WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS /* no direction */, &flow_key));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_flow_key_new(wolfsentry, &remote.sa, &local.sa, WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN, &flow_key));
+
+    /* the key owns copies of the sockaddrs. */
+    memset(remote.sa.addr, 0, sizeof remote.addr_buf);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch_by_flow_key(wolfsentry, flow_key, "connect", -1, NULL /* caller_arg */, &flow_id, &inexact_matches, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_INSERT));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 1);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch_by_flow_key(wolfsentry, flow_key, "connect", -1, NULL /* caller_arg */, &id, &inexact_matches, &action_results));
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_INSERT));
+    WOLFSENTRY_EXIT_ON_FALSE(id == flow_id);
+
+    /* and matches the same route as a plain dispatch for the same flow. */
+    memcpy(remote.sa.addr, "\12\0\0\1", sizeof remote.addr_buf);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch(wolfsentry, &remote.sa, &local.sa, WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN, "connect", -1, NULL /* caller_arg */, &id, &inexact_matches, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(id == flow_id);
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 1);
+
+    action_results = WOLFSENTRY_ACTION_RES_REJECT;
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_route_event_dispatch_by_flow_key_with_inited_result(wolfsentry, flow_key, "connect", -1, NULL /* caller_arg */, &id, &inexact_matches, &action_results));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_flow_key_free(wolfsentry, &flow_key));
+    WOLFSENTRY_EXIT_ON_FALSE(flow_key == NULL);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+static int test_route_connection (void) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_eventconfig config = { .max_connection_count = 2 };
+    struct {
+        struct wolfsentry_sockaddr sa;
+        byte addr_buf[4];
+    } remote, local;
+    struct wolfsentry_route_connection *connections[3];
+    struct wolfsentry_route_table *dynamic_routes;
+    struct wolfsentry_route *route;
+    wolfsentry_route_flags_t inexact_matches;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_ent_id_t id, route_id = WOLFSENTRY_ENT_ID_NONE;
+    int i;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_subnet_prefix_set(wolfsentry, AF_INET, 24));
+
+    remote.sa.sa_family = local.sa.sa_family = AF_INET;
+    remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+    remote.sa.sa_port = 12345;
+    local.sa.sa_port = 443;
+    remote.sa.addr_len = local.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+    remote.sa.interface = local.sa.interface = 1;
+    memcpy(remote.sa.addr, "\12\0\0\1", sizeof remote.addr_buf);
+    memcpy(local.sa.addr, "\300\250\1\1", sizeof local.addr_buf);
+
+    for (i = 0; i < 3; ++i) {
+        action_results = WOLFSENTRY_ACTION_RES_NONE;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch_connect(wolfsentry, &remote.sa, &local.sa, WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN, "connect", -1, NULL /* caller_arg */, &connections[i], &id, &inexact_matches, &action_results));
+        if (i == 0)
+            route_id = id;
+        else
+            WOLFSENTRY_EXIT_ON_FALSE(id == route_id);
+    }
+    /* the third was over max_connection_count, so wasn't counted. */
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    WOLFSENTRY_EXIT_ON_FALSE(connections[2] == NULL);
+    WOLFSENTRY_EXIT_ON_FALSE((connections[0] != NULL) && (connections[1] != NULL));
+
+    route = (struct wolfsentry_route *)dynamic_routes->header.head;
+    WOLFSENTRY_EXIT_ON_FALSE(route->meta.connection_count == 2);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->subnet_connections->slots[connections[0]->subnet_slot].count == 2);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_disconnect(wolfsentry, &connections[0], &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(connections[0] == NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(route->meta.connection_count == 1);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->subnet_connections->slots[connections[1]->subnet_slot].count == 1);
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_DEALLOCATED));
+
+    /* the handle keeps the route alive after it's deleted from the table. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(wolfsentry, NULL /* caller_arg */, route_id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 0);
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_DEALLOCATED));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_disconnect(wolfsentry, &connections[1], &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_DEALLOCATED));
+
+    WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_route_disconnect(wolfsentry, &connections[1], &action_results));
+
+    /* connections made before a prefix change don't come off the new counts. */
+    for (i = 0; i < 2; ++i) {
+        action_results = WOLFSENTRY_ACTION_RES_NONE;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch_connect(wolfsentry, &remote.sa, &local.sa, WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN, "connect", -1, NULL /* caller_arg */, &connections[i], &id, &inexact_matches, &action_results));
+        WOLFSENTRY_EXIT_ON_TRUE(connections[i] == NULL);
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_subnet_prefix_set(wolfsentry, AF_INET, 0));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_subnet_prefix_set(wolfsentry, AF_INET, 24));
+    memcpy(remote.sa.addr, "\12\0\0\2", sizeof remote.addr_buf);
+    action_results = WOLFSENTRY_ACTION_RES_NONE;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_event_dispatch_connect(wolfsentry, &remote.sa, &local.sa, WOLFSENTRY_ROUTE_FLAG_TCPLIKE_PORT_NUMBERS | WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN, "connect", -1, NULL /* caller_arg */, &connections[2], &id, &inexact_matches, &action_results));
+    WOLFSENTRY_EXIT_ON_TRUE(connections[2] == NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->subnet_connections->slots[connections[2]->subnet_slot].count == 1);
+    for (i = 0; i < 2; ++i)
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_disconnect(wolfsentry, &connections[i], &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->subnet_connections->slots[connections[2]->subnet_slot].count == 1);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_disconnect(wolfsentry, &connections[2], &action_results));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+static struct wolfsentry_route *test_snapshot_route(struct wolfsentry_route_table *table, byte last_octet) {
+    struct wolfsentry_table_ent_header *i;
+    for (i = table->header.head; i; i = i->next) {
+        if (WOLFSENTRY_ROUTE_REMOTE_ADDR((struct wolfsentry_route *)i)[3] == last_octet)
+            return (struct wolfsentry_route *)i;
+    }
+    return NULL;
+}
+
+static int test_route_snapshot (void) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_timecbs timecbs = {
+        .context = NULL,
+        .get_time = test_purge_get_time,
+        .diff_time = test_purge_diff_time,
+        .add_time = test_purge_add_time,
+        .to_epoch_time = test_purge_to_epoch_time,
+        .from_epoch_time = test_purge_from_epoch_time,
+        .interval_to_seconds = test_purge_to_epoch_time,
+        .interval_from_seconds = test_purge_from_epoch_time
+    };
+    struct wolfsentry_host_platform_interface hpi = { .allocator = NULL, .timecbs = &timecbs };
+    struct wolfsentry_eventconfig config = { .max_connection_count = 10, .max_subnet_connection_count = 3, .penaltybox_duration = 600000000, .route_private_data_size = 8 };
+    struct wolfsentry_route_table *dynamic_routes;
+    struct wolfsentry_route *route;
+    wolfsentry_route_flags_t flags_before, flags_after;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_hitcount_t hitcount;
+    wolfsentry_errcode_t ret;
+    wolfsentry_ent_id_t id;
+    void *private_data;
+    size_t private_data_size, snapshot_size = 0;
+    byte *snapshot;
+    byte octet;
+
+    test_purge_now = 1000000000;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_subnet_prefix_set(wolfsentry, AF_INET, 24));
+
+    /* 10.0.0.1 with two open connections and private data, 10.0.0.2 idle, 10.0.0.3 boxed a second later. */
+    if (test_dispatch_connection(wolfsentry, 1, WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    if (test_dispatch_connection(wolfsentry, 1, WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    if (test_dispatch_from(wolfsentry, 2, &action_results) != 0)
+        return 1;
+    test_purge_now += 1000000;
+    if (test_dispatch_from(wolfsentry, 3, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, test_snapshot_route(dynamic_routes, 3), WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    route = test_snapshot_route(dynamic_routes, 1);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_private_data(wolfsentry, route, &private_data, &private_data_size));
+    WOLFSENTRY_EXIT_ON_FALSE(private_data_size == 8);
+    memcpy(private_data, "snapshot", 8);
+    hitcount = route->header.hitcount;
+
+    ret = wolfsentry_route_table_snapshot_save(wolfsentry, dynamic_routes, NULL, &snapshot_size);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, BUFFER_TOO_SMALL));
+    WOLFSENTRY_EXIT_ON_FALSE((snapshot = malloc(snapshot_size)) != NULL);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_snapshot_save(wolfsentry, dynamic_routes, snapshot, &snapshot_size));
+    WOLFSENTRY_EXIT_ON_FALSE((snapshot_size & 7) == 0);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    /* the downtime doesn't count against the restored routes. */
+    test_purge_now += 3600000000;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_subnet_prefix_set(wolfsentry, AF_INET, 24));
+
+    /* the parent event has to be there first. */
+    ret = wolfsentry_route_table_snapshot_restore(wolfsentry, NULL /* caller_arg */, dynamic_routes, snapshot, snapshot_size, &action_results);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_NOT_FOUND));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 0);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_snapshot_restore(wolfsentry, NULL /* caller_arg */, dynamic_routes, snapshot, snapshot_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 3);
+
+    route = test_snapshot_route(dynamic_routes, 1);
+    WOLFSENTRY_EXIT_ON_FALSE(route != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(route->header.hitcount == hitcount);
+    WOLFSENTRY_EXIT_ON_FALSE(route->meta.connection_count == 2);
+    WOLFSENTRY_EXIT_ON_FALSE(route->meta.insert_time == test_purge_now - 1000000);
+    WOLFSENTRY_EXIT_ON_FALSE(route->parent_event != NULL);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_private_data(wolfsentry, route, &private_data, &private_data_size));
+    WOLFSENTRY_EXIT_ON_FALSE(memcmp(private_data, "snapshot", 8) == 0);
+
+    route = test_snapshot_route(dynamic_routes, 3);
+    WOLFSENTRY_EXIT_ON_FALSE(route != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(route->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED);
+    WOLFSENTRY_EXIT_ON_FALSE(route->meta.last_penaltybox_time == test_purge_now);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->penaltybox_queue.head == &route->penaltybox_link);
+    if (test_dispatch_from(wolfsentry, 3, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    /* the restored connections still count against the /24. */
+    if (test_dispatch_connection(wolfsentry, 4, WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    if (test_dispatch_connection(wolfsentry, 5, WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    ret = wolfsentry_route_table_snapshot_restore(wolfsentry, NULL /* caller_arg */, dynamic_routes, snapshot, snapshot_size, &action_results);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_ALREADY_PRESENT));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    /* a restore that collides partway takes back the routes it put in, and
+     * their connections' charge against the /24.
+     */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(&hpi, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_subnet_prefix_set(wolfsentry, AF_INET, 24));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    if (test_dispatch_from(wolfsentry, 2, &action_results) != 0)
+        return 1;
+    ret = wolfsentry_route_table_snapshot_restore(wolfsentry, NULL /* caller_arg */, dynamic_routes, snapshot, snapshot_size, &action_results);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_ALREADY_PRESENT));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 1);
+    WOLFSENTRY_EXIT_ON_FALSE(test_snapshot_route(dynamic_routes, 1) == NULL);
+    for (octet = 4; octet <= 6; ++octet) {
+        if (test_dispatch_connection(wolfsentry, octet, WOLFSENTRY_ACTION_RES_CONNECT, &action_results) != 0)
+            return 1;
+        WOLFSENTRY_EXIT_ON_TRUE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+    }
+
+    snapshot[snapshot_size - 1] ^= 1;
+    ret = wolfsentry_route_table_snapshot_restore(wolfsentry, NULL /* caller_arg */, dynamic_routes, snapshot, snapshot_size, &action_results);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, IMAGE_CHECKSUM));
+
+    free(snapshot);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+struct test_journal_sink {
+    byte buf[16384];
+    size_t len;
+    int n_syncs;
+    int fail_p;
+};
+
+static wolfsentry_errcode_t test_journal_write(void *sink_context, const void *buf, size_t len) {
+    struct test_journal_sink *sink = (struct test_journal_sink *)sink_context;
+    if (sink->fail_p)
+        WOLFSENTRY_ERROR_RETURN(SYS_OP_FAILED);
+    if (sink->len + len > sizeof sink->buf)
+        WOLFSENTRY_ERROR_RETURN(BUFFER_TOO_SMALL);
+    memcpy(sink->buf + sink->len, buf, len);
+    sink->len += len;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static wolfsentry_errcode_t test_journal_sync(void *sink_context) {
+    ++((struct test_journal_sink *)sink_context)->n_syncs;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static int test_route_journal (void) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_eventconfig config = { .max_connection_count = 10, .penaltybox_duration = 600000000 };
+    static struct test_journal_sink sink;
+    struct wolfsentry_journal_config journal_config = { .write = test_journal_write, .sync = test_journal_sync, .sink_context = &sink, .ring_size = 4096 };
+    struct wolfsentry_journal_stats stats;
+    struct wolfsentry_route_table *dynamic_routes;
+    struct wolfsentry_route *route;
+    wolfsentry_route_flags_t flags_before, flags_after;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_errcode_t ret;
+    wolfsentry_ent_id_t id;
+    size_t snapshot_size = 0, replayed_size, applied_size, gap_end;
+    byte *snapshot;
+    byte octet;
+
+    memset(&sink, 0, sizeof sink);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+
+    /* 10.0.0.1 goes in the snapshot, and the rest only in the journal. */
+    if (test_dispatch_from(wolfsentry, 1, &action_results) != 0)
+        return 1;
+    ret = wolfsentry_route_table_snapshot_save(wolfsentry, dynamic_routes, NULL, &snapshot_size);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, BUFFER_TOO_SMALL));
+    WOLFSENTRY_EXIT_ON_FALSE((snapshot = malloc(snapshot_size)) != NULL);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_snapshot_save(wolfsentry, dynamic_routes, snapshot, &snapshot_size));
+
+    ret = wolfsentry_journal_start(wolfsentry, NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, INVALID_ARG));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_start(wolfsentry, &journal_config));
+    ret = wolfsentry_journal_start(wolfsentry, &journal_config);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, ALREADY));
+
+    if (test_dispatch_from(wolfsentry, 2, &action_results) != 0)
+        return 1;
+    if (test_dispatch_from(wolfsentry, 3, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, test_snapshot_route(dynamic_routes, 3), WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    /* no change, no record. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, test_snapshot_route(dynamic_routes, 3), WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(wolfsentry, NULL /* caller_arg */, test_snapshot_route(dynamic_routes, 2)->header.id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, test_snapshot_route(dynamic_routes, 1), WOLFSENTRY_ROUTE_FLAG_GREENLISTED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_get_stats(wolfsentry, &stats));
+    WOLFSENTRY_EXIT_ON_FALSE(stats.n_records == 5);
+    WOLFSENTRY_EXIT_ON_FALSE(stats.n_dropped == 0);
+    WOLFSENTRY_EXIT_ON_FALSE(stats.n_bytes_written == sink.len);
+    WOLFSENTRY_EXIT_ON_FALSE((sink.len & 7) == 0);
+    WOLFSENTRY_EXIT_ON_FALSE(sink.n_syncs > 0);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, &config, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(wolfsentry, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(wolfsentry, &dynamic_routes));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_snapshot_restore(wolfsentry, NULL /* caller_arg */, dynamic_routes, snapshot, snapshot_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_replay(wolfsentry, NULL /* caller_arg */, sink.buf, sink.len, &replayed_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(replayed_size == sink.len);
+
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 2);
+    WOLFSENTRY_EXIT_ON_FALSE(test_snapshot_route(dynamic_routes, 2) == NULL);
+    route = test_snapshot_route(dynamic_routes, 1);
+    WOLFSENTRY_EXIT_ON_FALSE((route != NULL) && (route->flags & WOLFSENTRY_ROUTE_FLAG_GREENLISTED));
+    route = test_snapshot_route(dynamic_routes, 3);
+    WOLFSENTRY_EXIT_ON_FALSE((route != NULL) && (route->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED));
+    WOLFSENTRY_EXIT_ON_FALSE(route->meta.last_penaltybox_time != 0);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->penaltybox_queue.head == &route->penaltybox_link);
+    if (test_dispatch_from(wolfsentry, 3, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_REJECT));
+
+    /* replaying again changes nothing. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_replay(wolfsentry, NULL /* caller_arg */, sink.buf, sink.len, &replayed_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(dynamic_routes->header.n_ents == 2);
+
+    /* a torn last record is left off. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_replay(wolfsentry, NULL /* caller_arg */, sink.buf, sink.len - 8, &replayed_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE((replayed_size < sink.len - 8) && ((replayed_size & 7) == 0));
+    sink.buf[sink.len - 1] ^= 1;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_replay(wolfsentry, NULL /* caller_arg */, sink.buf, sink.len, &replayed_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(replayed_size < sink.len);
+
+#ifndef WOLFSENTRY_JOURNAL_THREAD
+    /* with no writer thread, a full ring isn't drained by the change that
+     * finds it full, and the change is dropped.
+     */
+    memset(&sink, 0, sizeof sink);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_start(wolfsentry, &journal_config));
+    for (octet = 100; octet < 250; ++octet) {
+        if (test_dispatch_from(wolfsentry, octet, &action_results) != 0)
+            return 1;
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_get_stats(wolfsentry, &stats));
+    WOLFSENTRY_EXIT_ON_FALSE(stats.n_dropped > 0);
+    WOLFSENTRY_EXIT_ON_FALSE((stats.n_writes == 0) && (sink.len == 0));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_stop(wolfsentry));
+    WOLFSENTRY_EXIT_ON_FALSE(sink.len > 0);
+    for (octet = 100; octet < 250; ++octet)
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(wolfsentry, NULL /* caller_arg */, test_snapshot_route(dynamic_routes, octet)->header.id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+#endif
+
+    /* a sink that stalls fills the ring, and the changes dropped then leave a
+     * gap in the journal, ahead of the next change to get in.
+     */
+    memset(&sink, 0, sizeof sink);
+    sink.fail_p = 1;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_start(wolfsentry, &journal_config));
+    for (octet = 100; octet < 250; ++octet) {
+        if (test_dispatch_from(wolfsentry, octet, &action_results) != 0)
+            return 1;
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_get_stats(wolfsentry, &stats));
+    WOLFSENTRY_EXIT_ON_FALSE(stats.n_dropped > 0);
+    sink.fail_p = 0;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(wolfsentry, test_snapshot_route(dynamic_routes, 100), WOLFSENTRY_ROUTE_FLAG_GREENLISTED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_stop(wolfsentry));
+
+    /* each gap stops the replay just past it, and the records after the last one are good. */
+    ret = wolfsentry_journal_replay(wolfsentry, NULL /* caller_arg */, sink.buf, sink.len, &replayed_size, &action_results);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, DATA_MISSING));
+    WOLFSENTRY_EXIT_ON_FALSE((replayed_size > 0) && (replayed_size < sink.len));
+    ret = wolfsentry_journal_apply(wolfsentry, NULL /* caller_arg */, sink.buf, sink.len, &applied_size, &action_results);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, DATA_MISSING));
+    WOLFSENTRY_EXIT_ON_FALSE(applied_size == replayed_size);
+    for (gap_end = replayed_size; ; gap_end += replayed_size) {
+        ret = wolfsentry_journal_replay(wolfsentry, NULL /* caller_arg */, sink.buf + gap_end, sink.len - gap_end, &replayed_size, &action_results);
+        if (! WOLFSENTRY_ERROR_CODE_IS(ret, DATA_MISSING))
+            break;
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(ret);
+    WOLFSENTRY_EXIT_ON_FALSE((replayed_size > 0) && (gap_end + replayed_size == sink.len));
+
+    free(snapshot);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&wolfsentry));
+
+    return 0;
+}
+
+/* waits for the clock of "later" to pass the time now on "earlier", so that the changes are ordered. */
+static int test_replication_tick(struct wolfsentry_context *earlier, struct wolfsentry_context *later) {
+    wolfsentry_time_t then, now;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_get_time(earlier, &then));
+    do
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_get_time(later, &now));
+    while (now <= then);
+    return 0;
+}
+
+static int test_route_replication (void) {
+    struct wolfsentry_context *a, *b;
+    struct wolfsentry_eventconfig config = { .max_connection_count = 10, .penaltybox_duration = 600000000 };
+    static struct test_journal_sink a_sink, b_sink;
+    struct wolfsentry_journal_config a_journal_config = { .write = test_journal_write, .sink_context = &a_sink, .ring_size = 4096 };
+    struct wolfsentry_journal_config b_journal_config = { .write = test_journal_write, .sink_context = &b_sink, .ring_size = 4096 };
+    struct wolfsentry_journal_stats stats;
+    struct wolfsentry_route_table *a_routes, *b_routes;
+    struct wolfsentry_route *route;
+    wolfsentry_route_flags_t flags_before, flags_after;
+    wolfsentry_action_res_t action_results;
+    wolfsentry_ent_id_t id;
+    size_t applied_size, stale_insert_len, stale_inserts_len;
+    byte stale_insert[256], *stale_inserts;
+    wolfsentry_time_t tie_time;
+    byte octet;
+
+    memset(&a_sink, 0, sizeof a_sink);
+    memset(&b_sink, 0, sizeof b_sink);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, &config, &a));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(NULL /* hpi */, &config, &b));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(a, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_insert(b, "connect", -1 /* label_len */, 10, NULL /* config */, WOLFSENTRY_EVENT_FLAG_NONE, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(a, &a_routes));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_dynamic(b, &b_routes));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_start(a, &a_journal_config));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_start(b, &b_journal_config));
+
+    /* a inserts 10.0.0.1-3, greenlists the first and boxes the third, and b catches up. */
+    if ((test_dispatch_from(a, 1, &action_results) != 0) ||
+        (test_dispatch_from(a, 2, &action_results) != 0) ||
+        (test_dispatch_from(a, 3, &action_results) != 0))
+        return 1;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(a, test_snapshot_route(a_routes, 1), WOLFSENTRY_ROUTE_FLAG_GREENLISTED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(a, test_snapshot_route(a_routes, 3), WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(a));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, a_sink.buf, a_sink.len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(applied_size == a_sink.len);
+    WOLFSENTRY_EXIT_ON_FALSE(b_routes->header.n_ents == 3);
+    route = test_snapshot_route(b_routes, 1);
+    WOLFSENTRY_EXIT_ON_FALSE((route != NULL) && (route->flags & WOLFSENTRY_ROUTE_FLAG_GREENLISTED));
+    WOLFSENTRY_EXIT_ON_FALSE(route->meta.last_change_time == test_snapshot_route(a_routes, 1)->meta.last_change_time);
+    route = test_snapshot_route(b_routes, 3);
+    WOLFSENTRY_EXIT_ON_FALSE((route != NULL) && (route->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED));
+    WOLFSENTRY_EXIT_ON_FALSE(route->meta.last_penaltybox_time == test_snapshot_route(a_routes, 3)->meta.last_penaltybox_time);
+    WOLFSENTRY_EXIT_ON_FALSE(b->penaltybox_queue.head == &route->penaltybox_link);
+
+    /* nothing echoes back, and a second helping changes nothing. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_get_stats(b, &stats));
+    WOLFSENTRY_EXIT_ON_FALSE(stats.n_records == 0);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, a_sink.buf, a_sink.len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(b_routes->header.n_ents == 3);
+
+    /* a deletes 10.0.0.2 and b boxes it later, so the box wins on both; a
+     * later still lets 10.0.0.3 out, which wins on both.
+     */
+    a_sink.len = 0;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(a, NULL /* caller_arg */, test_snapshot_route(a_routes, 2)->header.id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+    if (test_replication_tick(a, b) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(b, test_snapshot_route(b_routes, 2), WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    if (test_replication_tick(b, a) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(a, test_snapshot_route(a_routes, 3), WOLFSENTRY_ROUTE_FLAG_NONE, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, &flags_before, &flags_after));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(a));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(b));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, a_sink.buf, a_sink.len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(a, NULL /* caller_arg */, b_sink.buf, b_sink.len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(applied_size == b_sink.len);
+    route = test_snapshot_route(a_routes, 2);
+    WOLFSENTRY_EXIT_ON_FALSE((route != NULL) && (route->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED));
+    route = test_snapshot_route(b_routes, 2);
+    WOLFSENTRY_EXIT_ON_FALSE((route != NULL) && (route->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED));
+    WOLFSENTRY_EXIT_ON_TRUE(test_snapshot_route(a_routes, 3)->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED);
+    WOLFSENTRY_EXIT_ON_TRUE(test_snapshot_route(b_routes, 3)->flags & WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED);
+    WOLFSENTRY_EXIT_ON_FALSE((a_routes->header.n_ents == 3) && (b_routes->header.n_ents == 3));
+
+    /* a record split across receives waits for the rest. */
+    a_sink.len = 0;
+    if (test_dispatch_from(a, 4, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(a));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, a_sink.buf, a_sink.len - 8, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE((applied_size == 0) && (test_snapshot_route(b_routes, 4) == NULL));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, a_sink.buf, a_sink.len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE((applied_size == a_sink.len) && (test_snapshot_route(b_routes, 4) != NULL));
+
+    /* b boxes 10.0.0.4 and a deletes it later, and neither the box nor the
+     * insert, arriving after the delete, brings it back.
+     */
+    WOLFSENTRY_EXIT_ON_FALSE(a_sink.len <= sizeof stale_insert);
+    memcpy(stale_insert, a_sink.buf, a_sink.len);
+    stale_insert_len = a_sink.len;
+    a_sink.len = b_sink.len = 0;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(b, test_snapshot_route(b_routes, 4), WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    if (test_replication_tick(b, a) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(a, NULL /* caller_arg */, test_snapshot_route(a_routes, 4)->header.id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(a));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(b));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, a_sink.buf, a_sink.len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(test_snapshot_route(b_routes, 4) == NULL);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(a, NULL /* caller_arg */, b_sink.buf, b_sink.len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE((applied_size == b_sink.len) && (test_snapshot_route(a_routes, 4) == NULL));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, stale_insert, stale_insert_len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE((applied_size == stale_insert_len) && (test_snapshot_route(b_routes, 4) == NULL));
+    WOLFSENTRY_EXIT_ON_FALSE((a_routes->header.n_ents == 3) && (b_routes->header.n_ents == 3));
+
+    /* a greenlists 10.0.0.5 and b boxes it at the same moment, and both settle
+     * on the greater flags, the greenlist.
+     */
+    a_sink.len = 0;
+    if (test_dispatch_from(a, 5, &action_results) != 0)
+        return 1;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(a));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, a_sink.buf, a_sink.len, &applied_size, &action_results));
+    a_sink.len = b_sink.len = 0;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(a, test_snapshot_route(a_routes, 5), WOLFSENTRY_ROUTE_FLAG_GREENLISTED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_update_flags(b, test_snapshot_route(b_routes, 5), WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED, WOLFSENTRY_ROUTE_FLAG_NONE, &flags_before, &flags_after));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(a));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(b));
+    /* each record arrives stamped the same as the change it meets. */
+    tie_time = test_snapshot_route(a_routes, 5)->meta.last_change_time;
+    test_snapshot_route(a_routes, 5)->meta.last_change_time = test_snapshot_route(b_routes, 5)->meta.last_change_time;
+    test_snapshot_route(b_routes, 5)->meta.last_change_time = tie_time;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, a_sink.buf, a_sink.len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(a, NULL /* caller_arg */, b_sink.buf, b_sink.len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_MASKIN_BITS(test_snapshot_route(a_routes, 5)->flags, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED|WOLFSENTRY_ROUTE_FLAG_GREENLISTED) == WOLFSENTRY_ROUTE_FLAG_GREENLISTED);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_MASKIN_BITS(test_snapshot_route(b_routes, 5)->flags, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED|WOLFSENTRY_ROUTE_FLAG_GREENLISTED) == WOLFSENTRY_ROUTE_FLAG_GREENLISTED);
+    WOLFSENTRY_EXIT_ON_FALSE(b->journal != NULL);
+
+    /* by default, many more deletes are remembered than a burst of a hundred,
+     * and a journal started with fewer keeps the latest of them.
+     */
+    a_sink.len = 0;
+    for (octet = 100; octet < 200; ++octet) {
+        if (test_dispatch_from(a, octet, &action_results) != 0)
+            return 1;
+        if ((octet % 20) == 19)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(a));
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_get_stats(a, &stats));
+    WOLFSENTRY_EXIT_ON_FALSE(stats.n_dropped == 0);
+    WOLFSENTRY_EXIT_ON_FALSE((stale_inserts = malloc(a_sink.len)) != NULL);
+    memcpy(stale_inserts, a_sink.buf, a_sink.len);
+    stale_inserts_len = a_sink.len;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, a_sink.buf, a_sink.len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(b_routes->header.n_ents == 104);
+    a_sink.len = 0;
+    for (octet = 100; octet < 200; ++octet) {
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(a, NULL /* caller_arg */, test_snapshot_route(a_routes, octet)->header.id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+        if ((octet % 20) == 19)
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_flush(a));
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, a_sink.buf, a_sink.len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(b_routes->header.n_ents == 4);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, stale_inserts, stale_inserts_len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(b_routes->header.n_ents == 4);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_stop(b));
+    b_journal_config.n_tombstones = 10;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_start(b, &b_journal_config));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_journal_apply(b, NULL /* caller_arg */, stale_inserts, stale_inserts_len, &applied_size, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(b_routes->header.n_ents == 4 + 90);
+    WOLFSENTRY_EXIT_ON_FALSE(test_snapshot_route(b_routes, 189) != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(test_snapshot_route(b_routes, 190) == NULL);
+    free(stale_inserts);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&a));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&b));
+
+    return 0;
+}
+
+#endif /* TEST_DYNAMIC_RULES */
+
+#ifdef TEST_JSON
+
+#include "wolfsentry/wolfsentry_json.h"
+
+#ifdef LWIP
+#include "lwip-socket.h"
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+#define PRIVATE_DATA_SIZE 32
+#define PRIVATE_DATA_ALIGNMENT 16
+
+static int test_action_n_inserts;
+
+static wolfsentry_errcode_t test_action(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_action *action,
+    void *handler_arg,
+    void *caller_arg,
+    const struct wolfsentry_event *trigger_event,
+    wolfsentry_action_type_t action_type,
+    struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_route *route,
+    wolfsentry_action_res_t *action_results)
+{
+    const struct wolfsentry_event *parent_event = wolfsentry_route_parent_event(route);
+    (void)wolfsentry;
+    (void)handler_arg;
+    (void)route_table;
+    (void)action_results;
+    if (action_type == WOLFSENTRY_ACTION_TYPE_INSERT)
+        ++test_action_n_inserts;
+    printf("action callback: a=\"%s\" parent_event=\"%s\" trigger=\"%s\" t=%u r_id=%u caller_arg=%p\n",
+           wolfsentry_action_get_label(action),
+           wolfsentry_event_get_label(parent_event),
+           wolfsentry_event_get_label(trigger_event),
+           action_type,
+           wolfsentry_get_object_id(route),
+           caller_arg);
+    return 0;
+}
+
+static wolfsentry_errcode_t json_feed_file(struct wolfsentry_context *wolfsentry, const char *fname, wolfsentry_config_load_flags_t flags) {
+    wolfsentry_errcode_t ret;
+    struct wolfsentry_json_process_state *jps;
+    FILE *f;
+    char buf[512], err_buf[512];
+
+    if (strcmp(fname,"-"))
+        f = fopen(fname, "r");
+    else
+        f = stdin; // GCOV_EXCL_LINE
+    if (! f) {
+    // GCOV_EXCL_START
+        fprintf(stderr, "fopen(%s): %s\n",fname,strerror(errno));
+        WOLFSENTRY_ERROR_RETURN(UNIT_TEST_FAILURE);
+    // GCOV_EXCL_STOP
+    }
+
+    ret = wolfsentry_config_json_init(
+        wolfsentry,
+        flags,
+        &jps);
+    if (ret < 0)
+        goto out;
+
+    for (;;) {
+        size_t n = fread(buf, 1, sizeof buf, f);
+        if ((n < sizeof buf) && ferror(f)) {
+        // GCOV_EXCL_START
+            fprintf(stderr,"fread(%s): %s\n",fname, strerror(errno));
+            ret = WOLFSENTRY_ERROR_ENCODE(UNIT_TEST_FAILURE);
+            goto out;
+        // GCOV_EXCL_STOP
+        }
+
+        ret = wolfsentry_config_json_feed(jps, buf, n, err_buf, sizeof err_buf);
+        if (ret < 0) {
+        // GCOV_EXCL_START
+            fprintf(stderr, "%.*s\n", (int)sizeof err_buf, err_buf);
+            goto out;
+        // GCOV_EXCL_STOP
+        }
+        if ((n < sizeof buf) && feof(f))
+            break;
+    }
+    ret = wolfsentry_config_json_fini(&jps, err_buf, sizeof err_buf);
+    if (ret < 0) {
+    // GCOV_EXCL_START
+        fprintf(stderr, "%.*s\n", (int)sizeof err_buf, err_buf);
+        goto out;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = WOLFSENTRY_ERROR_ENCODE(OK);
+
+  out:
+
+    if (f != stdin)
+        fclose(f);
+
+    return ret;
+}
+
+
+static int test_json(const char *fname) {
+    wolfsentry_errcode_t ret;
+    struct wolfsentry_context *wolfsentry;
+    wolfsentry_ent_id_t id;
+
+    struct wolfsentry_eventconfig config = { .route_private_data_size = PRIVATE_DATA_SIZE, .route_private_data_alignment = PRIVATE_DATA_ALIGNMENT };
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI,
+                                               &config,
+                                               &wolfsentry));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(
+                                   wolfsentry,
+                                   "handle-insert",
+                                   WOLFSENTRY_LENGTH_NULL_TERMINATED,
+                                   WOLFSENTRY_ACTION_FLAG_NONE,
+                                   test_action,
+                                   NULL,
+                                   &id));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(
+                                   wolfsentry,
+                                   "handle-delete",
+                                   WOLFSENTRY_LENGTH_NULL_TERMINATED,
+                                   WOLFSENTRY_ACTION_FLAG_NONE,
+                                   test_action,
+                                   NULL,
                                    &id));
 
     WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(
@@ -1595,57 +3657,367 @@ static int test_json(const char *fname) {
                                    NULL,
                                    &id));
 
-    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(
-                                   wolfsentry,
-                                   "handle-connect2",
-                                   WOLFSENTRY_LENGTH_NULL_TERMINATED,
-                                   WOLFSENTRY_ACTION_FLAG_NONE,
-                                   test_action,
-                                   NULL,
-                                   &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(
+                                   wolfsentry,
+                                   "handle-connect2",
+                                   WOLFSENTRY_LENGTH_NULL_TERMINATED,
+                                   WOLFSENTRY_ACTION_FLAG_NONE,
+                                   test_action,
+                                   NULL,
+                                   &id));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(wolfsentry, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_DRY_RUN));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes_static.header.n_ents == 0);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(wolfsentry, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes_static.header.n_ents > 0);
+    /* the bulk insert action calls cover the static routes. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_bulk_clear_insert_action_status(wolfsentry));
+    test_action_n_inserts = 0;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_bulk_insert_actions(wolfsentry));
+    WOLFSENTRY_EXIT_ON_FALSE(test_action_n_inserts > 0);
+
+    WOLFSENTRY_EXIT_ON_SUCCESS(json_feed_file(wolfsentry, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(wolfsentry, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE));
+
+    /* a flush takes the events out of the ID index as well as their table.  the
+     * routes go through wolfsentry_table_map(), which passes their delete
+     * actions no action_results.
+     */
+    {
+        struct wolfsentry_table_ent_header *ent;
+        wolfsentry_ent_id_t event_id;
+
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->events.header.head != NULL);
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes_static.header.n_ents > 0);
+        event_id = wolfsentry->events.header.head->id;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_flush(wolfsentry));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes_static.header.n_ents == 0);
+        WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_table_ent_get_by_id(wolfsentry, event_id, &ent));
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->ents_by_id.n_ents == wolfsentry->actions.header.n_ents);
+        WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(wolfsentry, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE));
+    }
+
+    {
+        struct wolfsentry_context *clone;
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_clone(wolfsentry, &clone, WOLFSENTRY_CLONE_FLAG_AS_AT_CREATION));
+        WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(clone, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_exchange(wolfsentry, clone));
+
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_free(&clone));
+    }
+
+
+    {
+        struct wolfsentry_cursor *cursor;
+        struct wolfsentry_route *route;
+        struct wolfsentry_route_exports route_exports;
+        struct wolfsentry_route_table *static_routes;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_static(wolfsentry, &static_routes));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_iterate_start(wolfsentry, static_routes, &cursor));
+        for (ret = wolfsentry_route_table_iterate_current(wolfsentry, static_routes, cursor, &route);
+             ret >= 0;
+             ret = wolfsentry_route_table_iterate_next(wolfsentry, static_routes, cursor, &route)) {
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_export(wolfsentry, route, &route_exports));
+            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_exports_render(&route_exports, stdout));
+        }
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_iterate_end(wolfsentry, static_routes, &cursor));
+    }
+
+    {
+        struct {
+            struct wolfsentry_sockaddr sa;
+            byte addr_buf[4];
+        } remote, local;
+        wolfsentry_route_flags_t inexact_matches;
+        wolfsentry_action_res_t action_results;
+
+        remote.sa.sa_family = local.sa.sa_family = AF_INET;
+        remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
+        remote.sa.sa_port = 12345;
+        local.sa.sa_port = 443;
+        remote.sa.addr_len = local.sa.addr_len = sizeof remote.addr_buf * BITS_PER_BYTE;
+        remote.sa.interface = local.sa.interface = 1;
+        memcpy(remote.sa.addr,"\177\0\0\1",sizeof remote.addr_buf);
+        memcpy(local.sa.addr,"\177\0\0\1",sizeof local.addr_buf);
+
+        WOLFSENTRY_EXIT_ON_FAILURE(
+            wolfsentry_route_event_dispatch(
+                wolfsentry,
+                &remote.sa,
+                &local.sa,
+                WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN,
+                "call-in-from-unit-test",
+                WOLFSENTRY_LENGTH_NULL_TERMINATED,
+                (void *)0x12345678 /* caller_arg */,
+                &id,
+                &inexact_matches, &action_results));
+
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT));
+    }
+
+    return wolfsentry_shutdown(&wolfsentry);
+}
+
+static wolfsentry_errcode_t test_incremental_count_action(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_action *action,
+    void *handler_arg,
+    void *caller_arg,
+    const struct wolfsentry_event *trigger_event,
+    wolfsentry_action_type_t action_type,
+    struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_route *route,
+    wolfsentry_action_res_t *action_results)
+{
+    (void)wolfsentry;
+    (void)action;
+    (void)caller_arg;
+    (void)trigger_event;
+    (void)action_type;
+    (void)route_table;
+    (void)route;
+    (void)action_results;
+    ++*(int *)handler_arg;
+    return 0;
+}
+
+/* fails the routes inserted into the context that handler_arg points to. */
+static wolfsentry_errcode_t test_incremental_fail_action(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_action *action,
+    void *handler_arg,
+    void *caller_arg,
+    const struct wolfsentry_event *trigger_event,
+    wolfsentry_action_type_t action_type,
+    struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_route *route,
+    wolfsentry_action_res_t *action_results)
+{
+    (void)action;
+    (void)caller_arg;
+    (void)trigger_event;
+    (void)route_table;
+    (void)route;
+    (void)action_results;
+    if ((action_type == WOLFSENTRY_ACTION_TYPE_INSERT) && (wolfsentry == *(struct wolfsentry_context **)handler_arg))
+        WOLFSENTRY_ERROR_RETURN(NOT_PERMITTED);
+    WOLFSENTRY_RETURN_OK;
+}
+
+#define TEST_INCREMENTAL_JSON_ROUTE_1(parent_event, last_octet, penalty_boxed) \
+    "{ \"parent-event\" : \"" parent_event "\", \"direction-in\" : true, \"penalty-boxed\" : " penalty_boxed ", " \
+    "\"family\" : 2, \"protocol\" : 6, \"remote\" : { \"address\" : \"10.0.0." last_octet "\", \"prefix-bits\" : 32 }, \"local\" : { \"port\" : 443 } }"
+
+#define TEST_INCREMENTAL_JSON_ROUTE(last_octet, penalty_boxed)          \
+    TEST_INCREMENTAL_JSON_ROUTE_1("static-route-parent", last_octet, penalty_boxed)
+
+#define TEST_INCREMENTAL_JSON_1(events, routes)                         \
+    "{ \"wolfsentry-config-version\" : 1, "                             \
+    "\"events-insert\" : [ " events " ], "                               \
+    "\"static-routes-insert\" : [ " routes " ] }"
+
+#define TEST_INCREMENTAL_JSON(routes)                                   \
+    TEST_INCREMENTAL_JSON_1(                                            \
+        "{ \"label\" : \"event-on-insert\", \"actions\" : [ \"count-insert\" ] }, " \
+        "{ \"label\" : \"static-route-parent\", \"priority\" : 1, \"insert-event\" : \"event-on-insert\" }", \
+        routes)
+
+static struct wolfsentry_route *test_incremental_route(struct wolfsentry_context *wolfsentry, byte last_octet) {
+    struct wolfsentry_table_ent_header *i;
+    for (i = wolfsentry->routes_static.header.head; i; i = i->next) {
+        if (WOLFSENTRY_ROUTE_REMOTE_ADDR((struct wolfsentry_route *)i)[3] == last_octet)
+            return (struct wolfsentry_route *)i;
+    }
+    return NULL;
+}
+
+static int test_json_incremental(void) {
+    static const char base_json[] = TEST_INCREMENTAL_JSON(
+        TEST_INCREMENTAL_JSON_ROUTE("1", "false") ", "
+        TEST_INCREMENTAL_JSON_ROUTE("2", "false") ", "
+        TEST_INCREMENTAL_JSON_ROUTE("3", "false"));
+    static const char new_json[] = TEST_INCREMENTAL_JSON(
+        TEST_INCREMENTAL_JSON_ROUTE("1", "false") ", "
+        TEST_INCREMENTAL_JSON_ROUTE("2", "true") ", "
+        TEST_INCREMENTAL_JSON_ROUTE("4", "false"));
+    /* new-parent's routes can't go in, after the ones before them have. */
+    static const char fail_json[] = TEST_INCREMENTAL_JSON_1(
+        "{ \"label\" : \"event-on-insert\", \"actions\" : [ \"count-insert\" ] }, "
+        "{ \"label\" : \"static-route-parent\", \"priority\" : 2, \"insert-event\" : \"event-on-insert\" }, "
+        "{ \"label\" : \"event-on-fail\", \"actions\" : [ \"fail-insert\" ] }, "
+        "{ \"label\" : \"new-parent\", \"priority\" : 3, \"insert-event\" : \"event-on-fail\" }",
+        TEST_INCREMENTAL_JSON_ROUTE("1", "false") ", "
+        TEST_INCREMENTAL_JSON_ROUTE("5", "false") ", "
+        TEST_INCREMENTAL_JSON_ROUTE_1("new-parent", "6", "false") ", "
+        TEST_INCREMENTAL_JSON_ROUTE("7", "false"));
+    /* event-on-insert is no longer a subevent, and becomes a parent. */
+    static const char flip_json[] = TEST_INCREMENTAL_JSON_1(
+        "{ \"label\" : \"event-on-insert\", \"actions\" : [ \"count-insert\" ] }, "
+        "{ \"label\" : \"static-route-parent\", \"priority\" : 1 }",
+        TEST_INCREMENTAL_JSON_ROUTE("1", "false") ", "
+        TEST_INCREMENTAL_JSON_ROUTE_1("event-on-insert", "8", "false"));
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_route *route;
+    struct wolfsentry_event *event;
+    wolfsentry_ent_id_t id, kept_id, removed_id;
+    wolfsentry_errcode_t ret;
+    int n_inserts = 0;
+    char err_buf[512];
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI, NULL /* config */, &wolfsentry));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(wolfsentry, "count-insert", WOLFSENTRY_LENGTH_NULL_TERMINATED, WOLFSENTRY_ACTION_FLAG_NONE, test_incremental_count_action, &n_inserts, &id));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(wolfsentry, "fail-insert", WOLFSENTRY_LENGTH_NULL_TERMINATED, WOLFSENTRY_ACTION_FLAG_NONE, test_incremental_fail_action, &wolfsentry, &id));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot(wolfsentry, base_json, strlen(base_json), WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, err_buf, sizeof err_buf));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes_static.header.n_ents == 3);
+    WOLFSENTRY_EXIT_ON_FALSE(n_inserts == 3);
+
+    WOLFSENTRY_EXIT_ON_FALSE((route = test_incremental_route(wolfsentry, 1)) != NULL);
+    kept_id = route->header.id;
+    route->header.hitcount = 42;
+    WOLFSENTRY_EXIT_ON_FALSE((route = test_incremental_route(wolfsentry, 3)) != NULL);
+    removed_id = route->header.id;
+
+    /* only the difference touches the live context. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot(wolfsentry, new_json, strlen(new_json), WOLFSENTRY_CONFIG_LOAD_FLAG_INCREMENTAL, err_buf, sizeof err_buf));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes_static.header.n_ents == 3);
+    WOLFSENTRY_EXIT_ON_FALSE(n_inserts == 4);
+
+    WOLFSENTRY_EXIT_ON_FALSE((route = test_incremental_route(wolfsentry, 1)) != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(route->header.id == kept_id);
+    WOLFSENTRY_EXIT_ON_FALSE(route->header.hitcount == 42);
+    WOLFSENTRY_EXIT_ON_FALSE((route = test_incremental_route(wolfsentry, 2)) != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED));
+    WOLFSENTRY_EXIT_ON_FALSE(test_incremental_route(wolfsentry, 3) == NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(test_incremental_route(wolfsentry, 4) != NULL);
+    {
+        struct wolfsentry_table_ent_header *ent;
+        WOLFSENTRY_EXIT_ON_SUCCESS(wolfsentry_table_ent_get_by_id(wolfsentry, removed_id, &ent));
+    }
+
+    /* reloading the same config again changes nothing. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot(wolfsentry, new_json, strlen(new_json), WOLFSENTRY_CONFIG_LOAD_FLAG_INCREMENTAL, err_buf, sizeof err_buf));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes_static.header.n_ents == 3);
+    WOLFSENTRY_EXIT_ON_FALSE(n_inserts == 4);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->events.header.n_ents == 2);
+
+    /* a merge that fails partway leaves the live context as it was. */
+    ret = wolfsentry_config_json_oneshot(wolfsentry, fail_json, strlen(fail_json), WOLFSENTRY_CONFIG_LOAD_FLAG_INCREMENTAL, err_buf, sizeof err_buf);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, NOT_PERMITTED));
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->routes_static.header.n_ents == 3);
+    WOLFSENTRY_EXIT_ON_FALSE((route = test_incremental_route(wolfsentry, 1)) != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(route->header.id == kept_id);
+    WOLFSENTRY_EXIT_ON_FALSE(route->parent_event->priority == 1);
+    WOLFSENTRY_EXIT_ON_FALSE((route = test_incremental_route(wolfsentry, 2)) != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(route->flags, WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED));
+    WOLFSENTRY_EXIT_ON_FALSE(test_incremental_route(wolfsentry, 4) != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(test_incremental_route(wolfsentry, 5) == NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(test_incremental_route(wolfsentry, 7) == NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->events.header.n_ents == 2);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry->ents_by_id.n_ents == wolfsentry->actions.header.n_ents + 2 + 3);
+    for (route = (struct wolfsentry_route *)wolfsentry->routes_static.header.head; route->header.next; route = (struct wolfsentry_route *)route->header.next)
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry_route_key_cmp(route, (struct wolfsentry_route *)route->header.next) < 0);
+
+    /* the event flags follow the new config, rather than pile up. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_get_reference(wolfsentry, "event-on-insert", WOLFSENTRY_LENGTH_NULL_TERMINATED, &event));
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(wolfsentry_event_get_flags(event), WOLFSENTRY_EVENT_FLAG_IS_SUBEVENT));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot(wolfsentry, flip_json, strlen(flip_json), WOLFSENTRY_CONFIG_LOAD_FLAG_INCREMENTAL, err_buf, sizeof err_buf));
+    WOLFSENTRY_EXIT_ON_FALSE(test_incremental_route(wolfsentry, 8) != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(wolfsentry_event_get_flags(event) == WOLFSENTRY_EVENT_FLAG_IS_PARENT_EVENT);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_event_drop_reference(wolfsentry, event, NULL /* action_results */));
 
-    WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(wolfsentry, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_DRY_RUN));
+    return wolfsentry_shutdown(&wolfsentry);
+}
 
-    WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(wolfsentry, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT));
+static void test_image_release(void *release_arg, void *image, size_t image_size) {
+    (void)image_size;
+    ++*(int *)release_arg;
+    free(image);
+}
 
-    WOLFSENTRY_EXIT_ON_SUCCESS(json_feed_file(wolfsentry, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT));
+/* handle-insert goes to insert_handler, and the other actions to test_action. */
+static int test_image_context_1(struct wolfsentry_context **wolfsentry, size_t route_private_data_alignment, wolfsentry_action_callback_t insert_handler) {
+    static const char *action_labels[] = { "handle-insert", "handle-delete", "handle-match", "notify-on-match", "handle-connect", "handle-connect2" };
+    struct wolfsentry_eventconfig config = { .route_private_data_size = PRIVATE_DATA_SIZE, .route_private_data_alignment = route_private_data_alignment };
+    wolfsentry_ent_id_t id;
+    size_t i;
 
-    WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(wolfsentry, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI, &config, wolfsentry));
+    for (i = 0; i < sizeof action_labels / sizeof action_labels[0]; ++i)
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_action_insert(*wolfsentry, action_labels[i], WOLFSENTRY_LENGTH_NULL_TERMINATED, WOLFSENTRY_ACTION_FLAG_NONE, (i == 0) ? insert_handler : test_action, NULL, &id));
+    return 0;
+}
 
-    {
-        struct wolfsentry_context *clone;
+static int test_image_context(struct wolfsentry_context **wolfsentry) {
+    return test_image_context_1(wolfsentry, PRIVATE_DATA_ALIGNMENT, test_action);
+}
 
-        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_clone(wolfsentry, &clone, WOLFSENTRY_CLONE_FLAG_AS_AT_CREATION));
-        WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(clone, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE));
-        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_exchange(wolfsentry, clone));
+static int test_image_inserts_allowed;
 
-        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_context_free(&clone));
-    }
+/* fails each insert once test_image_inserts_allowed runs out. */
+static wolfsentry_errcode_t test_image_failing_insert(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_action *action,
+    void *handler_arg,
+    void *caller_arg,
+    const struct wolfsentry_event *trigger_event,
+    wolfsentry_action_type_t action_type,
+    struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_route *route,
+    wolfsentry_action_res_t *action_results)
+{
+    if ((action_type == WOLFSENTRY_ACTION_TYPE_INSERT) && (test_image_inserts_allowed-- <= 0))
+        WOLFSENTRY_ERROR_RETURN(UNIT_TEST_FAILURE);
+    return test_action(wolfsentry, action, handler_arg, caller_arg, trigger_event, action_type, route_table, route, action_results);
+}
 
+static int test_image(const char *fname) {
+    struct wolfsentry_context *compiled, *loaded, *from_file;
+    void *image, *image2;
+    size_t image_size = 0, image_size2;
+    struct wolfsentry_table_ent_header *i, *j;
+    wolfsentry_action_res_t action_results;
+    int n_released = 0;
+    char image_path[] = "/tmp/wolfsentry-test-image-XXXXXX";
+    int fd;
+    wolfsentry_errcode_t ret;
 
-    {
-        struct wolfsentry_cursor *cursor;
-        struct wolfsentry_route *route;
-        struct wolfsentry_route_exports route_exports;
-        struct wolfsentry_route_table *static_routes;
-        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_get_table_static(wolfsentry, &static_routes));
-        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_iterate_start(wolfsentry, static_routes, &cursor));
-        for (ret = wolfsentry_route_table_iterate_current(wolfsentry, static_routes, cursor, &route);
-             ret >= 0;
-             ret = wolfsentry_route_table_iterate_next(wolfsentry, static_routes, cursor, &route)) {
-            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_export(wolfsentry, route, &route_exports));
-            WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_exports_render(&route_exports, stdout));
-        }
-        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_table_iterate_end(wolfsentry, static_routes, &cursor));
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&compiled));
+    WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(compiled, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE));
+
+    ret = wolfsentry_image_compile(compiled, NULL, &image_size);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, BUFFER_TOO_SMALL));
+    WOLFSENTRY_EXIT_ON_FALSE(posix_memalign(&image, PRIVATE_DATA_ALIGNMENT, image_size) == 0);
+    WOLFSENTRY_EXIT_ON_FALSE(posix_memalign(&image2, PRIVATE_DATA_ALIGNMENT, image_size) == 0);
+    image_size2 = image_size;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_image_compile(compiled, image, &image_size));
+    memcpy(image2, image, image_size);
+
+    /* the loaded static routes are the compiled ones, in the same order, and in the image. */
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&loaded));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_image_load(loaded, NULL /* caller_arg */, image, image_size, test_image_release, &n_released, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(loaded->routes_static.header.n_ents == compiled->routes_static.header.n_ents);
+    WOLFSENTRY_EXIT_ON_FALSE(loaded->events.header.n_ents == compiled->events.header.n_ents);
+    for (i = compiled->routes_static.header.head, j = loaded->routes_static.header.head; i && j; i = i->next, j = j->next) {
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry_route_key_cmp((struct wolfsentry_route *)i, (struct wolfsentry_route *)j) == 0);
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry_image_owns(loaded, j));
     }
 
+    /* a second load of the same rules conflicts, and the image is handed straight back. */
+    ret = wolfsentry_image_load(loaded, NULL /* caller_arg */, image2, image_size2, test_image_release, &n_released, &action_results);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, ITEM_ALREADY_PRESENT));
+    WOLFSENTRY_EXIT_ON_FALSE(n_released == 1);
+
     {
         struct {
             struct wolfsentry_sockaddr sa;
             byte addr_buf[4];
         } remote, local;
         wolfsentry_route_flags_t inexact_matches;
-        wolfsentry_action_res_t action_results;
+        wolfsentry_ent_id_t id;
 
         remote.sa.sa_family = local.sa.sa_family = AF_INET;
         remote.sa.sa_proto = local.sa.sa_proto = IPPROTO_TCP;
@@ -1658,20 +4030,480 @@ static int test_json(const char *fname) {
 
         WOLFSENTRY_EXIT_ON_FAILURE(
             wolfsentry_route_event_dispatch(
-                wolfsentry,
+                loaded,
                 &remote.sa,
                 &local.sa,
                 WOLFSENTRY_ROUTE_FLAG_DIRECTION_IN,
                 "call-in-from-unit-test",
                 WOLFSENTRY_LENGTH_NULL_TERMINATED,
-                (void *)0x12345678 /* caller_arg */,
+                NULL /* caller_arg */,
                 &id,
                 &inexact_matches, &action_results));
-
         WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_CHECK_BITS(action_results, WOLFSENTRY_ACTION_RES_ACCEPT));
     }
 
-    return wolfsentry_shutdown(&wolfsentry);
+    /* write it out and map it back in. */
+    WOLFSENTRY_EXIT_ON_FALSE((fd = mkstemp(image_path)) >= 0);
+    WOLFSENTRY_EXIT_ON_FALSE(posix_memalign(&image2, PRIVATE_DATA_ALIGNMENT, image_size) == 0);
+    image_size2 = image_size;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_image_compile(compiled, image2, &image_size2));
+    WOLFSENTRY_EXIT_ON_FALSE(write(fd, image2, image_size2) == (ssize_t)image_size2);
+    (void)close(fd);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&from_file));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_image_load_file(from_file, NULL /* caller_arg */, image_path, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(from_file->routes_static.header.n_ents == compiled->routes_static.header.n_ents);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&from_file));
+
+    /* a corrupted image is turned away before anything is loaded. */
+    ((byte *)image2)[image_size2 - 1] ^= 1;
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&from_file));
+    ret = wolfsentry_image_load(from_file, NULL /* caller_arg */, image2, image_size2, test_image_release, &n_released, &action_results);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, IMAGE_CHECKSUM));
+    WOLFSENTRY_EXIT_ON_FALSE(n_released == 2);
+    WOLFSENTRY_EXIT_ON_FALSE(from_file->events.header.n_ents == 0);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&from_file));
+
+    /* a load that fails partway takes back everything it put in, and hands the
+     * image back.
+     */
+    {
+        struct wolfsentry_eventconfig config_before, config_after;
+        WOLFSENTRY_EXIT_ON_FALSE(posix_memalign(&image2, PRIVATE_DATA_ALIGNMENT, image_size) == 0);
+        image_size2 = image_size;
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_image_compile(compiled, image2, &image_size2));
+        WOLFSENTRY_EXIT_ON_FAILURE(test_image_context_1(&from_file, PRIVATE_DATA_ALIGNMENT, test_image_failing_insert));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_defaultconfig_get(from_file, &config_before));
+        test_image_inserts_allowed = 1;
+        ret = wolfsentry_image_load(from_file, NULL /* caller_arg */, image2, image_size2, test_image_release, &n_released, &action_results);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, UNIT_TEST_FAILURE));
+        WOLFSENTRY_EXIT_ON_FALSE(n_released == 3);
+        WOLFSENTRY_EXIT_ON_FALSE(from_file->routes_static.header.n_ents == 0);
+        WOLFSENTRY_EXIT_ON_FALSE(from_file->events.header.n_ents == 0);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_defaultconfig_get(from_file, &config_after));
+        WOLFSENTRY_EXIT_ON_FALSE(config_after.max_connection_count == config_before.max_connection_count);
+        WOLFSENTRY_EXIT_ON_FALSE(config_after.penaltybox_duration == config_before.penaltybox_duration);
+        WOLFSENTRY_EXIT_ON_FALSE(from_file->images.head == NULL);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&from_file));
+    }
+
+    /* an image file is read into memory aligned as its routes need, however
+     * much more that is than the allocator's default.
+     */
+    {
+        struct wolfsentry_context *aligned;
+        WOLFSENTRY_EXIT_ON_FAILURE(test_image_context_1(&aligned, 4096, test_action));
+        WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(aligned, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE));
+        image_size2 = 0;
+        ret = wolfsentry_image_compile(aligned, NULL, &image_size2);
+        WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(ret, BUFFER_TOO_SMALL));
+        WOLFSENTRY_EXIT_ON_FALSE(posix_memalign(&image2, 4096, image_size2) == 0);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_image_compile(aligned, image2, &image_size2));
+        {
+            FILE *f;
+            WOLFSENTRY_EXIT_ON_FALSE((f = fopen(image_path, "wb")) != NULL);
+            WOLFSENTRY_EXIT_ON_FALSE(fwrite(image2, 1, image_size2, f) == image_size2);
+            WOLFSENTRY_EXIT_ON_FALSE(fclose(f) == 0);
+        }
+        free(image2);
+        WOLFSENTRY_EXIT_ON_FAILURE(test_image_context_1(&from_file, 4096, test_action));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_image_load_file(from_file, NULL /* caller_arg */, image_path, &action_results));
+        WOLFSENTRY_EXIT_ON_FALSE(from_file->routes_static.header.n_ents == aligned->routes_static.header.n_ents);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&from_file));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&aligned));
+    }
+
+    (void)unlink(image_path);
+
+    /* routes deleted from the image stay put until the context goes. */
+    while (loaded->routes_static.header.head)
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_route_delete_by_id(loaded, NULL /* caller_arg */, loaded->routes_static.header.head->id, NULL /* event_label */, 0 /* event_label_len */, &action_results));
+    WOLFSENTRY_EXIT_ON_FALSE(n_released == 3);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&loaded));
+    WOLFSENTRY_EXIT_ON_FALSE(n_released == 4);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&compiled));
+
+    return 0;
+}
+
+/* n_routes routes in a config that's a mix of one-line and multi-line elements,
+ * with the last octet of route bad_i's address made invalid, and route dup_i
+ * made a duplicate of the first route, when they're nonnegative.  with
+ * events_last_p, the routes' parent event is defined after them.
+ */
+static char *test_json_parallel_config(int n_routes, int bad_i, int dup_i, int events_last_p, size_t *len) {
+    static const char events[] = "    \"events-insert\" : [ { \"label\" : \"static-route-parent\", \"priority\" : 1 } ]";
+    size_t size = 512 + (size_t)n_routes * 320, used;
+    char *json = malloc(size);
+    int i;
+
+    if (json == NULL)
+        return NULL;
+    used = (size_t)snprintf(json, size,
+                            "{\n"
+                            "    \"wolfsentry-config-version\" : 1,\n"
+                            "%s%s"
+                            "    \"static-routes-insert\" : [\n",
+                            events_last_p ? "" : events,
+                            events_last_p ? "" : ",\n");
+    for (i = 0; i < n_routes; ++i) {
+        used += (size_t)snprintf(json + used, size - used,
+                                 "%s        { \"parent-event\" : \"static-route-parent\", \"direction-in\" : true,%s"
+                                 "\"family\" : 2, \"protocol\" : 6, \"remote\" : { \"address\" : \"10.%d.%d.%s\", \"prefix-bits\" : 32 }, \"local\" : { \"port\" : 443 } }",
+                                 i ? ",\n" : "",
+                                 (i % 3) ? " " : "\n            ",
+                                 (n_routes - ((i == dup_i) ? 0 : i)) >> 8, (n_routes - ((i == dup_i) ? 0 : i)) & 0xff,
+                                 (i == bad_i) ? "x" : "1");
+    }
+    used += (size_t)snprintf(json + used, size - used, "\n    ]%s%s\n}\n", events_last_p ? ",\n" : "", events_last_p ? events : "");
+    *len = used;
+    return json;
+}
+
+static int test_json_parallel(const char *fname) {
+    struct wolfsentry_context *serial, *parallel;
+    struct wolfsentry_table_ent_header *i, *j;
+    char serial_err_buf[512], parallel_err_buf[512];
+    char *json;
+    size_t json_len;
+    wolfsentry_errcode_t serial_ret, parallel_ret;
+
+    /* the shipped config loads the same either way. */
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&serial));
+    WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(serial, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE));
+    {
+        FILE *f;
+        long f_len;
+        WOLFSENTRY_EXIT_ON_FALSE((f = fopen(fname, "r")) != NULL);
+        WOLFSENTRY_EXIT_ON_FALSE(fseek(f, 0, SEEK_END) == 0);
+        WOLFSENTRY_EXIT_ON_FALSE((f_len = ftell(f)) > 0);
+        rewind(f);
+        WOLFSENTRY_EXIT_ON_FALSE((json = malloc((size_t)f_len)) != NULL);
+        WOLFSENTRY_EXIT_ON_FALSE(fread(json, 1, (size_t)f_len, f) == (size_t)f_len);
+        (void)fclose(f);
+        json_len = (size_t)f_len;
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&parallel));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot_parallel(parallel, json, json_len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, 3, parallel_err_buf, sizeof parallel_err_buf));
+    free(json);
+    WOLFSENTRY_EXIT_ON_FALSE(parallel->routes_static.header.n_ents == serial->routes_static.header.n_ents);
+    WOLFSENTRY_EXIT_ON_FALSE(parallel->events.header.n_ents == serial->events.header.n_ents);
+    for (i = serial->routes_static.header.head, j = parallel->routes_static.header.head; i && j; i = i->next, j = j->next)
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry_route_key_cmp((struct wolfsentry_route *)i, (struct wolfsentry_route *)j) == 0);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&parallel));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&serial));
+
+    /* so does a longer one, split into more chunks. */
+    WOLFSENTRY_EXIT_ON_FALSE((json = test_json_parallel_config(1000, -1, -1, 0 /* events_last_p */, &json_len)) != NULL);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI, NULL /* config */, &serial));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot(serial, json, json_len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, serial_err_buf, sizeof serial_err_buf));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI, NULL /* config */, &parallel));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot_parallel(parallel, json, json_len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, 7, parallel_err_buf, sizeof parallel_err_buf));
+    free(json);
+    WOLFSENTRY_EXIT_ON_FALSE(parallel->routes_static.header.n_ents == 1000);
+    for (i = serial->routes_static.header.head, j = parallel->routes_static.header.head; i && j; i = i->next, j = j->next)
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry_route_key_cmp((struct wolfsentry_route *)i, (struct wolfsentry_route *)j) == 0);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&parallel));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&serial));
+
+    /* a bad route deep in the array is reported just where a serial load reports it. */
+    WOLFSENTRY_EXIT_ON_FALSE((json = test_json_parallel_config(1000, 876, -1, 0 /* events_last_p */, &json_len)) != NULL);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI, NULL /* config */, &serial));
+    serial_ret = wolfsentry_config_json_oneshot(serial, json, json_len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, serial_err_buf, sizeof serial_err_buf);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI, NULL /* config */, &parallel));
+    parallel_ret = wolfsentry_config_json_oneshot_parallel(parallel, json, json_len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, 7, parallel_err_buf, sizeof parallel_err_buf);
+    free(json);
+    WOLFSENTRY_EXIT_ON_FALSE(serial_ret < 0);
+    WOLFSENTRY_EXIT_ON_FALSE(parallel_ret == serial_ret);
+    WOLFSENTRY_EXIT_ON_FALSE(strcmp(parallel_err_buf, serial_err_buf) == 0);
+    WOLFSENTRY_EXIT_ON_FALSE(parallel->routes_static.header.n_ents == 0);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&parallel));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&serial));
+
+    /* and a route that collides with another in a different chunk fails the load. */
+    WOLFSENTRY_EXIT_ON_FALSE((json = test_json_parallel_config(1000, -1, 999, 0 /* events_last_p */, &json_len)) != NULL);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI, NULL /* config */, &parallel));
+    parallel_ret = wolfsentry_config_json_oneshot_parallel(parallel, json, json_len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, 7, parallel_err_buf, sizeof parallel_err_buf);
+    free(json);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(parallel_ret, ITEM_ALREADY_PRESENT));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&parallel));
+
+    /* the config is loaded in document order, so routes can't refer to an event
+     * defined after them.
+     */
+    WOLFSENTRY_EXIT_ON_FALSE((json = test_json_parallel_config(1000, -1, -1, 1 /* events_last_p */, &json_len)) != NULL);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI, NULL /* config */, &serial));
+    serial_ret = wolfsentry_config_json_oneshot(serial, json, json_len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, serial_err_buf, sizeof serial_err_buf);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_init(WOLFSENTRY_TEST_HPI, NULL /* config */, &parallel));
+    parallel_ret = wolfsentry_config_json_oneshot_parallel(parallel, json, json_len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, 7, parallel_err_buf, sizeof parallel_err_buf);
+    free(json);
+    WOLFSENTRY_EXIT_ON_FALSE(serial_ret < 0);
+    WOLFSENTRY_EXIT_ON_FALSE(parallel_ret == serial_ret);
+    WOLFSENTRY_EXIT_ON_FALSE(strcmp(parallel_err_buf, serial_err_buf) == 0);
+    WOLFSENTRY_EXIT_ON_FALSE(parallel->routes_static.header.n_ents == 0);
+    WOLFSENTRY_EXIT_ON_FALSE(parallel->events.header.n_ents == 0);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&parallel));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&serial));
+
+    return 0;
+}
+
+struct test_export_sink {
+    char *buf;
+    size_t len, size;
+    int n_chunks;
+    size_t max_chunk;
+    struct wolfsentry_context *flush_routes_from; /* if set, the static routes are flushed once their export starts. */
+};
+
+static wolfsentry_errcode_t test_export_sink(void *sink_arg, const char *buf, size_t buf_len) {
+    struct test_export_sink *sink = (struct test_export_sink *)sink_arg;
+    if (sink->len + buf_len + 1 > sink->size) {
+        char *new_buf;
+        sink->size = (sink->len + buf_len + 1) * 2;
+        if ((new_buf = realloc(sink->buf, sink->size)) == NULL)
+            WOLFSENTRY_ERROR_RETURN(SYS_RESOURCE_FAILED);
+        sink->buf = new_buf;
+    }
+    memcpy(sink->buf + sink->len, buf, buf_len);
+    sink->len += buf_len;
+    sink->buf[sink->len] = 0;
+    ++sink->n_chunks;
+    if (buf_len > sink->max_chunk)
+        sink->max_chunk = buf_len;
+    if (sink->flush_routes_from && strstr(sink->buf, "\"static-routes-insert\" : [\n")) {
+        wolfsentry_errcode_t ret;
+        if ((ret = wolfsentry_context_lock_mutex(sink->flush_routes_from)) < 0)
+            return ret;
+        ret = wolfsentry_route_flush_table(sink->flush_routes_from, &sink->flush_routes_from->routes_static);
+        WOLFSENTRY_WARN_ON_FAILURE(wolfsentry_context_unlock(sink->flush_routes_from));
+        sink->flush_routes_from = NULL;
+        if (ret < 0)
+            return ret;
+    }
+    WOLFSENTRY_RETURN_OK;
+}
+
+static int test_json_export(const char *fname) {
+    static const char chain_json[] =
+        "{ \"wolfsentry-config-version\" : 1, \"events-insert\" : [ "
+        "{ \"label\" : \"chain-c\" }, "
+        "{ \"label\" : \"chain-b\", \"match-event\" : \"chain-c\" }, "
+        "{ \"label\" : \"chain-a\", \"insert-event\" : \"chain-b\" } ] }";
+    struct wolfsentry_context *exported, *reloaded, *chained;
+    struct test_export_sink sink, sink2;
+    struct wolfsentry_table_ent_header *i, *j;
+    const char *chain_a, *chain_b, *chain_c;
+    char err_buf[512];
+    wolfsentry_hitcount_t n_routes;
+
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&exported));
+    WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(exported, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE));
+    n_routes = exported->routes_static.header.n_ents;
+
+    /* small chunks still hold whole entries, and the whole reloads to the same context. */
+    memset(&sink, 0, sizeof sink);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_export(exported, WOLFSENTRY_CONFIG_EXPORT_FLAG_NONE, 1024, test_export_sink, &sink));
+    WOLFSENTRY_EXIT_ON_FALSE(sink.n_chunks > 1);
+    WOLFSENTRY_EXIT_ON_FALSE(sink.max_chunk <= 1024);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&reloaded));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot(reloaded, sink.buf, sink.len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, err_buf, sizeof err_buf));
+    WOLFSENTRY_EXIT_ON_FALSE(reloaded->events.header.n_ents == exported->events.header.n_ents);
+    WOLFSENTRY_EXIT_ON_FALSE(reloaded->routes_static.header.n_ents == exported->routes_static.header.n_ents);
+    for (i = exported->routes_static.header.head, j = reloaded->routes_static.header.head; i && j; i = i->next, j = j->next)
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry_route_key_cmp((struct wolfsentry_route *)i, (struct wolfsentry_route *)j) == 0);
+
+    memset(&sink2, 0, sizeof sink2);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_export(reloaded, WOLFSENTRY_CONFIG_EXPORT_FLAG_NONE, 1 << 16, test_export_sink, &sink2));
+    WOLFSENTRY_EXIT_ON_FALSE(sink2.n_chunks == 1);
+    WOLFSENTRY_EXIT_ON_FALSE((sink2.len == sink.len) && (memcmp(sink2.buf, sink.buf, sink.len) == 0));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&reloaded));
+
+    /* a subevent chain goes out deepest first, whatever order the labels sort in. */
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&chained));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot(chained, chain_json, sizeof chain_json - 1, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, err_buf, sizeof err_buf));
+    sink2.len = 0;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_export(chained, WOLFSENTRY_CONFIG_EXPORT_FLAG_NONE, 512, test_export_sink, &sink2));
+    WOLFSENTRY_EXIT_ON_FALSE(sink2.n_chunks > 1);
+    WOLFSENTRY_EXIT_ON_FALSE((chain_c = strstr(sink2.buf, "\"label\" : \"chain-c\"")) != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE((chain_b = strstr(sink2.buf, "\"label\" : \"chain-b\"")) != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE((chain_a = strstr(sink2.buf, "\"label\" : \"chain-a\"")) != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE((chain_c < chain_b) && (chain_b < chain_a));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&chained));
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&chained));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot(chained, sink2.buf, sink2.len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, err_buf, sizeof err_buf));
+    WOLFSENTRY_EXIT_ON_FALSE(chained->events.header.n_ents == 3);
+    for (i = chained->events.header.head; i; i = i->next) {
+        const struct wolfsentry_event *event = (const struct wolfsentry_event *)i;
+        if (strcmp(event->label, "chain-a") == 0)
+            WOLFSENTRY_EXIT_ON_FALSE((event->insert_event != NULL) && (strcmp(event->insert_event->label, "chain-b") == 0) &&
+                                     (event->insert_event->match_event != NULL) && (strcmp(event->insert_event->match_event->label, "chain-c") == 0));
+    }
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&chained));
+
+    /* the optional sections. */
+    sink2.len = 0;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_export(exported, WOLFSENTRY_CONFIG_EXPORT_FLAG_DYNAMIC_ROUTES|WOLFSENTRY_CONFIG_EXPORT_FLAG_ROUTE_METADATA|WOLFSENTRY_CONFIG_EXPORT_FLAG_ACTIONS, 0 /* chunk_size */, test_export_sink, &sink2));
+    WOLFSENTRY_EXIT_ON_FALSE(strstr(sink2.buf, "\"dynamic-routes\" : [") != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(strstr(sink2.buf, "\"metadata\" : {") != NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(strstr(sink2.buf, "\"label\" : \"handle-connect2\"") != NULL);
+
+    /* an entry too big for a chunk fails the export. */
+    sink2.len = 0;
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_config_json_export(exported, WOLFSENTRY_CONFIG_EXPORT_FLAG_NONE, 64, test_export_sink, &sink2), BUFFER_TOO_SMALL));
+
+    /* routes deleted between chunks are skipped, and the rest is still well formed. */
+    sink2.len = 0;
+    sink2.flush_routes_from = exported;
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_export(exported, WOLFSENTRY_CONFIG_EXPORT_FLAG_NONE, 1024, test_export_sink, &sink2));
+    WOLFSENTRY_EXIT_ON_FALSE(sink2.flush_routes_from == NULL);
+    WOLFSENTRY_EXIT_ON_FALSE(exported->routes_static.header.n_ents == 0);
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&reloaded));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot(reloaded, sink2.buf, sink2.len, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, err_buf, sizeof err_buf));
+    WOLFSENTRY_EXIT_ON_FALSE(reloaded->routes_static.header.n_ents < n_routes);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&reloaded));
+
+    free(sink.buf);
+    free(sink2.buf);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&exported));
+
+    return 0;
+}
+
+static int test_json_load_file(const char *fname) {
+    struct wolfsentry_context *fed, *loaded;
+    struct wolfsentry_table_ent_header *i, *j;
+    char bad_path[] = "/tmp/wolfsentry-test-config-XXXXXX";
+    static const char bad_json[] = "{\n    \"wolfsentry-config-version\" : 1,\n    \"no-such-key\" : 1\n}\n";
+    char err_buf[512];
+    int fd;
+
+    /* the mapped file loads just as the fed one does. */
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&fed));
+    WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(fed, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE));
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&loaded));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_load_file(loaded, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, err_buf, sizeof err_buf));
+    WOLFSENTRY_EXIT_ON_FALSE(loaded->events.header.n_ents == fed->events.header.n_ents);
+    WOLFSENTRY_EXIT_ON_FALSE(loaded->routes_static.header.n_ents == fed->routes_static.header.n_ents);
+    for (i = fed->routes_static.header.head, j = loaded->routes_static.header.head; i && j; i = i->next, j = j->next)
+        WOLFSENTRY_EXIT_ON_FALSE(wolfsentry_route_key_cmp((struct wolfsentry_route *)i, (struct wolfsentry_route *)j) == 0);
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&fed));
+
+    /* errors name the file, or the place in it. */
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_config_json_load_file(loaded, "/nonexistent/wolfsentry.json", WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, err_buf, sizeof err_buf), SYS_OP_FAILED));
+    WOLFSENTRY_EXIT_ON_FALSE(strstr(err_buf, "/nonexistent/wolfsentry.json: ") == err_buf);
+
+    WOLFSENTRY_EXIT_ON_FALSE((fd = mkstemp(bad_path)) >= 0);
+    WOLFSENTRY_EXIT_ON_FALSE(write(fd, bad_json, sizeof bad_json - 1) == (ssize_t)(sizeof bad_json - 1));
+    (void)close(fd);
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_config_json_load_file(loaded, bad_path, WOLFSENTRY_CONFIG_LOAD_FLAG_DRY_RUN, err_buf, sizeof err_buf), CONFIG_INVALID_KEY));
+    (void)unlink(bad_path);
+    WOLFSENTRY_EXIT_ON_FALSE(strstr(err_buf, "L3, col 5") != NULL);
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&loaded));
+
+    return 0;
+}
+
+#define TEST_VALIDATE_JSON(events, routes)                              \
+    "{ \"wolfsentry-config-version\" : 1, "                             \
+    "\"events-insert\" : [ " events " ], "                              \
+    "\"static-routes-insert\" : [ " routes " ] }"
+
+#define TEST_VALIDATE_EVENT(label, extra)                               \
+    "{ \"label\" : \"" label "\", \"priority\" : 1" extra " }"
+
+#define TEST_VALIDATE_ROUTE_PREFIX(parent, direction, address, prefix_bits) \
+    "{ \"parent-event\" : \"" parent "\", \"" direction "\" : true, "   \
+    "\"family\" : 2, \"protocol\" : 6, \"remote\" : { \"address\" : \"" address "\", " \
+    "\"prefix-bits\" : " prefix_bits " } }"
+
+#define TEST_VALIDATE_ROUTE(parent, direction, address)                 \
+    TEST_VALIDATE_ROUTE_PREFIX(parent, direction, address, "32")
+
+/* a validate-only load fails where a dry run fails, and in the same way. */
+static int test_json_validate(const char *fname) {
+    static const char * const cases[] = {
+        TEST_VALIDATE_JSON(TEST_VALIDATE_EVENT("parent", ", \"actions\" : [ \"handle-insert\", \"handle-delete\" ]"),
+                           TEST_VALIDATE_ROUTE("parent", "direction-in", "10.0.0.1") ", "
+                           TEST_VALIDATE_ROUTE("parent", "direction-in", "10.0.0.2") ", "
+                           TEST_VALIDATE_ROUTE("parent", "direction-out", "10.0.0.1")),
+        TEST_VALIDATE_JSON(TEST_VALIDATE_EVENT("parent", ""),
+                           TEST_VALIDATE_ROUTE("parent", "direction-in", "10.0.0.1") ", "
+                           TEST_VALIDATE_ROUTE("parent", "direction-in", "10.0.0.1")),
+        TEST_VALIDATE_JSON(TEST_VALIDATE_EVENT("parent", ""),
+                           TEST_VALIDATE_ROUTE_PREFIX("parent", "direction-in", "10.0.0.1", "24") ", "
+                           TEST_VALIDATE_ROUTE_PREFIX("parent", "direction-in", "10.0.0.2", "24")),
+        TEST_VALIDATE_JSON(TEST_VALIDATE_EVENT("parent", ""),
+                           TEST_VALIDATE_ROUTE("nonesuch", "direction-in", "10.0.0.1")),
+        TEST_VALIDATE_JSON(TEST_VALIDATE_EVENT("parent", ""),
+                           TEST_VALIDATE_ROUTE("parent", "dont-count-hits", "10.0.0.1")),
+        TEST_VALIDATE_JSON(TEST_VALIDATE_EVENT("parent", ", \"actions\" : [ \"nonesuch\" ]"), ""),
+        TEST_VALIDATE_JSON(TEST_VALIDATE_EVENT("parent", "") ", " TEST_VALIDATE_EVENT("parent", ""), ""),
+        TEST_VALIDATE_JSON(TEST_VALIDATE_EVENT("parent", ", \"insert-event\" : \"nonesuch\""), ""),
+        TEST_VALIDATE_JSON(TEST_VALIDATE_EVENT("sub", ", \"config\" : { \"max-connection-count\" : 5 }") ", "
+                           TEST_VALIDATE_EVENT("parent", ", \"insert-event\" : \"sub\""), ""),
+        TEST_VALIDATE_JSON(TEST_VALIDATE_EVENT("sub", "") ", "
+                           TEST_VALIDATE_EVENT("parent", ", \"match-event\" : \"sub\""),
+                           TEST_VALIDATE_ROUTE("sub", "direction-in", "10.0.0.1")),
+        "{ \"wolfsentry-config-version\" : 1, \"config-update\" : { \"rate-limit-burst\" : 5 } }"
+    };
+    static const char live_json[] = TEST_VALIDATE_JSON(TEST_VALIDATE_EVENT("parent", ""), TEST_VALIDATE_ROUTE("parent", "direction-in", "10.0.0.1"));
+    static const char new_route_json[] = "{ \"wolfsentry-config-version\" : 1, \"static-routes-insert\" : [ " TEST_VALIDATE_ROUTE("parent", "direction-in", "10.0.0.2") " ] }";
+    static const char old_route_json[] = "{ \"wolfsentry-config-version\" : 1, \"static-routes-insert\" : [ " TEST_VALIDATE_ROUTE("parent", "direction-in", "10.0.0.1") " ] }";
+    static const char long_prefix_json[] = TEST_VALIDATE_JSON(TEST_VALIDATE_EVENT("parent", ""), TEST_VALIDATE_ROUTE_PREFIX("parent", "direction-in", "10.0.0.1", "200"));
+    struct wolfsentry_context *dry_run, *validated;
+    wolfsentry_errcode_t dry_run_ret, validated_ret;
+    char err_buf[512];
+    size_t i;
+
+    for (i = 0; i < sizeof cases / sizeof cases[0]; ++i) {
+        WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&dry_run));
+        WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&validated));
+        dry_run_ret = wolfsentry_config_json_oneshot(dry_run, cases[i], strlen(cases[i]), WOLFSENTRY_CONFIG_LOAD_FLAG_DRY_RUN, err_buf, sizeof err_buf);
+        validated_ret = wolfsentry_config_json_oneshot(validated, cases[i], strlen(cases[i]), WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY, err_buf, sizeof err_buf);
+        if (WOLFSENTRY_ERROR_DECODE_ERROR_CODE(dry_run_ret) != WOLFSENTRY_ERROR_DECODE_ERROR_CODE(validated_ret)) {
+            printf("case %zu: dry run " WOLFSENTRY_ERROR_FMT ", validate-only " WOLFSENTRY_ERROR_FMT "\n",
+                   i, WOLFSENTRY_ERROR_FMT_ARGS(dry_run_ret), WOLFSENTRY_ERROR_FMT_ARGS(validated_ret));
+            return 1;
+        }
+        WOLFSENTRY_EXIT_ON_FALSE((i == 0) == (validated_ret >= 0));
+        WOLFSENTRY_EXIT_ON_FALSE(validated->events.header.n_ents == 0);
+        WOLFSENTRY_EXIT_ON_FALSE(validated->routes_static.header.n_ents == 0);
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&dry_run));
+        WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&validated));
+    }
+
+    /* a prefix longer than any address is refused before it is used, by
+     * every kind of load.
+     */
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&validated));
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_config_json_oneshot(validated, long_prefix_json, strlen(long_prefix_json), WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, err_buf, sizeof err_buf), CONFIG_INVALID_VALUE));
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_config_json_oneshot(validated, long_prefix_json, strlen(long_prefix_json), WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY, err_buf, sizeof err_buf), CONFIG_INVALID_VALUE));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&validated));
+
+    /* the test config validates, and touches nothing. */
+    WOLFSENTRY_EXIT_ON_FAILURE(test_image_context(&validated));
+    WOLFSENTRY_EXIT_ON_FAILURE(json_feed_file(validated, fname, WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY));
+    WOLFSENTRY_EXIT_ON_FALSE(validated->events.header.n_ents == 0);
+    WOLFSENTRY_EXIT_ON_FALSE(validated->routes_static.header.n_ents == 0);
+
+    /* with NO_FLUSH, the live context counts too. */
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot(validated, live_json, strlen(live_json), WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, err_buf, sizeof err_buf));
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_config_json_oneshot(validated, new_route_json, strlen(new_route_json), WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY|WOLFSENTRY_CONFIG_LOAD_FLAG_NO_FLUSH, err_buf, sizeof err_buf));
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_config_json_oneshot(validated, old_route_json, strlen(old_route_json), WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY|WOLFSENTRY_CONFIG_LOAD_FLAG_NO_FLUSH, err_buf, sizeof err_buf), ITEM_ALREADY_PRESENT));
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_config_json_oneshot(validated, live_json, strlen(live_json), WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY|WOLFSENTRY_CONFIG_LOAD_FLAG_NO_FLUSH, err_buf, sizeof err_buf), ITEM_ALREADY_PRESENT));
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_config_json_oneshot(validated, new_route_json, strlen(new_route_json), WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY, err_buf, sizeof err_buf), ITEM_NOT_FOUND));
+    WOLFSENTRY_EXIT_ON_FALSE(validated->events.header.n_ents == 1);
+    WOLFSENTRY_EXIT_ON_FALSE(validated->routes_static.header.n_ents == 1);
+
+    WOLFSENTRY_EXIT_ON_FALSE(WOLFSENTRY_ERROR_CODE_IS(wolfsentry_config_json_oneshot(validated, live_json, strlen(live_json), WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY|WOLFSENTRY_CONFIG_LOAD_FLAG_INCREMENTAL, err_buf, sizeof err_buf), INVALID_ARG));
+
+    WOLFSENTRY_EXIT_ON_FAILURE(wolfsentry_shutdown(&validated));
+
+    return 0;
 }
 
 #endif /* TEST_JSON */
@@ -1696,6 +4528,15 @@ int main (int argc, char* argv[]) {
         err = 1;
     // GCOV_EXCL_STOP
     }
+#ifdef WOLFSENTRY_CLOCK_BUILTINS
+    ret = test_time_modes();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_time_modes failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+#endif
 #endif
 
 #ifdef TEST_RWLOCKS
@@ -1716,6 +4557,32 @@ int main (int argc, char* argv[]) {
         err = 1;
     // GCOV_EXCL_STOP
     }
+
+    ret = test_static_routes_inet6();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_static_routes_inet6 failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_static_routes_partial_prefix();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_static_routes_partial_prefix failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+#ifndef LWIP
+    ret = test_addr_pton();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_addr_pton failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+#endif
 #endif
 
 #ifdef TEST_DYNAMIC_RULES
@@ -1726,6 +4593,118 @@ int main (int argc, char* argv[]) {
         err = 1;
     // GCOV_EXCL_STOP
     }
+
+    ret = test_route_purge();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_route_purge failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_penaltybox_release();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_penaltybox_release failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_rate_limit();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_rate_limit failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_route_admission();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_route_admission failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_derogatory_penaltybox();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_derogatory_penaltybox failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_penaltybox_aggregate();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_penaltybox_aggregate failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_subnet_connections();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_subnet_connections failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_dispatch_batch();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_dispatch_batch failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_flow_key();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_flow_key failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_route_connection();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_route_connection failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_route_snapshot();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_route_snapshot failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+    ret = test_route_journal();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_route_journal failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+    ret = test_route_replication();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_route_replication failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+#ifdef WOLFSENTRY_MAINTENANCE_THREAD
+    ret = test_maintenance_thread();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_maintenance_thread failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+#endif
 #endif
 
 #ifdef TEST_JSON
@@ -1745,6 +4724,54 @@ int main (int argc, char* argv[]) {
         err = 1;
     // GCOV_EXCL_STOP
     }
+
+    ret = test_json_incremental();
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_json_incremental failed, " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_json_parallel(TEST_NUMERIC_JSON_CONFIG_PATH);
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_json_parallel failed for " TEST_NUMERIC_JSON_CONFIG_PATH ", " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_json_export(TEST_NUMERIC_JSON_CONFIG_PATH);
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_json_export failed for " TEST_NUMERIC_JSON_CONFIG_PATH ", " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_json_load_file(TEST_NUMERIC_JSON_CONFIG_PATH);
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_json_load_file failed for " TEST_NUMERIC_JSON_CONFIG_PATH ", " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_json_validate(TEST_NUMERIC_JSON_CONFIG_PATH);
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_json_validate failed for " TEST_NUMERIC_JSON_CONFIG_PATH ", " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
+
+    ret = test_image(TEST_NUMERIC_JSON_CONFIG_PATH);
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, OK)) {
+    // GCOV_EXCL_START
+        printf("test_image failed for " TEST_NUMERIC_JSON_CONFIG_PATH ", " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        err = 1;
+    // GCOV_EXCL_STOP
+    }
 #endif
 
     return err;
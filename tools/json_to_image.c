@@ -0,0 +1,170 @@
+/*
+ * json_to_image.c
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfSentry.
+ *
+ * wolfSentry is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSentry is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+/* compiles a JSON config into a ruleset image for wolfsentry_image_load_file().
+ *
+ * the image binds actions by label, so every action the config refers to must
+ * be named with -a, and the context loading the image must have the same
+ * route private data size and alignment as given here with -p and -P.  images
+ * are specific to the build of the library that made them.
+ */
+
+#define _GNU_SOURCE
+
+#define WOLFSENTRY_SOURCE_ID WOLFSENTRY_SOURCE_ID_USER_BASE
+
+#include "wolfsentry/wolfsentry.h"
+#include "wolfsentry/wolfsentry_json.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static wolfsentry_errcode_t stub_action(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_action *action,
+    void *handler_arg,
+    void *caller_arg,
+    const struct wolfsentry_event *trigger_event,
+    wolfsentry_action_type_t action_type,
+    struct wolfsentry_route_table *route_table,
+    const struct wolfsentry_route *route,
+    wolfsentry_action_res_t *action_results)
+{
+    (void)wolfsentry;
+    (void)action;
+    (void)handler_arg;
+    (void)caller_arg;
+    (void)trigger_event;
+    (void)action_type;
+    (void)route_table;
+    (void)route;
+    (void)action_results;
+    WOLFSENTRY_RETURN_OK;
+}
+
+static void usage(const char *progname) {
+    fprintf(stderr, "usage: %s [-a action-label ...] [-p private-data-size] [-P private-data-alignment] config.json image-file\n", progname);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    struct wolfsentry_context *wolfsentry;
+    struct wolfsentry_eventconfig config;
+    struct wolfsentry_json_process_state *jps;
+    wolfsentry_ent_id_t id;
+    wolfsentry_errcode_t ret;
+    char err_buf[512];
+    char buf[1 << 16];
+    void *image;
+    size_t image_size = 0, n;
+    FILE *f;
+    const char **action_labels;
+    int opt, n_actions = 0, i;
+
+    memset(&config, 0, sizeof config);
+    if ((action_labels = calloc((size_t)argc, sizeof *action_labels)) == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    while ((opt = getopt(argc, argv, "a:p:P:")) != -1) {
+        switch (opt) {
+        case 'a':
+            action_labels[n_actions++] = optarg;
+            break;
+        case 'p':
+            config.route_private_data_size = (size_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'P':
+            config.route_private_data_alignment = (size_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2)
+        usage(argv[0]);
+
+    if ((ret = wolfsentry_init(NULL /* hpi */, &config, &wolfsentry)) < 0) {
+        fprintf(stderr, "wolfsentry_init: " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        exit(1);
+    }
+
+    /* the actions only need to exist for the config to load. */
+    for (i = 0; i < n_actions; ++i) {
+        if ((ret = wolfsentry_action_insert(wolfsentry, action_labels[i], WOLFSENTRY_LENGTH_NULL_TERMINATED, WOLFSENTRY_ACTION_FLAG_NONE, stub_action, NULL /* handler_arg */, &id)) < 0) {
+            fprintf(stderr, "action \"%s\": " WOLFSENTRY_ERROR_FMT "\n", action_labels[i], WOLFSENTRY_ERROR_FMT_ARGS(ret));
+            exit(1);
+        }
+    }
+
+    if ((f = fopen(argv[optind], "r")) == NULL) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    if ((ret = wolfsentry_config_json_init(wolfsentry, WOLFSENTRY_CONFIG_LOAD_FLAG_NONE, &jps)) < 0) {
+        fprintf(stderr, "wolfsentry_config_json_init: " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        exit(1);
+    }
+    while ((n = fread(buf, 1, sizeof buf, f)) > 0) {
+        if (wolfsentry_config_json_feed(jps, buf, n, err_buf, sizeof err_buf) < 0) {
+            fprintf(stderr, "%s: %s\n", argv[optind], err_buf);
+            exit(1);
+        }
+    }
+    (void)fclose(f);
+    if (wolfsentry_config_json_fini(&jps, err_buf, sizeof err_buf) < 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], err_buf);
+        exit(1);
+    }
+
+    ret = wolfsentry_image_compile(wolfsentry, NULL, &image_size);
+    if (! WOLFSENTRY_ERROR_CODE_IS(ret, BUFFER_TOO_SMALL)) {
+        fprintf(stderr, "wolfsentry_image_compile: " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        exit(1);
+    }
+    if ((image = malloc(image_size)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    if ((ret = wolfsentry_image_compile(wolfsentry, image, &image_size)) < 0) {
+        fprintf(stderr, "wolfsentry_image_compile: " WOLFSENTRY_ERROR_FMT "\n", WOLFSENTRY_ERROR_FMT_ARGS(ret));
+        exit(1);
+    }
+
+    if ((f = fopen(argv[optind + 1], "w")) == NULL) {
+        perror(argv[optind + 1]);
+        exit(1);
+    }
+    if ((fwrite(image, 1, image_size, f) != image_size) || (fclose(f) != 0)) {
+        perror(argv[optind + 1]);
+        exit(1);
+    }
+
+    free(image);
+    free(action_labels);
+    (void)wolfsentry_shutdown(&wolfsentry);
+
+    return 0;
+}
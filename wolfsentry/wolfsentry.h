@@ -39,6 +39,14 @@
 #define WOLFSENTRY_USE_NONPOSIX_SEMAPHORES
 #endif
 
+#if !defined(WOLFSENTRY_NO_MAINTENANCE_THREAD) && !defined(FREERTOS) && !defined(_WIN32)
+#define WOLFSENTRY_MAINTENANCE_THREAD
+#endif
+
+#if !defined(WOLFSENTRY_NO_JOURNAL_THREAD) && !defined(FREERTOS) && !defined(_WIN32)
+#define WOLFSENTRY_JOURNAL_THREAD
+#endif
+
 #ifndef WOLFSENTRY_USE_NONPOSIX_SEMAPHORES
 #define WOLFSENTRY_USE_NATIVE_POSIX_SEMAPHORES
 #endif
@@ -49,6 +57,10 @@
 
 #endif /* !WOLFSENTRY_SINGLETHREADED */
 
+#if !defined(WOLFSENTRY_NO_MMAP) && (defined(FREERTOS) || defined(_WIN32))
+#define WOLFSENTRY_NO_MMAP
+#endif
+
 #ifndef WOLFSENTRY_NO_CLOCK_BUILTIN
 #define WOLFSENTRY_CLOCK_BUILTINS
 #endif
@@ -280,7 +292,8 @@ typedef enum {
     WOLFSENTRY_ACTION_TYPE_POST = 1, /* called when an event is posted. */
     WOLFSENTRY_ACTION_TYPE_INSERT = 2, /* called when a route is added to the route table for this event. */
     WOLFSENTRY_ACTION_TYPE_MATCH = 3, /* called by wolfsentry_route_dispatch() for a route match. */
-    WOLFSENTRY_ACTION_TYPE_DELETE = 4 /* called when a route associated with this event expires or is otherwise deleted. */
+    WOLFSENTRY_ACTION_TYPE_DELETE = 4, /* called when a route associated with this event expires or is otherwise deleted. */
+    WOLFSENTRY_ACTION_TYPE_RELEASE = 5 /* called when a route associated with this event is released from the penalty box at the end of penaltybox_duration. */
 } wolfsentry_action_type_t;
 
 #define WOLFSENTRY_ACTION_RES_USER_SHIFT 16U
@@ -374,6 +387,11 @@ struct wolfsentry_route_metadata {
     wolfsentry_time_t insert_time;
     wolfsentry_time_t last_hit_time;
     wolfsentry_time_t last_penaltybox_time;
+    wolfsentry_time_t rate_limit_full_time; /* when the route's token bucket will next be full. */
+    wolfsentry_time_t derogatory_window_start;
+    wolfsentry_time_t last_change_time; /* of the insert or the latest flag change -- the clock for wolfsentry_journal_apply(). */
+    uint16_t derogatory_window_count; /* derogatory results since derogatory_window_start. */
+    uint16_t derogatory_window_prev_count; /* derogatory results in the window before that. */
     uint16_t connection_count;
     uint16_t derogatory_count;
     uint16_t commendable_count;}
@@ -410,6 +428,13 @@ struct wolfsentry_eventconfig {
     uint32_t max_connection_count;
     wolfsentry_time_t penaltybox_duration; /* zero means time-unbounded. */
     wolfsentry_eventconfig_flags_t flags;
+    uint32_t rate_limit_tokens; /* tokens added to each route's bucket per rate_limit_period -- zero disables rate limiting. */
+    wolfsentry_time_t rate_limit_period;
+    uint32_t rate_limit_burst; /* bucket depth -- zero means rate_limit_tokens. */
+    uint32_t route_admission_threshold; /* a dynamic route is only inserted for a source seen more than this many times recently -- zero inserts on first sight.  at most 254. */
+    uint32_t derogatory_threshold_for_penaltybox; /* penalty-box a route automatically once it has this many derogatory results within derogatory_window -- zero disables. */
+    wolfsentry_time_t derogatory_window; /* zero means counting since the route last left the penalty box. */
+    uint32_t max_subnet_connection_count; /* limit on connections from each remote subnet set up with wolfsentry_route_subnet_prefix_set() -- zero means no limit. */
 };
 
 #define WOLFSENTRY_TIME_NEVER ((wolfsentry_time_t)0)
@@ -490,6 +515,36 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_from_epoch_time(struct wolfsentry
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_interval_to_seconds(struct wolfsentry_context *wolfsentry, wolfsentry_time_t howlong, long *howlong_secs, long *howlong_nsecs);
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_interval_from_seconds(struct wolfsentry_context *wolfsentry, long howlong_secs, long howlong_nsecs, wolfsentry_time_t *howlong);
 
+#ifdef WOLFSENTRY_CLOCK_BUILTINS
+
+typedef enum {
+    WOLFSENTRY_TIME_MODE_REALTIME = 0, /* clock_gettime(CLOCK_REALTIME), the default. */
+    WOLFSENTRY_TIME_MODE_MONOTONIC_COARSE = 1, /* CLOCK_MONOTONIC_COARSE where available -- no syscall, tick resolution. */
+    WOLFSENTRY_TIME_MODE_CACHED = 2, /* per-thread value, updated by wolfsentry_builtin_time_cache_refresh(). */
+    WOLFSENTRY_TIME_MODE_TSC = 3 /* calibrated x86 TSC. */
+} wolfsentry_time_mode_t;
+
+#ifndef WOLFSENTRY_TSC_CALIBRATION_USECS
+#define WOLFSENTRY_TSC_CALIBRATION_USECS 10000
+#endif
+
+/* fills in *timecbs for use in a struct wolfsentry_host_platform_interface.
+ * WOLFSENTRY_TIME_MODE_TSC calibrates on first use, busy-waiting for
+ * WOLFSENTRY_TSC_CALIBRATION_USECS, and isn't thread-safe until then.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_builtin_timecbs_get(wolfsentry_time_mode_t mode, struct wolfsentry_timecbs *timecbs);
+
+/* in WOLFSENTRY_TIME_MODE_CACHED, call this once per batch or tick in each
+ * thread that dispatches, or that calls wolfsentry_maintenance_slice() or
+ * wolfsentry_route_penaltybox_release_expired().  a thread that never calls it
+ * reads the clock on first use and then keeps that time, so nothing in it
+ * ever expires.  the maintenance and journal threads refresh their own at the
+ * start of each pass.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_builtin_time_cache_refresh(void);
+
+#endif /* WOLFSENTRY_CLOCK_BUILTINS */
+
 struct wolfsentry_host_platform_interface {
     struct wolfsentry_allocator *allocator;
     struct wolfsentry_timecbs *timecbs;
@@ -522,6 +577,17 @@ typedef enum {
 } wolfsentry_clone_flags_t;
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_clone(struct wolfsentry_context *wolfsentry, struct wolfsentry_context **clone, wolfsentry_clone_flags_t flags);
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_exchange(struct wolfsentry_context *wolfsentry1, struct wolfsentry_context *wolfsentry2);
+/* brings the events, static routes, default config and default policies of
+ * wolfsentry in line with those of staged (typically a clone that a new config
+ * was loaded into), changing only what differs.  static routes in both keep
+ * their ID, hit count and metadata, only new routes get their insert actions,
+ * and dynamic routes are left alone.  staged is left as it was.  the caller must
+ * hold a mutex on wolfsentry.  the checks and allocations are all done before
+ * anything is deleted, so that a merge that fails leaves wolfsentry as it was,
+ * save for the insert and delete actions of any new routes that had to be
+ * taken back out.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_context_merge(struct wolfsentry_context *wolfsentry, void *caller_arg, struct wolfsentry_context *staged);
 
 #ifdef WOLFSENTRY_THREADSAFE
 
@@ -720,6 +786,16 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_default_policy_get(
     struct wolfsentry_route_table *table,
     wolfsentry_action_res_t *default_policy);
 
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_purge_age_set(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    wolfsentry_time_t purge_age);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_purge_age_get(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    wolfsentry_time_t *purge_age);
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_get_reference(
     struct wolfsentry_context *wolfsentry,
     const struct wolfsentry_route_table *table,
@@ -770,6 +846,96 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_with_inited_
     wolfsentry_route_flags_t *inexact_matches,
     wolfsentry_action_res_t *action_results);
 
+/* as wolfsentry_route_event_dispatch_with_inited_result() with
+ * WOLFSENTRY_ACTION_RES_CONNECT set.  if the connection was counted, *connection
+ * is set to a handle holding a reference to the matched route, and must be
+ * passed to wolfsentry_route_disconnect() when the connection closes, even if
+ * the route is deleted in the meantime.  otherwise *connection is set to null.
+ */
+struct wolfsentry_route_connection;
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_connect(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s). */
+    struct wolfsentry_route_connection **connection,
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results);
+
+/* uncounts the connection and releases the handle, without a lookup or any
+ * action dispatch.  WOLFSENTRY_ACTION_RES_DEALLOCATED is set in action_results
+ * if the route was already deleted and this was its last reference.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_disconnect(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_connection **connection,
+    wolfsentry_action_res_t *action_results);
+
+/* dispatches event_label for each of n_dispatches remotes[i]/locals[i]/flags[i]
+ * triples, as wolfsentry_route_event_dispatch() would, leaving the results in
+ * action_results[i], and the route IDs and return codes in ids[i] and rets[i]
+ * if those are non-null.  if rets is non-null, the return value reflects only
+ * the event lookup.  if it is null, the whole batch is still dispatched, and
+ * the return value is the error from the first dispatch that failed.
+ * as with single dispatch, locking is up to the caller -- take the context
+ * lock once around the batch.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_batch(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_sockaddr * const *remotes,
+    const struct wolfsentry_sockaddr * const *locals,
+    const wolfsentry_route_flags_t *flags,
+    size_t n_dispatches,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s). */
+    wolfsentry_ent_id_t *ids,
+    wolfsentry_action_res_t *action_results,
+    wolfsentry_errcode_t *rets);
+
+/* a flow key holds the remote/local/flags lookup key for a dispatch, copied
+ * and normalized once, so that the dispatches for a connection's lifetime
+ * (e.g. its connect and disconnect) don't each redo that work.  it holds no
+ * reference to any route, so it stays valid as routes come and go.
+ */
+struct wolfsentry_flow_key;
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_flow_key_new(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    struct wolfsentry_flow_key **flow_key);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_flow_key_free(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_flow_key **flow_key);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_flow_key(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_flow_key *flow_key,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s). */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_flow_key_with_inited_result(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_flow_key *flow_key,
+    const char *event_label,
+    int event_label_len,
+    void *caller_arg, /* passed to action callback(s). */
+    wolfsentry_ent_id_t *id,
+    wolfsentry_route_flags_t *inexact_matches,
+    wolfsentry_action_res_t *action_results);
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_event_dispatch_by_id(
     struct wolfsentry_context *wolfsentry,
     wolfsentry_ent_id_t id,
@@ -792,6 +958,110 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_stale_purge(
     struct wolfsentry_context *wolfsentry,
     struct wolfsentry_route_table *table);
 
+/* like wolfsentry_route_stale_purge(), but does at most max_entries units of
+ * work (zero for no limit) -- each a route examined, or moved between slots of
+ * the table's timing wheel -- setting *done if the purge caught up.  a
+ * subsequent call resumes where the last left off, and routes can be inserted
+ * and deleted in between.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_stale_purge_incremental(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    wolfsentry_hitcount_t max_entries,
+    int *done);
+
+/* clears WOLFSENTRY_ROUTE_FLAG_PENALTYBOXED on routes whose penaltybox_duration
+ * has run out, and runs the release_event actions of their parent events.
+ * route dispatch releases the dispatched route, and up to
+ * WOLFSENTRY_PENALTYBOX_RELEASES_PER_DISPATCH others, once their deadlines
+ * pass, so this is only needed for boxes to lapse, and their release_event
+ * actions to run, on time in the absence of traffic.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_penaltybox_release_expired(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    int *n_released);
+
+/* sums current connections from remote addresses of family sa_family over
+ * their leading prefix_bits, for enforcement of max_subnet_connection_count.
+ * the sums are kept in a fixed table of WOLFSENTRY_SUBNET_CONNECTION_BUCKETS
+ * slots, shared by all families, each holding its own prefix.  a subnet whose
+ * WOLFSENTRY_SUBNET_CONNECTION_PROBES candidate slots are all held by others
+ * is refused while a limit is in force.  a prefix_bits of zero stops subnet
+ * accounting for the family.  any change resets all subnet counts, and
+ * wolfsentry_route_disconnect() leaves the new counts alone for connections
+ * made before it.  a DISCONNECT dispatch without a handle can't tell, and takes
+ * one off the subnet if it has live connections.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_subnet_prefix_set(
+    struct wolfsentry_context *wolfsentry,
+    wolfsentry_family_t sa_family,
+    wolfsentry_addr_bits_t prefix_bits);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_subnet_prefix_get(
+    struct wolfsentry_context *wolfsentry,
+    wolfsentry_family_t sa_family,
+    wolfsentry_addr_bits_t *prefix_bits);
+
+/* collapses penalty-boxed dynamic routes of family sa_family, wherever at least
+ * min_routes of them share a remote prefix_bits prefix and all other key
+ * fields, into a single boxed route for the prefix with the remote port
+ * wildcarded.  the prefix route takes the earliest insert time, the latest hit
+ * and penalty-box times, and the summed hit, derogatory, and commendable
+ * counts of the routes it replaces.  boxed routes that arrive later under an
+ * existing aggregate are folded into it regardless of min_routes.  routes with
+ * live connections are left alone until those connections are released.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_penaltybox_aggregate(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    wolfsentry_family_t sa_family,
+    wolfsentry_addr_bits_t prefix_bits,
+    int min_routes,
+    int *n_aggregated);
+
+struct wolfsentry_maintenance_config {
+    wolfsentry_time_t interval; /* time between passes of the maintenance thread. */
+    wolfsentry_hitcount_t max_entries_per_slice; /* routes released, examined, or moved between timing wheel slots.  zero means no limit. */
+    wolfsentry_time_t max_slice_time; /* zero means no limit. */
+};
+
+#define WOLFSENTRY_MAINTENANCE_DEFAULT_INTERVAL 1000000
+#define WOLFSENTRY_MAINTENANCE_DEFAULT_MAX_ENTRIES_PER_SLICE 256
+#define WOLFSENTRY_MAINTENANCE_DEFAULT_MAX_SLICE_TIME 1000
+
+/* does a bounded slice of penalty-box expiry and stale route purging, setting
+ * *done when everything due has been handled.  a slice stops when either
+ * limit in config is reached, even partway through a timing wheel tick or
+ * catch-up sweep, and the next slice resumes it.  route tables with a zero
+ * purge_age are skipped.  the caller must hold the context mutex.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_maintenance_slice(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_maintenance_config *config,
+    int *done);
+
+#ifdef WOLFSENTRY_MAINTENANCE_THREAD
+/* starts a thread that, every config->interval, runs slices with the context
+ * mutex held, releasing it between slices, until there's nothing left due.
+ * config may be null for the defaults.
+ *
+ * the library takes no locks of its own, so while the thread runs, every
+ * other call that reads or changes routes, events, or the context --
+ * including wolfsentry_route_event_dispatch() and its variants -- must be made
+ * with the context mutex held (wolfsentry_context_lock_mutex()).  a shared
+ * lock isn't enough, because dispatch inserts routes, updates their counts,
+ * and releases due penalty boxes.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_maintenance_start(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_maintenance_config *config);
+
+/* stops and joins the maintenance thread.  called automatically by wolfsentry_shutdown(). */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_maintenance_stop(
+    struct wolfsentry_context *wolfsentry);
+#endif
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_flush_table(
     struct wolfsentry_context *wolfsentry,
     struct wolfsentry_route_table *table);
@@ -802,6 +1072,45 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_bulk_clear_insert_action_st
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_bulk_insert_actions(
     struct wolfsentry_context *wolfsentry);
 
+/* a route batch holds static routes that have been built but not yet put in
+ * the table.  batches can be filled on separate threads at once, provided the
+ * context's events don't change meanwhile, and then put in the static route
+ * table together by wolfsentry_route_batch_insert_static(), which consumes
+ * them.  wolfsentry_route_batch_sort() can be called on the filling thread to
+ * take the sorting off the inserting thread.
+ */
+struct wolfsentry_route_batch;
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_batch_new(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_batch **batch);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_batch_add_static(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_batch *batch,
+    const struct wolfsentry_sockaddr *remote,
+    const struct wolfsentry_sockaddr *local,
+    wolfsentry_route_flags_t flags,
+    const char *event_label,
+    int event_label_len);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_batch_sort(
+    struct wolfsentry_route_batch *batch);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_batch_free(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_batch **batch);
+
+/* insert actions are called in key order rather than in the order the routes
+ * were added.  stops at the first failure, and all batches are freed either way.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_batch_insert_static(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_batch **batches,
+    int n_batches,
+    wolfsentry_action_res_t *action_results);
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_get_private_data(
     struct wolfsentry_context *wolfsentry,
     struct wolfsentry_route *route,
@@ -828,11 +1137,218 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_set_wildcard(
     struct wolfsentry_route *route,
     wolfsentry_route_flags_t wildcards_to_set);
 
+/* parses the text form of an AF_INET, AF_INET6, or AF_LINK address (not
+ * NUL-terminated) into addr, which must have room for 16 bytes, and sets
+ * *addr_bits to its full length.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_addr_pton(
+    wolfsentry_family_t sa_family,
+    const char *addr_string,
+    size_t addr_string_len,
+    byte *addr,
+    wolfsentry_addr_bits_t *addr_bits);
+
 #ifndef WOLFSENTRY_NO_STDIO
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_render(const struct wolfsentry_route *r, FILE *f);
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_exports_render(const struct wolfsentry_route_exports *r, FILE *f);
 #endif
 
+/* ruleset images: the events and static routes of a context, with its default
+ * config and static default policy, compiled into one checksummed block with
+ * no pointers in it.  a loaded image is used in place -- its routes are linked
+ * into the static route table without being copied.  an image is only
+ * loadable by a build with the same struct layout, byte order and time units
+ * as the one that compiled it.  actions are recorded by label only, and must
+ * already be in the context that loads the image.
+ */
+#define WOLFSENTRY_IMAGE_VERSION 1
+
+typedef void (*wolfsentry_image_release_cb_t)(void *release_arg, void *image, size_t image_size);
+
+/* with image null or *image_size too small, returns BUFFER_TOO_SMALL with
+ * *image_size set to the size needed.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_image_compile(
+    struct wolfsentry_context *wolfsentry,
+    void *image,
+    size_t *image_size);
+
+/* image must be writable, 8-byte aligned (or aligned to
+ * route_private_data_alignment if that is larger), and untouched by the caller
+ * from here on, whatever the outcome.  release (if non-null) is called on it
+ * when the context is done with it -- on failure, or when the context is
+ * freed.  a failure partway through the load takes back the events, routes,
+ * default config, and default policy it put in.  if a route from the image is
+ * still referenced from outside the table by then, the image is held until the
+ * context is freed, rather than released on failure.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_image_load(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    void *image,
+    size_t image_size,
+    wolfsentry_image_release_cb_t release,
+    void *release_arg,
+    wolfsentry_action_res_t *action_results);
+
+#ifndef WOLFSENTRY_NO_STDIO
+/* maps the file privately (or reads it, with WOLFSENTRY_NO_MMAP, the default on
+ * FreeRTOS and Windows) and loads it.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_image_load_file(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    const char *path,
+    wolfsentry_action_res_t *action_results);
+#endif
+
+/* route table snapshots: the routes of a table with their flags, metadata and
+ * private data, packed into a checksummed block, so that penalty boxes,
+ * connection counts and rate limits survive a restart.  parent events are
+ * recorded by label, and times as ages at the moment of the save -- a restore
+ * re-bases them on the restoring context's clock, so the time between save
+ * and restore doesn't count.  a snapshot doesn't depend on struct layout or
+ * time units, but is only restorable by a build with the same byte order, and
+ * under configs with the same route private data sizes.  malformed snapshots
+ * fail with the IMAGE_* errors.
+ */
+#define WOLFSENTRY_ROUTE_SNAPSHOT_VERSION 2
+
+/* with snapshot null or *snapshot_size too small, returns BUFFER_TOO_SMALL
+ * with *snapshot_size set to the size needed.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_snapshot_save(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_route_table *table,
+    void *snapshot,
+    size_t *snapshot_size);
+
+/* the whole snapshot is checked, and its routes built, before any go in the
+ * table, where they are then put together as by
+ * wolfsentry_route_batch_insert_static() -- in key order, with insert actions
+ * called.  it's all or none: if a route fails to go in, those already in are
+ * deleted again, with their delete actions called, so the table is left as
+ * it was.  parent events must already be in the context.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_route_table_snapshot_restore(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    struct wolfsentry_route_table *table,
+    const void *snapshot,
+    size_t snapshot_size,
+    wolfsentry_action_res_t *action_results);
+
+/* the route journal: a record of each insert, delete and flag change in the
+ * dynamic route table, for replay on top of the last snapshot after a crash.
+ * records are appended to a lock-free ring by whatever changes the route, and
+ * drained by a writer that hands them to the sink in groups, calling the sync
+ * callback (if any) after each group -- with WOLFSENTRY_JOURNAL_THREAD, the
+ * writer is a thread that wakes every group_commit_interval, or when
+ * group_commit_bytes are pending, and otherwise it is wolfsentry_journal_flush(),
+ * which the caller must call often enough to keep the ring from filling.
+ * a change that finds the ring full is dropped and counted, never waited on,
+ * and a gap record takes its place ahead of the next change to get in (or at
+ * the end, on wolfsentry_journal_stop()).  the records before a gap no longer
+ * describe the table, so a reader that meets one needs a fresh snapshot.
+ * each record is checksummed, so a torn write at the end of the journal is
+ * detected on replay.  like snapshots, records are host byte order, and times
+ * are re-based on replay so that downtime doesn't count.
+ */
+#define WOLFSENTRY_JOURNAL_VERSION 1
+
+#define WOLFSENTRY_JOURNAL_DEFAULT_RING_SIZE 65536
+#define WOLFSENTRY_JOURNAL_DEFAULT_GROUP_COMMIT_INTERVAL 10000
+#ifndef WOLFSENTRY_JOURNAL_DEFAULT_TOMBSTONES
+#define WOLFSENTRY_JOURNAL_DEFAULT_TOMBSTONES 1024
+#endif
+
+typedef wolfsentry_errcode_t (*wolfsentry_journal_write_cb_t)(void *sink_context, const void *buf, size_t len);
+typedef wolfsentry_errcode_t (*wolfsentry_journal_sync_cb_t)(void *sink_context);
+
+struct wolfsentry_journal_config {
+    wolfsentry_journal_write_cb_t write;
+    wolfsentry_journal_sync_cb_t sync; /* may be null. */
+    void *sink_context;
+    size_t ring_size; /* a power of two; zero for the default. */
+    size_t group_commit_bytes; /* zero for a quarter of the ring. */
+    wolfsentry_time_t group_commit_interval; /* zero for the default. */
+    size_t n_tombstones; /* deletes remembered for wolfsentry_journal_apply(); zero for the default. */
+};
+
+struct wolfsentry_journal_stats {
+    uint64_t n_records; /* appended to the ring. */
+    uint64_t n_dropped; /* turned away by a full ring. */
+    uint64_t n_writes;
+    uint64_t n_bytes_written;
+    uint64_t n_syncs;
+};
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_journal_start(
+    struct wolfsentry_context *wolfsentry,
+    const struct wolfsentry_journal_config *config);
+
+/* drains the ring to the sink and syncs it, in the caller's thread. */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_journal_flush(
+    struct wolfsentry_context *wolfsentry);
+
+/* flushes, stops the writer, and frees the journal.  called automatically by
+ * wolfsentry_shutdown().
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_journal_stop(
+    struct wolfsentry_context *wolfsentry);
+
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_journal_get_stats(
+    struct wolfsentry_context *wolfsentry,
+    struct wolfsentry_journal_stats *stats);
+
+/* applies the records of a journal to the dynamic route table, in order,
+ * stopping quietly at the first record that is torn or fails its checksum,
+ * with *replayed_size set to the length of the good part.  an insert of a
+ * route that is already present (from the snapshot) just brings its flags up
+ * to date, and deletes and flag changes of routes that aren't present are
+ * skipped, so replaying over a newer snapshot is harmless.  a gap stops the
+ * replay with WOLFSENTRY_ERROR_ID_DATA_MISSING, and *replayed_size just past
+ * it -- the rest is only good on top of a snapshot saved after the gap.  call
+ * before wolfsentry_journal_start(), which would journal the replay again.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_journal_replay(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    const void *journal,
+    size_t journal_size,
+    size_t *replayed_size,
+    wolfsentry_action_res_t *action_results);
+
+/* journal records double as a delta stream for keeping the dynamic route
+ * tables of several contexts in step -- a journal whose sink sends to the
+ * peers emits it, and each peer feeds what it receives to
+ * wolfsentry_journal_apply().  unlike replay, apply resolves conflicts by
+ * last writer wins, comparing the time of each record with the
+ * last_change_time of the route it names (so the peers' clocks need to
+ * agree), and keeps record times as they are.  a tie goes to a delete, or
+ * else to the greater mutable flags, so that every peer settles it alike.  an insert or flag change of a
+ * route that isn't present inserts it, and routes are inserted in batches.
+ * applied changes are not journaled, so they don't echo back.  *applied_size
+ * is set to the length of the complete records applied -- the caller keeps
+ * the rest, which may be a record split across receives, for the next call.
+ * a gap stops the apply with WOLFSENTRY_ERROR_ID_DATA_MISSING, and
+ * *applied_size just past it, once the records before it are applied -- the
+ * peer has missed changes, and needs a fresh snapshot from the sender before
+ * carrying on with the rest.
+ * the latest deletes, journaled or applied, are remembered with their times
+ * (n_tombstones of them, or WOLFSENTRY_JOURNAL_DEFAULT_TOMBSTONES until a
+ * journal is started), so that an insert or flag change no newer than the
+ * delete of its route, arriving after it, is dropped rather than putting the
+ * route back.  a stale change that outlives that memory still does.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_journal_apply(
+    struct wolfsentry_context *wolfsentry,
+    void *caller_arg,
+    const void *records,
+    size_t records_size,
+    size_t *applied_size,
+    wolfsentry_action_res_t *action_results);
+
 WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_action_insert(
     struct wolfsentry_context *wolfsentry,
     const char *label,
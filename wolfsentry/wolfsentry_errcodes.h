@@ -111,6 +111,10 @@ enum wolfsentry_source_id {
     WOLFSENTRY_SOURCE_ID_ROUTES_C   =  4,
     WOLFSENTRY_SOURCE_ID_UTIL_C     =  5,
     WOLFSENTRY_SOURCE_ID_JSON_LOAD_CONFIG_C =  6,
+    WOLFSENTRY_SOURCE_ID_IMAGE_C    =  7,
+    WOLFSENTRY_SOURCE_ID_JSON_EXPORT_CONFIG_C =  8,
+    WOLFSENTRY_SOURCE_ID_SNAPSHOT_C =  9,
+    WOLFSENTRY_SOURCE_ID_JOURNAL_C  = 10,
 
     WOLFSENTRY_SOURCE_ID_USER_BASE  =  112
 };
@@ -151,6 +155,9 @@ enum wolfsentry_error_id {
     WOLFSENTRY_ERROR_ID_CONFIG_UNEXPECTED      =  27,
     WOLFSENTRY_ERROR_ID_CONFIG_PARSER          =  28,
     WOLFSENTRY_ERROR_ID_OP_NOT_SUPP_FOR_PROTO  =  29,
+    WOLFSENTRY_ERROR_ID_IMAGE_INVALID          =  30,
+    WOLFSENTRY_ERROR_ID_IMAGE_CHECKSUM         =  31,
+    WOLFSENTRY_ERROR_ID_IMAGE_INCOMPATIBLE     =  32,
 
     WOLFSENTRY_ERROR_ID_USER_BASE              = 224
 };
@@ -40,6 +40,8 @@ enum {
     WOLFSENTRY_CONFIG_LOAD_FLAG_NO_FLUSH         = 1U << 0U,
     WOLFSENTRY_CONFIG_LOAD_FLAG_DRY_RUN          = 1U << 1U,
     WOLFSENTRY_CONFIG_LOAD_FLAG_LOAD_THEN_COMMIT = 1U << 2U,
+    WOLFSENTRY_CONFIG_LOAD_FLAG_INCREMENTAL      = 1U << 3U, /* like LOAD_THEN_COMMIT, but commits with wolfsentry_context_merge(), preserving unchanged routes. */
+    WOLFSENTRY_CONFIG_LOAD_FLAG_VALIDATE_ONLY    = 1U << 4U, /* like DRY_RUN, but without a clone: checks the config against temporary indexes, and allocates no events or routes. */
     WOLFSENTRY_CONFIG_LOAD_FLAG_FINI             = 1U << 30U
 };
 
@@ -76,4 +78,63 @@ WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_config_json_oneshot(
     char *err_buf,
     size_t err_buf_size);
 
+/* loads the config in the file at path.  the file is mapped and fed to the
+ * parser in large chunks, with the mapping advised for sequential access, or
+ * with WOLFSENTRY_NO_MMAP (the default on FreeRTOS and Windows), read a chunk
+ * at a time.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_config_json_load_file(
+    struct wolfsentry_context *wolfsentry,
+    const char *path,
+    wolfsentry_config_load_flags_t load_flags,
+    char *err_buf,
+    size_t err_buf_size);
+
+/* like wolfsentry_config_json_oneshot(), but the static-routes-insert array is
+ * split into n_threads chunks at element boundaries, which are parsed at once
+ * on separate threads, and the resulting routes are inserted together, in key
+ * order.  the rest of the config is loaded in document order around them, as
+ * in a serial load, so routes see only what precedes them.  routes get a null
+ * caller_arg in their insert actions, as with wolfsentry_config_json_oneshot().
+ * the context's allocator must be thread-safe.
+ * in builds without threads, the chunks are parsed one after another.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_config_json_oneshot_parallel(
+    struct wolfsentry_context *wolfsentry,
+    const char *json_in,
+    size_t json_in_len,
+    wolfsentry_config_load_flags_t load_flags,
+    int n_threads,
+    char *err_buf,
+    size_t err_buf_size);
+
+typedef enumint_t wolfsentry_config_export_flags_t;
+enum {
+    WOLFSENTRY_CONFIG_EXPORT_FLAG_NONE           = 0U,
+    WOLFSENTRY_CONFIG_EXPORT_FLAG_DYNAMIC_ROUTES = 1U << 0U, /* adds a "dynamic-routes" array, with each route's metadata. */
+    WOLFSENTRY_CONFIG_EXPORT_FLAG_ROUTE_METADATA = 1U << 1U, /* adds each static route's metadata. */
+    WOLFSENTRY_CONFIG_EXPORT_FLAG_ACTIONS        = 1U << 2U  /* adds an "actions-update" array with each action's flags. */
+};
+
+typedef wolfsentry_errcode_t (*wolfsentry_config_export_sink_t)(void *sink_arg, const char *buf, size_t buf_len);
+
+#ifndef WOLFSENTRY_CONFIG_EXPORT_CHUNK_SIZE_DEFAULT
+#define WOLFSENTRY_CONFIG_EXPORT_CHUNK_SIZE_DEFAULT 4096
+#endif
+
+/* writes the context's config, events, and static routes as JSON that
+ * wolfsentry_config_json_feed() accepts, passing it to sink in chunks of at
+ * most chunk_size bytes (0 for the default), each holding whole entries.  the
+ * context is locked shared only while each chunk is rendered, never across a
+ * call to sink, so the caller mustn't hold the lock.  entries inserted or
+ * deleted between chunks may or may not appear.  output with any of the flags
+ * above is for inspection, and won't load.
+ */
+WOLFSENTRY_API wolfsentry_errcode_t wolfsentry_config_json_export(
+    struct wolfsentry_context *wolfsentry,
+    wolfsentry_config_export_flags_t export_flags,
+    size_t chunk_size,
+    wolfsentry_config_export_sink_t sink,
+    void *sink_arg);
+
 #endif /* WOLFSENTRY_JSON_H */
@@ -50,6 +50,12 @@
 
 #define WOLFSENTRY_BITS_TO_BYTES(x) (((x) + 7) >> 3)
 
+#ifdef __GNUC__
+#define WOLFSENTRY_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define WOLFSENTRY_PREFETCH(addr) do {} while (0)
+#endif
+
 /* helpers for stringifying the expanded value of a macro argument rather than its literal text: */
 #define _qq(x) #x
 #define _q(x) _qq(x)
@@ -64,6 +70,9 @@
 #define WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(i) WOLFSENTRY_ATOMIC_DECREMENT(i, 1)
 #define WOLFSENTRY_ATOMIC_POSTINCREMENT(i, x) __atomic_fetch_add(&(i),x,__ATOMIC_SEQ_CST)
 #define WOLFSENTRY_ATOMIC_POSTDECREMENT(i, x) __atomic_fetch_sub(&(i),x,__ATOMIC_SEQ_CST)
+#define WOLFSENTRY_ATOMIC_LOAD(i) __atomic_load_n(&(i),__ATOMIC_ACQUIRE)
+#define WOLFSENTRY_ATOMIC_STORE(i, x) __atomic_store_n(&(i),x,__ATOMIC_RELEASE)
+#define WOLFSENTRY_ATOMIC_CMPXCHG(i, expected, desired) __atomic_compare_exchange_n(&(i),expected,desired,0 /* weak */,__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST)
 
 #define WOLFSENTRY_ATOMIC_UPDATE(i, set_i, clear_i, pre_i, post_i)      \
 do {                                                                    \
@@ -91,6 +100,9 @@ do {                                                                    \
 #define WOLFSENTRY_ATOMIC_INCREMENT_BY_ONE(i) (++(i))
 #define WOLFSENTRY_ATOMIC_DECREMENT(i, x) ((i) -= (x))
 #define WOLFSENTRY_ATOMIC_DECREMENT_BY_ONE(i) (--(i))
+#define WOLFSENTRY_ATOMIC_LOAD(i) (i)
+#define WOLFSENTRY_ATOMIC_STORE(i, x) ((i) = (x))
+#define WOLFSENTRY_ATOMIC_CMPXCHG(i, expected, desired) (((i) == *(expected)) ? ((i) = (desired), 1) : (*(expected) = (i), 0))
 
 #define WOLFSENTRY_ATOMIC_UPDATE(i, set_i, clear_i, pre_i, post_i)      \
 do {                                                                    \